@@ -0,0 +1,79 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <cstdio>
+
+
+BenchmarkRunner::BenchmarkRunner(const BenchmarkOptions& options) :
+	options(options)
+{
+	if (this->options.numSamples < 1) {
+		this->options.numSamples = 1;
+	}
+}
+
+void BenchmarkRunner::AddResult(const std::string& name, std::uint64_t iterations, std::vector<double> samples)
+{
+	std::sort(samples.begin(), samples.end());
+
+	BenchmarkResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.nsPerOp = samples[samples.size() / 2];
+	result.minNsPerOp = samples.front();
+	result.maxNsPerOp = samples.back();
+	results.push_back(result);
+}
+
+
+namespace {
+	// Fixed precision, so equal timings always print the same
+	std::string FormatTime(double nanoseconds)
+	{
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.3f", nanoseconds);
+		return buffer;
+	}
+
+	// Benchmark names are plain ASCII, but escape anyway so the output always parses
+	std::string EscapeJsonString(const std::string& value)
+	{
+		std::string escaped;
+		for (char c : value)
+		{
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+			}
+			if (static_cast<unsigned char>(c) < 0x20) {
+				continue;
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+}
+
+void BenchmarkRunner::WriteJson(std::ostream& out) const
+{
+	std::vector<BenchmarkResult> sortedResults = results;
+	std::sort(sortedResults.begin(), sortedResults.end(), [](const BenchmarkResult& result1, const BenchmarkResult& result2) {
+		return result1.name < result2.name;
+	});
+
+	out << "{\n";
+	out << "  \"version\": " << BenchmarkOutputVersion << ",\n";
+	out << "  \"samples\": " << options.numSamples << ",\n";
+	out << "  \"benchmarks\": [";
+	for (std::size_t i = 0; i < sortedResults.size(); ++i)
+	{
+		const BenchmarkResult& result = sortedResults[i];
+		out << (i == 0 ? "\n" : ",\n");
+		out << "    {\"name\": \"" << EscapeJsonString(result.name) << "\"";
+		out << ", \"iterations\": " << result.iterations;
+		out << ", \"ns_per_op\": " << FormatTime(result.nsPerOp);
+		out << ", \"min_ns_per_op\": " << FormatTime(result.minNsPerOp);
+		out << ", \"max_ns_per_op\": " << FormatTime(result.maxNsPerOp);
+		out << "}";
+	}
+	out << "\n  ]\n";
+	out << "}\n";
+}
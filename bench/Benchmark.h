@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Version of the JSON output layout. Bump when fields are renamed or change meaning.
+const int BenchmarkOutputVersion = 1;
+
+
+struct BenchmarkOptions
+{
+	std::string filter;					// Only run benchmarks whose name contains this (empty = all)
+	int numSamples = 7;					// Timed batches per benchmark. The median is reported.
+	double minSampleTime = 0.02;		// Seconds. Batches are grown until they take at least this long.
+};
+
+
+struct BenchmarkResult
+{
+	std::string name;
+	std::uint64_t iterations;			// Iterations in each timed batch
+	double nsPerOp;						// Median of the samples
+	double minNsPerOp;
+	double maxNsPerOp;
+};
+
+
+// Times small functions, and reports the results as JSON
+// Each benchmark is run in batches. The batch size is calibrated first, then numSamples batches are timed.
+class BenchmarkRunner
+{
+public:
+	BenchmarkRunner(const BenchmarkOptions& options);
+
+	// Times function(), which does one operation per call
+	template <typename Function>
+	void Run(const std::string& name, Function function);
+
+	// Results are sorted by name, so output from different runs (and releases) lines up
+	void WriteJson(std::ostream& out) const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	template <typename Function>
+	static double TimeBatch(Function& function, std::uint64_t iterations);
+	void AddResult(const std::string& name, std::uint64_t iterations, std::vector<double> samples);
+
+	BenchmarkOptions options;
+	std::vector<BenchmarkResult> results;
+};
+
+
+// Stops the compiler from optimizing away a result that is never used
+template <typename Type>
+inline void KeepResult(const Type& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+template <typename Function>
+double BenchmarkRunner::TimeBatch(Function& function, std::uint64_t iterations)
+{
+	const Clock::time_point startTime = Clock::now();
+	for (std::uint64_t i = 0; i < iterations; ++i) {
+		function();
+	}
+	const Clock::time_point endTime = Clock::now();
+
+	return std::chrono::duration<double>(endTime - startTime).count();
+}
+
+template <typename Function>
+void BenchmarkRunner::Run(const std::string& name, Function function)
+{
+	if (name.find(options.filter) == std::string::npos) {
+		return;
+	}
+
+	// Grow the batch until it is long enough to time accurately  (also warms caches)
+	std::uint64_t iterations = 1;
+	while (TimeBatch(function, iterations) < options.minSampleTime && iterations < (1ull << 40)) {
+		iterations *= 2;
+	}
+
+	std::vector<double> samples;
+	for (int i = 0; i < options.numSamples; ++i) {
+		samples.push_back(TimeBatch(function, iterations) * 1e9 / iterations);
+	}
+
+	AddResult(name, iterations, samples);
+}
+
+
+// Benchmark groups
+void RunPacketBenchmarks(BenchmarkRunner& runner);
+void RunLogBenchmarks(BenchmarkRunner& runner);
+void RunPlayerNetIDBenchmarks(BenchmarkRunner& runner);
+void RunTransportLayerBenchmarks(BenchmarkRunner& runner);
+void RunParityBenchmarks(BenchmarkRunner& runner);
+void RunCompressionBenchmarks(BenchmarkRunner& runner);
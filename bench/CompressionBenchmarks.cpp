@@ -0,0 +1,54 @@
+#include "Benchmark.h"
+#include "PacketCompression.h"
+#include "NetFixProtocol.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+void RunCompressionBenchmarks(BenchmarkRunner& runner)
+{
+	// A players list for a 2 player game (mostly empty slots), and an incompressible payload of the largest size
+	Packet playersListPacket;
+	std::memset(&playersListPacket, 0, sizeof(playersListPacket));
+	playersListPacket.header.sizeOfPayload = sizeof(PlayersList);
+	playersListPacket.tlMessage.tlHeader.commandType = TransportLayerCommand::SetPlayersList;
+	playersListPacket.tlMessage.playersList.numPlayers = 2;
+
+	Packet randomPacket;
+	randomPacket.header.sizeOfPayload = static_cast<unsigned char>(MaxPacketPayloadSize);
+	std::uint32_t seed = 0x12345678;
+	for (std::size_t i = 0; i < sizeof(randomPacket.data); ++i)
+	{
+		seed = seed * 1664525 + 1013904223;
+		randomPacket.data[i] = static_cast<unsigned char>(seed >> 24);
+	}
+
+	const std::pair<const char*, const Packet*> payloads[] = {
+		{ "PlayersList", &playersListPacket },
+		{ "Random", &randomPacket },
+	};
+
+	for (const auto& payload : payloads)
+	{
+		const Packet& packet = *payload.second;
+		const std::string name = payload.first;
+
+		std::array<std::uint8_t, sizeof(Packet)> compressed;
+		runner.Run("CompressPayload/" + name, [&]() {
+			KeepResult(CompressPayload(packet.data, packet.header.sizeOfPayload, compressed.data(), MaxCompressedDataSize));
+		});
+
+		// Incompressible payloads never reach the receiver
+		const std::size_t compressedSize = CompressPayload(packet.data, packet.header.sizeOfPayload, compressed.data(), MaxCompressedDataSize);
+		if (compressedSize == 0) {
+			continue;
+		}
+
+		std::array<std::uint8_t, sizeof(Packet)> decompressed;
+		runner.Run("DecompressPayload/" + name, [&]() {
+			KeepResult(DecompressPayload(compressed.data(), compressedSize, decompressed.data(), packet.header.sizeOfPayload));
+		});
+	}
+}
@@ -0,0 +1,77 @@
+// Stand-ins for the parts of Outpost 2 the benchmarked client code uses
+// OP2Internal binds these to code and data inside Outpost2.exe, which isn't loaded by the benchmark.
+// They are linked ahead of OP2Internal, so its versions of these symbols are never pulled in.
+// Settings come from defaults rather than outpost2.ini, so every run is configured the same.
+
+#include "NetFixSettings.h"
+#include "OPUNetTransportLayer.h"
+#include <cstdint>
+#include <cstring>
+
+
+namespace OP2Internal
+{
+	// Same algorithm as the game: sum of the payload as 32 bit words, then any trailing bytes
+	int Packet::Checksum() const
+	{
+		std::uint32_t checksum = 0;
+		const std::size_t payloadSize = header.sizeOfPayload;
+
+		std::size_t i = 0;
+		for (; i + 4 <= payloadSize; i += 4)
+		{
+			std::uint32_t word;
+			std::memcpy(&word, &data[i], sizeof(word));
+			checksum += word;
+		}
+		for (; i < payloadSize; ++i) {
+			checksum += data[i];
+		}
+
+		return static_cast<int>(checksum);
+	}
+
+	namespace {
+		const GUID benchGameIdentifier = { 0x5A0B9E4C, 0x7F21, 0x4C3A, { 0x9D, 0x61, 0x2E, 0x84, 0x0B, 0x5C, 0x73, 0xA6 } };
+	}
+	const GUID& gameIdentifier = benchGameIdentifier;
+}
+
+
+// op2ext exports  (log output would swamp the timings, so it is discarded)
+namespace op2ext {
+extern "C" {
+	void Log(const char*) {}
+	void LogError(const char*) {}
+	void LogDebug(const char*) {}
+	// Cache files (such as the NAT classification) go in the working directory
+	std::size_t GetGameDir_s(char* buffer, std::size_t bufferSize)
+	{
+		if (bufferSize > 0) {
+			buffer[0] = '\0';
+		}
+		return 1;
+	}
+}
+}
+
+
+// NetFixSettings.cpp reads outpost2.ini through the game, so the benchmark supplies fixed settings
+// No game server is set (nothing is sent over the network by accident), and LAN broadcasts and port mapping are off
+namespace {
+	const NetFixSettings benchSettings{ 0, "", {}, DefaultClientPort, DefaultClientPort, 0, 0, 0, 0, 0, "", 0, 0 };
+}
+
+void LoadNetFixSettings()
+{
+}
+
+bool ReloadNetFixSettingsIfModified()
+{
+	return false;
+}
+
+const NetFixSettings& GetNetFixSettings()
+{
+	return benchSettings;
+}
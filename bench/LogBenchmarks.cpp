@@ -0,0 +1,111 @@
+#include "Benchmark.h"
+#include "Log.h"
+#include "OPUNetTransportLayer.h"
+#include <ws2tcpip.h>
+#include <array>
+
+
+namespace {
+	const GUID sampleGuid = { 0x12345678, 0x9ABC, 0xDEF0, { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF } };
+	const int samplePlayerNetID = (0x12345678 & ~7) | 3;
+
+	NetAddress MakeIPv4Address()
+	{
+		return NetAddress::FromIPv4(htonl(0xC0A80165), htons(47800));		// 192.168.1.101:47800
+	}
+
+	NetAddress MakeIPv6Address()
+	{
+		NetAddress address;
+		ParseIPAddress("2001:db8:85a3::8a2e:370:7334", address);
+		address.SetPort(47800);
+		return address;
+	}
+
+	// A full game: host, four joined players, and an empty slot
+	std::array<PeerInfo, MaxRemotePlayers> MakePlayerList()
+	{
+		std::array<PeerInfo, MaxRemotePlayers> peerInfos;
+		for (int i = 0; i < MaxRemotePlayers; ++i)
+		{
+			PeerInfo& peerInfo = peerInfos[i];
+			peerInfo.Clear();
+			peerInfo.bReturnJoinPacket = false;
+			if (i < MaxRemotePlayers - 1)
+			{
+				peerInfo.playerNetID = (0x10000 * (i + 1)) | i;
+				peerInfo.status = PeerStatus::Normal;
+				peerInfo.address = NetAddress::FromIPv4(htonl(0xC0A80164 + i), htons(47800));
+			}
+		}
+		return peerInfos;
+	}
+}
+
+
+void RunLogBenchmarks(BenchmarkRunner& runner)
+{
+	const NetAddress ipv4Address = MakeIPv4Address();
+	const NetAddress ipv6Address = MakeIPv6Address();
+	const std::array<PeerInfo, MaxRemotePlayers> peerInfos = MakePlayerList();
+	NatBehaviour natBehaviour;
+	natBehaviour.mapping = NatMapping::AddressDependent;
+	natBehaviour.filtering = NatFiltering::AddressPortDependent;
+	natBehaviour.hairpin = NatHairpin::Supported;
+	ConnectivityMatrix connectivityMatrix;
+	for (std::size_t row = 0; row < connectivityMatrix.size(); ++row) {
+		for (std::size_t column = 0; column < connectivityMatrix[row].size(); ++column) {
+			connectivityMatrix[row][column] = (row == column || column == MaxRemotePlayers - 1) ? -1 : static_cast<int>(20 + row * 7 + column * 3);
+		}
+	}
+
+	Packet packet;
+	packet.header.sourcePlayerNetID = samplePlayerNetID;
+	packet.header.destPlayerNetID = 0;
+	packet.header.sizeOfPayload = sizeof(HostedGameSearchQuery);
+	packet.header.type = 1;
+	packet.tlMessage.tlHeader.commandType = TransportLayerCommand::HostedGameSearchQuery;
+
+	runner.Run("Log/FormatAddress/sockaddr_in", [&ipv4Address]() {
+		KeepResult(FormatAddress(ipv4Address.ipv4));
+	});
+	runner.Run("Log/FormatAddress/NetAddress-IPv4", [&ipv4Address]() {
+		KeepResult(FormatAddress(ipv4Address));
+	});
+	runner.Run("Log/FormatAddress/NetAddress-IPv6", [&ipv6Address]() {
+		KeepResult(FormatAddress(ipv6Address));
+	});
+	runner.Run("Log/FormatAddress/pointer", [&packet]() {
+		KeepResult(FormatAddress(static_cast<void*>(&packet)));
+	});
+	runner.Run("Log/FormatIP4Address", [&ipv4Address]() {
+		KeepResult(FormatIP4Address(ipv4Address.ipv4.sin_addr.s_addr));
+	});
+	runner.Run("Log/FormatIPAddress/IPv6", [&ipv6Address]() {
+		KeepResult(FormatIPAddress(ipv6Address));
+	});
+	runner.Run("Log/FormatPlayerList", [&peerInfos]() {
+		KeepResult(FormatPlayerList(peerInfos));
+	});
+	runner.Run("Log/FormatPlayerNetID", []() {
+		KeepResult(FormatPlayerNetID(samplePlayerNetID));
+	});
+	runner.Run("Log/FormatConnectivityMatrix", [&connectivityMatrix]() {
+		KeepResult(FormatConnectivityMatrix(connectivityMatrix));
+	});
+	runner.Run("Log/FormatNatBehaviour", [&natBehaviour]() {
+		KeepResult(FormatNatBehaviour(natBehaviour));
+	});
+	runner.Run("Log/FormatGuid", []() {
+		KeepResult(FormatGuid(sampleGuid));
+	});
+	runner.Run("Log/FormatTransportLayerCommand", []() {
+		KeepResult(FormatTransportLayerCommand(TransportLayerCommand::HostedGameSearchReply));
+	});
+	runner.Run("Log/FormatTransportLayerCommandIncludeIndex", []() {
+		KeepResult(FormatTransportLayerCommandIncludeIndex(TransportLayerCommand::HostedGameSearchReply));
+	});
+	runner.Run("Log/FormatPacket", [&packet]() {
+		KeepResult(FormatPacket(packet));
+	});
+}
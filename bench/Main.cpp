@@ -0,0 +1,73 @@
+// Microbenchmarks for NetFix transport primitives
+// Usage: netFixBench [--filter TEXT] [--samples N] [--min-time MS]
+// Results are written to stdout as JSON
+
+#include "Benchmark.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+
+namespace {
+	void PrintUsage()
+	{
+		std::cerr <<
+			"Usage: netFixBench [options]\n"
+			"  --filter TEXT  Only run benchmarks with TEXT in their name\n"
+			"  --samples N    Timed batches per benchmark (median is reported). Default 7\n"
+			"  --min-time MS  Minimum time of each batch. Default 20\n";
+	}
+
+	bool ParseArguments(int argc, char* argv[], BenchmarkOptions& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string argument = argv[i];
+
+			// All options take a value
+			if (i + 1 >= argc) {
+				return false;
+			}
+			const char* value = argv[++i];
+
+			if (argument == "--filter") {
+				options.filter = value;
+			}
+			else if (argument == "--samples") {
+				options.numSamples = std::atoi(value);
+			}
+			else if (argument == "--min-time") {
+				options.minSampleTime = std::atoi(value) / 1000.0;
+			}
+			else {
+				return false;
+			}
+		}
+
+		return options.numSamples > 0 && options.minSampleTime > 0;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		PrintUsage();
+		return EXIT_FAILURE;
+	}
+
+	BenchmarkRunner runner(options);
+
+	RunPacketBenchmarks(runner);
+	RunLogBenchmarks(runner);
+	RunPlayerNetIDBenchmarks(runner);
+	RunTransportLayerBenchmarks(runner);
+	RunParityBenchmarks(runner);
+	RunCompressionBenchmarks(runner);
+
+	runner.WriteJson(std::cout);
+
+	return EXIT_SUCCESS;
+}
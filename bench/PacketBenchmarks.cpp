@@ -0,0 +1,31 @@
+#include "Benchmark.h"
+#include "NetFixProtocol.h"
+#include "OPUNetTransportLayer.h"
+#include <string>
+
+
+void RunPacketBenchmarks(BenchmarkRunner& runner)
+{
+	// Fixed fill pattern, so every run checksums the same bytes
+	Packet packet;
+	for (std::size_t i = 0; i < sizeof(packet.data); ++i) {
+		packet.data[i] = static_cast<unsigned char>(i * 31 + 7);
+	}
+
+	// Typical message sizes: status update, search query, search reply, player list, and the largest payload
+	const std::size_t payloadSizes[] = {
+		sizeof(StatusUpdate),
+		sizeof(HostedGameSearchQuery),
+		sizeof(HostedGameSearchReply),
+		sizeof(PlayersList),
+		MaxPacketPayloadSize,
+	};
+
+	for (std::size_t payloadSize : payloadSizes)
+	{
+		packet.header.sizeOfPayload = static_cast<unsigned char>(payloadSize);
+		runner.Run("Packet::Checksum/" + std::to_string(payloadSize), [&packet]() {
+			KeepResult(packet.Checksum());
+		});
+	}
+}
@@ -0,0 +1,55 @@
+#include "Benchmark.h"
+#include "ParityStream.h"
+#include "NetFixProtocol.h"
+#include <string>
+
+
+void RunParityBenchmarks(BenchmarkRunner& runner)
+{
+	// A typical in game packet (small), and the largest packet parity can cover
+	const std::size_t packetSizes[] = { sizeof(PacketHeader) + 16, MaxParityDataSize };
+
+	for (std::size_t packetSize : packetSizes)
+	{
+		Packet packet;
+		for (std::size_t i = 0; i < sizeof(packet.data); ++i) {
+			packet.data[i] = static_cast<unsigned char>(i * 31 + 7);
+		}
+		packet.header.sourcePlayerNetID = 1;
+		packet.header.destPlayerNetID = 0;
+		packet.header.sizeOfPayload = static_cast<unsigned char>(packetSize - sizeof(PacketHeader));
+		packet.header.type = 0;
+		packet.header.checksum = packet.Checksum();
+
+		const std::string sizeName = std::to_string(packetSize);
+
+		// Cost added to each covered send
+		ParityEncoder encoder;
+		Packet parityPacket;
+		runner.Run("ParityEncoder::Add/" + sizeName, [&]() {
+			KeepResult(encoder.Add(packet, packetSize));
+			if (encoder.IsGroupComplete(MaxParityGroupSize)) {
+				encoder.BuildParity(parityPacket);
+			}
+		});
+
+		// Rebuilding the last packet of a group of 4 (recording the other 3, then the parity)
+		const int groupSize = 4;
+		ParityEncoder groupEncoder;
+		for (int i = 0; i < groupSize; ++i) {
+			groupEncoder.Add(packet, packetSize);
+		}
+		groupEncoder.BuildParity(parityPacket);
+		const NetFixParity& parity = GetNetFixMessage<NetFixParity>(parityPacket);
+
+		ParityDecoder decoder;
+		Packet recoveredPacket;
+		runner.Run("ParityDecoder::OnParity/" + sizeName, [&]() {
+			decoder.Reset();
+			for (int i = 0; i < groupSize - 1; ++i) {
+				decoder.OnPacket(static_cast<std::uint16_t>(i), packet, packetSize);
+			}
+			KeepResult(decoder.OnParity(parity, parityPacket.header.sizeOfPayload, recoveredPacket));
+		});
+	}
+}
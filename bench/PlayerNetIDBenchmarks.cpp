@@ -0,0 +1,29 @@
+#include "Benchmark.h"
+#include "PlayerNetID.h"
+#include <array>
+#include <cstddef>
+
+
+void RunPlayerNetIDBenchmarks(BenchmarkRunner& runner)
+{
+	// Cycle through a table of IDs, so the calls can't be folded into constants
+	std::array<int, 64> playerNetIDs;
+	for (std::size_t i = 0; i < playerNetIDs.size(); ++i) {
+		playerNetIDs[i] = static_cast<int>(i * 0x9E3779B1u);
+	}
+	std::size_t index = 0;
+
+	runner.Run("PlayerNetID/GetPlayerIndex", [&]() {
+		KeepResult(PlayerNetID::GetPlayerIndex(playerNetIDs[index++ % playerNetIDs.size()]));
+	});
+	runner.Run("PlayerNetID/GetTimeStamp", [&]() {
+		KeepResult(PlayerNetID::GetTimeStamp(playerNetIDs[index++ % playerNetIDs.size()]));
+	});
+	runner.Run("PlayerNetID/SetTimeStamp", [&]() {
+		const int playerNetID = playerNetIDs[index++ % playerNetIDs.size()];
+		KeepResult(PlayerNetID::SetTimeStamp(playerNetID, playerNetID ^ 0x5555));
+	});
+	runner.Run("PlayerNetID/SetCurrentTime", [&]() {
+		KeepResult(PlayerNetID::SetCurrentTime(playerNetIDs[index++ % playerNetIDs.size()]));
+	});
+}
@@ -0,0 +1,222 @@
+#include "Benchmark.h"
+#include "OPUNetTransportLayer.h"
+#include "NetFixProtocol.h"
+#include "HostAddressCache.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <ws2tcpip.h>
+#include <mmsystem.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+
+namespace {
+	const int LocalPlayerIndex = 1;
+	const GUID sessionIdentifier = { 0x0C1D2E3F, 0x4A5B, 0x6C7D, { 0x8E, 0x9F, 0xA0, 0xB1, 0xC2, 0xD3, 0xE4, 0xF5 } };
+	const GUID otherSessionIdentifier = { 0xF5E4D3C2, 0xB1A0, 0x9F8E, { 0x7D, 0x6C, 0x5B, 0x4A, 0x3F, 0x2E, 0x1D, 0x0C } };
+	const char* const hostPassword = "bench";
+
+	int MakePlayerNetID(int playerIndex)
+	{
+		return (0x20000 * (playerIndex + 1)) | playerIndex;
+	}
+
+	// Loopback discard port, so the few handlers that reply don't reach anything
+	NetAddress MakeLoopbackAddress()
+	{
+		return NetAddress::FromIPv4(htonl(INADDR_LOOPBACK), htons(9));
+	}
+
+	// Give a background host name lookup time to finish, so the cached path is timed
+	void WaitForLookup(const char* hostName)
+	{
+		const DWORD startTime = timeGetTime();
+		NetAddress address;
+		while (hostAddressCache.Lookup(hostName, address) == HostAddressCache::LookupResult::Pending && timeGetTime() - startTime < 5000) {
+			Sleep(10);
+		}
+	}
+
+	// Sets the transport layer up as player 1 in a game hosted by player 0
+	// The state is Hosting, so host side messages reach their handlers too
+	void SetUpSession(OPUNetTransportLayer& transportLayer, int numPlayers)
+	{
+		int playerNetIDs[MaxRemotePlayers];
+		for (int i = 0; i < numPlayers; ++i) {
+			playerNetIDs[i] = MakePlayerNetID(i);
+		}
+		transportLayer.BenchHostSession(playerNetIDs, numPlayers, MakePlayerNetID(LocalPlayerIndex), MakeLoopbackAddress(), sessionIdentifier, hostPassword);
+	}
+
+	Packet MakePacket(int numPlayers, TransportLayerCommand command, std::size_t payloadSize, int sourcePlayerNetID)
+	{
+		Packet packet;
+		std::memset(&packet, 0, sizeof(packet));
+		packet.header.sourcePlayerNetID = sourcePlayerNetID;
+		packet.header.destPlayerNetID = 0;
+		packet.header.sizeOfPayload = static_cast<unsigned char>(payloadSize);
+		packet.header.type = 1;
+		packet.tlMessage.tlHeader.commandType = command;
+
+		TransportLayerMessage& tlMessage = packet.tlMessage;
+		switch (command)
+		{
+		case TransportLayerCommand::JoinRequest:
+			tlMessage.joinRequest.sessionIdentifier = otherSessionIdentifier;	// Stale session, discarded
+			break;
+		case TransportLayerCommand::JoinHelpRequest:
+			tlMessage.joinHelpRequest.sessionIdentifier = otherSessionIdentifier;	// Stale session, discarded
+			break;
+		case TransportLayerCommand::HostedGameSearchQuery:
+			tlMessage.searchQuery.gameIdentifier = gameIdentifier;
+			std::strncpy(tlMessage.searchQuery.password, "wrong", sizeof(tlMessage.searchQuery.password));
+			break;
+		case TransportLayerCommand::HostedGameSearchReply:
+			tlMessage.searchReply.gameIdentifier = gameIdentifier;
+			tlMessage.searchReply.sessionIdentifier = sessionIdentifier;
+			break;
+		case TransportLayerCommand::SetPlayersList:
+		{
+			// The same list the session already has, so every iteration does the same work
+			const NetAddress loopbackAddress = MakeLoopbackAddress();
+			tlMessage.playersList.numPlayers = numPlayers;
+			for (int i = 0; i < numPlayers; ++i)
+			{
+				tlMessage.playersList.netPeerInfo[i].ip = loopbackAddress.ipv4.sin_addr.s_addr;
+				tlMessage.playersList.netPeerInfo[i].port = loopbackAddress.ipv4.sin_port;
+				tlMessage.playersList.netPeerInfo[i].status = PeerStatus::Normal;
+				tlMessage.playersList.netPeerInfo[i].playerNetID = MakePlayerNetID(i);
+			}
+			break;
+		}
+		case TransportLayerCommand::UpdateStatus:
+			tlMessage.statusUpdate.newStatus = PeerStatus::Normal;
+			break;
+		default:
+			break;
+		}
+
+		return packet;
+	}
+
+
+	void RunGetHostAddress(BenchmarkRunner& runner, OPUNetTransportLayer& transportLayer)
+	{
+		struct HostAddressCase
+		{
+			const char* name;
+			const char* hostAddressString;
+		};
+		const HostAddressCase cases[] = {
+			{ "IPv4", "192.168.1.101" },
+			{ "IPv4-port", "192.168.1.101:47801" },
+			{ "IPv4-leading-space", "  192.168.1.101:47801" },
+			{ "IPv6", "2001:db8::1" },
+			{ "IPv6-bracket-port", "[2001:db8::1]:47801" },
+			{ "host-name-cached", "localhost:47801" },
+			{ "port-only", ":47801" },
+			{ "invalid-bracket", "[2001:db8::1" },
+		};
+
+		WaitForLookup("localhost");
+
+		for (const HostAddressCase& hostAddressCase : cases)
+		{
+			const char* hostAddressString = hostAddressCase.hostAddressString;
+			runner.Run(std::string("OPUNetTransportLayer::GetHostAddress/") + hostAddressCase.name, [&transportLayer, hostAddressString]() {
+				NetAddress hostAddress = NetAddress::FromIPv4(0, htons(DefaultClientPort));
+				KeepResult(transportLayer.BenchGetHostAddress(hostAddressString, hostAddress));
+				KeepResult(hostAddress);
+			});
+		}
+	}
+
+	void RunOnImmediatePacketProcess(BenchmarkRunner& runner, OPUNetTransportLayer& transportLayer)
+	{
+		struct DispatchCase
+		{
+			const char* name;
+			TransportLayerCommand command;
+			std::size_t payloadSize;
+			int sourcePlayerIndex;		// -1 for packets from outside the game (sourcePlayerNetID = 0)
+		};
+		const DispatchCase cases[] = {
+			{ "JoinRequest", TransportLayerCommand::JoinRequest, sizeof(JoinRequest), -1 },
+			{ "JoinGranted", TransportLayerCommand::JoinGranted, sizeof(JoinReply), -1 },
+			{ "JoinRefused", TransportLayerCommand::JoinRefused, sizeof(JoinReply), -1 },
+			{ "StartGame", TransportLayerCommand::StartGame, 4, -1 },
+			{ "SetPlayersList", TransportLayerCommand::SetPlayersList, sizeof(PlayersList), HostPlayerIndex },
+			{ "SetPlayersListFailed", TransportLayerCommand::SetPlayersListFailed, 4, HostPlayerIndex },
+			{ "UpdateStatus", TransportLayerCommand::UpdateStatus, sizeof(StatusUpdate), 2 },
+			{ "HostedGameSearchQuery", TransportLayerCommand::HostedGameSearchQuery, sizeof(HostedGameSearchQuery), -1 },
+			{ "HostedGameSearchReply", TransportLayerCommand::HostedGameSearchReply, sizeof(HostedGameSearchReply), -1 },
+			{ "GameServerPoke", TransportLayerCommand::GameServerPoke, sizeof(GameServerPoke), -1 },
+			{ "JoinHelpRequest", TransportLayerCommand::JoinHelpRequest, sizeof(JoinHelpRequest), -1 },
+			{ "RequestExternalAddress", TransportLayerCommand::RequestExternalAddress, sizeof(RequestExternalAddress), -1 },
+			{ "EchoExternalAddress", TransportLayerCommand::EchoExternalAddress, sizeof(EchoExternalAddress), -1 },
+			{ "NetFix-Hello", ToTransportLayerCommand(NetFixCommand::Hello), sizeof(NetFixHello), 2 },
+			{ "NetFix-PeerAddressList", ToTransportLayerCommand(NetFixCommand::PeerAddressList), sizeof(NetFixPeerAddressList), HostPlayerIndex },
+		};
+
+		const NetAddress fromAddress = MakeLoopbackAddress();
+
+		for (const DispatchCase& dispatchCase : cases)
+		{
+			// Each case starts from the same session, as some handlers change it
+			SetUpSession(transportLayer, MaxRemotePlayers - 1);
+
+			const int sourcePlayerNetID = (dispatchCase.sourcePlayerIndex < 0) ? 0 : MakePlayerNetID(dispatchCase.sourcePlayerIndex);
+			Packet templatePacket = MakePacket(MaxRemotePlayers - 1, dispatchCase.command, dispatchCase.payloadSize, sourcePlayerNetID);
+			if (dispatchCase.command == ToTransportLayerCommand(NetFixCommand::Hello))
+			{
+				NetFixHello& hello = GetNetFixMessage<NetFixHello>(templatePacket);
+				hello.protocolVersion = NetFixProtocolVersion;
+				hello.bReply = true;		// Don't answer it
+			}
+
+			// Handlers rewrite the packet, so restore it each time  (only the part in use is copied)
+			const std::size_t packetSize = sizeof(PacketHeader) + dispatchCase.payloadSize;
+			Packet packet;
+			runner.Run(std::string("OPUNetTransportLayer::OnImmediatePacketProcess/") + dispatchCase.name, [&]() {
+				std::memcpy(&packet, &templatePacket, packetSize);
+				KeepResult(transportLayer.BenchOnImmediatePacketProcess(packet, fromAddress));
+			});
+		}
+	}
+
+	void RunGetOpponentNetIDList(BenchmarkRunner& runner, OPUNetTransportLayer& transportLayer)
+	{
+		const int playerCounts[] = { 2, MaxRemotePlayers };
+
+		for (int numPlayers : playerCounts)
+		{
+			SetUpSession(transportLayer, numPlayers);
+
+			int netIDList[MaxRemotePlayers];
+			runner.Run("OPUNetTransportLayer::GetOpponentNetIDList/" + std::to_string(numPlayers), [&]() {
+				KeepResult(transportLayer.GetOpponentNetIDList(netIDList, MaxRemotePlayers));
+				KeepResult(netIDList);
+			});
+		}
+	}
+}
+
+
+void RunTransportLayerBenchmarks(BenchmarkRunner& runner)
+{
+	OPUNetTransportLayer* transportLayer = OPUNetTransportLayer::Create();
+	if (transportLayer == nullptr)
+	{
+		std::cerr << "Could not create the transport layer. Skipping OPUNetTransportLayer benchmarks." << std::endl;
+		return;
+	}
+
+	RunGetHostAddress(runner, *transportLayer);
+	RunOnImmediatePacketProcess(runner, *transportLayer);
+	RunGetOpponentNetIDList(runner, *transportLayer);
+
+	// Not really hosting, so don't cancel anything on the way out
+	transportLayer->BenchEndSession();
+	delete transportLayer;
+}
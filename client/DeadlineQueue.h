@@ -0,0 +1,79 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+// Min-heap of items, each due at a deadline (timeGetTime milliseconds)
+// Only the earliest deadline is checked, so finding due items doesn't depend on how many are waiting.
+// Times are compared as differences, so deadlines work across timeGetTime wrapping around.
+// Items with the same deadline are returned in the order they were pushed.
+template <typename Item>
+class DeadlineQueue
+{
+public:
+	void Push(DWORD deadline, const Item& item)
+	{
+		entries.push_back(Entry{ deadline, nextSequence++, item });
+		std::push_heap(entries.begin(), entries.end(), IsLater);
+	}
+
+	// Removes the item with the earliest deadline, if it is due at currentTime
+	// Returns false if nothing is due
+	bool PopDue(DWORD currentTime, Item& item)
+	{
+		if (entries.empty() || static_cast<int>(currentTime - entries.front().deadline) < 0) {
+			return false;
+		}
+
+		std::pop_heap(entries.begin(), entries.end(), IsLater);
+		item = entries.back().item;
+		entries.pop_back();
+		return true;
+	}
+
+	bool IsEmpty() const
+	{
+		return entries.empty();
+	}
+
+	std::size_t Size() const
+	{
+		return entries.size();
+	}
+
+	// Only valid if the queue is not empty
+	DWORD NextDeadline() const
+	{
+		return entries.front().deadline;
+	}
+
+	void Clear()
+	{
+		entries.clear();
+	}
+
+private:
+	struct Entry
+	{
+		DWORD deadline;
+		std::uint64_t sequence;
+		Item item;
+	};
+
+	// Heap order: the front entry is the one no other entry is earlier than
+	static bool IsLater(const Entry& entry1, const Entry& entry2)
+	{
+		const int difference = static_cast<int>(entry1.deadline - entry2.deadline);
+		if (difference != 0) {
+			return difference > 0;
+		}
+		return entry1.sequence > entry2.sequence;
+	}
+
+	std::vector<Entry> entries;
+	std::uint64_t nextSequence = 0;
+};
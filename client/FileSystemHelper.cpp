@@ -21,3 +21,12 @@ std::string GetOutpost2Directory()
 
 	return buffer;
 }
+
+std::string GetOutpost2FilePath(const char* fileName)
+{
+	std::string path = GetOutpost2Directory();
+	if (!path.empty() && path.back() != '\\' && path.back() != '/') {
+		path += '\\';
+	}
+	return path + fileName;
+}
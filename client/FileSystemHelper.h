@@ -3,3 +3,5 @@
 #include <string>
 
 std::string GetOutpost2Directory();
+// Path of a file in the Outpost 2 directory
+std::string GetOutpost2FilePath(const char* fileName);
@@ -0,0 +1,111 @@
+#include "GameListCache.h"
+#include "FileSystemHelper.h"
+#include "Log.h"
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+
+namespace
+{
+	const char* const GameListCacheFileName = "NetFixGameListCache.ini";
+	const char* const GameListCacheSection = "Games";
+
+	std::string GetGameListCacheFilePath()
+	{
+		return GetOutpost2FilePath(GameListCacheFileName);
+	}
+
+	// Session identifiers and game info are stored as their raw bytes
+	std::string FormatHex(const void* data, std::size_t size)
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		std::string text;
+		text.reserve(size * 2);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			text += digits[bytes[i] >> 4];
+			text += digits[bytes[i] & 15];
+		}
+		return text;
+	}
+
+	bool ParseHex(const char* text, void* data, std::size_t size)
+	{
+		unsigned char* bytes = static_cast<unsigned char*>(data);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			unsigned int byte;
+			if (std::sscanf(text + i * 2, "%2x", &byte) != 1) {
+				return false;
+			}
+			bytes[i] = static_cast<unsigned char>(byte);
+		}
+		return text[size * 2] == 0;
+	}
+}
+
+std::vector<HostedGameInfo> LoadGameListCache()
+{
+	const std::string filePath = GetGameListCacheFilePath();
+	const long long currentTime = static_cast<long long>(std::time(nullptr));
+
+	std::vector<HostedGameInfo> games;
+	for (std::size_t i = 0; i < MaxCachedGames; ++i)
+	{
+		char value[256];
+		GetPrivateProfileString(GameListCacheSection, std::to_string(i).c_str(), "", value, sizeof(value), filePath.c_str());
+		if (value[0] == 0) {
+			break;
+		}
+
+		// IP, port, session identifier, game info, ping, last seen
+		char ipString[64];
+		unsigned int port;
+		char sessionString[96];
+		char createGameInfoString[96];
+		unsigned int ping;
+		long long lastSeenTime;
+		if (std::sscanf(value, "%63s %u %95s %95s %u %lld", ipString, &port, sessionString, createGameInfoString, &ping, &lastSeenTime) != 6) {
+			continue;
+		}
+		const long long age = currentTime - lastSeenTime;
+		if (age < 0 || age > GameListCacheMaxAge) {
+			continue;
+		}
+
+		HostedGameInfo game{};
+		if (!ParseIPAddress(ipString, game.address) || port == 0 || port > 0xFFFF ||
+			!ParseHex(sessionString, &game.sessionIdentifier, sizeof(game.sessionIdentifier)) ||
+			!ParseHex(createGameInfoString, &game.createGameInfo, sizeof(game.createGameInfo)))
+		{
+			continue;
+		}
+		game.address.SetPort(static_cast<Port>(port));
+		game.ping = ping;
+		game.bStale = true;
+		game.lastSeenTime = lastSeenTime;
+		games.push_back(game);
+	}
+
+	return games;
+}
+
+void SaveGameListCache(const std::vector<HostedGameInfo>& games)
+{
+	// The whole section is replaced at once: key=value pairs, each ending with a null, then a final null
+	std::string section;
+	for (std::size_t i = 0; i < games.size() && i < MaxCachedGames; ++i)
+	{
+		const HostedGameInfo& game = games[i];
+		section += std::to_string(i) + "=" + FormatIPAddress(game.address) + " " + std::to_string(game.address.GetPort()) + " " +
+			FormatHex(&game.sessionIdentifier, sizeof(game.sessionIdentifier)) + " " +
+			FormatHex(&game.createGameInfo, sizeof(game.createGameInfo)) + " " +
+			std::to_string(game.ping) + " " + std::to_string(game.lastSeenTime);
+		section += '\0';
+	}
+	section += '\0';
+
+	WritePrivateProfileSection(GameListCacheSection, section.c_str(), GetGameListCacheFilePath().c_str());
+}
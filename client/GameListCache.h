@@ -0,0 +1,16 @@
+#pragma once
+
+#include "OPUNetTransportLayer.h"
+#include <vector>
+
+
+const std::size_t MaxCachedGames = 64;
+const long long GameListCacheMaxAge = 1800;		// Seconds a game is shown after it was last seen (30 minutes)
+
+
+// Games seen the last time the join window was open, so the next one starts with a list
+// Stored in NetFixGameListCache.ini, one game per key. Games older than GameListCacheMaxAge are dropped.
+// Loaded games are marked stale, with lastSeenTime set.
+std::vector<HostedGameInfo> LoadGameListCache();
+// Replaces the cached list. Each game's lastSeenTime is saved with it.
+void SaveGameListCache(const std::vector<HostedGameInfo>& games);
@@ -0,0 +1,236 @@
+#include "GameListSubscription.h"
+#include "NetFixProtocol.h"
+#include "Log.h"
+#include <algorithm>
+
+
+namespace
+{
+	// Sequence numbers wrap, so compare them like time stamps
+	bool IsNewer(std::uint32_t sequence, std::uint32_t reference)
+	{
+		return static_cast<std::int32_t>(sequence - reference) > 0;
+	}
+
+	bool Contains(const std::vector<GUID>& sessions, const GUID& sessionIdentifier)
+	{
+		return std::find(sessions.begin(), sessions.end(), sessionIdentifier) != sessions.end();
+	}
+}
+
+
+void GameListSubscription::Start(const NetAddress& server, DWORD currentTime)
+{
+	this->server = server;
+	state = State::Subscribing;
+	sequence = 0;
+	bAwaitingReply = false;
+	bWantSnapshot = true;
+	attempt = 0;
+	requestTime = currentTime;
+	lastReplyTime = currentTime;
+	roundTripTime = 0;
+	sessions.clear();
+	bReceivingSnapshot = false;
+}
+
+bool GameListSubscription::GetDueRequest(DWORD currentTime, DWORD renewInterval, std::uint32_t& sequence)
+{
+	if (bReceivingSnapshot)
+	{
+		if ((currentTime - snapshotStartTime) < GameListSnapshotTimeOut) {
+			return false;
+		}
+		// Part of the full list was lost. Ask for all of it again.
+		LogDebug("Game list from " + FormatAddress(server) + " incomplete (" + std::to_string(snapshotSessions.size()) +
+			" of " + std::to_string(snapshotCount) + " games)");
+		bReceivingSnapshot = false;
+		bWantSnapshot = true;
+	}
+
+	if (bAwaitingReply && (currentTime - requestTime) < GameListRetryDelay) {
+		return false;
+	}
+	const bool bOnlyRenewing = (state == State::Polling) || (state == State::Subscribed && !bWantSnapshot);
+	if (!bAwaitingReply && bOnlyRenewing && (currentTime - lastReplyTime) < renewInterval) {
+		return false;
+	}
+
+	// Out of retries  (a polled server gets one try per renewal)
+	if (attempt >= MaxGameListAttempt || (state == State::Polling && bAwaitingReply))
+	{
+		if (state != State::Polling) {
+			Log("Game server " + FormatAddress(server) + " is not answering game list requests. Searching it instead.");
+		}
+		state = State::Polling;
+		bAwaitingReply = false;
+		bWantSnapshot = true;
+		attempt = 0;
+		lastReplyTime = currentTime;
+		return false;
+	}
+
+	sequence = bWantSnapshot ? 0 : this->sequence;
+	bAwaitingReply = true;
+	requestTime = currentTime;
+	attempt++;
+	return true;
+}
+
+void GameListSubscription::RequestSnapshot(DWORD currentTime)
+{
+	bWantSnapshot = true;
+	bReceivingSnapshot = false;
+	if (state != State::Polling)
+	{
+		// Ask right away
+		bAwaitingReply = false;
+		attempt = 0;
+		requestTime = currentTime;
+	}
+}
+
+void GameListSubscription::OnEvent(const NetFixGameListEvent& event, DWORD currentTime, std::vector<Change>& changes)
+{
+	switch (event.eventType)
+	{
+	case NetFixGameListEventType::Snapshot:
+		OnSnapshot(event, currentTime, changes);
+		break;
+	case NetFixGameListEventType::Added:
+	case NetFixGameListEventType::Updated:
+	case NetFixGameListEventType::Removed:
+		OnChange(event, currentTime, changes);
+		break;
+	case NetFixGameListEventType::Sync:
+		if (event.timeStamp != 0) {
+			roundTripTime = currentTime - event.timeStamp;
+		}
+		OnReply(currentTime);
+		// A renewal reply names the server's version. Anything missed means fetching the full list.
+		if (!bWantSnapshot && !bReceivingSnapshot && sequence != 0 && event.sequence == sequence)
+		{
+			state = State::Subscribed;
+			attempt = 0;
+		}
+		else if (!bReceivingSnapshot) {
+			bWantSnapshot = true;
+		}
+		break;
+	}
+}
+
+GameListSubscription::State GameListSubscription::GetState() const
+{
+	return state;
+}
+
+bool GameListSubscription::HasPendingRequests() const
+{
+	return bAwaitingReply || bReceivingSnapshot || (bWantSnapshot && state != State::Polling);
+}
+
+const NetAddress& GameListSubscription::GetServer() const
+{
+	return server;
+}
+
+void GameListSubscription::OnSnapshot(const NetFixGameListEvent& event, DWORD currentTime, std::vector<Change>& changes)
+{
+	// A newer list replaces one partly received. Anything left over from an earlier list is ignored.
+	const bool bNewList = bReceivingSnapshot ? IsNewer(event.sequence, snapshotSequence) : (bWantSnapshot || IsNewer(event.sequence, sequence));
+	if (!bNewList && !(bReceivingSnapshot && event.sequence == snapshotSequence)) {
+		return;
+	}
+
+	if (bNewList)
+	{
+		if (event.timeStamp != 0) {
+			roundTripTime = currentTime - event.timeStamp;
+		}
+		OnReply(currentTime);
+		bWantSnapshot = false;
+		bReceivingSnapshot = true;
+		snapshotSequence = event.sequence;
+		snapshotStartTime = currentTime;
+		snapshotCount = event.count;
+		snapshotReceived.assign(snapshotCount, false);
+		snapshotSessions.clear();
+	}
+
+	if (event.count != snapshotCount) {
+		return;
+	}
+	if (event.index < snapshotCount && !snapshotReceived[event.index])
+	{
+		snapshotReceived[event.index] = true;
+		snapshotSessions.push_back(event.game.sessionIdentifier);
+		changes.push_back(Change{ false, event.game });
+		changes.back().game.timeStamp = currentTime - roundTripTime;
+	}
+	if (snapshotSessions.size() < snapshotCount) {
+		return;
+	}
+
+	// Complete. Anything the list no longer holds was removed while we weren't following it.
+	for (const GUID& sessionIdentifier : sessions)
+	{
+		if (!Contains(snapshotSessions, sessionIdentifier))
+		{
+			changes.push_back(Change{ true, HostedGameSearchReply{} });
+			changes.back().game.sessionIdentifier = sessionIdentifier;
+		}
+	}
+
+	LogDebug("Game list from " + FormatAddress(server) + ": " + std::to_string(snapshotCount) + " games (version " + std::to_string(snapshotSequence) + ")");
+	sessions.swap(snapshotSessions);
+	sequence = snapshotSequence;
+	bReceivingSnapshot = false;
+	state = State::Subscribed;
+	attempt = 0;
+}
+
+void GameListSubscription::OnChange(const NetFixGameListEvent& event, DWORD currentTime, std::vector<Change>& changes)
+{
+	// Changes made before the full list (or while waiting on it) are part of it
+	if (state != State::Subscribed || bWantSnapshot || bReceivingSnapshot || !IsNewer(event.sequence, sequence)) {
+		return;
+	}
+
+	if (event.sequence != sequence + 1)
+	{
+		LogDebug("Game list from " + FormatAddress(server) + " skipped from version " + std::to_string(sequence) + " to " + std::to_string(event.sequence));
+		RequestSnapshot(currentTime);
+		return;
+	}
+	sequence = event.sequence;
+
+	const GUID& sessionIdentifier = event.game.sessionIdentifier;
+	if (event.eventType == NetFixGameListEventType::Removed)
+	{
+		ForgetSession(sessionIdentifier);
+		changes.push_back(Change{ true, HostedGameSearchReply{} });
+		changes.back().game.sessionIdentifier = sessionIdentifier;
+		return;
+	}
+
+	if (!Contains(sessions, sessionIdentifier)) {
+		sessions.push_back(sessionIdentifier);
+	}
+	changes.push_back(Change{ false, event.game });
+	changes.back().game.timeStamp = currentTime - roundTripTime;
+}
+
+void GameListSubscription::OnReply(DWORD currentTime)
+{
+	bAwaitingReply = false;
+	lastReplyTime = currentTime;
+	if (state == State::Polling) {
+		state = State::Subscribing;
+	}
+}
+
+void GameListSubscription::ForgetSession(const GUID& sessionIdentifier)
+{
+	sessions.erase(std::remove(sessions.begin(), sessions.end(), sessionIdentifier), sessions.end());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "NetAddress.h"
+#include <OP2Internal.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <cstdint>
+#include <vector>
+
+using namespace OP2Internal;
+
+struct NetFixGameListEvent;
+
+
+const DWORD GameListRetryDelay = 1000;			// Milliseconds to wait for a reply before asking again
+const int MaxGameListAttempt = 3;				// Requests before the server is searched instead
+const DWORD GameListSnapshotTimeOut = 2000;		// Milliseconds to wait for the rest of a full list
+
+
+// Follows one game server's game list from the changes it pushes, instead of searching it every few seconds
+// Each change has the next sequence number. A gap, an incomplete full list, or a renewal that finds the
+// server on a different version, asks for the full list again. Games missing from it are removed.
+// A server that doesn't answer is searched as before, and asked again at each renewal.
+// Only tracks the list. The transport sends the requests, and passes in the events.
+class GameListSubscription
+{
+public:
+	enum class State : unsigned char
+	{
+		Subscribing,	// Waiting on the full list
+		Subscribed,
+		Polling,		// Not answering (or an older server). Searched instead.
+	};
+
+	struct Change
+	{
+		bool bRemoved;
+		HostedGameSearchReply game;		// Removed: only the session identifier is set
+	};
+
+	void Start(const NetAddress& server, DWORD currentTime);
+	// Returns true if a request is due: subscribe, retry, or renew. sequence is the value to send.
+	bool GetDueRequest(DWORD currentTime, DWORD renewInterval, std::uint32_t& sequence);
+	// Ask for the full list again  (such as after the window cleared its list)
+	void RequestSnapshot(DWORD currentTime);
+	// Adds any changes to the list
+	void OnEvent(const NetFixGameListEvent& event, DWORD currentTime, std::vector<Change>& changes);
+
+	State GetState() const;
+	bool HasPendingRequests() const;	// Waiting on a reply, or the rest of a full list
+	const NetAddress& GetServer() const;
+
+private:
+	void OnSnapshot(const NetFixGameListEvent& event, DWORD currentTime, std::vector<Change>& changes);
+	void OnChange(const NetFixGameListEvent& event, DWORD currentTime, std::vector<Change>& changes);
+	void OnReply(DWORD currentTime);
+	void ForgetSession(const GUID& sessionIdentifier);
+
+	NetAddress server;
+	State state = State::Subscribing;
+	std::uint32_t sequence = 0;			// Last change applied
+	bool bAwaitingReply = false;
+	bool bWantSnapshot = true;
+	int attempt = 0;
+	DWORD requestTime = 0;
+	DWORD lastReplyTime = 0;
+	unsigned int roundTripTime = 0;		// From the last echoed time stamp. Pushed games are given this ping.
+	std::vector<GUID> sessions;			// Games the list holds
+
+	// Full list being received
+	bool bReceivingSnapshot = false;
+	std::uint32_t snapshotSequence = 0;
+	DWORD snapshotStartTime = 0;
+	std::vector<bool> snapshotReceived;	// By index
+	std::size_t snapshotCount = 0;
+	std::vector<GUID> snapshotSessions;
+};
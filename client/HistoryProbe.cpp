@@ -0,0 +1,136 @@
+#include "HistoryProbe.h"
+#include <algorithm>
+
+
+void HistoryProbe::Start(const std::vector<std::string>& addresses, DWORD currentTime)
+{
+	entries.clear();
+	for (const std::string& address : addresses)
+	{
+		// The history can repeat an address typed in two ways, but the same string is only probed once
+		if (address.empty() || FindEntry(address) != nullptr) {
+			continue;
+		}
+		entries.push_back(Entry{ address, NetAddress{}, State::Probing, 0, GUID{} });
+	}
+
+	bRunning = !entries.empty();
+	roundsSent = 0;
+	nextRoundTime = currentTime;
+	lastRoundTime = currentTime;
+}
+
+void HistoryProbe::Stop()
+{
+	bRunning = false;
+	for (Entry& entry : entries)
+	{
+		if (entry.state == State::Probing) {
+			entry.state = State::NoReply;
+		}
+	}
+}
+
+bool HistoryProbe::StartRoundIfDue(DWORD currentTime)
+{
+	if (!bRunning || roundsSent >= HistoryProbeRounds || static_cast<int>(currentTime - nextRoundTime) < 0) {
+		return false;
+	}
+
+	roundsSent++;
+	lastRoundTime = currentTime;
+	nextRoundTime = currentTime + HistoryProbeInterval;
+	return true;
+}
+
+bool HistoryProbe::Update(DWORD currentTime)
+{
+	if (!bRunning || roundsSent < HistoryProbeRounds) {
+		return false;
+	}
+
+	// Finish early once every entry has replied. Replies to the last round still update the round trip times.
+	const bool bAllLive = std::all_of(entries.begin(), entries.end(), [](const Entry& entry) {
+		return entry.state == State::Live;
+	});
+	if (!bAllLive && (currentTime - lastRoundTime) < HistoryProbeTimeOut) {
+		return false;
+	}
+
+	Stop();
+	return true;
+}
+
+bool HistoryProbe::OnReply(const NetAddress& from, unsigned int ping, const GUID& sessionIdentifier)
+{
+	bool bMatched = false;
+	for (Entry& entry : entries)
+	{
+		if (!entry.hostAddress.IsSet() || !(entry.hostAddress == from)) {
+			continue;
+		}
+		bMatched = true;
+
+		// Late replies still count: the server is up, even if it was slow
+		if (entry.state != State::Live || ping < entry.roundTripTime)
+		{
+			entry.roundTripTime = ping;
+			entry.fastestGame = sessionIdentifier;
+		}
+		entry.state = State::Live;
+	}
+	return bMatched;
+}
+
+bool HistoryProbe::IsRunning() const
+{
+	return bRunning;
+}
+
+std::vector<HistoryProbe::Entry>& HistoryProbe::GetEntries()
+{
+	return entries;
+}
+
+const HistoryProbe::Entry* HistoryProbe::FindEntry(const std::string& address) const
+{
+	for (const Entry& entry : entries)
+	{
+		if (entry.address == address) {
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+bool HistoryProbe::GetFastestGame(GUID& sessionIdentifier) const
+{
+	const Entry* fastestEntry = nullptr;
+	for (const Entry& entry : entries)
+	{
+		if (entry.state == State::Live && (fastestEntry == nullptr || entry.roundTripTime < fastestEntry->roundTripTime)) {
+			fastestEntry = &entry;
+		}
+	}
+
+	if (fastestEntry == nullptr) {
+		return false;
+	}
+	sessionIdentifier = fastestEntry->fastestGame;
+	return true;
+}
+
+
+std::string FormatHistoryProbeState(const HistoryProbe::Entry& entry)
+{
+	switch (entry.state)
+	{
+	case HistoryProbe::State::Probing:
+		return "...";
+	case HistoryProbe::State::Live:
+		return std::to_string(entry.roundTripTime) + " ms";
+	case HistoryProbe::State::NoReply:
+		return "no games";
+	}
+	return "";
+}
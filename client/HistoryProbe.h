@@ -0,0 +1,62 @@
+#pragma once
+
+#include "NetAddress.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <string>
+#include <vector>
+
+
+const int HistoryProbeRounds = 3;				// Search queries sent to each history entry (the fastest reply is kept)
+const DWORD HistoryProbeInterval = 500;			// Milliseconds between rounds of queries
+const DWORD HistoryProbeTimeOut = 2000;			// Milliseconds to wait for replies after the last round
+
+
+// Checks each server address in the history when the lobby opens, so its latency is known before the user picks one
+// Replies are matched to entries by source address. Host names are matched once their lookup completes.
+// Only tracks results. The window sends the search queries, and passes in the replies.
+class HistoryProbe
+{
+public:
+	enum class State : unsigned char
+	{
+		Probing,
+		Live,			// Replied with at least one game
+		NoReply,		// No games, or nothing is running there
+	};
+
+	struct Entry
+	{
+		std::string address;			// As shown in the history
+		NetAddress hostAddress;			// Not set until resolved
+		State state;
+		unsigned int roundTripTime;		// Fastest reply, in milliseconds (Live only)
+		GUID fastestGame;				// Session of the game that gave the fastest reply
+	};
+
+	void Start(const std::vector<std::string>& addresses, DWORD currentTime);
+	void Stop();
+
+	// Returns true if a round of queries is due. The window sends one to each entry.
+	bool StartRoundIfDue(DWORD currentTime);
+	// Marks unanswered entries once the time out passes. Returns true when the probe finishes.
+	bool Update(DWORD currentTime);
+	// Returns true if the reply came from a history entry
+	bool OnReply(const NetAddress& from, unsigned int ping, const GUID& sessionIdentifier);
+
+	bool IsRunning() const;
+	std::vector<Entry>& GetEntries();
+	const Entry* FindEntry(const std::string& address) const;
+	// Game with the lowest round trip time, over all live entries
+	bool GetFastestGame(GUID& sessionIdentifier) const;
+
+private:
+	bool bRunning = false;
+	std::vector<Entry> entries;
+	int roundsSent = 0;
+	DWORD nextRoundTime = 0;
+	DWORD lastRoundTime = 0;
+};
+
+// Text shown beside a history entry
+std::string FormatHistoryProbeState(const HistoryProbe::Entry& entry);
@@ -0,0 +1,244 @@
+#include "HostAddressCache.h"
+#include "Log.h"
+#include <ws2tcpip.h>
+#include <mmsystem.h>
+#include <cstring>
+
+
+HostAddressCache hostAddressCache;
+
+
+HostAddressCache::HostAddressCache()
+{
+	InitializeCriticalSection(&criticalSection);
+	workQueuedEvent = CreateEvent(nullptr, false, false, nullptr);	// Auto reset, initially not signalled
+	stopEvent = CreateEvent(nullptr, true, false, nullptr);			// Manual reset, initially not signalled
+}
+
+HostAddressCache::~HostAddressCache()
+{
+	// A worker still running can not be waited on here, since this runs under the loader lock during DLL unload.
+	// Shutdown stops it first. Without that, the thread may still be using these.
+	if (workerThreadHandle != nullptr && WaitForSingleObject(workerThreadHandle, 0) != WAIT_OBJECT_0) {
+		return;
+	}
+
+	if (workerThreadHandle != nullptr) {
+		CloseHandle(workerThreadHandle);
+	}
+	CloseHandle(workQueuedEvent);
+	CloseHandle(stopEvent);
+	DeleteCriticalSection(&criticalSection);
+}
+
+void HostAddressCache::Shutdown()
+{
+	EnterCriticalSection(&criticalSection);
+	bShutDown = true;
+	HANDLE thread = workerThreadHandle;
+	workerThreadHandle = nullptr;
+	LeaveCriticalSection(&criticalSection);
+
+	if (thread == nullptr) {
+		return;
+	}
+	// A lookup in progress finishes first
+	SetEvent(stopEvent);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+
+HostAddressCache::LookupResult HostAddressCache::Lookup(const std::string& hostName, NetAddress& address)
+{
+	LookupResult result = LookupResult::Pending;
+
+	EnterCriticalSection(&criticalSection);
+
+	Entry& entry = entries[hostName];
+	// Check for a new (or expired) entry
+	if (!entry.bLookupComplete || static_cast<int>(timeGetTime() - entry.expireTime) >= 0)
+	{
+		QueueLookup(hostName, entry);
+	}
+
+	if (entry.bResolved)
+	{
+		// Use the cached address, even if a refresh is in progress
+		address = entry.address;
+		result = LookupResult::Resolved;
+	}
+	else if (entry.bLookupComplete && !entry.bLookupQueued)
+	{
+		result = LookupResult::Failed;
+	}
+
+	LeaveCriticalSection(&criticalSection);
+
+	return result;
+}
+
+void HostAddressCache::Prefetch(const std::string& hostName)
+{
+	NetAddress address;
+	Lookup(hostName, address);
+}
+
+
+// Must be called with the critical section held
+void HostAddressCache::QueueLookup(const std::string& hostName, Entry& entry)
+{
+	if (entry.bLookupQueued) {
+		return;		// Lookup already in progress
+	}
+
+	entry.bLookupQueued = true;
+	lookupQueue.push_back(hostName);
+
+	if (bShutDown || (!bWorkerRunning && !StartWorkerThread()))
+	{
+		// Could not start the worker. Fail the lookup, and try again after the failure time out.
+		lookupQueue.pop_back();
+		entry.bLookupQueued = false;
+		entry.bLookupComplete = true;
+		entry.expireTime = timeGetTime() + FailedLookupTimeToLive;
+		if (!bShutDown) {
+			LogError("Unable to start host address lookup thread");
+		}
+		return;
+	}
+
+	SetEvent(workQueuedEvent);
+}
+
+// Must be called with the critical section held
+bool HostAddressCache::StartWorkerThread()
+{
+	// An earlier worker exited after being idle. It no longer needs the lock, so it is done, or about to be.
+	if (workerThreadHandle != nullptr)
+	{
+		WaitForSingleObject(workerThreadHandle, INFINITE);
+		CloseHandle(workerThreadHandle);
+		workerThreadHandle = nullptr;
+	}
+
+	workerThreadHandle = CreateThread(nullptr, 0, WorkerThreadProc, this, 0, nullptr);
+	if (workerThreadHandle == nullptr) {
+		return false;
+	}
+
+	bWorkerRunning = true;
+	return true;
+}
+
+
+DWORD WINAPI HostAddressCache::WorkerThreadProc(LPVOID parameter)
+{
+	static_cast<HostAddressCache*>(parameter)->WorkerThread();
+	return 0;
+}
+
+void HostAddressCache::WorkerThread()
+{
+	// Winsock is reference counted, so hold our own reference while lookups are in progress
+	WSADATA wsaData;
+	const bool bWinsockStarted = (WSAStartup(MAKEWORD(2, 2), &wsaData) == 0);
+
+	for (;;)
+	{
+		EnterCriticalSection(&criticalSection);
+		// Stop before starting another lookup
+		if (WaitForSingleObject(stopEvent, 0) == WAIT_OBJECT_0)
+		{
+			bWorkerRunning = false;
+			LeaveCriticalSection(&criticalSection);
+			break;
+		}
+		if (lookupQueue.empty())
+		{
+			LeaveCriticalSection(&criticalSection);
+
+			// Wait for more work, or to be stopped
+			const HANDLE events[] = { workQueuedEvent, stopEvent };
+			const DWORD waitResult = WaitForMultipleObjects(2, events, false, LookupWorkerIdleTimeOut);
+			if (waitResult == WAIT_OBJECT_0) {
+				continue;
+			}
+
+			// Stopped, or idle time out. Exit, unless work was queued while timing out.
+			EnterCriticalSection(&criticalSection);
+			if (waitResult == WAIT_OBJECT_0 + 1 || lookupQueue.empty())
+			{
+				bWorkerRunning = false;
+				LeaveCriticalSection(&criticalSection);
+				break;
+			}
+		}
+
+		std::string hostName = lookupQueue.front();
+		lookupQueue.pop_front();
+		LeaveCriticalSection(&criticalSection);
+
+		// Do the (possibly slow) lookup without holding the lock
+		NetAddress address;
+		const bool bSuccess = ResolveHostName(hostName, address);
+
+		EnterCriticalSection(&criticalSection);
+		Entry& entry = entries[hostName];
+		entry.bLookupQueued = false;
+		entry.bLookupComplete = true;
+		if (bSuccess)
+		{
+			entry.address = address;
+			entry.bResolved = true;
+			entry.expireTime = timeGetTime() + HostAddressTimeToLive;
+		}
+		else
+		{
+			// Keep any previously resolved address. A transient DNS failure should not drop a working server.
+			entry.expireTime = timeGetTime() + FailedLookupTimeToLive;
+		}
+		LeaveCriticalSection(&criticalSection);
+
+		LogDebug("Host address lookup " + std::string(bSuccess ? "succeeded" : "failed") + ": " + hostName +
+			(bSuccess ? " = " + FormatIPAddress(address) : ""));
+	}
+
+	if (bWinsockStarted) {
+		WSACleanup();
+	}
+}
+
+bool HostAddressCache::ResolveHostName(const std::string& hostName, NetAddress& address)
+{
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	addrinfo* result = nullptr;
+	if (getaddrinfo(hostName.c_str(), nullptr, &hints, &result) != 0) {
+		return false;
+	}
+
+	// Prefer the first IPv4 address, otherwise use the first IPv6 address
+	bool bFound = false;
+	for (addrinfo* info = result; info != nullptr; info = info->ai_next)
+	{
+		if (info->ai_family != AF_INET && info->ai_family != AF_INET6) {
+			continue;
+		}
+
+		NetAddress infoAddress = NetAddress::FromSocketAddress(info->ai_addr, static_cast<int>(info->ai_addrlen));
+		if (!bFound || (infoAddress.IsIPv4() && !address.IsIPv4()))
+		{
+			address = infoAddress;
+			address.SetPort(0);
+			bFound = true;
+		}
+	}
+
+	freeaddrinfo(result);
+	return bFound;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "NetAddress.h"
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <string>
+#include <map>
+#include <deque>
+
+// Time a successful lookup is used before a refresh is queued
+const DWORD HostAddressTimeToLive = 300000;		// 5 minutes
+// Time a failed lookup is remembered before it is retried
+const DWORD FailedLookupTimeToLive = 30000;		// 30 seconds
+// Time the worker thread waits for new work before exiting
+const DWORD LookupWorkerIdleTimeOut = 30000;	// 30 seconds
+
+
+// Caches host name lookups so DNS resolution never blocks the calling (UI/game) thread.
+// Lookups are done with getaddrinfo on a background worker thread.
+// IPv4 addresses are preferred. An IPv6 address is used when a name has no IPv4 address.
+// Cached addresses are returned immediately. Expired entries keep being returned
+// while a refresh runs in the background.
+class HostAddressCache
+{
+public:
+	enum class LookupResult
+	{
+		Resolved,
+		Pending,
+		Failed
+	};
+
+	HostAddressCache();
+	~HostAddressCache();
+
+	// Never blocks. Queues a background lookup for unknown or expired names.
+	LookupResult Lookup(const std::string& hostName, NetAddress& address);
+	// Queue a background lookup, so a later Lookup can be answered from the cache
+	void Prefetch(const std::string& hostName);
+	// Stops the worker thread and waits for it. Must be called outside the loader lock (such as from DestroyMod).
+	// Lookups made afterwards fail.
+	void Shutdown();
+
+private:
+	struct Entry
+	{
+		NetAddress address;		// Port is not set
+		bool bResolved;			// A lookup has succeeded at least once
+		bool bLookupComplete;	// A lookup has finished at least once (success or failure)
+		bool bLookupQueued;
+		DWORD expireTime;
+	};
+
+	void QueueLookup(const std::string& hostName, Entry& entry);
+	bool StartWorkerThread();
+	static DWORD WINAPI WorkerThreadProc(LPVOID parameter);
+	void WorkerThread();
+	static bool ResolveHostName(const std::string& hostName, NetAddress& address);
+
+	CRITICAL_SECTION criticalSection;
+	HANDLE workQueuedEvent;
+	HANDLE stopEvent;
+	HANDLE workerThreadHandle = nullptr;	// Kept so Shutdown can wait on the thread
+	bool bWorkerRunning = false;
+	bool bShutDown = false;
+	std::map<std::string, Entry> entries;
+	std::deque<std::string> lookupQueue;
+};
+
+
+extern HostAddressCache hostAddressCache;
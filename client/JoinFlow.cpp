@@ -0,0 +1,84 @@
+#include "JoinFlow.h"
+#include <mmsystem.h>
+#include <algorithm>
+
+
+void JoinFlow::Start(unsigned int hostPing)
+{
+	// Allow a reply twice the ping, plus time for the host to process the request
+	baseRetryDelay = (hostPing == 0) ? UnknownPingJoinRetryDelay :
+		std::min(std::max(static_cast<UINT>(2 * hostPing + 100), MinJoinRetryDelay), MaxJoinRetryDelay);
+
+	attempt = 0;
+	startTime = timeGetTime();
+	finishTime = startTime;
+	resumePoint = ResumePoint::Begin;
+}
+
+void JoinFlow::Cancel()
+{
+	resumePoint = ResumePoint::Finished;
+}
+
+JoinFlow::Action JoinFlow::Resume(Event event)
+{
+	switch (resumePoint)
+	{
+	case ResumePoint::Begin:
+		if (event != Event::Start) {
+			return Action::Await;
+		}
+		attempt = 1;
+		resumePoint = ResumePoint::AwaitReply;
+		return Action::SendRequest;
+
+	case ResumePoint::AwaitReply:
+		switch (event)
+		{
+		case Event::Granted:
+			finishTime = timeGetTime();
+			resumePoint = ResumePoint::Finished;
+			return Action::Joined;
+		case Event::Refused:
+			finishTime = timeGetTime();
+			resumePoint = ResumePoint::Finished;
+			return Action::Refused;
+		case Event::TimedOut:
+			if (attempt >= MaxJoinAttempt)
+			{
+				resumePoint = ResumePoint::Finished;
+				return Action::Failed;
+			}
+			attempt++;
+			return Action::SendRequest;
+		default:
+			return Action::Await;
+		}
+
+	case ResumePoint::Finished:
+	default:
+		return Action::Await;
+	}
+}
+
+bool JoinFlow::IsActive() const
+{
+	return resumePoint != ResumePoint::Finished;
+}
+
+UINT JoinFlow::Attempt() const
+{
+	return attempt;
+}
+
+UINT JoinFlow::RetryDelay() const
+{
+	// Back off on each retry, in case the reply was lost to congestion
+	const UINT shift = std::min(attempt > 0 ? attempt - 1 : 0u, 4u);
+	return std::min(baseRetryDelay << shift, MaxJoinRetryDelay);
+}
+
+DWORD JoinFlow::ElapsedTime() const
+{
+	return finishTime - startTime;
+}
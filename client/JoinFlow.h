@@ -0,0 +1,67 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+
+// Join request retries are timed from the host's measured round trip time (search reply ping)
+const UINT MinJoinRetryDelay = 250;			// Milliseconds
+const UINT MaxJoinRetryDelay = 4000;		// Milliseconds
+const UINT UnknownPingJoinRetryDelay = 1000;	// Used when no ping has been measured
+const UINT MaxJoinAttempt = 4;				// Requests sent before giving up
+
+
+// Client side join sequence, written as a resumable (stackless coroutine style) flow:
+//   for each attempt: send the join request, then await a reply or time out
+//   reply: complete (granted or refused)
+//   out of attempts: fail
+// The window drives the flow from its event loop. Each call to Resume continues from the point
+// the flow last suspended, and returns what it wants done next. A reply resumes the flow as
+// soon as it arrives, so the join completes without waiting on a timer.
+class JoinFlow
+{
+public:
+	enum class Event
+	{
+		Start,
+		Granted,
+		Refused,
+		TimedOut,
+	};
+
+	enum class Action
+	{
+		SendRequest,	// Send a join request, then resume with a reply, or TimedOut after RetryDelay
+		Await,			// Keep waiting (event was not expected at this point)
+		Joined,
+		Refused,
+		Failed,
+	};
+
+	// hostPing: round trip time to the host, in milliseconds (0 if not measured)
+	void Start(unsigned int hostPing);
+	void Cancel();
+	Action Resume(Event event);
+
+	bool IsActive() const;
+	UINT Attempt() const;
+	// Time to wait for a reply to the current request
+	UINT RetryDelay() const;
+	// Milliseconds from the first request to the reply (valid after Joined or Refused)
+	DWORD ElapsedTime() const;
+
+private:
+	// Points the flow can be suspended at
+	enum class ResumePoint
+	{
+		Finished,
+		Begin,
+		AwaitReply,
+	};
+
+	ResumePoint resumePoint = ResumePoint::Finished;
+	UINT attempt = 0;
+	UINT baseRetryDelay = UnknownPingJoinRetryDelay;
+	DWORD startTime = 0;
+	DWORD finishTime = 0;
+};
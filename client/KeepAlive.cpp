@@ -0,0 +1,36 @@
+#include "KeepAlive.h"
+#include <algorithm>
+
+
+bool MappingLifetimeEstimate::OnMappingReplaced(DWORD silentTime)
+{
+	if (silentTime < MinMappingLifetime || (lifetime != 0 && silentTime >= lifetime)) {
+		return false;
+	}
+	lifetime = silentTime;
+	return true;
+}
+
+void MappingLifetimeEstimate::SetLifetime(DWORD lifetime)
+{
+	this->lifetime = (lifetime < MinMappingLifetime) ? 0 : lifetime;
+}
+
+DWORD MappingLifetimeEstimate::GetLifetime() const
+{
+	return lifetime;
+}
+
+DWORD MappingLifetimeEstimate::GetKeepAliveInterval() const
+{
+	if (lifetime == 0) {
+		return DefaultKeepAliveInterval;
+	}
+	return std::min(DefaultKeepAliveInterval, std::max(MinKeepAliveInterval, lifetime / 2));
+}
+
+// Any packet sent on the path refreshes the mapping, so keepalives are only needed after a silence
+bool MappingLifetimeEstimate::IsKeepAliveDue(const PathActivity& activity, DWORD currentTime) const
+{
+	return (currentTime - activity.lastSendTime) >= GetKeepAliveInterval();
+}
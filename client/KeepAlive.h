@@ -0,0 +1,43 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+
+const DWORD DefaultKeepAliveInterval = 15000;	// Milliseconds of silence before a keepalive, until an expiry is seen (half the shortest common NAT UDP timeout)
+const DWORD MinKeepAliveInterval = 3000;
+const DWORD MinMappingLifetime = 6000;			// Port changes after shorter silences are rebinding, not expiry
+const DWORD KeepAliveCheckInterval = 1000;		// Milliseconds between checks for silent paths
+
+
+// Last traffic each way on one path (to a player, or the game servers)
+struct PathActivity
+{
+	DWORD lastSendTime;
+	DWORD lastReceiveTime;
+
+	void Reset(DWORD currentTime)
+	{
+		lastSendTime = currentTime;
+		lastReceiveTime = currentTime;
+	}
+};
+
+
+// Shortest NAT mapping lifetime seen, and the keepalive interval it calls for
+// A mapping that was replaced (a new external port) after a silence lived at most that long.
+// Keepalives are sent at half the shortest such lifetime, so one lost keepalive doesn't let a mapping expire.
+class MappingLifetimeEstimate
+{
+public:
+	// Returns true if the estimate got shorter
+	bool OnMappingReplaced(DWORD silentTime);
+	void SetLifetime(DWORD lifetime);		// From the cache (0 = none seen)
+
+	DWORD GetLifetime() const;				// 0 if no mapping has expired yet
+	DWORD GetKeepAliveInterval() const;
+	bool IsKeepAliveDue(const PathActivity& activity, DWORD currentTime) const;
+
+private:
+	DWORD lifetime = 0;
+};
@@ -5,6 +5,7 @@ namespace op2ext {
 #include "op2ext.h"
 }
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <objbase.h>
 #include <iostream>
 #include <sstream>
@@ -22,6 +23,21 @@ std::string FormatAddress(const sockaddr_in& address)
 	return ss.str();
 }
 
+std::string FormatAddress(const NetAddress& address)
+{
+	if (!address.IsIPv6()) {
+		return FormatAddress(address.ipv4);
+	}
+
+	std::stringstream ss;
+
+	ss << "(AF:" << address.GetFamily() << ") ";
+	ss << "[" << FormatIPAddress(address) << "]";
+	ss << ":" << address.GetPort();
+
+	return ss.str();
+}
+
 std::string FormatIP4Address(unsigned long ip)
 {
 	std::stringstream ss;
@@ -34,6 +50,17 @@ std::string FormatIP4Address(unsigned long ip)
 	return ss.str();
 }
 
+std::string FormatIPAddress(const NetAddress& address)
+{
+	if (!address.IsIPv6()) {
+		return FormatIP4Address(address.ipv4.sin_addr.s_addr);
+	}
+
+	char buffer[INET6_ADDRSTRLEN] = "";
+	inet_ntop(AF_INET6, const_cast<in6_addr*>(&address.ipv6.sin6_addr), buffer, sizeof(buffer));
+	return buffer;
+}
+
 std::string FormatPlayerList(const std::array<PeerInfo, MaxRemotePlayers>& peerInfos)
 {
 	std::stringstream ss;
@@ -59,6 +86,46 @@ std::string FormatPlayerNetID(int playerNetID)
 	return ss.str();
 }
 
+std::string FormatConnectivityMatrix(const ConnectivityMatrix& connectivityMatrix)
+{
+	std::stringstream ss;
+
+	for (std::size_t row = 0; row < connectivityMatrix.size(); ++row)
+	{
+		ss << "\n " << row << ")";
+		for (std::size_t column = 0; column < connectivityMatrix[row].size(); ++column)
+		{
+			ss << " ";
+			if (row == column) {
+				ss << std::setw(5) << "*";
+			}
+			else if (connectivityMatrix[row][column] < 0) {
+				ss << std::setw(5) << "-";
+			}
+			else {
+				ss << std::setw(5) << connectivityMatrix[row][column];
+			}
+		}
+	}
+
+	return ss.str();
+}
+
+std::string FormatNatBehaviour(const NatBehaviour& natBehaviour)
+{
+	static const char* const mappingNames[] = { "Unknown", "None", "Endpoint-Independent", "Address-Dependent", "Address and Port-Dependent" };
+	static const char* const filteringNames[] = { "Unknown", "None", "Address-Dependent", "Address and Port-Dependent" };
+	static const char* const hairpinNames[] = { "Unknown", "Supported", "Unsupported" };
+
+	std::stringstream ss;
+
+	ss << "Mapping: " << mappingNames[static_cast<int>(natBehaviour.mapping)];
+	ss << ", Filtering: " << filteringNames[static_cast<int>(natBehaviour.filtering)];
+	ss << ", Hairpin: " << hairpinNames[static_cast<int>(natBehaviour.hairpin)];
+
+	return ss.str();
+}
+
 std::string FormatGuid(const GUID& guid)
 {
 	std::stringstream ss;
@@ -112,6 +179,23 @@ std::string FormatTransportLayerCommandIncludeIndex(TransportLayerCommand comman
 	return std::to_string(static_cast<int>(command)) +  " (" + FormatTransportLayerCommand(command) + ")";
 }
 
+std::string FormatTransportState(TransportState state)
+{
+	switch (state)
+	{
+	case TransportState::Idle:
+		return "Idle";
+	case TransportState::Hosting:
+		return "Hosting";
+	case TransportState::Joined:
+		return "Joined";
+	case TransportState::InGame:
+		return "In Game";
+	default:
+		return "Unknown Transport State";
+	}
+}
+
 std::string FormatPacket(const OP2Internal::Packet& packet)
 {
 	std::stringstream ss;
@@ -139,17 +223,37 @@ std::string FormatAddress(std::uintptr_t value)
 }
 
 
+namespace {
+	// The warm up and host name lookup threads log too, and op2ext's log is not thread safe
+	struct LogCriticalSection
+	{
+		LogCriticalSection() { InitializeCriticalSection(&criticalSection); }
+		~LogCriticalSection() { DeleteCriticalSection(&criticalSection); }
+
+		CRITICAL_SECTION criticalSection;
+	};
+
+	LogCriticalSection logCriticalSection;
+}
+
+
 void Log(const std::string& message)
 {
+	EnterCriticalSection(&logCriticalSection.criticalSection);
 	op2ext::Log(message.c_str());
+	LeaveCriticalSection(&logCriticalSection.criticalSection);
 }
 
 void LogError(const std::string& message)
 {
+	EnterCriticalSection(&logCriticalSection.criticalSection);
 	op2ext::LogError(message.c_str());
+	LeaveCriticalSection(&logCriticalSection.criticalSection);
 }
 
 void LogDebug(const std::string& message)
 {
+	EnterCriticalSection(&logCriticalSection.criticalSection);
 	op2ext::LogDebug(message.c_str());
+	LeaveCriticalSection(&logCriticalSection.criticalSection);
 }
@@ -16,12 +16,17 @@ namespace OP2Internal {
 
 
 std::string FormatAddress(const sockaddr_in& address);
+std::string FormatAddress(const NetAddress& address);
 std::string FormatIP4Address(unsigned long ip);
+std::string FormatIPAddress(const NetAddress& address);
 std::string FormatPlayerList(const std::array<PeerInfo, MaxRemotePlayers>& peerInfos);
 std::string FormatPlayerNetID(int playerNetID);
+std::string FormatConnectivityMatrix(const ConnectivityMatrix& connectivityMatrix);
+std::string FormatNatBehaviour(const NatBehaviour& natBehaviour);
 std::string FormatGuid(const GUID& guid);
 std::string FormatTransportLayerCommand(TransportLayerCommand command);
 std::string FormatTransportLayerCommandIncludeIndex(TransportLayerCommand command);
+std::string FormatTransportState(TransportState state);
 std::string FormatPacket(const OP2Internal::Packet& packet);
 std::string FormatAddress(void* value);
 std::string FormatAddress(std::uintptr_t value);
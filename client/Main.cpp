@@ -1,4 +1,7 @@
 #include "OPUNetGameProtocol.h"
+#include "NetFixSettings.h"
+#include "TransportWarmUp.h"
+#include "HostAddressCache.h"
 #include "Log.h"
 #include <OP2Internal.h>
 #define WIN32_LEAN_AND_MEAN
@@ -11,7 +14,6 @@ using namespace OP2Internal;
 HINSTANCE hInstance;
 OPUNetGameProtocol opuNetGameProtocol;
 char sectionName[64] = "";				// Ini file section name, for loading additional parameters
-const int DefaultProtocolIndex = 4;		// "SIGS"
 const std::uintptr_t ExpectedOutpost2Addr = 0x00400000;
 
 
@@ -55,9 +57,26 @@ extern "C" __declspec(dllexport) void InitMod(char* iniSectionName)
 	// Store the .ini section name
 	strncpy_s(sectionName, iniSectionName, sizeof(sectionName));
 
+	// Load the module settings once, so network code does not need to read the ini file
+	LoadNetFixSettings();
+
 	// Get multiplayer button index that NetFix will replace
-	int protocolIndex = config.GetInt(sectionName, "ProtocolIndex", DefaultProtocolIndex);
-	LogDebug("ProtocolIndex set to " + std::to_string(protocolIndex));
+	int protocolIndex = GetNetFixSettings().protocolIndex;
 	// Set a new multiplayer protocol type
 	protocolList[protocolIndex].netGameProtocol = &opuNetGameProtocol;
+
+	// Open the socket and search for games in the background, so the join window opens ready
+	if (GetNetFixSettings().warmStart != 0) {
+		transportWarmUp.Start();
+	}
+}
+
+// Called before the module is unloaded  (outside the loader lock, so threads can be waited on)
+extern "C" __declspec(dllexport) bool DestroyMod()
+{
+	// A warm up the join window never took over is stopped, and its port mapping removed
+	transportWarmUp.Discard();
+	// The warm up may have queued host name lookups, so the lookup thread is stopped after it
+	hostAddressCache.Shutdown();
+	return true;
 }
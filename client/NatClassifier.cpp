@@ -0,0 +1,279 @@
+#include "NatClassifier.h"
+#include "FileSystemHelper.h"
+#include "Log.h"
+#include <cstdio>
+#include <ctime>
+
+
+void NatClassifier::Start(const NetAddress& localAddress, int numMappingProbes, DWORD currentTime)
+{
+	bRunning = true;
+	startTime = currentTime;
+	this->localAddress = localAddress;
+	this->numMappingProbes = numMappingProbes;
+	mappingProbes.clear();
+	bFilteringBaseline = false;
+	bFilteringChangedPort = false;
+	bHairpinProbeSent = false;
+	bHairpinReceived = false;
+	behaviour = NatBehaviour{};
+}
+
+void NatClassifier::OnMappedAddress(const NetAddress& serverAddress, const NetAddress& mappedAddress)
+{
+	if (!bRunning) {
+		return;
+	}
+
+	// Retries are answered again, so only count each server port once
+	for (const MappingProbe& mappingProbe : mappingProbes)
+	{
+		if (mappingProbe.serverAddress == serverAddress) {
+			return;
+		}
+	}
+	mappingProbes.push_back(MappingProbe{ serverAddress, mappedAddress });
+}
+
+void NatClassifier::OnFilteringEcho(bool bChangedPort)
+{
+	if (bChangedPort) {
+		bFilteringChangedPort = true;
+	}
+	else {
+		bFilteringBaseline = true;
+	}
+}
+
+void NatClassifier::OnHairpinProbeSent()
+{
+	bHairpinProbeSent = true;
+}
+
+void NatClassifier::OnHairpin()
+{
+	bHairpinReceived = true;
+}
+
+bool NatClassifier::Update(DWORD currentTime)
+{
+	if (!bRunning) {
+		return false;
+	}
+
+	// Finish early once nothing more can change the result
+	const bool bMappingDone = static_cast<int>(mappingProbes.size()) >= numMappingProbes;
+	const bool bFilteringDone = bFilteringBaseline && bFilteringChangedPort;
+	const bool bHairpinDone = bHairpinReceived;
+	const bool bTimedOut = (currentTime - startTime) >= NatProbeTimeOut;
+	if (!bTimedOut && !(bMappingDone && bFilteringDone && bHairpinDone)) {
+		return false;
+	}
+
+	Classify(bTimedOut);
+	bRunning = false;
+	return true;
+}
+
+bool NatClassifier::IsRunning() const
+{
+	return bRunning;
+}
+
+const NatBehaviour& NatClassifier::GetBehaviour() const
+{
+	return behaviour;
+}
+
+const NetAddress& NatClassifier::GetPublicAddress() const
+{
+	static const NetAddress noAddress{};
+	return mappingProbes.empty() ? noAddress : mappingProbes.front().mappedAddress;
+}
+
+void NatClassifier::Classify(bool bTimedOut)
+{
+	behaviour.mapping = ClassifyMapping();
+
+	if (behaviour.mapping == NatMapping::None) {
+		behaviour.filtering = NatFiltering::None;
+	}
+	else if (bFilteringChangedPort) {
+		behaviour.filtering = NatFiltering::AddressDependent;
+	}
+	else if (bFilteringBaseline && bTimedOut) {
+		behaviour.filtering = NatFiltering::AddressPortDependent;
+	}
+	// Otherwise the server doesn't answer filtering probes
+
+	if (bHairpinReceived) {
+		behaviour.hairpin = NatHairpin::Supported;
+	}
+	else if (bHairpinProbeSent) {
+		behaviour.hairpin = NatHairpin::Unsupported;
+	}
+}
+
+NatMapping NatClassifier::ClassifyMapping() const
+{
+	if (mappingProbes.empty()) {
+		return NatMapping::Unknown;
+	}
+	if (localAddress.IsSet() && mappingProbes.front().mappedAddress == localAddress) {
+		return NatMapping::None;
+	}
+
+	// Compare each pair of server ports
+	bool bComparedPorts = false;
+	bool bComparedAddresses = false;
+	bool bAddressDependent = false;
+	for (std::size_t i = 0; i < mappingProbes.size(); ++i)
+	{
+		for (std::size_t j = i + 1; j < mappingProbes.size(); ++j)
+		{
+			NetAddress server1 = mappingProbes[i].serverAddress;
+			NetAddress server2 = mappingProbes[j].serverAddress;
+			const bool bSameMapping = (mappingProbes[i].mappedAddress == mappingProbes[j].mappedAddress);
+			server1.SetPort(0);
+			server2.SetPort(0);
+			if (server1 == server2)
+			{
+				// Same server IP, different port
+				if (!bSameMapping) {
+					return NatMapping::AddressPortDependent;
+				}
+				bComparedPorts = true;
+			}
+			else
+			{
+				bComparedAddresses = true;
+				bAddressDependent |= !bSameMapping;
+			}
+		}
+	}
+
+	if (bAddressDependent) {
+		return NatMapping::AddressDependent;
+	}
+	// Only one echo can't show anything
+	return (bComparedPorts || bComparedAddresses) ? NatMapping::EndpointIndependent : NatMapping::Unknown;
+}
+
+
+// Cache
+// -----
+
+namespace
+{
+	const char* const NatCacheFileName = "NetFixNatCache.ini";
+	const char* const NatCacheBehaviourSection = "NatBehaviour";
+	const char* const NatCachePublicAddressSection = "PublicAddress";
+	const char* const NatCacheMappingLifetimeSection = "MappingLifetime";
+
+	std::string GetNatCacheFilePath()
+	{
+		return GetOutpost2FilePath(NatCacheFileName);
+	}
+
+	std::string GetBehaviourKey(const NetAddress& localAddress, const NetAddress& publicAddress)
+	{
+		return FormatIPAddress(localAddress) + "/" + FormatIPAddress(publicAddress);
+	}
+}
+
+bool LoadNatBehaviour(const NetAddress& localAddress, NatBehaviour& behaviour)
+{
+	char publicAddressString[64];
+	GetPrivateProfileString(NatCachePublicAddressSection, FormatIPAddress(localAddress).c_str(), "",
+		publicAddressString, sizeof(publicAddressString), GetNatCacheFilePath().c_str());
+
+	NetAddress publicAddress;
+	if (!ParseIPAddress(publicAddressString, publicAddress)) {
+		return false;
+	}
+	return LoadNatBehaviour(localAddress, publicAddress, behaviour);
+}
+
+bool LoadNatBehaviour(const NetAddress& localAddress, const NetAddress& publicAddress, NatBehaviour& behaviour)
+{
+	if (!localAddress.IsSet() || !publicAddress.IsSet()) {
+		return false;
+	}
+
+	char value[64];
+	GetPrivateProfileString(NatCacheBehaviourSection, GetBehaviourKey(localAddress, publicAddress).c_str(), "",
+		value, sizeof(value), GetNatCacheFilePath().c_str());
+
+	int mapping;
+	int filtering;
+	int hairpin;
+	long long savedTime;
+	if (std::sscanf(value, "%d %d %d %lld", &mapping, &filtering, &hairpin, &savedTime) != 4) {
+		return false;
+	}
+	// Routers get replaced and reconfigured, so old results are measured again
+	const long long age = static_cast<long long>(std::time(nullptr)) - savedTime;
+	if (age < 0 || age > NatCacheMaxAge) {
+		return false;
+	}
+	if (mapping > static_cast<int>(NatMapping::AddressPortDependent) || filtering > static_cast<int>(NatFiltering::AddressPortDependent) ||
+		hairpin > static_cast<int>(NatHairpin::Unsupported) || mapping < 0 || filtering < 0 || hairpin < 0)
+	{
+		return false;
+	}
+
+	behaviour.mapping = static_cast<NatMapping>(mapping);
+	behaviour.filtering = static_cast<NatFiltering>(filtering);
+	behaviour.hairpin = static_cast<NatHairpin>(hairpin);
+	return behaviour.IsKnown();
+}
+
+void SaveNatBehaviour(const NetAddress& localAddress, const NetAddress& publicAddress, const NatBehaviour& behaviour)
+{
+	if (!localAddress.IsSet() || !publicAddress.IsSet() || !behaviour.IsKnown()) {
+		return;
+	}
+
+	const std::string filePath = GetNatCacheFilePath();
+	const std::string value = std::to_string(static_cast<int>(behaviour.mapping)) + " " +
+		std::to_string(static_cast<int>(behaviour.filtering)) + " " +
+		std::to_string(static_cast<int>(behaviour.hairpin)) + " " +
+		std::to_string(static_cast<long long>(std::time(nullptr)));
+
+	WritePrivateProfileString(NatCacheBehaviourSection, GetBehaviourKey(localAddress, publicAddress).c_str(), value.c_str(), filePath.c_str());
+	WritePrivateProfileString(NatCachePublicAddressSection, FormatIPAddress(localAddress).c_str(), FormatIPAddress(publicAddress).c_str(), filePath.c_str());
+}
+
+bool LoadMappingLifetime(const NetAddress& localAddress, DWORD& lifetime)
+{
+	if (!localAddress.IsSet()) {
+		return false;
+	}
+
+	char value[64];
+	GetPrivateProfileString(NatCacheMappingLifetimeSection, FormatIPAddress(localAddress).c_str(), "",
+		value, sizeof(value), GetNatCacheFilePath().c_str());
+
+	unsigned long savedLifetime;
+	long long savedTime;
+	if (std::sscanf(value, "%lu %lld", &savedLifetime, &savedTime) != 2 || savedLifetime == 0) {
+		return false;
+	}
+	const long long age = static_cast<long long>(std::time(nullptr)) - savedTime;
+	if (age < 0 || age > NatCacheMaxAge) {
+		return false;
+	}
+
+	lifetime = static_cast<DWORD>(savedLifetime);
+	return true;
+}
+
+void SaveMappingLifetime(const NetAddress& localAddress, DWORD lifetime)
+{
+	if (!localAddress.IsSet() || lifetime == 0) {
+		return;
+	}
+
+	const std::string value = std::to_string(lifetime) + " " + std::to_string(static_cast<long long>(std::time(nullptr)));
+	WritePrivateProfileString(NatCacheMappingLifetimeSection, FormatIPAddress(localAddress).c_str(), value.c_str(), GetNatCacheFilePath().c_str());
+}
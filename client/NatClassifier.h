@@ -0,0 +1,108 @@
+#pragma once
+
+#include "NetAddress.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <string>
+#include <vector>
+
+
+const DWORD NatProbeTimeOut = 2000;				// Milliseconds to wait for probe replies, from the first probe
+const unsigned int NatCacheMaxAge = 7 * 24 * 60 * 60;	// Seconds a cached classification is trusted
+
+
+// How the NAT picks the external address for a local socket
+enum class NatMapping : unsigned char
+{
+	Unknown,
+	None,					// No NAT (the server saw the local address)
+	EndpointIndependent,	// Same external address for every destination
+	AddressDependent,		// Different external address for each destination IP
+	AddressPortDependent,	// Different external address for each destination IP and port ("symmetric" NAT)
+};
+
+// Which packets the NAT lets in to an external address
+enum class NatFiltering : unsigned char
+{
+	Unknown,
+	None,					// No NAT
+	AddressDependent,		// From any port of an address that was sent to (or less restrictive)
+	AddressPortDependent,	// Only from the exact address and port that was sent to
+};
+
+// Whether packets sent to our own external address are looped back in
+enum class NatHairpin : unsigned char
+{
+	Unknown,
+	Supported,
+	Unsupported,
+};
+
+struct NatBehaviour
+{
+	NatMapping mapping = NatMapping::Unknown;
+	NatFiltering filtering = NatFiltering::Unknown;
+	NatHairpin hairpin = NatHairpin::Unknown;
+
+	bool IsKnown() const
+	{
+		return mapping != NatMapping::Unknown;
+	}
+};
+
+
+// Classifies NAT behaviour from game server echoes
+// Mapping: The external address each game server port saw for the same local socket.
+// Filtering: A separate probe socket asks the game server to echo from its other port as well.
+// Hairpin: The main socket sends to the probe socket's external address.
+// All probes are sent at once. Results are final once every reply arrives, or at the time out.
+class NatClassifier
+{
+public:
+	// localAddress: Interface address and port of the main socket
+	// numMappingProbes: Echoes expected for the main socket (two per game server)
+	void Start(const NetAddress& localAddress, int numMappingProbes, DWORD currentTime);
+
+	void OnMappedAddress(const NetAddress& serverAddress, const NetAddress& mappedAddress);
+	void OnFilteringEcho(bool bChangedPort);
+	void OnHairpinProbeSent();
+	void OnHairpin();
+
+	// Returns true when the classification finishes
+	bool Update(DWORD currentTime);
+
+	bool IsRunning() const;
+	const NatBehaviour& GetBehaviour() const;
+	const NetAddress& GetPublicAddress() const;		// Set once any echo has arrived
+
+private:
+	struct MappingProbe
+	{
+		NetAddress serverAddress;
+		NetAddress mappedAddress;
+	};
+
+	void Classify(bool bTimedOut);
+	NatMapping ClassifyMapping() const;
+
+	bool bRunning = false;
+	DWORD startTime = 0;
+	NetAddress localAddress;
+	int numMappingProbes = 0;
+	std::vector<MappingProbe> mappingProbes;
+	bool bFilteringBaseline = false;		// The probe socket's echo from the port it sent to
+	bool bFilteringChangedPort = false;		// The probe socket's echo from the other port
+	bool bHairpinProbeSent = false;
+	bool bHairpinReceived = false;
+	NatBehaviour behaviour;
+};
+
+
+// Classifications are cached on disk, keyed by the local interface and public IP address
+// The last public IP of each interface is kept too, so a cached result can be shown before any echo arrives.
+bool LoadNatBehaviour(const NetAddress& localAddress, NatBehaviour& behaviour);
+bool LoadNatBehaviour(const NetAddress& localAddress, const NetAddress& publicAddress, NatBehaviour& behaviour);
+void SaveNatBehaviour(const NetAddress& localAddress, const NetAddress& publicAddress, const NatBehaviour& behaviour);
+// Shortest NAT mapping lifetime seen from each interface (milliseconds), so keepalives start at the right interval
+bool LoadMappingLifetime(const NetAddress& localAddress, DWORD& lifetime);
+void SaveMappingLifetime(const NetAddress& localAddress, DWORD lifetime);
@@ -0,0 +1,256 @@
+#include "NetAddress.h"
+#include <iphlpapi.h>
+#include <cstring>
+
+
+// Any routable global IPv6 address will do. Nothing is sent to it.
+const char* const IPv6RouteProbeAddress = "2001:4860:4860::8888";
+
+
+NetAddress NetAddress::FromIPv4(const sockaddr_in& address)
+{
+	NetAddress netAddress;
+	netAddress.Clear();
+	netAddress.ipv4.sin_family = AF_INET;
+	netAddress.ipv4.sin_port = address.sin_port;
+	netAddress.ipv4.sin_addr = address.sin_addr;
+	return netAddress;
+}
+
+NetAddress NetAddress::FromIPv4(unsigned long ip, Port networkOrderPort)
+{
+	NetAddress netAddress;
+	netAddress.Clear();
+	netAddress.ipv4.sin_family = AF_INET;
+	netAddress.ipv4.sin_port = networkOrderPort;
+	netAddress.ipv4.sin_addr.s_addr = ip;
+	return netAddress;
+}
+
+NetAddress NetAddress::FromSocketAddress(const sockaddr* address, int addressLength)
+{
+	NetAddress netAddress;
+	netAddress.Clear();
+
+	if (address->sa_family == AF_INET && addressLength >= static_cast<int>(sizeof(sockaddr_in)))
+	{
+		return FromIPv4(*reinterpret_cast<const sockaddr_in*>(address));
+	}
+
+	if (address->sa_family == AF_INET6 && addressLength >= static_cast<int>(sizeof(sockaddr_in6)))
+	{
+		const sockaddr_in6& address6 = *reinterpret_cast<const sockaddr_in6*>(address);
+		const unsigned char* bytes = address6.sin6_addr.s6_addr;
+
+		// Check for an IPv4-mapped address (::ffff:a.b.c.d)
+		const unsigned char mappedPrefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+		if (std::memcmp(bytes, mappedPrefix, sizeof(mappedPrefix)) == 0)
+		{
+			unsigned long ip;
+			std::memcpy(&ip, &bytes[12], sizeof(ip));
+			return FromIPv4(ip, address6.sin6_port);
+		}
+
+		netAddress.ipv6 = address6;
+	}
+
+	return netAddress;
+}
+
+
+void NetAddress::Clear()
+{
+	std::memset(this, 0, sizeof(*this));
+}
+
+bool NetAddress::IsIPv4() const
+{
+	return ipv4.sin_family == AF_INET;
+}
+
+bool NetAddress::IsIPv6() const
+{
+	return ipv6.sin6_family == AF_INET6;
+}
+
+bool NetAddress::IsSet() const
+{
+	if (IsIPv4()) {
+		return ipv4.sin_addr.s_addr != INADDR_ANY;
+	}
+	if (IsIPv6())
+	{
+		const unsigned char zero[sizeof(ipv6.sin6_addr)] = {};
+		return std::memcmp(&ipv6.sin6_addr, zero, sizeof(zero)) != 0;
+	}
+	return false;
+}
+
+int NetAddress::GetFamily() const
+{
+	return ipv4.sin_family;
+}
+
+Port NetAddress::GetPort() const
+{
+	// sin_port and sin6_port share the same offset
+	return ntohs(IsIPv6() ? ipv6.sin6_port : ipv4.sin_port);
+}
+
+void NetAddress::SetPort(Port port)
+{
+	if (IsIPv6()) {
+		ipv6.sin6_port = htons(port);
+	}
+	else {
+		ipv4.sin_port = htons(port);
+	}
+}
+
+const sockaddr* NetAddress::GetSocketAddress() const
+{
+	return reinterpret_cast<const sockaddr*>(&ipv4);
+}
+
+int NetAddress::GetSocketAddressLength() const
+{
+	return IsIPv6() ? sizeof(ipv6) : sizeof(ipv4);
+}
+
+bool NetAddress::operator==(const NetAddress& other) const
+{
+	if (GetFamily() != other.GetFamily()) {
+		return false;
+	}
+
+	if (IsIPv6())
+	{
+		return (ipv6.sin6_port == other.ipv6.sin6_port) &&
+			(std::memcmp(&ipv6.sin6_addr, &other.ipv6.sin6_addr, sizeof(ipv6.sin6_addr)) == 0) &&
+			(ipv6.sin6_scope_id == other.ipv6.sin6_scope_id);
+	}
+
+	return (ipv4.sin_port == other.ipv4.sin_port) && (ipv4.sin_addr.s_addr == other.ipv4.sin_addr.s_addr);
+}
+
+bool NetAddress::operator!=(const NetAddress& other) const
+{
+	return !(*this == other);
+}
+
+bool NetAddress::IsSameIP(const NetAddress& other) const
+{
+	NetAddress otherWithPort = other;
+	otherWithPort.SetPort(GetPort());
+	return *this == otherWithPort;
+}
+
+
+bool ParseIPAddress(const char* addressString, NetAddress& address)
+{
+	address.Clear();
+
+	// Check for an IPv4 dotted quad
+	in_addr ip4;
+	if (inet_pton(AF_INET, addressString, &ip4) == 1)
+	{
+		address.ipv4.sin_family = AF_INET;
+		address.ipv4.sin_addr = ip4;
+		return true;
+	}
+
+	// Check for an IPv6 address
+	in6_addr ip6;
+	if (inet_pton(AF_INET6, addressString, &ip6) == 1)
+	{
+		address.ipv6.sin6_family = AF_INET6;
+		address.ipv6.sin6_addr = ip6;
+		// Normalize IPv4-mapped addresses
+		address = NetAddress::FromSocketAddress(reinterpret_cast<const sockaddr*>(&address.ipv6), sizeof(address.ipv6));
+		return true;
+	}
+
+	return false;
+}
+
+bool GetLocalIPv6Address(NetAddress& address)
+{
+	NetAddress probeAddress;
+	return ParseIPAddress(IPv6RouteProbeAddress, probeAddress) && GetLocalInterfaceAddress(probeAddress, address) && address.IsIPv6();
+}
+
+std::vector<in_addr> GetLocalIPv4Addresses()
+{
+	std::vector<in_addr> addresses;
+
+	// Looking up our own host name returns the interface addresses, without a DNS query
+	char hostName[256];
+	if (gethostname(hostName, sizeof(hostName)) != 0) {
+		return addresses;
+	}
+
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	addrinfo* result = nullptr;
+	if (getaddrinfo(hostName, nullptr, &hints, &result) != 0) {
+		return addresses;
+	}
+
+	for (addrinfo* info = result; info != nullptr; info = info->ai_next)
+	{
+		const in_addr address = reinterpret_cast<sockaddr_in*>(info->ai_addr)->sin_addr;
+		// Skip loopback (127.x.x.x)
+		if ((ntohl(address.s_addr) >> 24) == 127) {
+			continue;
+		}
+		addresses.push_back(address);
+	}
+
+	freeaddrinfo(result);
+	return addresses;
+}
+
+bool GetLocalInterfaceAddress(const NetAddress& destination, NetAddress& address)
+{
+	SOCKET routeSocket = socket(destination.GetFamily(), SOCK_DGRAM, IPPROTO_UDP);
+	if (routeSocket == INVALID_SOCKET) {
+		return false;
+	}
+
+	// Connecting needs a port, even though nothing is sent
+	NetAddress routeDestination = destination;
+	if (routeDestination.GetPort() == 0) {
+		routeDestination.SetPort(9);	// Discard
+	}
+
+	// Connecting a UDP socket only picks the route (nothing is sent), which binds it to that interface's address
+	sockaddr_storage localStorage;
+	int localLength = sizeof(localStorage);
+	const bool bSuccess = connect(routeSocket, routeDestination.GetSocketAddress(), routeDestination.GetSocketAddressLength()) != SOCKET_ERROR &&
+		getsockname(routeSocket, reinterpret_cast<sockaddr*>(&localStorage), &localLength) != SOCKET_ERROR;
+	closesocket(routeSocket);
+
+	if (bSuccess)
+	{
+		address = NetAddress::FromSocketAddress(reinterpret_cast<sockaddr*>(&localStorage), localLength);
+		address.SetPort(0);
+	}
+	return bSuccess && address.IsSet();
+}
+
+bool GetDefaultGateway(NetAddress& gateway)
+{
+	in_addr destination;
+	inet_pton(AF_INET, DefaultRouteProbeAddress, &destination);
+
+	MIB_IPFORWARDROW route;
+	if (GetBestRoute(destination.s_addr, 0, &route) != NO_ERROR || route.dwForwardNextHop == 0) {
+		return false;
+	}
+
+	gateway = NetAddress::FromIPv4(route.dwForwardNextHop, 0);
+	return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <string>
+#include <vector>
+
+// Type alias to handle different type names used by winsock and POSIX socket implementations
+#ifdef WIN32
+using Port = u_short;
+#else
+using Port = in_port_t;
+#endif
+
+
+// Socket address of either family (IPv4 or IPv6)
+// IPv4-mapped IPv6 addresses are stored as plain IPv4, so an address compares equal however it was received.
+// Plain data, so it can be memset and copied like the sockaddr_in it replaces.
+struct NetAddress
+{
+	union
+	{
+		sockaddr_in ipv4;
+		sockaddr_in6 ipv6;
+	};
+
+	static NetAddress FromIPv4(const sockaddr_in& address);
+	static NetAddress FromIPv4(unsigned long ip, Port networkOrderPort);
+	static NetAddress FromSocketAddress(const sockaddr* address, int addressLength);
+
+	void Clear();
+	bool IsIPv4() const;
+	bool IsIPv6() const;
+	bool IsSet() const;		// Has a non-zero IP address
+	int GetFamily() const;
+	Port GetPort() const;	// Host byte order
+	void SetPort(Port port);	// Host byte order
+	bool IsSameIP(const NetAddress& other) const;	// Ignores the port
+	const sockaddr* GetSocketAddress() const;
+	int GetSocketAddressLength() const;
+
+	bool operator==(const NetAddress& other) const;
+	bool operator!=(const NetAddress& other) const;
+};
+
+// Any address beyond the LAN picks the default route (TEST-NET-2, so nothing is ever sent to it)
+const char* const DefaultRouteProbeAddress = "198.51.100.1";
+
+
+// Parse an IP literal (IPv4 dotted quad or IPv6, without brackets). Port is left at 0.
+bool ParseIPAddress(const char* addressString, NetAddress& address);
+// Try to find a global IPv6 address of this machine, which other players could use to reach us
+bool GetLocalIPv6Address(NetAddress& address);
+// IPv4 addresses of this machine's network interfaces (excluding loopback)
+std::vector<in_addr> GetLocalIPv4Addresses();
+// Address of the interface the routing table picks to reach destination (port 0)
+bool GetLocalInterfaceAddress(const NetAddress& destination, NetAddress& address);
+// Next hop of the IPv4 default route (the local router)
+bool GetDefaultGateway(NetAddress& gateway);
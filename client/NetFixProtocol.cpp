@@ -0,0 +1,59 @@
+#include "NetFixProtocol.h"
+#include "NetFixSettings.h"
+#include <cstring>
+
+
+unsigned int GetLocalNetFixCapabilities()
+{
+	unsigned int capabilities = NetFixCapability::IPv6 | NetFixCapability::Relay | NetFixCapability::Punch;
+	if (GetNetFixSettings().parityGroupSize > 0) {
+		capabilities |= NetFixCapability::Parity;
+	}
+	if (GetNetFixSettings().compressionThreshold > 0) {
+		capabilities |= NetFixCapability::Compression;
+	}
+	return capabilities;
+}
+
+
+NetFixAddress ToNetFixAddress(const NetAddress& address)
+{
+	NetFixAddress netFixAddress;
+	std::memset(&netFixAddress, 0, sizeof(netFixAddress));
+
+	if (address.IsIPv4())
+	{
+		netFixAddress.family = 4;
+		netFixAddress.port = address.ipv4.sin_port;
+		std::memcpy(netFixAddress.ip, &address.ipv4.sin_addr, sizeof(address.ipv4.sin_addr));
+	}
+	else if (address.IsIPv6())
+	{
+		netFixAddress.family = 6;
+		netFixAddress.port = address.ipv6.sin6_port;
+		std::memcpy(netFixAddress.ip, &address.ipv6.sin6_addr, sizeof(address.ipv6.sin6_addr));
+	}
+
+	return netFixAddress;
+}
+
+NetAddress FromNetFixAddress(const NetFixAddress& netFixAddress)
+{
+	NetAddress address;
+	address.Clear();
+
+	if (netFixAddress.family == 4)
+	{
+		address.ipv4.sin_family = AF_INET;
+		address.ipv4.sin_port = netFixAddress.port;
+		std::memcpy(&address.ipv4.sin_addr, netFixAddress.ip, sizeof(address.ipv4.sin_addr));
+	}
+	else if (netFixAddress.family == 6)
+	{
+		address.ipv6.sin6_family = AF_INET6;
+		address.ipv6.sin6_port = netFixAddress.port;
+		std::memcpy(&address.ipv6.sin6_addr, netFixAddress.ip, sizeof(address.ipv6.sin6_addr));
+	}
+
+	return address;
+}
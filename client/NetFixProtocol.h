@@ -0,0 +1,326 @@
+#pragma once
+
+// NetFix protocol extensions
+// ---------------------------
+// Extension messages are transport layer messages (packet type 1) using command numbers above
+// those used by Outpost 2 and the NetFixServer. They are addressed to NetFixMessageDestPlayerNetID,
+// which no player can have, so older clients discard them after immediate processing.
+// Anything beyond Hello is only sent to peers that announced support for it in a Hello message.
+
+#include "OPUNetTransportLayer.h"
+#include "NetAddress.h"
+#include <OP2Internal.h>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+
+using namespace OP2Internal;
+
+
+const int NetFixProtocolVersion = 1;
+// Player index 7 is never used, so this never matches a real playerNetID
+const int NetFixMessageDestPlayerNetID = -1;
+
+enum class NetFixCommand : int
+{
+	Hello = 64,
+	PeerAddressList = 65,
+	Parity = 66,
+	Compressed = 67,
+	Relay = 68,
+	PathProbe = 69,
+	PeerTable = 70,
+	Punch = 71,
+	PunchReport = 72,
+	NatProbe = 73,
+	KeepAlive = 74,
+	PeerCandidates = 75,
+	GameListSubscribe = 76,
+	GameListEvent = 77,
+	SearchBatch = 78,
+	JoinPrepare = 79,
+	SearchOptions = 80,
+};
+
+// Capability bits announced in Hello
+namespace NetFixCapability
+{
+	const unsigned int IPv6 = 1 << 0;
+	const unsigned int Parity = 1 << 1;		// Sends and accepts parity for in game packets
+	const unsigned int Compression = 1 << 2;	// Sends and accepts compressed packets
+	const unsigned int Relay = 1 << 3;			// Answers path probes, and accepts packets relayed by a game server
+	const unsigned int Punch = 1 << 4;			// Opens paths to other players before the game starts
+}
+
+// Option bits sent with search queries  (see NetFixSearchOptions)
+namespace NetFixSearchFlag
+{
+	const unsigned int BatchedReplies = 1 << 0;	// Accepts NetFixSearchBatch replies
+}
+
+// Capabilities announced to other players  (depends on settings)
+unsigned int GetLocalNetFixCapabilities();
+
+
+inline TransportLayerCommand ToTransportLayerCommand(NetFixCommand command)
+{
+	return static_cast<TransportLayerCommand>(command);
+}
+
+inline bool IsNetFixCommand(TransportLayerCommand command)
+{
+	return static_cast<int>(command) >= static_cast<int>(NetFixCommand::Hello);
+}
+
+
+#pragma pack(push, 1)
+
+// Address of either family, in a fixed size wire format
+struct NetFixAddress
+{
+	std::uint8_t family;		// 0 = None, 4 = IPv4, 6 = IPv6
+	std::uint8_t reserved;
+	std::uint16_t port;			// Network byte order
+	std::uint8_t ip[16];		// IPv4 addresses use the first 4 bytes
+};
+
+struct NetFixHello
+{
+	TransportLayerCommand commandType;
+	std::int32_t protocolVersion;
+	std::uint32_t capabilities;
+	std::uint8_t bReply;			// Replies are never answered
+	NetFixAddress ipv6Address;		// Where the sender can be reached over IPv6 (if anywhere)
+	NetFixAddress localAddress;		// Sender's IPv4 address and port on its own network (before any NAT)
+};
+
+struct NetFixPeerEntry
+{
+	std::uint32_t capabilities;
+	NetFixAddress ipv6Address;
+};
+
+// Sent by the host before SetPlayersList, with details the original PlayersList can not hold
+struct NetFixPeerAddressList
+{
+	TransportLayerCommand commandType;
+	NetFixPeerEntry peers[MaxRemotePlayers];
+};
+
+// Appended (after the payload) to in game packets covered by parity
+// Older clients ignore bytes beyond the payload.
+struct NetFixParityTrailer
+{
+	std::uint16_t marker;		// ParityTrailerMarker
+	std::uint16_t sequence;		// Per peer, counting covered packets
+};
+
+// XOR of a group of consecutive covered packets, sent to the same peer after the last of them
+// A receiver missing exactly one packet of the group can rebuild it.
+struct NetFixParity
+{
+	TransportLayerCommand commandType;
+	std::uint16_t firstSequence;
+	std::uint8_t count;
+	std::uint8_t reserved;
+	std::uint16_t sizeXor;		// XOR of the covered packet sizes (header and payload)
+	std::uint8_t data[1];		// XOR of the covered packets (header and payload), as long as the largest of them
+};
+
+// A packet with its payload compressed (PacketCompression.h)
+// The receiver rebuilds the original packet, and processes it as if it had arrived that way.
+struct NetFixCompressed
+{
+	TransportLayerCommand commandType;
+	std::int32_t sourcePlayerNetID;		// Original packet header
+	std::int32_t destPlayerNetID;
+	std::uint8_t type;
+	std::uint8_t sizeOfPayload;			// Before compression
+	std::uint8_t data[1];				// Compressed payload
+};
+
+// A packet for another player, sent through a game server acting as a relay
+// To the relay, address is where to forward it. The relay replaces it with the sender's address.
+struct NetFixRelay
+{
+	TransportLayerCommand commandType;
+	NetFixAddress address;
+	std::uint8_t data[1];				// The packet (header, payload and any trailer)
+};
+
+// Round trip time probe, sent over the direct path and through the relay
+struct NetFixPathProbe
+{
+	TransportLayerCommand commandType;
+	std::uint32_t timeStamp;			// Echoed in the reply
+	std::uint8_t path;					// PathSelector::Path the probe was sent over (the reply uses the same path)
+	std::uint8_t bReply;
+};
+
+struct NetFixPeerTableEntry
+{
+	std::int32_t playerNetID;			// 0 = Empty slot
+	std::uint32_t capabilities;
+	NetFixAddress address;				// As seen by the host
+};
+
+// Sent by the host to each joined player (repeatedly, until the game starts), so players can open paths to each other
+struct NetFixPeerTable
+{
+	TransportLayerCommand commandType;
+	NetFixPeerTableEntry peers[MaxRemotePlayers];
+};
+
+// Hole punching probe between two joined players. Replies go to where the probe came from.
+struct NetFixPunch
+{
+	TransportLayerCommand commandType;
+	std::uint32_t timeStamp;			// Echoed in the reply
+	std::uint8_t bReply;
+};
+
+// Sent by each joined player to the host: round trip time to every other player
+struct NetFixPunchReport
+{
+	TransportLayerCommand commandType;
+	std::int32_t roundTripTimes[MaxRemotePlayers];	// Milliseconds, by player index (-1 = not reachable)
+};
+
+// Sent to a game server from a separate socket, to test NAT filtering: the server echoes the address it saw
+// (EchoExternalAddress) from the port it was sent to, and with bChangePort, also from its other port.
+// Also sent to our own external address, to test hairpinning.
+struct NetFixNatProbe
+{
+	TransportLayerCommand commandType;
+	std::uint32_t nonce;
+	std::uint8_t bChangePort;
+};
+
+// Sent by the host with the peer table: the local address of each other player behind the same public IP as the receiver
+// Players punch these along with the public address, and keep whichever answers first.
+struct NetFixPeerCandidates
+{
+	TransportLayerCommand commandType;
+	NetFixAddress localAddresses[MaxRemotePlayers];		// By player index (family 0 = none)
+};
+
+// Sent to players and game servers after a silence, so NAT mappings don't expire before the game starts. Never answered.
+struct NetFixKeepAlive
+{
+	TransportLayerCommand commandType;
+};
+
+// Sent to a game server to have changes to its game list pushed, instead of searching it every few seconds
+// Renewed before the server forgets the subscription (and to keep the NAT mapping open for the pushes).
+struct NetFixGameListSubscribe
+{
+	TransportLayerCommand commandType;
+	GUID gameIdentifier;
+	std::uint32_t sequence;				// Last change applied (0 asks for the full list)
+	std::uint32_t timeStamp;			// Echoed in the reply
+	std::uint8_t bUnsubscribe;
+};
+
+enum class NetFixGameListEventType : std::uint8_t
+{
+	Snapshot,		// One game of the full list: the reply to a subscription, or a renewal that was behind
+	Added,
+	Updated,
+	Removed,		// Only the game's session identifier is set
+	Sync,			// Reply to a renewal that was up to date (no game)
+};
+
+// Sent by a game server to each subscriber
+// Changes are numbered in sequence, so a subscriber that misses one asks for the full list again.
+struct NetFixGameListEvent
+{
+	TransportLayerCommand commandType;
+	std::uint32_t sequence;				// Game list version, after this change
+	std::uint32_t timeStamp;			// Snapshot and Sync: echoed from the request (0 for pushed changes)
+	NetFixGameListEventType eventType;
+	std::uint16_t index;				// Snapshot: position of this game in the list
+	std::uint16_t count;				// Snapshot: games in the list  (an empty list is a single event with count 0)
+	HostedGameSearchReply game;			// As a search reply would have it, with the host address filled in
+};
+
+// Sent to a game server just before a search query, asking for its replies in another form
+// Servers remember the options for the sender's address a while; older ones ignore the message and reply as usual.
+struct NetFixSearchOptions
+{
+	TransportLayerCommand commandType;
+	std::uint32_t flags;		// NetFixSearchFlag
+};
+
+struct NetFixSearchBatchEntry
+{
+	GUID sessionIdentifier;
+	CreateGameInfo createGameInfo;
+	sockaddr_in hostAddress;
+};
+
+// Game server reply to a search query that asked for BatchedReplies: several games in place of one HostedGameSearchReply each
+// Only count entries are sent. A list longer than one batch is sent in several.
+const std::size_t MaxSearchBatchEntries = 4;
+struct NetFixSearchBatch
+{
+	TransportLayerCommand commandType;
+	GUID gameIdentifier;
+	std::uint32_t timeStamp;			// Echoed from the query
+	std::uint8_t count;
+	NetFixSearchBatchEntry entries[MaxSearchBatchEntries];
+};
+
+// Sent to the game servers when a game is selected in the lobby, before the join is requested
+// A server sends the host a JoinHelpRequest, as it would for a JoinRequest, so the host opens a path back to us early.
+struct NetFixJoinPrepare
+{
+	TransportLayerCommand commandType;
+	GUID sessionIdentifier;
+	int returnPortNum;					// As in JoinRequest
+};
+
+#pragma pack(pop)
+
+const std::uint16_t ParityTrailerMarker = 0x5046;		// "FP"
+
+
+// Largest payload a packet can carry (limited by both the packet buffer and the header's size field)
+constexpr std::size_t MaxPacketPayloadSize = std::min<std::size_t>(
+	sizeof(Packet) - sizeof(PacketHeader),
+	std::numeric_limits<decltype(PacketHeader::sizeOfPayload)>::max());
+
+static_assert(sizeof(NetFixHello) <= MaxPacketPayloadSize, "NetFixHello does not fit in a packet");
+static_assert(sizeof(NetFixPeerAddressList) <= MaxPacketPayloadSize, "NetFixPeerAddressList does not fit in a packet");
+
+// Largest packet (header and payload) parity can cover
+constexpr std::size_t MaxParityDataSize = MaxPacketPayloadSize - offsetof(NetFixParity, data);
+static_assert(MaxParityDataSize > sizeof(PacketHeader), "NetFixParity can not cover any packet");
+
+// Largest compressed payload a NetFixCompressed message can carry
+constexpr std::size_t MaxCompressedDataSize = MaxPacketPayloadSize - offsetof(NetFixCompressed, data);
+// Largest packet (header, payload and any trailer) that can be relayed
+constexpr std::size_t MaxRelayDataSize = MaxPacketPayloadSize - offsetof(NetFixRelay, data);
+static_assert(sizeof(NetFixPathProbe) <= MaxPacketPayloadSize, "NetFixPathProbe does not fit in a packet");
+static_assert(sizeof(NetFixPeerTable) <= MaxPacketPayloadSize, "NetFixPeerTable does not fit in a packet");
+static_assert(sizeof(NetFixPunchReport) <= MaxPacketPayloadSize, "NetFixPunchReport does not fit in a packet");
+static_assert(sizeof(NetFixPeerCandidates) <= MaxPacketPayloadSize, "NetFixPeerCandidates does not fit in a packet");
+static_assert(sizeof(NetFixGameListEvent) <= MaxPacketPayloadSize, "NetFixGameListEvent does not fit in a packet");
+static_assert(sizeof(NetFixSearchBatch) <= MaxPacketPayloadSize, "NetFixSearchBatch does not fit in a packet");
+
+
+NetFixAddress ToNetFixAddress(const NetAddress& address);
+NetAddress FromNetFixAddress(const NetFixAddress& address);
+
+// Extension messages are overlaid on the packet's transport layer message
+template <typename MessageType>
+MessageType& GetNetFixMessage(Packet& packet)
+{
+	return reinterpret_cast<MessageType&>(packet.tlMessage);
+}
+
+template <typename MessageType>
+const MessageType& GetNetFixMessage(const Packet& packet)
+{
+	return reinterpret_cast<const MessageType&>(packet.tlMessage);
+}
@@ -0,0 +1,126 @@
+#include "NetFixSettings.h"
+#include "FileSystemHelper.h"
+#include "OPUNetTransportLayer.h"
+#include "Log.h"
+#include <OP2Internal.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <algorithm>
+
+using namespace OP2Internal;
+
+extern char sectionName[];
+
+const int DefaultProtocolIndex = 4;		// "SIGS"
+const int DefaultLanBroadcastInterval = 4;
+const int DefaultParityGroupSize = 0;		// Off
+const int DefaultCompressionThreshold = 64;	// Bytes of payload
+const int DefaultPortMapping = 1;			// On
+const int DefaultGameListSubscription = 1;	// On
+const int DefaultWarmStart = 0;				// Off
+
+
+namespace {
+	NetFixSettings settings{ DefaultProtocolIndex, "", {}, DefaultClientPort, DefaultClientPort, 0, DefaultLanBroadcastInterval, DefaultParityGroupSize, DefaultCompressionThreshold, DefaultPortMapping, "", DefaultGameListSubscription, DefaultWarmStart };
+	FILETIME iniFileWriteTime = {};
+
+	// Split a comma (or semicolon) separated list, dropping blank entries
+	std::vector<std::string> SplitAddressList(const std::string& addressList)
+	{
+		std::vector<std::string> addresses;
+
+		std::size_t start = 0;
+		while (start <= addressList.size())
+		{
+			std::size_t end = addressList.find_first_of(",;", start);
+			if (end == std::string::npos) {
+				end = addressList.size();
+			}
+
+			// Trim surrounding white space
+			const std::size_t first = addressList.find_first_not_of(" \t", start);
+			if (first != std::string::npos && first < end)
+			{
+				const std::size_t last = addressList.find_last_not_of(" \t", end - 1);
+				addresses.push_back(addressList.substr(first, last - first + 1));
+			}
+
+			start = end + 1;
+		}
+
+		return addresses;
+	}
+
+	bool GetIniFileWriteTime(FILETIME& writeTime)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA fileAttributes;
+		if (!GetFileAttributesEx(GetOutpost2FilePath("outpost2.ini").c_str(), GetFileExInfoStandard, &fileAttributes)) {
+			return false;
+		}
+
+		writeTime = fileAttributes.ftLastWriteTime;
+		return true;
+	}
+}
+
+
+void LoadNetFixSettings()
+{
+	// Remember the file time, so later changes to the file can be detected
+	GetIniFileWriteTime(iniFileWriteTime);
+
+	char buffer[1024];
+	config.GetString(sectionName, "GameServerAddr", buffer, sizeof(buffer), "");
+
+	NetFixSettings newSettings;
+	newSettings.protocolIndex = config.GetInt(sectionName, "ProtocolIndex", DefaultProtocolIndex);
+	newSettings.gameServerAddrs = SplitAddressList(buffer);
+	newSettings.gameServerAddr = newSettings.gameServerAddrs.empty() ? "" : newSettings.gameServerAddrs.front();
+	newSettings.clientPort = config.GetInt(sectionName, "ClientPort", DefaultClientPort);
+	newSettings.hostPort = config.GetInt(sectionName, "HostPort", DefaultClientPort);
+	newSettings.forcedPort = config.GetInt(sectionName, "ForcedPort", 0);
+	newSettings.lanBroadcastInterval = config.GetInt(sectionName, "LanBroadcastInterval", DefaultLanBroadcastInterval);
+	newSettings.parityGroupSize = std::min(std::max(config.GetInt(sectionName, "ParityGroupSize", DefaultParityGroupSize), 0), MaxParityGroupSize);
+	newSettings.compressionThreshold = std::max(config.GetInt(sectionName, "CompressionThreshold", DefaultCompressionThreshold), 0);
+	newSettings.portMapping = config.GetInt(sectionName, "PortMapping", DefaultPortMapping);
+	newSettings.gameListSubscription = config.GetInt(sectionName, "GameListSubscription", DefaultGameListSubscription);
+	newSettings.warmStart = config.GetInt(sectionName, "WarmStart", DefaultWarmStart);
+	char gatewayBuffer[128];
+	config.GetString(sectionName, "PortMapGateway", gatewayBuffer, sizeof(gatewayBuffer), "");
+	newSettings.portMapGateway = gatewayBuffer;
+	settings = newSettings;
+
+	LogDebug("ProtocolIndex = " + std::to_string(settings.protocolIndex));
+	LogDebug("GameServerAddr = " + std::string(buffer) + "  (" + std::to_string(settings.gameServerAddrs.size()) + " servers)");
+	LogDebug("ClientPort = " + std::to_string(settings.clientPort) +
+		", HostPort = " + std::to_string(settings.hostPort) +
+		", ForcedPort = " + std::to_string(settings.forcedPort) +
+		", LanBroadcastInterval = " + std::to_string(settings.lanBroadcastInterval) +
+		", ParityGroupSize = " + std::to_string(settings.parityGroupSize) +
+		", CompressionThreshold = " + std::to_string(settings.compressionThreshold) +
+		", PortMapping = " + std::to_string(settings.portMapping) +
+		(settings.portMapGateway.empty() ? "" : ", PortMapGateway = " + settings.portMapGateway) +
+		", GameListSubscription = " + std::to_string(settings.gameListSubscription) +
+		", WarmStart = " + std::to_string(settings.warmStart));
+}
+
+bool ReloadNetFixSettingsIfModified()
+{
+	FILETIME writeTime;
+	if (!GetIniFileWriteTime(writeTime)) {
+		return false;
+	}
+
+	if (CompareFileTime(&writeTime, &iniFileWriteTime) == 0) {
+		return false;		// Unchanged
+	}
+
+	LogDebug("outpost2.ini modified. Reloading NetFix settings");
+	LoadNetFixSettings();
+	return true;
+}
+
+const NetFixSettings& GetNetFixSettings()
+{
+	return settings;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+// NetFix module settings, read from the module's section of outpost2.ini
+// Settings are loaded once (at InitMod) into an immutable snapshot, so network code never reads the ini file.
+// The snapshot is only replaced by an explicit reload, or when the ini file is seen to have changed.
+struct NetFixSettings
+{
+	int protocolIndex;
+	std::string gameServerAddr;					// First (primary) game server, or empty
+	std::vector<std::string> gameServerAddrs;	// All game servers, from a comma separated GameServerAddr list
+	int clientPort;
+	int hostPort;
+	int forcedPort;
+	int lanBroadcastInterval;	// Every Nth LAN search is also broadcast, for older hosts (0 = never)
+	int parityGroupSize;		// In game packets per parity packet, to players who also use parity (0 = off)
+	int compressionThreshold;	// Smallest payload compressed, for players who also use compression (0 = off)
+	int portMapping;			// Ask the local gateway to forward our ports, with PCP or NAT-PMP (0 = off)
+	std::string portMapGateway;	// Gateway to ask, instead of the default route's (IP address, optional port)
+	int gameListSubscription;	// Follow game server lists from pushed changes, instead of searching them (0 = off)
+	int warmStart;				// Create the transport layer, and search for games, when the module loads (0 = off)
+};
+
+
+void LoadNetFixSettings();
+bool ReloadNetFixSettingsIfModified();		// Returns true if the settings were reloaded
+const NetFixSettings& GetNetFixSettings();
@@ -6,6 +6,10 @@
 //  (on receive of new hosted game?)  (the list is cleared if they click search)
 
 #include "OPUNetGameSelectWnd.h"
+#include "NetFixSettings.h"
+#include "NetFixProtocol.h"
+#include "TransportWarmUp.h"
+#include "GameListCache.h"
 #include "Log.h"
 #include "resource.h"
 #define WIN32_LEAN_AND_MEAN
@@ -15,12 +19,10 @@
 #include <shlobj.h>
 #include <stdio.h>
 #include <cstring>
+#include <ctime>
 #include <string>
 
 
-extern char sectionName[];
-
-
 const char* GameTypeName[] =
 {
 	"",
@@ -56,7 +58,11 @@ int OPUNetGameSelectWnd::DlgProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
 		return true;			// Let system call SetFocus
 
 	case WM_TIMER:
-		OnTimer();
+		OnTimer(wParam);
+		return true;			// Message processed
+
+	case NetReadyMessage:
+		OnNetReady();
 		return true;			// Message processed
 
 	case WM_COMMAND:
@@ -65,6 +71,9 @@ int OPUNetGameSelectWnd::DlgProc(UINT uMsg, WPARAM wParam, LPARAM lParam)
 	case WM_NOTIFY:
 		return OnNotify(wParam, lParam);
 
+	case WM_DRAWITEM:
+		return OnDrawItem(*reinterpret_cast<const DRAWITEMSTRUCT*>(lParam));
+
 	case WM_DESTROY:
 		OnDestroy();
 		return false;			// Should return 0 for this message
@@ -86,9 +95,19 @@ void OPUNetGameSelectWnd::OnInitialization()
 	InitializeServerAddressComboBox();
 	CreateServerAddressToolTip();
 	InitializeGameSessionsListView();
+	// Show the games from last time while the first search is out
+	LoadCachedGames();
+	// The warm up thread reads the settings, so it is stopped before they can change
+	transportWarmUp.Stop();
+	// Pick up any settings changes made since the module was loaded  (the warmed up ports may no longer match)
+	if (ReloadNetFixSettingsIfModified()) {
+		transportWarmUp.Discard();
+	}
 	InitializeNetTransportLayer();
+	// Show the cached NAT type (if any) until it is measured again
+	UpdateNetInfoText();
 
-	timer = SetTimer(this->hWnd, 0, timerInterval, nullptr);
+	StartNetworkPump();
 }
 
 void OPUNetGameSelectWnd::InitializePlayerNameComboBox()
@@ -184,7 +203,11 @@ void OPUNetGameSelectWnd::InitializeGameSessionsListView()
 
 void OPUNetGameSelectWnd::InitializeNetTransportLayer()
 {
-	opuNetTransportLayer = OPUNetTransportLayer::Create();
+	// Use the transport layer warmed up when the module loaded, with its replies waiting, if there is one
+	opuNetTransportLayer = transportWarmUp.TakeTransportLayer();
+	if (opuNetTransportLayer == nullptr) {
+		opuNetTransportLayer = OPUNetTransportLayer::Create();
+	}
 
 	if (opuNetTransportLayer == nullptr)
 	{
@@ -270,6 +293,84 @@ void OPUNetGameSelectWnd::ClearGamesList()
 
 	// Clear the list view
 	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_DELETEALLITEMS, 0, 0);
+	bStaleGamesListed = false;
+	KillTimer(this->hWnd, StaleGamesTimerId);
+}
+
+// Lists the games seen the last time the window was open. They are shown as stale until a search finds them again.
+void OPUNetGameSelectWnd::LoadCachedGames()
+{
+	const std::vector<HostedGameInfo> cachedGames = LoadGameListCache();
+	if (cachedGames.empty()) {
+		return;
+	}
+
+	for (const HostedGameInfo& cachedGame : cachedGames) {
+		SetGameListItem(-1, new HostedGameInfo(cachedGame));
+	}
+	SortGamesList();
+
+	bStaleGamesListed = true;
+	SetTimer(this->hWnd, StaleGamesTimerId, StaleGameTimeOut, nullptr);
+	SetStatusText(("Showing " + std::to_string(cachedGames.size()) + " games from last time. Searching...").c_str());
+}
+
+// Saves the games list for the next time the window is opened
+void OPUNetGameSelectWnd::SaveCachedGames()
+{
+	LVITEM item;
+	item.mask = LVIF_PARAM;
+	item.iSubItem = 0;
+
+	const long long currentTime = static_cast<long long>(std::time(nullptr));
+	std::vector<HostedGameInfo> games;
+	const int gameCount = SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEMCOUNT, 0, 0);
+	for (int i = 0; i < gameCount; ++i)
+	{
+		item.iItem = i;
+		if (SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEM, 0, reinterpret_cast<LPARAM>(&item)))
+		{
+			const HostedGameInfo* hostedGameInfo = reinterpret_cast<const HostedGameInfo*>(item.lParam);
+			if (hostedGameInfo == nullptr) {
+				continue;
+			}
+			games.push_back(*hostedGameInfo);
+			// Stale games keep the time they were really seen, so they still expire
+			if (!hostedGameInfo->bStale) {
+				games.back().lastSeenTime = currentTime;
+			}
+		}
+	}
+
+	SaveGameListCache(games);
+}
+
+// Removes cached games that no search has found again
+void OPUNetGameSelectWnd::RemoveStaleGames()
+{
+	LVITEM item;
+	item.mask = LVIF_PARAM;
+	item.iSubItem = 0;
+
+	// Work backwards, so removing an item doesn't move the ones still to check
+	const int gameCount = SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEMCOUNT, 0, 0);
+	for (int i = gameCount - 1; i >= 0; --i)
+	{
+		item.iItem = i;
+		if (!SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEM, 0, reinterpret_cast<LPARAM>(&item))) {
+			continue;
+		}
+		// A join in progress gets its answer from the host
+		HostedGameInfo* hostedGameInfo = reinterpret_cast<HostedGameInfo*>(item.lParam);
+		if (hostedGameInfo == nullptr || !hostedGameInfo->bStale || hostedGameInfo == joiningGame) {
+			continue;
+		}
+		SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_DELETEITEM, static_cast<WPARAM>(i), 0);
+		delete hostedGameInfo;
+	}
+
+	bStaleGamesListed = false;
+	KillTimer(this->hWnd, StaleGamesTimerId);
 }
 
 
@@ -299,12 +400,11 @@ void OPUNetGameSelectWnd::SetStatusText(const char* text)
 
 void OPUNetGameSelectWnd::OnDestroy()
 {
-	if (timer != 0) {
-		KillTimer(this->hWnd, timer);
-	}
+	StopNetworkPump();
 
 	WritePlayerNameToIniFile();
 	WriteServerAddressListToIniFile();
+	SaveCachedGames();
 	ClearGamesList();
 }
 
@@ -337,96 +437,279 @@ void OPUNetGameSelectWnd::WriteServerAddressListToIniFile()
 	}
 }
 
-void OPUNetGameSelectWnd::OnTimer()
+// Starts processing network traffic for the lobby, and the periodic searches and requests
+void OPUNetGameSelectWnd::StartNetworkPump()
 {
-	if (opuNetTransportLayer == nullptr) {
+	if (opuNetTransportLayer == nullptr || bPumpRunning) {
 		return;
 	}
+	bPumpRunning = true;
 
-	// Periodically search for games
-	searchTickCount++;
-	if (searchTickCount >= SearchTickInterval)
-	{
-		SearchForGames();
-	}
+	// Packets are processed as soon as they arrive
+	opuNetTransportLayer->SetReceiveNotify(this->hWnd, NetReadyMessage);
 
-	if ((joinAttempt > 0) && (joiningGame != nullptr))
-	{
-		UpdateJoinAttempt();
+	// Game servers that support it push changes to their list, so they aren't searched
+	opuNetTransportLayer->SubscribeToGameLists();
+
+	// Search right away, then periodically
+	SearchForGames();
+	SetTimer(this->hWnd, SearchTimerId, SearchInterval, nullptr);
+	// Games from last time get a full time out to be found again
+	if (bStaleGamesListed) {
+		SetTimer(this->hWnd, StaleGamesTimerId, StaleGameTimeOut, nullptr);
 	}
 
+	// Measure the latency of each server address in the history
+	StartHistoryProbe();
+
+	// Check the external address right away, then retry until it's known
 	if ((externalPort == 0) && (numEchoRequestsSent < MaxEchoAttempt))
 	{
 		RequestExternalAddress();
+		SetTimer(this->hWnd, EchoTimerId, EchoInterval, nullptr);
 	}
 
-	// Check for network replies
+	// Pick up anything that arrived while stopped
+	PumpNetwork();
+}
+
+// Stops all network processing, so the packets are left for the game (or the pre game setup window)
+void OPUNetGameSelectWnd::StopNetworkPump()
+{
+	if (!bPumpRunning) {
+		return;
+	}
+	bPumpRunning = false;
+
+	KillTimer(this->hWnd, SearchTimerId);
+	KillTimer(this->hWnd, JoinTimerId);
+	KillTimer(this->hWnd, EchoTimerId);
+	KillTimer(this->hWnd, PendingSendTimerId);
+	KillTimer(this->hWnd, HistoryProbeTimerId);
+	KillTimer(this->hWnd, StaleGamesTimerId);
+	StopJoinPreparation();
+
+	opuNetTransportLayer->UnsubscribeFromGameLists();
+	opuNetTransportLayer->SetReceiveNotify(nullptr, 0);
+}
+
+// Processes every packet waiting to be read
+void OPUNetGameSelectWnd::PumpNetwork()
+{
+	// Everything waiting is applied to the games list as one update, so a large lobby is sorted and drawn once
+	const HWND gamesList = GetDlgItem(this->hWnd, IDC_GamesList);
+	SendMessage(gamesList, WM_SETREDRAW, FALSE, 0);
+	bGamesListChanged = false;
+
+	// Check for network replies  (a handler may stop the pump, such as when a join is accepted)
 	Packet packet;
-	while (opuNetTransportLayer->Receive(packet))
+	bool bReceived = false;
+	while (bPumpRunning && opuNetTransportLayer->Receive(packet))
 	{
 		// Process the packet
 		OnReceive(packet);
+		bReceived = true;
+	}
+
+	if (bGamesListChanged) {
+		SortGamesList();
+	}
+	SendMessage(gamesList, WM_SETREDRAW, TRUE, 0);
+	if (bReceived) {
+		InvalidateRect(gamesList, nullptr, TRUE);
+	}
+
+	if (!bPumpRunning) {
+		return;
+	}
+
+	// Sends waiting on a host name lookup or reply delay are made by Receive, so keep calling it until they're done
+	if (opuNetTransportLayer->HasPendingSends()) {
+		SetTimer(this->hWnd, PendingSendTimerId, PendingSendInterval, nullptr);
+	}
+	else {
+		KillTimer(this->hWnd, PendingSendTimerId);
 	}
 }
 
-void OPUNetGameSelectWnd::SearchForGames()
+void OPUNetGameSelectWnd::OnNetReady()
 {
-	searchTickCount = 0;
+	if (bPumpRunning) {
+		PumpNetwork();
+	}
+}
 
-	// First check a game server for games (if info is setup)
-	char addrString[MaxServerAddressLength];
-	opuNetTransportLayer->GetGameServerAddressString(addrString, sizeof(addrString));
-	if (addrString[0] != 0)
-	{
-		// Check the game server for a list of games
-		opuNetTransportLayer->SearchForGames(addrString, DefaultGameServerPort);
+void OPUNetGameSelectWnd::OnTimer(UINT_PTR timerId)
+{
+	if (!bPumpRunning) {
+		return;
 	}
-	else
+
+	switch (timerId)
 	{
-		// Game server not available. Broadcast a search query  (Broadcast to LAN)
-		opuNetTransportLayer->SearchForGames(nullptr, config.GetInt(sectionName, "ClientPort", DefaultClientPort));
+	case SearchTimerId:
+		SearchForGames();
+		break;
+	case JoinTimerId:
+		RunJoinFlow(JoinFlow::Event::TimedOut);
+		break;
+	case EchoTimerId:
+		if ((externalPort == 0) && (numEchoRequestsSent < MaxEchoAttempt)) {
+			RequestExternalAddress();
+		}
+		else if (!opuNetTransportLayer->IsNatClassificationRunning())
+		{
+			// Classification finishes in Receive (on a time out, if some probes went unanswered)
+			KillTimer(this->hWnd, EchoTimerId);
+			UpdateNetInfoText();
+		}
+		break;
+	case HistoryProbeTimerId:
+		UpdateHistoryProbe();
+		break;
+	case StaleGamesTimerId:
+		RemoveStaleGames();
+		break;
+	case JoinPrepareTimerId:
+		SendJoinPreparation();
+		break;
 	}
+
+	PumpNetwork();
 }
 
-void OPUNetGameSelectWnd::UpdateJoinAttempt()
+void OPUNetGameSelectWnd::SearchForGames()
 {
-	joinAttemptTickCount++;
-	if (joinAttemptTickCount >= JoinAttemptInterval)
+	// Query all game servers and the LAN at once. Replies are merged as they arrive,
+	// so a slow or dead game server doesn't hold up (or hide) games found elsewhere.
+	for (const std::string& gameServerAddr : GetNetFixSettings().gameServerAddrs)
 	{
-		joinAttemptTickCount = 0;
+		// A subscribed server already pushes its changes
+		if (opuNetTransportLayer->IsGameListSubscribed(gameServerAddr.c_str())) {
+			continue;
+		}
+		// Check the game server for a list of games
+		opuNetTransportLayer->SearchForGames(gameServerAddr.c_str(), DefaultGameServerPort);
+	}
 
-		if (joinAttempt > MaxJoinAttempt)
-		{
-			joinAttempt = 0;
-			joiningGame = nullptr;
+	// Search the LAN with a multicast query. Older hosts only answer broadcasts, so broadcast every few searches too.
+	const int broadcastInterval = GetNetFixSettings().lanBroadcastInterval;
+	const bool bBroadcast = (broadcastInterval > 0) && (lanSearchCount % broadcastInterval == 0);
+	lanSearchCount++;
+	opuNetTransportLayer->SearchForGamesOnLan(GetNetFixSettings().clientPort, bBroadcast);
+}
 
-			SetStatusText("Game join failed");
+// Queries every server address in the history, so the drop down list can show which are live, and how fast
+void OPUNetGameSelectWnd::StartHistoryProbe()
+{
+	std::vector<std::string> addresses;
+	char buffer[MaxServerAddressLength];
+	const int addressCount = SendDlgItemMessage(this->hWnd, IDC_ServerAddress, CB_GETCOUNT, 0, 0);
+	for (int i = 0; i < addressCount; ++i)
+	{
+		if (SendDlgItemMessage(this->hWnd, IDC_ServerAddress, CB_GETLBTEXT, static_cast<WPARAM>(i), reinterpret_cast<LPARAM>(buffer)) != CB_ERR) {
+			addresses.push_back(buffer);
 		}
-		else
-		{
-			joinAttempt++;
-			// Resend the Join request
-			opuNetTransportLayer->JoinGame(*joiningGame, joinRequestPassword);
+	}
+
+	historyProbe.Start(addresses, timeGetTime());
+	if (!historyProbe.IsRunning()) {
+		return;
+	}
+
+	// First round right away
+	UpdateHistoryProbe();
+	SetTimer(this->hWnd, HistoryProbeTimerId, HistoryProbeInterval, nullptr);
+	RedrawServerAddressList();
+}
+
+void OPUNetGameSelectWnd::UpdateHistoryProbe()
+{
+	const DWORD currentTime = timeGetTime();
+
+	if (historyProbe.StartRoundIfDue(currentTime))
+	{
+		// Same query as the Search button. Host name entries are sent once their lookup completes.
+		for (const HistoryProbe::Entry& entry : historyProbe.GetEntries()) {
+			opuNetTransportLayer->SearchForGames(entry.address.c_str(), GetNetFixSettings().clientPort);
 		}
 	}
+	// Once per tick, rather than per reply. Host name lookups finish in the background.
+	ResolveHistoryAddresses();
+
+	if (historyProbe.Update(currentTime))
+	{
+		KillTimer(this->hWnd, HistoryProbeTimerId);
+		RedrawServerAddressList();
+	}
 }
 
-void OPUNetGameSelectWnd::RequestExternalAddress()
+// Replies come from the resolved address, so that's what they are matched against
+void OPUNetGameSelectWnd::ResolveHistoryAddresses()
 {
-	echoTick++;
-	if (echoTick >= EchoTickInterval)
+	for (HistoryProbe::Entry& entry : historyProbe.GetEntries())
 	{
-		if (numEchoRequestsSent == 0)
-		{
-			internalPort = opuNetTransportLayer->GetPort();
+		if (!entry.hostAddress.IsSet()) {
+			opuNetTransportLayer->ResolveHostAddress(entry.address.c_str(), GetNetFixSettings().clientPort, entry.hostAddress);
 		}
+	}
+}
 
-		echoTick = 0;
-		numEchoRequestsSent++;
+// Repaints the latencies, if the drop down list is open
+void OPUNetGameSelectWnd::RedrawServerAddressList()
+{
+	COMBOBOXINFO comboBoxInfo = { };
+	comboBoxInfo.cbSize = sizeof(comboBoxInfo);
+	if (GetComboBoxInfo(::GetDlgItem(this->hWnd, IDC_ServerAddress), &comboBoxInfo)) {
+		InvalidateRect(comboBoxInfo.hwndList, nullptr, true);
+	}
+}
+
+// Carries out the actions requested by the join flow
+void OPUNetGameSelectWnd::RunJoinFlow(JoinFlow::Event event)
+{
+	// One-shot timer: each request sets its own retry delay
+	KillTimer(this->hWnd, JoinTimerId);
 
-		// Request external address
-		opuNetTransportLayer->GetExternalAddress();
+	if (joiningGame == nullptr)
+	{
+		joinFlow.Cancel();
+		return;
 	}
+
+	switch (joinFlow.Resume(event))
+	{
+	case JoinFlow::Action::SendRequest:
+		opuNetTransportLayer->JoinGame(*joiningGame, joinRequestPassword);
+		SetTimer(this->hWnd, JoinTimerId, joinFlow.RetryDelay(), nullptr);
+		break;
+	case JoinFlow::Action::Await:
+		break;
+	case JoinFlow::Action::Joined:
+		LogDebug("Join granted after " + std::to_string(joinFlow.ElapsedTime()) + " ms (" + std::to_string(joinFlow.Attempt()) + " requests)");
+		break;
+	case JoinFlow::Action::Refused:
+		SetStatusText("Join Failed:  The requested game is full");
+		joiningGame = nullptr;
+		break;
+	case JoinFlow::Action::Failed:
+		SetStatusText("Game join failed");
+		joiningGame = nullptr;
+		break;
+	}
+}
+
+void OPUNetGameSelectWnd::RequestExternalAddress()
+{
+	if (numEchoRequestsSent == 0)
+	{
+		internalPort = opuNetTransportLayer->GetPort();
+	}
+
+	numEchoRequestsSent++;
+
+	// Request external address
+	opuNetTransportLayer->GetExternalAddress();
 }
 
 bool OPUNetGameSelectWnd::OnCommand(WPARAM wParam)
@@ -446,6 +729,10 @@ bool OPUNetGameSelectWnd::OnCommand(WPARAM wParam)
 			OnClickJoin();
 			return true;		// Message processed
 
+		case IDC_JoinFastestButton:
+			OnClickJoinFastest();
+			return true;		// Message processed
+
 		case IDC_CreateButton:
 			OnClickCreate();
 			return true;		// Message processed
@@ -471,9 +758,64 @@ bool OPUNetGameSelectWnd::OnNotify(WPARAM wParam, LPARAM lParam)
 		return true;			// Message processed
 	}
 
+#pragma warning(suppress: 26454) // MSVC C26454 produced within expansion of LVN_ITEMCHANGED
+	if ((controlId == IDC_GamesList) && (notifyCode == LVN_ITEMCHANGED))
+	{
+		// Start preparing a join as soon as a game is selected
+		const NMLISTVIEW& listView = *reinterpret_cast<NMLISTVIEW*>(lParam);
+		if ((listView.uChanged & LVIF_STATE) && (listView.uNewState & LVIS_SELECTED) && !(listView.uOldState & LVIS_SELECTED)) {
+			StartJoinPreparation(reinterpret_cast<const HostedGameInfo*>(listView.lParam));
+		}
+		return true;			// Message processed
+	}
+
 	return false; // Message not processed
 }
 
+// Server address drop down list items: the address, with the latency measured by the history probe on the right
+bool OPUNetGameSelectWnd::OnDrawItem(const DRAWITEMSTRUCT& drawItem)
+{
+	if (drawItem.CtlID != IDC_ServerAddress || drawItem.itemID == static_cast<UINT>(-1)) {
+		return false;			// Message not processed
+	}
+
+	char address[MaxServerAddressLength];
+	if (SendMessage(drawItem.hwndItem, CB_GETLBTEXT, drawItem.itemID, reinterpret_cast<LPARAM>(address)) == CB_ERR) {
+		return false;			// Message not processed
+	}
+
+	const bool bSelected = (drawItem.itemState & ODS_SELECTED) != 0;
+	FillRect(drawItem.hDC, &drawItem.rcItem, GetSysColorBrush(bSelected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+	SetBkMode(drawItem.hDC, TRANSPARENT);
+
+	RECT textRect = drawItem.rcItem;
+	textRect.left += 2;
+	textRect.right -= 2;
+
+	// Latency, right aligned  (addresses typed since the probe ran have none)
+	const HistoryProbe::Entry* entry = historyProbe.FindEntry(address);
+	if (entry != nullptr)
+	{
+		const std::string stateText = FormatHistoryProbeState(*entry);
+		SetTextColor(drawItem.hDC, GetSysColor(bSelected ? COLOR_HIGHLIGHTTEXT : COLOR_GRAYTEXT));
+		DrawText(drawItem.hDC, stateText.c_str(), -1, &textRect, DT_RIGHT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX);
+
+		SIZE stateTextSize;
+		if (GetTextExtentPoint32(drawItem.hDC, stateText.c_str(), static_cast<int>(stateText.size()), &stateTextSize)) {
+			textRect.right -= stateTextSize.cx + 6;
+		}
+	}
+
+	SetTextColor(drawItem.hDC, GetSysColor(bSelected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
+	DrawText(drawItem.hDC, address, -1, &textRect, DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX | DT_END_ELLIPSIS);
+
+	if ((drawItem.itemState & ODS_FOCUS) != 0) {
+		DrawFocusRect(drawItem.hDC, &drawItem.rcItem);
+	}
+
+	return true;				// Message processed
+}
+
 void OPUNetGameSelectWnd::OnReceive(Packet &packet)
 {
 	// Make sure the packet is of the correct format
@@ -497,10 +839,46 @@ void OPUNetGameSelectWnd::OnReceive(Packet &packet)
 		OnReceiveEchoExternalAddress(packet);
 		break;
 	default:  // Silence warnings about unused enumeration value in switch
+		if (packet.tlMessage.tlHeader.commandType == ToTransportLayerCommand(NetFixCommand::GameListEvent)) {
+			OnReceiveGameListRemoval(packet);
+		}
 		break;
 	}
 }
 
+// A subscribed game server removed a game from its list
+void OPUNetGameSelectWnd::OnReceiveGameListRemoval(Packet& packet)
+{
+	if (packet.header.sizeOfPayload != sizeof(NetFixGameListEvent)) {
+		return;						// Discard packet
+	}
+	const NetFixGameListEvent& event = GetNetFixMessage<NetFixGameListEvent>(packet);
+	if (event.eventType != NetFixGameListEventType::Removed) {
+		return;						// Discard packet
+	}
+
+	const int itemIndex = FindGameListItem(event.game.sessionIdentifier);
+	if (itemIndex < 0) {
+		return;
+	}
+
+	LVITEM item;
+	item.mask = LVIF_PARAM;
+	item.iSubItem = 0;
+	item.iItem = itemIndex;
+	if (!SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEM, 0, reinterpret_cast<LPARAM>(&item))) {
+		return;
+	}
+	// A join in progress gets its answer from the host
+	HostedGameInfo* hostedGameInfo = reinterpret_cast<HostedGameInfo*>(item.lParam);
+	if (hostedGameInfo == joiningGame) {
+		return;
+	}
+
+	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_DELETEITEM, static_cast<WPARAM>(itemIndex), 0);
+	delete hostedGameInfo;
+}
+
 void OPUNetGameSelectWnd::OnReceiveHostedGameSearchReply(Packet& packet)
 {
 	// Verify packet size
@@ -512,6 +890,11 @@ void OPUNetGameSelectWnd::OnReceiveHostedGameSearchReply(Packet& packet)
 		return;						// Discard Packet
 	}
 
+	// Record the latency of a server address in the history  (replies keep coming after the probe finishes)
+	if (historyProbe.OnReply(opuNetTransportLayer->GetLastSourceAddress(), timeGetTime() - packet.tlMessage.searchReply.timeStamp, packet.tlMessage.searchReply.sessionIdentifier)) {
+		RedrawServerAddressList();
+	}
+
 	// Check if we already know about this game
 	// ----------------------------------------
 	// Prepare a LVITEM struct
@@ -519,6 +902,12 @@ void OPUNetGameSelectWnd::OnReceiveHostedGameSearchReply(Packet& packet)
 	item.mask = LVIF_PARAM;
 	item.iSubItem = 0;
 
+	// Determine the host address  (an IPv6 host can't be described in the reply, so use the packet source)
+	NetAddress hostAddress = opuNetTransportLayer->GetLastSourceAddress();
+	if (packet.tlMessage.searchReply.hostAddress.sin_addr.s_addr != 0) {
+		hostAddress = NetAddress::FromIPv4(packet.tlMessage.searchReply.hostAddress);
+	}
+
 	// Search the list of games
 	HostedGameInfo* hostedGameInfo;
 	const int gameCount = SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEMCOUNT, 0, 0);
@@ -534,17 +923,26 @@ void OPUNetGameSelectWnd::OnReceiveHostedGameSearchReply(Packet& packet)
 			// Make sure we have a valid pointer
 			if (hostedGameInfo != nullptr)
 			{
-				// Check if it's the same game
-				//if (hostedGameInfo->sessionIdentifier == packet.tlMessage.searchReply.sessionIdentifier)
-				// Check if it's the same host
-				if (std::memcmp(&hostedGameInfo->address, &packet.tlMessage.searchReply.hostAddress, sizeof(sockaddr_in)) == 0)
+				// Check if it's the same game (possibly found through another server, or the LAN)
+				const bool bSameGame = (hostedGameInfo->sessionIdentifier == packet.tlMessage.searchReply.sessionIdentifier);
+				// Check if it's the same host  (which may have started a new session)
+				const bool bSameHost = (hostedGameInfo->address == hostAddress);
+				if (bSameGame || bSameHost)
 				{
 					// Matching game found. Update game info
+					const unsigned int ping = timeGetTime() - packet.tlMessage.searchReply.timeStamp;
 					hostedGameInfo->createGameInfo = packet.tlMessage.searchReply.createGameInfo;
 					hostedGameInfo->sessionIdentifier = packet.tlMessage.searchReply.sessionIdentifier;
-					hostedGameInfo->ping = timeGetTime() - packet.tlMessage.searchReply.timeStamp;
-					// Update the display
+					// Keep the fastest route to the game  (a cached ping is from last time, so is replaced)
+					if (bSameHost || hostedGameInfo->bStale || ping < hostedGameInfo->ping)
+					{
+						hostedGameInfo->address = hostAddress;
+						hostedGameInfo->ping = ping;
+					}
+					hostedGameInfo->bStale = false;
+					// Update the display  (sorted once the pump is done)
 					SetGameListItem(i, hostedGameInfo);
+					bGamesListChanged = true;
 					return;					// Packet handled
 				}
 			}
@@ -568,10 +966,13 @@ void OPUNetGameSelectWnd::OnReceiveHostedGameSearchReply(Packet& packet)
 	hostedGameInfo->createGameInfo = packet.tlMessage.searchReply.createGameInfo;
 	hostedGameInfo->ping = timeGetTime() - packet.tlMessage.searchReply.timeStamp;
 	hostedGameInfo->sessionIdentifier = packet.tlMessage.searchReply.sessionIdentifier;
-	hostedGameInfo->address = packet.tlMessage.searchReply.hostAddress;
+	hostedGameInfo->address = hostAddress;
+	hostedGameInfo->bStale = false;
+	hostedGameInfo->lastSeenTime = 0;
 
 	// Add a new List Item to the List View control (Games List)
 	SetGameListItem(-1, hostedGameInfo);
+	bGamesListChanged = true;
 }
 
 void OPUNetGameSelectWnd::OnReceiveJoinGranted(Packet& packet)
@@ -580,6 +981,7 @@ void OPUNetGameSelectWnd::OnReceiveJoinGranted(Packet& packet)
 		return; // Discard packet
 	}
 
+	RunJoinFlow(JoinFlow::Event::Granted);
 	opuNetTransportLayer->OnJoinAccepted(packet);
 
 	OnJoinAccepted();
@@ -593,9 +995,7 @@ void OPUNetGameSelectWnd::OnReceiveJoinRefused(Packet& packet)
 		return; // Discard packet
 	}
 
-	SetStatusText("Join Failed:  The requested game is full");
-
-	joiningGame = nullptr;
+	RunJoinFlow(JoinFlow::Event::Refused);
 }
 
 bool OPUNetGameSelectWnd::OnReceiveJoin(Packet& packet)
@@ -605,7 +1005,7 @@ bool OPUNetGameSelectWnd::OnReceiveJoin(Packet& packet)
 		return false; // Discard packet
 	}
 	// Make sure we've requested to join a game
-	if (joiningGame == nullptr)
+	if (joiningGame == nullptr || !joinFlow.IsActive())
 	{
 		LogDebug("Unexpected Join reply received");
 		return false; // Discard packet
@@ -633,14 +1033,6 @@ void OPUNetGameSelectWnd::OnReceiveEchoExternalAddress(Packet& packet)
 	{
 		bReceivedInternal = true;
 	}
-	// Check if we've received a different external port than previous
-	if (ntohs(packet.tlMessage.echoExternalAddress.addr.sin_port) != externalPort)
-	{
-		if (externalPort != 0)
-		{
-			bTwoExternal = true;	// Received two distinct external ports
-		}
-	}
 	// Record external information
 	externalIp = packet.tlMessage.echoExternalAddress.addr.sin_addr;
 	if ((externalPort == 0) || (externalPort == internalPort))
@@ -648,15 +1040,34 @@ void OPUNetGameSelectWnd::OnReceiveEchoExternalAddress(Packet& packet)
 		externalPort = ntohs(packet.tlMessage.echoExternalAddress.addr.sin_port);
 	}
 
+	UpdateNetInfoText();
+}
+
+void OPUNetGameSelectWnd::UpdateNetInfoText()
+{
+	if (opuNetTransportLayer == nullptr) {
+		return;
+	}
+
 	// Build new net info text string
-	std::string text = "External IP: " + FormatIP4Address(externalIp.s_addr) + ":" + std::to_string(externalPort);
+	std::string text;
+	if (externalPort != 0) {
+		text = "External IP: " + FormatIP4Address(externalIp.s_addr) + ":" + std::to_string(externalPort) + "\n";
+	}
 	// Check if internal address received
 	if (bReceivedInternal)
 	{
 		// Not quite true, since internal port might be random (no hosting, but possibly still open)
 		//text += " (Direct Host Capable)";
 	}
-	if (bTwoExternal)
+	const NatBehaviour& natBehaviour = opuNetTransportLayer->GetNatBehaviour();
+	if (natBehaviour.IsKnown()) {
+		text += "NAT " + FormatNatBehaviour(natBehaviour);
+	}
+	else if (opuNetTransportLayer->IsNatClassificationRunning()) {
+		text += "Checking NAT type...";
+	}
+	if (natBehaviour.mapping == NatMapping::AddressPortDependent)
 	{
 		text += "\nWarning: Address and Port-Dependent Mapping detected\nYou may have difficulty joining games.";
 	}
@@ -666,7 +1077,7 @@ void OPUNetGameSelectWnd::OnReceiveEchoExternalAddress(Packet& packet)
 
 void OPUNetGameSelectWnd::SetGameListItem(int index, HostedGameInfo* hostedGameInfo)
 {
-	char buffer[32];
+	char buffer[64];
 
 	// Fill in new List Item fields
 	LVITEM item;
@@ -708,25 +1119,67 @@ void OPUNetGameSelectWnd::SetGameListItem(int index, HostedGameInfo* hostedGameI
 	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SETITEM, 0, (LPARAM)&item);
 	// IP address
 	item.iSubItem = 3;
-	in_addr ip = hostedGameInfo->address.sin_addr;
-	scr_snprintf(buffer, sizeof(buffer), "%i.%i.%i.%i", ip.S_un.S_un_b.s_b1, ip.S_un.S_un_b.s_b2, ip.S_un.S_un_b.s_b3, ip.S_un.S_un_b.s_b4);
+	scr_snprintf(buffer, sizeof(buffer), "%s", FormatIPAddress(hostedGameInfo->address).c_str());
 	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SETITEM, 0, (LPARAM)&item);
 	// Port
 	item.iSubItem = 4;
-	scr_snprintf(buffer, sizeof(buffer), "%i", ntohs(hostedGameInfo->address.sin_port));
+	scr_snprintf(buffer, sizeof(buffer), "%i", hostedGameInfo->address.GetPort());
 	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SETITEM, 0, (LPARAM)&item);
-	// Ping
+	// Ping  (in brackets for a game from last time, not seen again yet)
 	item.iSubItem = 5;
-	scr_snprintf(buffer, sizeof(buffer), "%i", hostedGameInfo->ping);
+	scr_snprintf(buffer, sizeof(buffer), hostedGameInfo->bStale ? "(%i)" : "%i", hostedGameInfo->ping);
 	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SETITEM, 0, (LPARAM)&item);
 }
 
 
+// Order games by ping (fastest first)
+void OPUNetGameSelectWnd::SortGamesList()
+{
+	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SORTITEMS, 0, reinterpret_cast<LPARAM>(&CompareGamePing));
+}
+
+// Returns the list index of the game, or -1 if it isn't listed
+int OPUNetGameSelectWnd::FindGameListItem(const GUID& sessionIdentifier)
+{
+	LVITEM item;
+	item.mask = LVIF_PARAM;
+	item.iSubItem = 0;
+
+	const int gameCount = SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEMCOUNT, 0, 0);
+	for (int i = 0; i < gameCount; ++i)
+	{
+		item.iItem = i;
+		if (SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEM, 0, reinterpret_cast<LPARAM>(&item)))
+		{
+			const HostedGameInfo* hostedGameInfo = reinterpret_cast<const HostedGameInfo*>(item.lParam);
+			if (hostedGameInfo != nullptr && hostedGameInfo->sessionIdentifier == sessionIdentifier) {
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+int CALLBACK OPUNetGameSelectWnd::CompareGamePing(LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort)
+{
+	const HostedGameInfo* hostedGameInfo1 = reinterpret_cast<const HostedGameInfo*>(lParam1);
+	const HostedGameInfo* hostedGameInfo2 = reinterpret_cast<const HostedGameInfo*>(lParam2);
+	// Games not seen since last time go after the live ones
+	if (hostedGameInfo1->bStale != hostedGameInfo2->bStale) {
+		return hostedGameInfo1->bStale ? 1 : -1;
+	}
+	if (hostedGameInfo1->ping == hostedGameInfo2->ping) {
+		return 0;
+	}
+	return (hostedGameInfo1->ping < hostedGameInfo2->ping) ? -1 : 1;
+}
+
+
 void OPUNetGameSelectWnd::OnJoinAccepted()
 {
-	// Stop the update timer
-	KillTimer(this->hWnd, 0);
-	timer = 0;
+	// Leave packets for the pre game setup window
+	StopNetworkPump();
 
 
 	SetStatusText("Join accepted");
@@ -763,12 +1216,11 @@ void OPUNetGameSelectWnd::OnJoinAccepted()
 	}
 	else
 	{
-		// Game cancelled. Restart the update timer
-		timer = SetTimer(this->hWnd, 0, timerInterval, nullptr);
-		searchTickCount = SearchTickInterval - 1;	// Broadcast right away
-
 		// Send the player Quit message
 		CleanupGuaranteedSendLayerManager();
+
+		// Game cancelled. Back to the lobby  (searches again right away)
+		StartNetworkPump();
 	}
 }
 
@@ -776,6 +1228,8 @@ void OPUNetGameSelectWnd::OnJoinAccepted()
 void OPUNetGameSelectWnd::OnClickSearch()
 {
 	ClearGamesList();
+	// Subscribed servers send their full list again
+	opuNetTransportLayer->RequestGameListSnapshots();
 
 	SetStatusText("Searching for games...");
 
@@ -783,7 +1237,7 @@ void OPUNetGameSelectWnd::OnClickSearch()
 	char serverAddress[MaxServerAddressLength];
 	SendDlgItemMessage(this->hWnd, IDC_ServerAddress, WM_GETTEXT, (WPARAM)sizeof(serverAddress), (LPARAM)serverAddress);
 	// Request games list from server
-	bool success = opuNetTransportLayer->SearchForGames(serverAddress, config.GetInt(sectionName, "ClientPort", DefaultClientPort));
+	bool success = opuNetTransportLayer->SearchForGames(serverAddress, GetNetFixSettings().clientPort);
 
 	// Check if the request was successfully sent
 	if (success)
@@ -813,8 +1267,40 @@ void OPUNetGameSelectWnd::OnClickJoin()
 
 	SetStatusText("Sending Join request...");
 
-	joinAttempt = 1;
-	opuNetTransportLayer->JoinGame(*joiningGame, joinRequestPassword);
+	// The join flow takes over. Its first request uses the paths, and the ping, the preparation measured.
+	StopJoinPreparation();
+	joinFlow.Start(joiningGame->ping);
+	RunJoinFlow(JoinFlow::Event::Start);
+}
+
+// Joins the game with the lowest latency, of those found at the server addresses in the history
+void OPUNetGameSelectWnd::OnClickJoinFastest()
+{
+	GUID sessionIdentifier;
+	if (!historyProbe.GetFastestGame(sessionIdentifier))
+	{
+		SetStatusText(historyProbe.IsRunning() ? "Still checking the server address history..." : "No games found at the server addresses in the history");
+		return;
+	}
+
+	// A search clears the games list. Check the history again to find the game.
+	const int itemIndex = FindGameListItem(sessionIdentifier);
+	if (itemIndex < 0)
+	{
+		SetStatusText("Checking the server address history again...");
+		StartHistoryProbe();
+		return;
+	}
+
+	// Select the game, and join it as if it was picked from the list
+	LVITEM item;
+	item.stateMask = LVIS_SELECTED | LVIS_FOCUSED;
+	item.state = LVIS_SELECTED | LVIS_FOCUSED;
+	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SETITEMSTATE, static_cast<WPARAM>(itemIndex), reinterpret_cast<LPARAM>(&item));
+	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_SETSELECTIONMARK, 0, static_cast<LPARAM>(itemIndex));
+	SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_ENSUREVISIBLE, static_cast<WPARAM>(itemIndex), false);
+
+	OnClickJoin();
 }
 
 void OPUNetGameSelectWnd::SetJoiningGame()
@@ -832,13 +1318,57 @@ void OPUNetGameSelectWnd::SetJoiningGame()
 	}
 }
 
+// Opens the paths to the selected game's host, and measures its ping, before Join is clicked
+void OPUNetGameSelectWnd::StartJoinPreparation(const HostedGameInfo* hostedGameInfo)
+{
+	if (hostedGameInfo == nullptr || !bPumpRunning || joinFlow.IsActive()) {
+		return;
+	}
+	if (bPreparingJoin && preparedSession == hostedGameInfo->sessionIdentifier) {
+		return;
+	}
+
+	bPreparingJoin = true;
+	preparedSession = hostedGameInfo->sessionIdentifier;
+	joinPrepareRounds = 0;
+	SendJoinPreparation();
+}
+
+void OPUNetGameSelectWnd::SendJoinPreparation()
+{
+	KillTimer(this->hWnd, JoinPrepareTimerId);
+	if (!bPreparingJoin) {
+		return;
+	}
+
+	// The game may have left the list since it was selected
+	LVITEM item;
+	item.mask = LVIF_PARAM;
+	item.iSubItem = 0;
+	item.iItem = FindGameListItem(preparedSession);
+	if (item.iItem < 0 || !SendDlgItemMessage(this->hWnd, IDC_GamesList, LVM_GETITEM, 0, reinterpret_cast<LPARAM>(&item)))
+	{
+		bPreparingJoin = false;
+		return;
+	}
+
+	opuNetTransportLayer->PrepareJoin(*reinterpret_cast<const HostedGameInfo*>(item.lParam));
+	joinPrepareRounds++;
+	SetTimer(this->hWnd, JoinPrepareTimerId, (joinPrepareRounds < JoinPrepareFastRounds) ? JoinPrepareInterval : JoinPrepareRefreshInterval, nullptr);
+}
+
+void OPUNetGameSelectWnd::StopJoinPreparation()
+{
+	bPreparingJoin = false;
+	KillTimer(this->hWnd, JoinPrepareTimerId);
+}
+
 void OPUNetGameSelectWnd::OnClickCreate()
 {
 	char hostPassword[16];
 
-	// Stop the update timer
-	KillTimer(this->hWnd, 0);
-	timer = 0;
+	// Leave packets for the pre game setup window
+	StopNetworkPump();
 
 	SetStatusText("");
 
@@ -855,13 +1385,14 @@ void OPUNetGameSelectWnd::OnClickCreate()
 	hostGameParameters.startupFlags.missionType = gameType;
 
 	// Try to Host
-	int errorCode = opuNetTransportLayer->HostGame(config.GetInt(sectionName, "HostPort", DefaultClientPort), hostPassword, hostGameParameters.gameCreatorName, maxPlayers, gameType);
+	int errorCode = opuNetTransportLayer->HostGame(GetNetFixSettings().hostPort, hostPassword, hostGameParameters.gameCreatorName, maxPlayers, gameType);
 	// Check for errors
 	if (errorCode == false)
 	{
 		// Error binding to server listen port. Inform user
 		SetStatusText("Could not Bind to the server port.");
 
+		StartNetworkPump();
 		return;
 	}
 
@@ -893,9 +1424,8 @@ void OPUNetGameSelectWnd::OnClickCreate()
 
 		SetStatusText("Game Cancelled");
 
-		// Restart the update timer
-		timer = SetTimer(this->hWnd, 0, timerInterval, nullptr);
-		searchTickCount = SearchTickInterval - 1;	// Broadcast right away
+		// Back to the lobby  (searches again right away)
+		StartNetworkPump();
 	}
 }
 
@@ -1,16 +1,29 @@
 #include "OPUNetTransportLayer.h"
+#include "JoinFlow.h"
+#include "HistoryProbe.h"
 #include <OP2Internal.h>
 
 using namespace OP2Internal;
 
 const int MaxServerAddressLength = 128;
 const int MaxPlayerNameLength = 13;
-const int timerInterval = 50;
-const int SearchTickInterval = 60;
-const int JoinAttemptInterval = 20;
-const int MaxJoinAttempt = 3;
-const int EchoTickInterval = 20;
+// Packets are processed as they arrive (NetReadyMessage). Timers are only used for periodic work.
+const UINT NetReadyMessage = WM_APP + 1;		// Posted by the transport layer when a packet arrives
+const UINT_PTR SearchTimerId = 1;
+const UINT_PTR JoinTimerId = 2;
+const UINT_PTR EchoTimerId = 3;
+const UINT_PTR PendingSendTimerId = 4;
+const UINT_PTR HistoryProbeTimerId = 5;
+const UINT_PTR StaleGamesTimerId = 6;
+const UINT_PTR JoinPrepareTimerId = 7;
+const UINT SearchInterval = 3000;			// Milliseconds between game searches
+const UINT EchoInterval = 1000;				// Milliseconds between external address requests
 const int MaxEchoAttempt = 3;
+const UINT PendingSendInterval = 50;		// Polling while sends wait on a host name lookup or reply delay
+const UINT StaleGameTimeOut = 10000;		// Milliseconds games from the last session stay listed without being seen again
+const UINT JoinPrepareInterval = 500;		// Milliseconds between the first join preparations for a selected game
+const int JoinPrepareFastRounds = 3;
+const UINT JoinPrepareRefreshInterval = 10000;	// Then repeated to keep the paths open, while the game stays selected
 
 
 class OPUNetGameSelectWnd : public IDlgWnd
@@ -25,21 +38,25 @@ private:
 	// Button click handlers
 	void OnClickSearch();
 	void OnClickJoin();
+	void OnClickJoinFastest();
 	void OnClickCreate();
 	void OnClickCancel();
 
 	// Other event handlers
 	void OnInitialization();
 	void OnDestroy();
-	void OnTimer();
+	void OnTimer(UINT_PTR timerId);
+	void OnNetReady();
 	bool OnCommand(WPARAM wParam);
 	bool OnNotify(WPARAM wParam, LPARAM lParam);
+	bool OnDrawItem(const DRAWITEMSTRUCT& drawItem);
 	void OnReceive(Packet &packet);
 	void OnReceiveHostedGameSearchReply(Packet& packet);
 	void OnReceiveJoinGranted(Packet& packet);
 	void OnReceiveJoinRefused(Packet& packet);
 	bool OnReceiveJoin(Packet& packet);
 	void OnReceiveEchoExternalAddress(Packet& packet);
+	void OnReceiveGameListRemoval(Packet& packet);
 	void OnJoinAccepted();
 
 	// Member functions
@@ -52,30 +69,50 @@ private:
 	bool InitializeGuaranteedSendLayerManager();
 	void CleanupGuaranteedSendLayerManager();
 	void ClearGamesList();
+	void LoadCachedGames();
+	void SaveCachedGames();
+	void RemoveStaleGames();
 	void SetGameListItem(int itemIndex, HostedGameInfo* hostedGameInfo);
+	void SortGamesList();
+	int FindGameListItem(const GUID& sessionIdentifier);
+	static int CALLBACK CompareGamePing(LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort);
 	void AddServerAddress(const char* address);
 	void SetStatusText(const char* text);
 	void WritePlayerNameToIniFile();
 	void WriteServerAddressListToIniFile();
+	void StartNetworkPump();
+	void StopNetworkPump();
+	void PumpNetwork();
 	void SearchForGames();
-	void UpdateJoinAttempt();
+	void StartHistoryProbe();
+	void UpdateHistoryProbe();
+	void ResolveHistoryAddresses();
+	void RedrawServerAddressList();
+	void RunJoinFlow(JoinFlow::Event event);
 	void RequestExternalAddress();
+	void UpdateNetInfoText();
 	void SetJoiningGame();
+	void StartJoinPreparation(const HostedGameInfo* hostedGameInfo);
+	void SendJoinPreparation();
+	void StopJoinPreparation();
 
 	void CreateServerAddressToolTip();
 
 	OPUNetTransportLayer* opuNetTransportLayer = nullptr;
-	UINT_PTR timer = 0;
-	UINT searchTickCount = SearchTickInterval - 1;	// Broadcast right away
+	bool bPumpRunning = false;
+	bool bGamesListChanged = false;		// Set by replies during a pump, which sorts the list once
+	bool bStaleGamesListed = false;		// Games from the last session, not seen again yet, are in the list
+	UINT lanSearchCount = 0;
 	HostedGameInfo* joiningGame = nullptr;
 	char joinRequestPassword[16] = { };
-	UINT joinAttempt = 0;
-	UINT joinAttemptTickCount = 0;
+	JoinFlow joinFlow;
+	bool bPreparingJoin = false;
+	GUID preparedSession = { };				// Selected game  (looked up each time, as the list can drop it)
+	int joinPrepareRounds = 0;
+	HistoryProbe historyProbe;
 	Port internalPort = 0;
 	Port externalPort = 0;
 	in_addr externalIp;
 	bool bReceivedInternal = false;
-	bool bTwoExternal = false;
 	UCHAR numEchoRequestsSent = 0;
-	UCHAR echoTick = EchoTickInterval - 1;	// Check external address right away
 };
@@ -2,18 +2,22 @@
 // **TODO** Discard packets from bad net ids (non-zero values that don't match up to proper index, (with proper source IP?))
 
 #include "OPUNetTransportLayer.h"
+#include "NetFixProtocol.h"
+#include "HostAddressCache.h"
+#include "NetFixSettings.h"
 #include "Log.h"
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <ws2tcpip.h>
 #include <mmsystem.h>
 #include <objbase.h>
 #include <string>
 #include <cstring>
+#include <algorithm>
+#include <cstdlib>
 
-extern char sectionName[];
 
-
-bool ValidatePacket(Packet& packet, sockaddr_in& fromAddress);
+bool ValidatePacket(Packet& packet, NetAddress& fromAddress);
 
 
 // Public member functions
@@ -41,6 +45,19 @@ OPUNetTransportLayer* OPUNetTransportLayer::Create()		// Public static construct
 		return nullptr;
 	}
 
+	// Start resolving the game server addresses in the background, so they are ready when first needed
+	for (const std::string& gameServerAddr : GetNetFixSettings().gameServerAddrs)
+	{
+		NetAddress gameServerAddress;
+		opuNetTransportLayer->GetGameServerAddress(gameServerAddr.c_str(), gameServerAddress);
+	}
+
+	// Known NAT characteristics are available before any probe is answered
+	opuNetTransportLayer->LoadCachedNatBehaviour();
+
+	// Ask the local gateway to forward the client port
+	opuNetTransportLayer->StartPortMapping();
+
 	// Return the newly constructed object
 	return opuNetTransportLayer;
 }
@@ -64,7 +81,7 @@ bool OPUNetTransportLayer::CreateSocket()
 	setsockopt(netSocket, SOL_SOCKET, SO_BROADCAST, (const char*)&newValue, sizeof(newValue));
 
 	// Check if the port needs to be bound (forced)
-	forcedPort = config.GetInt(sectionName, "ForcedPort", 0);
+	forcedPort = GetNetFixSettings().forcedPort;
 	if (forcedPort != 0)
 	{
 		int retVal;
@@ -89,15 +106,136 @@ bool OPUNetTransportLayer::CreateSocket()
 		}
 	}
 
+	// Create the IPv6 socket  (optional, IPv4 still works without it)
+	if (netSocket6 != INVALID_SOCKET) {
+		closesocket(netSocket6);
+	}
+	netSocket6 = CreateIPv6Socket(static_cast<Port>(forcedPort));
+	if (netSocket6 == INVALID_SOCKET && forcedPort != 0) {
+		netSocket6 = CreateIPv6Socket(0);
+	}
+
+	// Find the address other players can reach the IPv6 socket on
+	localIPv6Address.Clear();
+	if (netSocket6 != INVALID_SOCKET && GetLocalIPv6Address(localIPv6Address))
+	{
+		sockaddr_in6 boundAddress;
+		int addressLength = sizeof(boundAddress);
+		if (getsockname(netSocket6, (sockaddr*)&boundAddress, &addressLength) == 0) {
+			localIPv6Address.ipv6.sin6_port = boundAddress.sin6_port;
+		}
+		LogDebug("Local IPv6 address: " + FormatAddress(localIPv6Address));
+	}
+
+	// Listen for LAN multicast discovery  (optional, broadcast search still works without it)
+	lanInterfaces = GetLocalIPv4Addresses();
+	if (multicastSocket != INVALID_SOCKET) {
+		closesocket(multicastSocket);
+	}
+	multicastSocket = CreateMulticastSocket();
+	if (multicastSocket == INVALID_SOCKET) {
+		Log("Warning: Could not join LAN multicast group " + std::string(LanMulticastGroup));
+	}
+
+	// Keep any receive notification working with the new sockets
+	ApplyReceiveNotify(netSocket);
+	ApplyReceiveNotify(netSocket6);
+	ApplyReceiveNotify(multicastSocket);
+
+	// A recreated socket may have a new port
+	if (portMapper.IsStarted() && netSocket != INVALID_SOCKET) {
+		portMapper.AddMapping(static_cast<Port>(GetPort()), timeGetTime());
+	}
+	// Its new NAT mapping says nothing about how long the old one lasted
+	externalEchoAddress.Clear();
+
 	// Return status
 	return netSocket != INVALID_SOCKET;
 }
 
+// Returns INVALID_SOCKET on failure
+// The socket is IPv6 only, so it can share a port number with an IPv4 socket
+SOCKET OPUNetTransportLayer::CreateIPv6Socket(Port port)
+{
+	SOCKET newSocket = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (newSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+
+	DWORD bIPv6Only = true;
+	setsockopt(newSocket, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&bIPv6Only, sizeof(bIPv6Only));
+
+	// Always bind (even to an ephemeral port), so the port is known and can be sent to other players
+	sockaddr_in6 localAddress;
+	std::memset(&localAddress, 0, sizeof(localAddress));
+	localAddress.sin6_family = AF_INET6;
+	localAddress.sin6_port = htons(port);
+	localAddress.sin6_addr = in6addr_any;
+
+	if (bind(newSocket, (sockaddr*)&localAddress, sizeof(localAddress)) == SOCKET_ERROR)
+	{
+		closesocket(newSocket);
+		return INVALID_SOCKET;
+	}
+
+	return newSocket;
+}
+
+// Returns INVALID_SOCKET on failure
+// Receives LAN multicast search queries (when hosting) and game announcements (when searching)
+SOCKET OPUNetTransportLayer::CreateMulticastSocket()
+{
+	SOCKET newSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (newSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+
+	// Allow several copies of the game on one machine to share the port
+	BOOL bReuseAddress = true;
+	setsockopt(newSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&bReuseAddress, sizeof(bReuseAddress));
+
+	sockaddr_in localAddress;
+	std::memset(&localAddress, 0, sizeof(localAddress));
+	localAddress.sin_family = AF_INET;
+	localAddress.sin_port = htons(LanMulticastPort);
+	localAddress.sin_addr.s_addr = INADDR_ANY;
+
+	if (bind(newSocket, (sockaddr*)&localAddress, sizeof(localAddress)) == SOCKET_ERROR)
+	{
+		closesocket(newSocket);
+		return INVALID_SOCKET;
+	}
+
+	// Join the group on every interface  (joining on INADDR_ANY only covers the default interface)
+	ip_mreq membership;
+	inet_pton(AF_INET, LanMulticastGroup, &membership.imr_multiaddr);
+	int numJoined = 0;
+	for (const in_addr& interfaceAddress : lanInterfaces)
+	{
+		membership.imr_interface = interfaceAddress;
+		if (setsockopt(newSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&membership, sizeof(membership)) == 0) {
+			numJoined++;
+		}
+	}
+	if (numJoined == 0)
+	{
+		membership.imr_interface.s_addr = INADDR_ANY;
+		if (setsockopt(newSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&membership, sizeof(membership)) != 0)
+		{
+			closesocket(newSocket);
+			return INVALID_SOCKET;
+		}
+	}
+
+	return newSocket;
+}
+
 bool OPUNetTransportLayer::HostGame(Port port, const char* hostPassword, const char* creatorName, int maxPlayers, int gameType)
 {
 	ClearPlayers();
 
 	sockaddr_in localAddress;
+	std::memset(&localAddress, 0, sizeof(localAddress));
 	// Check if we want to bind to the host port
 	if (port != 0)
 	{
@@ -138,6 +276,17 @@ bool OPUNetTransportLayer::HostGame(Port port, const char* hostPassword, const c
 		}
 
 		LogDebug("Bound to server port: " + std::to_string(port));
+
+		// Listen for IPv6 players on the same port number  (if the client socket doesn't already)
+		if (netSocket6 != INVALID_SOCKET && localIPv6Address.GetPort() != port) {
+			hostSocket6 = CreateIPv6Socket(port);
+		}
+
+		ApplyReceiveNotify(hostSocket);
+		ApplyReceiveNotify(hostSocket6);
+
+		// Players can join directly once the gateway forwards the host port
+		portMapper.AddMapping(port, timeGetTime());
 	}
 
 
@@ -168,13 +317,16 @@ bool OPUNetTransportLayer::HostGame(Port port, const char* hostPassword, const c
 	LogDebug(" Host playerNetID: " + FormatPlayerNetID(playerNetID));
 	// Set the host fields
 	peerInfos[HostPlayerIndex].playerNetID = playerNetID;
-	peerInfos[HostPlayerIndex].address = localAddress;
+	peerInfos[HostPlayerIndex].address = NetAddress::FromIPv4(localAddress);
 	peerInfos[HostPlayerIndex].status = PeerStatus::Normal;
 	// Update number of players
 	numPlayers = 1;
 
 	// Enable game host query replies
-	bInvite = true;
+	ChangeState(TransportEvent::HostGame);
+
+	// Let players already searching the LAN see the game right away
+	AnnounceHostedGame();
 
 
 	// Poke the game server (and let it know a new game is hosted)
@@ -200,56 +352,101 @@ bool OPUNetTransportLayer::GetExternalAddress()
 	packet.tlMessage.tlHeader.commandType = TransportLayerCommand::RequestExternalAddress;
 	packet.tlMessage.requestExternalAddress.internalPort = GetPort();
 
-	// Get the game server address
-	sockaddr_in gameServerAddr;
-	if (!GetGameServerAddress(gameServerAddr))
+	// If the echo shows a new external port, our mapping expired during this silence
+	UpdateKeepAliveServers();
+	externalEchoSilentTime = timeGetTime() - gameServerActivity.lastSendTime;
+
+	// Ask both ports of every game server at once. Comparing the echoes shows how the NAT maps ports.
+	const std::vector<std::string>& gameServerAddrs = GetNetFixSettings().gameServerAddrs;
+	NetAddress firstGameServerAddr;
+	int numSent = 0;
+	for (const std::string& gameServerAddrString : gameServerAddrs)
 	{
-		// Error. Could not obtain game server address
-		return false;		// Error
+		// Servers still being looked up are tried again by the caller
+		NetAddress gameServerAddr;
+		if (GetGameServerAddress(gameServerAddrString.c_str(), gameServerAddr) != HostAddressCode::Success || !gameServerAddr.IsIPv4()) {
+			continue;
+		}
+
+		// Send the request packet to the game server (first port)
+		if (!SendTo(packet, gameServerAddr)) {
+			continue;
+		}
+		if (numSent == 0) {
+			firstGameServerAddr = gameServerAddr;
+		}
+		numSent++;
+
+		// Send the request packet to the game server (second port)
+		gameServerAddr.SetPort(gameServerAddr.GetPort() + 1);
+		if (SendTo(packet, gameServerAddr)) {
+			numSent++;
+		}
 	}
 
-	// Send the request packet to the game server (first port)
-	bool errorCode = SendTo(packet, gameServerAddr);
-	if (errorCode == false) {
-		return false;
+	if (numSent == 0) {
+		return false;		// Error. Could not obtain a game server address
+	}
+	if (!(firstGameServerAddr == externalEchoServer))
+	{
+		externalEchoServer = firstGameServerAddr;
+		externalEchoAddress.Clear();
 	}
 
-	// Send the request packet to the game server (second port)
-	gameServerAddr.sin_port = htons(ntohs(gameServerAddr.sin_port) + 1);
-	errorCode = SendTo(packet, gameServerAddr);
+	// Only wait on echoes of requests that were sent  (some servers may still be looked up, or a send failed)
+	if (!bNatClassificationStarted) {
+		StartNatClassification(firstGameServerAddr, numSent);
+	}
 
-	return errorCode;
+	return true;
 }
 
-bool OPUNetTransportLayer::SearchForGames(char* hostAddressString, Port defaultHostPort)
+bool OPUNetTransportLayer::SearchForGames(const char* hostAddressString, Port defaultHostPort)
 {
 	// Create the default host address
-	sockaddr_in hostAddress;
-	hostAddress.sin_family = AF_INET;
-	hostAddress.sin_port = htons(defaultHostPort);
-	hostAddress.sin_addr.S_un.S_addr = INADDR_BROADCAST;
-
-	// Try to convert the string fields
-	auto errorCode = GetHostAddress(hostAddressString, hostAddress);
-	if (errorCode == HostAddressCode::InvalidAddress) {
-		return false;
-	}
+	NetAddress hostAddress = NetAddress::FromIPv4(INADDR_BROADCAST, htons(defaultHostPort));
 
 	// Construct the SearchQuery packet
 	Packet packet;
-	packet.header.sourcePlayerNetID = 0;
-	packet.header.destPlayerNetID = 0;
-	packet.header.sizeOfPayload = sizeof(HostedGameSearchQuery);
-	packet.header.type = 1;
-	packet.tlMessage.searchQuery.commandType = TransportLayerCommand::HostedGameSearchQuery;
-	packet.tlMessage.searchQuery.gameIdentifier = gameIdentifier;
-	packet.tlMessage.searchQuery.timeStamp = timeGetTime();
-	packet.tlMessage.searchQuery.password[0] = 0;
+	BuildSearchQuery(packet);
 
-	LogDebug("Search for games: " + FormatAddress(hostAddress));
+	LogDebug("Search for games: " + std::string(hostAddressString != nullptr ? hostAddressString : FormatAddress(hostAddress)));
+
+	// Game servers that know the options send many games per reply  (older servers ignore them)
+	if (hostAddressString != nullptr) {
+		SendSearchOptions(hostAddressString, hostAddress);
+	}
 
 	// Send the HostGameSearchQuery
-	return SendTo(packet, hostAddress);
+	return SendToHost(packet, hostAddressString, hostAddress);
+}
+
+// Searches the LAN using the multicast group (sent out of every interface)
+// Older hosts don't listen to the group, so bBroadcast also sends an old style broadcast search
+bool OPUNetTransportLayer::SearchForGamesOnLan(Port broadcastPort, bool bBroadcast)
+{
+	Packet packet;
+	BuildSearchQuery(packet);
+
+	bool bSuccess = SendToLanGroup(packet);
+
+	if (bBroadcast && SearchForGames(nullptr, broadcastPort)) {
+		bSuccess = true;
+	}
+
+	return bSuccess;
+}
+
+// Address that SearchForGames sends to, so replies can be matched to the address string
+bool OPUNetTransportLayer::ResolveHostAddress(const char* hostAddressString, Port defaultHostPort, NetAddress& hostAddress)
+{
+	NetAddress address = NetAddress::FromIPv4(INADDR_ANY, htons(defaultHostPort));
+	if (GetHostAddress(hostAddressString, address) != HostAddressCode::Success) {
+		return false;
+	}
+
+	hostAddress = address;
+	return true;
 }
 
 bool OPUNetTransportLayer::JoinGame(HostedGameInfo &game, const char* joinRequestPassword)
@@ -274,18 +471,50 @@ bool OPUNetTransportLayer::JoinGame(HostedGameInfo &game, const char* joinReques
 	LogDebug("  Session ID: " + FormatGuid(packet.tlMessage.joinRequest.sessionIdentifier));
 	LogDebug(FormatPacket(packet));
 
-	sockaddr_in gameServerAddr;
-	// Check if a Game Server is set
-	if (GetGameServerAddress(gameServerAddr))
+	// Send a Join message through the game servers too  (any of them may have listed the game)
+	for (const std::string& gameServerAddrString : GetNetFixSettings().gameServerAddrs)
 	{
-		// Send a Join message through the server too
-		SendTo(packet, gameServerAddr);
+		NetAddress gameServerAddr;
+		if (GetGameServerAddress(gameServerAddrString.c_str(), gameServerAddr) == HostAddressCode::Success) {
+			SendTo(packet, gameServerAddr);
+		}
 	}
 
 	// Send the JoinRequest
 	return SendTo(packet, game.address);
 }
 
+// Sent while a game is selected, so a join request gets through on its first try
+// The search query opens our NAT towards the host, and its reply updates the game's ping.
+// The game servers ask the host to open its side  (older servers ignore the request).
+bool OPUNetTransportLayer::PrepareJoin(const HostedGameInfo& game)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixJoinPrepare);
+	packet.header.type = 1;
+
+	NetFixJoinPrepare& joinPrepare = GetNetFixMessage<NetFixJoinPrepare>(packet);
+	joinPrepare.commandType = ToTransportLayerCommand(NetFixCommand::JoinPrepare);
+	joinPrepare.sessionIdentifier = game.sessionIdentifier;
+	joinPrepare.returnPortNum = forcedPort;
+
+	LogDebug("Preparing join: " + FormatAddress(game.address));
+
+	for (const std::string& gameServerAddrString : GetNetFixSettings().gameServerAddrs)
+	{
+		NetAddress gameServerAddr;
+		if (GetGameServerAddress(gameServerAddrString.c_str(), gameServerAddr) == HostAddressCode::Success) {
+			SendTo(packet, gameServerAddr);
+		}
+	}
+
+	Packet queryPacket;
+	BuildSearchQuery(queryPacket);
+	return SendTo(queryPacket, game.address);
+}
+
 
 void OPUNetTransportLayer::OnJoinAccepted(Packet &packet)
 {
@@ -300,12 +529,13 @@ void OPUNetTransportLayer::OnJoinAccepted(Packet &packet)
 	peerInfos[HostPlayerIndex].playerNetID = packet.header.sourcePlayerNetID;	// Store Host playerNetID
 	peerInfos[HostPlayerIndex].address = joiningGameInfo->address;				// Store Host address
 	peerInfos[HostPlayerIndex].status = PeerStatus::Normal;
+	peerActivity[HostPlayerIndex].Reset(timeGetTime());
 	// Get the assigned playerNetID
 	playerNetID = packet.tlMessage.joinReply.newPlayerNetID;	// Store playerNetID
 	int localPlayerNum = PlayerNetID::GetPlayerIndex(playerNetID);   // Cache (frequently used)
 	// Update local info
 	peerInfos[localPlayerNum].playerNetID = playerNetID;
-	peerInfos[localPlayerNum].address.sin_addr.s_addr = INADDR_ANY;	// Clear the address
+	peerInfos[localPlayerNum].address.Clear();	// Clear the address
 	peerInfos[localPlayerNum].status = PeerStatus::Normal;
 
 	LogDebug("OnJoinAccepted");
@@ -313,6 +543,7 @@ void OPUNetTransportLayer::OnJoinAccepted(Packet &packet)
 
 	// Update num players (for quit messages from cancelled games)
 	numPlayers = 1;
+	ChangeState(TransportEvent::JoinAccepted);
 
 	// Send updated status to host
 	bool bSuccess = SendStatusUpdate();
@@ -321,6 +552,9 @@ void OPUNetTransportLayer::OnJoinAccepted(Packet &packet)
 		LogError("Error sending updated status to host");
 	}
 
+	// Introduce ourselves to the host  (older hosts discard this)
+	SendHello(peerInfos[HostPlayerIndex].address, false);
+
 	// Reset network traffic counters
 	ResetTrafficCounters();
 }
@@ -371,12 +605,16 @@ bool OPUNetTransportLayer::GetAddress(sockaddr_in& addr)
 OPUNetTransportLayer::~OPUNetTransportLayer()
 {
 	// Check if a game was cancelled
-	if (bInvite == true)
+	if (state == TransportState::Hosting)
 	{
 		// Inform the game server
 		PokeGameServer(PokeStatusCode::GameCancelled);
 	}
 
+	LogParityStats();
+	LogCompressionStats();
+	StopPortMapping();
+
 	// Make sure we don't Cleanup if we haven't done Startup
 	if (bInitialized)
 	{
@@ -387,6 +625,18 @@ OPUNetTransportLayer::~OPUNetTransportLayer()
 		if (hostSocket != INVALID_SOCKET) {
 			closesocket(hostSocket);
 		}
+		if (netSocket6 != INVALID_SOCKET) {
+			closesocket(netSocket6);
+		}
+		if (hostSocket6 != INVALID_SOCKET) {
+			closesocket(hostSocket6);
+		}
+		if (multicastSocket != INVALID_SOCKET) {
+			closesocket(multicastSocket);
+		}
+		if (natProbeSocket != INVALID_SOCKET) {
+			closesocket(natProbeSocket);
+		}
 
 		// Shutdown Winsock
 		WSACleanup();
@@ -401,9 +651,19 @@ int OPUNetTransportLayer::GetHostPlayerNetID()
 // Called when the game is starting (but not when cancelled)
 void OPUNetTransportLayer::ShutDownInvite()
 {
+	// Joins still in progress can't complete once the game starts
+	CancelJoins();
+
+	if (state == TransportState::Hosting) {
+		Log("Connectivity at game start:" + FormatConnectivityMatrix(connectivityMatrix));
+	}
+
 	// Disable game host query replies
-	bInvite = false;
-	bGameStarted = true;
+	ChangeState(TransportEvent::StartGame);
+	SetGameSockets();
+
+	// Parity sequences start with the game
+	ResetParity();
 
 	// Let the game server know the game is starting
 	PokeGameServer(PokeStatusCode::GameStarted);
@@ -420,18 +680,23 @@ int OPUNetTransportLayer::ReplicatePlayersList()
 	// Fill in the packet body
 	packet.tlMessage.playersList.commandType = TransportLayerCommand::SetPlayersList;
 	packet.tlMessage.playersList.numPlayers = numPlayers;
-	// Copy the players list
+	// Copy the players list  (players who joined over IPv6 have no IPv4 address to list)
 	for (int i = 0; i < MaxRemotePlayers; i++)
 	{
-		packet.tlMessage.playersList.netPeerInfo[i].ip = peerInfos[i].address.sin_addr.s_addr;
-		packet.tlMessage.playersList.netPeerInfo[i].port = peerInfos[i].address.sin_port;
+		const bool bIPv4 = peerInfos[i].address.IsIPv4();
+		packet.tlMessage.playersList.netPeerInfo[i].ip = bIPv4 ? peerInfos[i].address.ipv4.sin_addr.s_addr : 0;
+		packet.tlMessage.playersList.netPeerInfo[i].port = bIPv4 ? peerInfos[i].address.ipv4.sin_port : 0;
 		packet.tlMessage.playersList.netPeerInfo[i].status = peerInfos[i].status;
 		packet.tlMessage.playersList.netPeerInfo[i].playerNetID = peerInfos[i].playerNetID;
 	};
 
+	// IPv6 addresses are sent separately, to players that understand them
+	Packet peerAddressListPacket;
+	BuildPeerAddressList(peerAddressListPacket);
+
 
 	// Send the Player List
-	int retVal = SendUntilStatusUpdate(packet, PeerStatus::ReplicateSuccess, 16, 500);
+	int retVal = SendUntilStatusUpdate(packet, PeerStatus::ReplicateSuccess, 16, 500, &peerAddressListPacket);
 
 
 	// Check for errors
@@ -496,6 +761,14 @@ void OPUNetTransportLayer::RemovePlayer(int playerNetID)
 	{
 		// Remove the player
 		peerInfos[playerIndex].Clear();
+		parityEncoders[playerIndex].Reset();
+		parityDecoders[playerIndex].Reset();
+		punchPeers[playerIndex].Clear();
+		for (int otherIndex = 0; otherIndex < MaxRemotePlayers; ++otherIndex)
+		{
+			connectivityMatrix[playerIndex][otherIndex] = -1;
+			connectivityMatrix[otherIndex][playerIndex] = -1;
+		}
 		// Update player count
 		numPlayers--;
 	}
@@ -523,111 +796,143 @@ int OPUNetTransportLayer::Send(Packet& packet)
 void OPUNetTransportLayer::SendBroadcast(Packet& packet, int packetSize)
 {
 	// Send packet to all players
-	for (PeerInfo& peerInfo : peerInfos)
+	CompressedCopy compressedCopy;
+	for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex)
 	{
-		// Make sure the player record is valid
-		if (peerInfo.status != PeerStatus::EmptySlot)
-		{
-			// Don't send to self
-			if (peerInfo.playerNetID != playerNetID)
-			{
-				// Send the packet to current player
-				sockaddr_in* address = &peerInfo.address;
-				int errorCode = sendto(netSocket, reinterpret_cast<char*>(&packet), packetSize, 0, (sockaddr*)address, sizeof(*address));
-
-				if (errorCode != SOCKET_ERROR)
-				{
-					trafficCounters.numPacketsSent++;
-					trafficCounters.numBytesSent += packetSize;
-				}
-			}
-		}
+		SendToPeer(playerIndex, packet, packetSize, compressedCopy);
 	}
 }
 
 void OPUNetTransportLayer::SendSinglecast(Packet& packet, int packetSize)
 {
-	PeerInfo& peerInfo = peerInfos[packet.header.destPlayerNetID & 7];
+	const int playerIndex = packet.header.destPlayerNetID & 7;
+	if (playerIndex < MaxRemotePlayers)
+	{
+		CompressedCopy compressedCopy;
+		SendToPeer(playerIndex, packet, packetSize, compressedCopy);
+	}
+}
+
+void OPUNetTransportLayer::SendToPeer(int playerIndex, Packet& packet, int packetSize, CompressedCopy& compressedCopy)
+{
+	PeerInfo& peerInfo = peerInfos[playerIndex];
 
 	// Make sure the player record is valid
-	if (peerInfo.status != PeerStatus::EmptySlot)
+	if (peerInfo.status == PeerStatus::EmptySlot) {
+		return;
+	}
+	// Don't send to self
+	if (peerInfo.playerNetID == playerNetID) {
+		return;
+	}
+
+	const char* sendBuffer = reinterpret_cast<char*>(&packet);
+	int sendSize = packetSize;
+
+	// Compressed packets are sent in place of the original  (and are not covered by parity)
+	const Packet* compressedPacket = CompressForPeer(peerInfo, packet, compressedCopy);
+	const bool bCompressed = (compressedPacket != nullptr);
+	if (bCompressed)
 	{
-		// Don't send to self
-		if (peerInfo.playerNetID != playerNetID)
-		{
-			sockaddr_in* address = &peerInfo.address;
-			int errorCode = sendto(netSocket, reinterpret_cast<char*>(&packet), packetSize, 0, (sockaddr*)address, sizeof(*address));
+		sendBuffer = reinterpret_cast<const char*>(compressedPacket);
+		sendSize = sizeof(compressedPacket->header) + compressedPacket->header.sizeOfPayload;
+	}
 
-			if (errorCode != SOCKET_ERROR)
-			{
-				trafficCounters.numPacketsSent++;
-				trafficCounters.numBytesSent += packetSize;
-			}
-		}
+	// Tag packets covered by parity with their sequence number
+	char taggedPacket[sizeof(Packet) + sizeof(NetFixParityTrailer)];
+	const bool bParityCovered = !bCompressed && IsParityCovered(peerInfo, packet, packetSize);
+	if (bParityCovered)
+	{
+		const NetFixParityTrailer trailer{ ParityTrailerMarker, parityEncoders[playerIndex].Add(packet, packetSize) };
+		std::memcpy(taggedPacket, &packet, packetSize);
+		std::memcpy(taggedPacket + packetSize, &trailer, sizeof(trailer));
+		sendBuffer = taggedPacket;
+		sendSize += sizeof(trailer);
+
+		parityStats.numPacketsCovered++;
+		parityStats.numBytesCovered += packetSize;
+	}
+
+	SendToPlayer(sendBuffer, sendSize, peerInfo, peerInfo.bUseRelay);
+
+	// Follow each full group with its parity
+	if (bParityCovered && parityEncoders[playerIndex].IsGroupComplete(GetNetFixSettings().parityGroupSize)) {
+		SendParity(playerIndex);
 	}
 }
 
 int OPUNetTransportLayer::Receive(Packet& packet)
 {
+	// One clock read serves every deadline checked in this call
+	const DWORD currentTime = timeGetTime();
+
+	// In game, only the paths to the players need looking after. Everything else is lobby work.
+	const bool bInGame = (state == TransportState::InGame);
+	if (bInGame)
+	{
+		if (static_cast<int>(currentTime - nextPathProbeTime) >= 0)
+		{
+			ProbePaths(currentTime);
+			// Port mapping leases are renewed at the same pace  (a long game can outlast one)
+			if (portMapSocket != INVALID_SOCKET && (portMapper.HasPendingRequests() || portMapper.IsDue(currentTime))) {
+				UpdatePortMapping(currentTime);
+			}
+		}
+	}
+	else {
+		UpdateLobby(currentTime);
+	}
+
 	for (;;)
 	{
-		// Check if we need to return a JoinReturned packet
-		if (numJoining != 0)
+		// Packets made up by the transport layer, or held back, for the lobby
+		if (!bInGame && GetLobbyPacket(packet, currentTime)) {
+			return true;
+		}
+
+		NetAddress fromAddress;
+		int numBytes = -1;
+		const bool bRebuilt = !rebuiltPackets.empty();
+		if (bRebuilt)
+		{
+			// Packets rebuilt from parity, decompressed, or relayed, are processed as if they had just arrived
+			packet = rebuiltPackets.front().packet;
+			fromAddress = rebuiltPackets.front().fromAddress;
+			numBytes = rebuiltPackets.front().size;
+			rebuiltPackets.pop_front();
+		}
+		else if (bInGame)
 		{
-			// Check each player for joining
-			for (PeerInfo& peerInfo : peerInfos)
+			// Only the sockets players send to  (set when the game started)
+			for (std::size_t i = 0; i < numGameSockets; ++i)
 			{
-				// Check if this player is joining
-				if (peerInfo.bReturnJoinPacket)
+				numBytes = ReadSocket(gameSockets[i], packet, fromAddress);
+				if (numBytes != -1)
 				{
-					// Construct the JoinGranted packet
-					// Note: This packet is returned as if it was received over the network
-					// Note: Required sourcePlayerNetID=0 for: 1=JoinGranted, 3=RemoteStart, 4=SetPlayerList
-					packet.header.sourcePlayerNetID = 0;	// Must be 0 to be processed
-					packet.header.destPlayerNetID = playerNetID;		// Send fake packet to self
-					packet.header.sizeOfPayload = sizeof(JoinReturned);
-					packet.header.type = 1;
-					packet.tlMessage.tlHeader.commandType = TransportLayerCommand::JoinGranted;
-					packet.tlMessage.joinReturned.newPlayerNetID = peerInfo.playerNetID;
-
-					// Mark as returned
-					peerInfo.bReturnJoinPacket = false;
-					numJoining--;
-					return true;		// Return packet for processing
+					lastSourceSocket = gameSockets[i];
+					break;
 				}
-				else
+			}
+		}
+		else
+		{
+			// Try to read from each socket in turn (net socket first)
+			const SOCKET sourceSockets[] = { netSocket, hostSocket, netSocket6, hostSocket6, multicastSocket };
+			for (SOCKET sourceSocket : sourceSockets)
+			{
+				numBytes = ReadSocket(sourceSocket, packet, fromAddress);
+				if (numBytes != -1)
 				{
-					// Check if partially joined
-					if (peerInfo.status == PeerStatus::Joining)
-					{
-						// Check if timed out
-						if (timeGetTime() - PlayerNetID::GetTimeStamp(peerInfo.playerNetID) > JoinTimeOut)
-						{
-							// Cancel the join, and reclaim the player record
-							numPlayers--;
-							numJoining--;
-							peerInfo.bReturnJoinPacket = false;
-							peerInfo.Clear();
-						}
-					}
+					lastSourceSocket = sourceSocket;
+					break;
 				}
 			}
 		}
-
-
-		// Try to read from the net socket
-		sockaddr_in fromAddress;
-		auto numBytes = ReadSocket(netSocket, packet, fromAddress);
 		// Check for errors
-		if (numBytes == -1)
-		{
-			// Try to read from the host socket
-			numBytes = ReadSocket(hostSocket, packet, fromAddress);
-			// Check for errors
-			if (numBytes == -1) {
-				return false;
-			}
+		if (numBytes == -1) {
+			return false;
 		}
+		lastSourceAddress = fromAddress;
 
 		LogDebug("ReadSocket: type = " + std::to_string(packet.header.type)
 			+ "  commandType = " + FormatTransportLayerCommandIncludeIndex(packet.tlMessage.tlHeader.commandType)
@@ -665,12 +970,23 @@ int OPUNetTransportLayer::Receive(Packet& packet)
 			}
 		}
 
-		// Count the received packet
-		trafficCounters.numPacketsReceived++;
-		trafficCounters.numBytesReceived += packet.header.sizeOfPayload + sizeof(packet.header);
+		// Count the received packet  (rebuilt packets were counted as they arrived)
+		if (!bRebuilt)
+		{
+			trafficCounters.numPacketsReceived++;
+			trafficCounters.numBytesReceived += packet.header.sizeOfPayload + sizeof(packet.header);
+		}
+
+		// Discard packets that were already rebuilt from parity
+		if (!AcceptParityTrailer(packet, numBytes)) {
+			continue;
+		}
 
 		// Check for unexpected source ports
-		CheckSourcePort(packet, fromAddress);
+		CheckSourcePort(packet, fromAddress, currentTime);
+		if (sourcePlayerNetID != 0) {
+			peerActivity[PlayerNetID::GetPlayerIndex(sourcePlayerNetID)].lastReceiveTime = currentTime;
+		}
 
 		// Determine if immediate processing is required
 		bool bRetVal = packet.header.type == 1;
@@ -689,6 +1005,12 @@ int OPUNetTransportLayer::Receive(Packet& packet)
 			// Validate packet makes sense (discard if it doesn't)
 			if (ValidatePacket(packet, fromAddress))
 			{
+				// The NAT is classified from echoes as they arrive  (held warm up replies were handled when they arrived)
+				if (packet.header.type == 1 && packet.tlMessage.tlHeader.commandType == TransportLayerCommand::EchoExternalAddress &&
+					packet.header.sizeOfPayload == sizeof(EchoExternalAddress))
+				{
+					OnExternalAddressEcho(packet.tlMessage.echoExternalAddress);
+				}
 				// Non immediate processed packet received. Return packet
 				return true;
 			}
@@ -696,14 +1018,134 @@ int OPUNetTransportLayer::Receive(Packet& packet)
 	}
 }
 
+// In game, players only send to the client and host sockets
+void OPUNetTransportLayer::SetGameSockets()
+{
+	numGameSockets = 0;
+	for (SOCKET gameSocket : { netSocket, hostSocket, netSocket6, hostSocket6 })
+	{
+		if (gameSocket == INVALID_SOCKET || std::find(gameSockets.begin(), gameSockets.begin() + numGameSockets, gameSocket) != gameSockets.begin() + numGameSockets) {
+			continue;
+		}
+		gameSockets[numGameSockets++] = gameSocket;
+	}
+}
+
+// Timers and retries for searching, joining, and setting up a game
+void OPUNetTransportLayer::UpdateLobby(DWORD currentTime)
+{
+	// Send any packets that were waiting on a host name lookup
+	if (!deferredSends.empty()) {
+		SendDeferred(currentTime);
+	}
+	// Send any held back replies that are now due
+	if (!delayedSends.IsEmpty()) {
+		SendDelayed(currentTime);
+	}
+	// Cancel joins that didn't finish in time
+	if (!joinDeadlines.IsEmpty()) {
+		ExpireJoins(currentTime);
+	}
+	// Measure the direct and relay paths to each player
+	if (static_cast<int>(currentTime - nextPathProbeTime) >= 0) {
+		ProbePaths(currentTime);
+	}
+	// Request, retry, and renew port mappings
+	if (portMapSocket != INVALID_SOCKET && (portMapper.HasPendingRequests() || portMapper.IsDue(currentTime))) {
+		UpdatePortMapping(currentTime);
+	}
+	// Finish classifying the NAT
+	if (natClassifier.IsRunning())
+	{
+		ReadNatProbeSocket();
+		if (natClassifier.Update(currentTime)) {
+			FinishNatClassification();
+		}
+	}
+	// Open paths between players before the game starts
+	if (static_cast<int>(currentTime - nextPunchTime) >= 0) {
+		UpdatePunching(currentTime);
+	}
+	// Keep NAT mappings open while waiting for the game to start
+	if (static_cast<int>(currentTime - nextKeepAliveTime) >= 0) {
+		SendKeepAlives(currentTime);
+	}
+	// Subscribe to the game servers' lists, and renew the subscriptions
+	if (bGameListSubscribed) {
+		UpdateGameListSubscriptions(currentTime);
+	}
+}
+
+// Packets for the lobby that were made up by the transport layer, or held back. Returns true if one was returned.
+bool OPUNetTransportLayer::GetLobbyPacket(Packet& packet, DWORD currentTime)
+{
+	// Check if we need to return a JoinReturned packet
+	if (state == TransportState::Hosting && numJoining != 0)
+	{
+		// Check each player for joining
+		for (PeerInfo& peerInfo : peerInfos)
+		{
+			// Check if this player is joining
+			if (peerInfo.bReturnJoinPacket)
+			{
+				// Construct the JoinGranted packet
+				// Note: This packet is returned as if it was received over the network
+				// Note: Required sourcePlayerNetID=0 for: 1=JoinGranted, 3=RemoteStart, 4=SetPlayerList
+				packet.header.sourcePlayerNetID = 0;	// Must be 0 to be processed
+				packet.header.destPlayerNetID = playerNetID;		// Send fake packet to self
+				packet.header.sizeOfPayload = sizeof(JoinReturned);
+				packet.header.type = 1;
+				packet.tlMessage.tlHeader.commandType = TransportLayerCommand::JoinGranted;
+				packet.tlMessage.joinReturned.newPlayerNetID = peerInfo.playerNetID;
+
+				// Mark as returned
+				peerInfo.bReturnJoinPacket = false;
+				numJoining--;
+				return true;		// Return packet for processing
+			}
+		}
+	}
+
+
+	// Return game list changes pushed, or batched, by a game server  (already checked, and in the form the lobby expects)
+	if (!gameListPackets.empty())
+	{
+		packet = gameListPackets.front().packet;
+		lastSourceAddress = gameListPackets.front().fromAddress;
+		gameListPackets.pop_front();
+		return true;
+	}
+
+	// Return replies received during the warm up, as if they had just arrived
+	while (!bWarmingUp && !warmUpReplies.empty())
+	{
+		const WarmUpReply reply = warmUpReplies.front();
+		warmUpReplies.pop_front();
+		const DWORD age = currentTime - reply.receiveTime;
+		if (age > WarmUpReplyMaxAge) {
+			continue;
+		}
+
+		packet = reply.rebuilt.packet;
+		lastSourceAddress = reply.rebuilt.fromAddress;
+		// Ping is measured from the echoed time stamp, so leave out the time the reply was held
+		if (packet.tlMessage.tlHeader.commandType == TransportLayerCommand::HostedGameSearchReply) {
+			packet.tlMessage.searchReply.timeStamp += age;
+		}
+		return true;
+	}
+
+	return false;
+}
+
 int OPUNetTransportLayer::IsHost()				// IsCurrentGameHost?
 {
-	return (bInvite && (playerNetID == peerInfos[HostPlayerIndex].playerNetID));
+	return (state == TransportState::Hosting && (playerNetID == peerInfos[HostPlayerIndex].playerNetID));
 }
 
 int OPUNetTransportLayer::IsValidPlayer()		// IsHostWaitingToStart?
 {
-	return bInvite;
+	return state == TransportState::Hosting;
 }
 
 int OPUNetTransportLayer::F1()
@@ -714,12 +1156,57 @@ int OPUNetTransportLayer::F1()
 int OPUNetTransportLayer::GetAddressString(int playerNetID, char* addressString, int bufferSize)
 {
 	// Get the address and convert it to a string
-	sockaddr_in* address = &peerInfos[PlayerNetID::GetPlayerIndex(playerNetID)].address;
-	scr_snprintf(addressString, bufferSize, "%i.%i.%i.%i", address->sin_addr.S_un.S_un_b.s_b1, address->sin_addr.S_un.S_un_b.s_b2, address->sin_addr.S_un.S_un_b.s_b3, address->sin_addr.S_un.S_un_b.s_b4);
+	const NetAddress& address = peerInfos[PlayerNetID::GetPlayerIndex(playerNetID)].GetSendAddress();
+	scr_snprintf(addressString, bufferSize, "%s", FormatIPAddress(address).c_str());
 
 	return true;
 }
 
+const NetAddress& OPUNetTransportLayer::GetLastSourceAddress() const
+{
+	return lastSourceAddress;
+}
+
+// Posts notifyMessage to notifyWindow whenever a socket has a packet to read
+// Sockets are non-blocking while notification is on. Turning it off puts them back in blocking mode.
+void OPUNetTransportLayer::SetReceiveNotify(HWND notifyWindow, UINT notifyMessage)
+{
+	const SOCKET sockets[] = { netSocket, hostSocket, netSocket6, hostSocket6, multicastSocket, natProbeSocket, portMapSocket };
+
+	if (notifyWindow == nullptr)
+	{
+		if (receiveNotifyWindow != nullptr)
+		{
+			for (SOCKET socket : sockets)
+			{
+				if (socket != INVALID_SOCKET)
+				{
+					WSAAsyncSelect(socket, receiveNotifyWindow, 0, 0);
+					unsigned long bNonBlocking = 0;
+					ioctlsocket(socket, FIONBIO, &bNonBlocking);
+				}
+			}
+		}
+		receiveNotifyWindow = nullptr;
+		receiveNotifyMessage = 0;
+		return;
+	}
+
+	receiveNotifyWindow = notifyWindow;
+	receiveNotifyMessage = notifyMessage;
+	for (SOCKET socket : sockets) {
+		ApplyReceiveNotify(socket);
+	}
+}
+
+bool OPUNetTransportLayer::HasPendingSends() const
+{
+	return !deferredSends.empty() || !delayedSends.IsEmpty() || (portMapSocket != INVALID_SOCKET && portMapper.HasPendingRequests()) ||
+		std::any_of(gameListSubscriptions.begin(), gameListSubscriptions.end(), [](const GameListSubscription& subscription) {
+			return subscription.HasPendingRequests();
+		});
+}
+
 int OPUNetTransportLayer::ResetTrafficCounters()
 {
 	// Clear the TrafficCounters
@@ -756,16 +1243,48 @@ OPUNetTransportLayer::OPUNetTransportLayer()	// Private Constructor  [Prevent ob
 	bInitialized = false;
 	netSocket = INVALID_SOCKET;
 	hostSocket = INVALID_SOCKET;
+	netSocket6 = INVALID_SOCKET;
+	hostSocket6 = INVALID_SOCKET;
+	multicastSocket = INVALID_SOCKET;
+	lastSourceSocket = INVALID_SOCKET;
+	numGameSockets = 0;
 	forcedPort = 0;
+	localIPv6Address.Clear();
+	lastSourceAddress.Clear();
+	receiveNotifyWindow = nullptr;
+	receiveNotifyMessage = 0;
 	std::memset(&peerInfos, 0, sizeof(peerInfos));
-	bInvite = false;
-	bGameStarted = false;
+	state = TransportState::Idle;
 	std::memset(&hostedGameInfo, 0, sizeof(hostedGameInfo));
 	hostedGameInfo.ping = -1;
 	ResetTrafficCounters();
+	parityStats = ParityStats{};
+	compressionStats = CompressionStats{};
+	probedPlayerNetIDs.fill(0);
+	nextPathProbeTime = timeGetTime();
+	cachedRelayAddress.Clear();
+	ResetPunching();
+	bNatClassificationStarted = false;
+	natCacheInterface.Clear();
+	natProbeSocket = INVALID_SOCKET;
+	natProbeServer.Clear();
+	natProbeNonce = 0;
+	portMapSocket = INVALID_SOCKET;
+	for (PathActivity& activity : peerActivity) {
+		activity.Reset(timeGetTime());
+	}
+	gameServerActivity.Reset(timeGetTime());
+	nextKeepAliveTime = timeGetTime();
+	externalEchoServer.Clear();
+	externalEchoAddress.Clear();
+	externalEchoSilentTime = 0;
+	bGameListSubscribed = false;
+	bWarmingUp = false;
 	joiningGameInfo = nullptr;
 	numJoining = 0;
 	randValue = timeGetTime() ^ RandValueXor;
+	// Seed differently on each machine (and process), so hosts pick different reply delays
+	jitterRandom.seed(timeGetTime() ^ GetCurrentProcessId());
 }
 
 
@@ -803,7 +1322,7 @@ bool OPUNetTransportLayer::InitializeWinsock()
 
 // -------------------------------------------
 
-OPUNetTransportLayer::HostAddressCode OPUNetTransportLayer::GetHostAddress(char* hostAddressString, sockaddr_in &hostAddress)
+OPUNetTransportLayer::HostAddressCode OPUNetTransportLayer::GetHostAddress(const char* hostAddressString, NetAddress &hostAddress)
 {
 	// Check if a specific host address was indicated
 	if (hostAddressString == nullptr) {
@@ -818,60 +1337,80 @@ OPUNetTransportLayer::HostAddressCode OPUNetTransportLayer::GetHostAddress(char*
 		hostAddressString++;
 	}
 
+	// Split off the port number (if any)
+	// IPv6 addresses contain ':' themselves, so they need brackets to specify a port: [::1]:47800
+	std::string hostString(hostAddressString);
+	const char* portNumString = nullptr;
+	if (hostString[0] == '[')
+	{
+		const std::size_t closeBracket = hostString.find(']');
+		if (closeBracket == std::string::npos) {
+			return HostAddressCode::InvalidAddress;
+		}
+		if (hostString[closeBracket + 1] == ':') {
+			portNumString = &hostAddressString[closeBracket + 2];
+		}
+		hostString = hostString.substr(1, closeBracket - 1);
+	}
+	else if (std::count(hostString.begin(), hostString.end(), ':') == 1)
+	{
+		const std::size_t colon = hostString.find(':');
+		portNumString = &hostAddressString[colon + 1];
+		hostString.erase(colon);
+	}
+
 	// Check if a port number was specified
-	char* portNumString = strchr(hostAddressString, ':');
+	Port port = hostAddress.GetPort();
 	if (portNumString != nullptr)
 	{
-		// Convert the port number
-		int port = atoi(&portNumString[1]);
 		// Make sure a number was actually specified  (otherwise use the default port)
-		if (port != 0) {
-			hostAddress.sin_port = htons(port);
+		int specifiedPort = atoi(portNumString);
+		if (specifiedPort != 0)
+		{
+			port = static_cast<Port>(specifiedPort);
+			hostAddress.SetPort(port);
 		}
-		// Truncate the address string, so lookup succeeds
-		portNumString[0] = 0;
 	}
 
 	// Check if the address part is empty  (in which case use the default)
-	if (hostAddressString[0] == 0)
-	{
-		if (portNumString != nullptr) {
-			portNumString[0] = ':';		// Restore string
-		}
+	if (hostString.empty()) {
 		return HostAddressCode::NoAddressSpecified;
 	}
 
+	auto returnCode = HostAddressCode::Success;
+
 	// First try a numeric conversion
-	hostAddress.sin_addr.S_un.S_addr = inet_addr(hostAddressString);
-	// Check for failure
-	if (hostAddress.sin_addr.S_un.S_addr == INADDR_NONE)
-	{
-		HOSTENT* hostEnt;
-		// Try looking up the address
-		hostEnt = gethostbyname(hostAddressString);
-		// Check for failure
-		if (hostEnt == nullptr)
+	NetAddress address;
+	if (!ParseIPAddress(hostString.c_str(), address))
+	{
+		// Try looking up the address (never blocks, a lookup is done in the background if not cached)
+		switch (hostAddressCache.Lookup(hostString, address))
 		{
-			if (portNumString != nullptr) {
-				portNumString[0] = ':';		// Restore string
-			}
-			return HostAddressCode::InvalidAddress;
+		case HostAddressCache::LookupResult::Resolved:
+			break;
+		case HostAddressCache::LookupResult::Pending:
+			returnCode = HostAddressCode::Pending;
+			break;
+		case HostAddressCache::LookupResult::Failed:
+			returnCode = HostAddressCode::InvalidAddress;
+			break;
 		}
-		// Get the host IP address
-		hostAddress.sin_addr.S_un.S_addr = *(unsigned long*)hostEnt->h_addr_list[0];
 	}
 
-	if (portNumString != nullptr) {
-		portNumString[0] = ':';		// Restore string
+	if (returnCode == HostAddressCode::Success)
+	{
+		hostAddress = address;
+		hostAddress.SetPort(port);
 	}
-	return HostAddressCode::Success;
+
+	return returnCode;
 }
 
 
 // -------------------------------------------
 
 // Returns a new playerNetID
-int OPUNetTransportLayer::AddPlayer(const sockaddr_in& from)
+int OPUNetTransportLayer::AddPlayer(const NetAddress& from)
 {
 	// Make sure there is room for a new player
 	if (numPlayers >= hostedGameInfo.createGameInfo.startupFlags.maxPlayers) {
@@ -890,9 +1429,12 @@ int OPUNetTransportLayer::AddPlayer(const sockaddr_in& from)
 			peerInfos[newPlayerIndex].address = from;
 			peerInfos[newPlayerIndex].status = PeerStatus::Joining;
 			peerInfos[newPlayerIndex].playerNetID = PlayerNetID::SetCurrentTime(newPlayerIndex);
+			peerActivity[newPlayerIndex].Reset(timeGetTime());
 			// Increase connected player count
 			numPlayers++;
 			numJoining++;
+			// The join is cancelled if it doesn't finish in time
+			joinDeadlines.Push(timeGetTime() + JoinTimeOut, JoinDeadline{ newPlayerIndex, peerInfos[newPlayerIndex].playerNetID });
 
 			// Return the new playerNetID
 			return peerInfos[newPlayerIndex].playerNetID;	// Success
@@ -906,7 +1448,7 @@ int OPUNetTransportLayer::AddPlayer(const sockaddr_in& from)
 
 // -------------------------------------------
 
-int OPUNetTransportLayer::ReadSocket(SOCKET sourceSocket, Packet& packet, sockaddr_in& from)
+int OPUNetTransportLayer::ReadSocket(SOCKET sourceSocket, Packet& packet, NetAddress& from)
 {
 	// Check if the host socket is in use
 	if (sourceSocket == INVALID_SOCKET) {
@@ -925,15 +1467,18 @@ int OPUNetTransportLayer::ReadSocket(SOCKET sourceSocket, Packet& packet, sockad
 		return -1;
 	}
 
-	// Read the data
-	int fromLen = sizeof(from);
+	// Read the data  (into storage large enough for an address of either family)
+	sockaddr_storage fromStorage;
+	int fromLen = sizeof(fromStorage);
 	auto receivedByteCount = recvfrom(sourceSocket, reinterpret_cast<char*>(&packet),
-		sizeof(packet), 0, reinterpret_cast<sockaddr*>(&from), &fromLen);
+		sizeof(packet), 0, reinterpret_cast<sockaddr*>(&fromStorage), &fromLen);
 
 	if (receivedByteCount == SOCKET_ERROR) {
 		return -1;
 	}
 
+	from = NetAddress::FromSocketAddress(reinterpret_cast<sockaddr*>(&fromStorage), fromLen);
+
 	// Return number of bytes read
 	return receivedByteCount;
 }
@@ -941,7 +1486,13 @@ int OPUNetTransportLayer::ReadSocket(SOCKET sourceSocket, Packet& packet, sockad
 
 // -------------------------------------------
 
-bool OPUNetTransportLayer::SendTo(Packet& packet, const sockaddr_in& to)
+// Packets are sent from the client socket of the destination's address family
+SOCKET OPUNetTransportLayer::GetSendSocket(const NetAddress& to) const
+{
+	return to.IsIPv6() ? netSocket6 : netSocket;
+}
+
+bool OPUNetTransportLayer::SendTo(Packet& packet, const NetAddress& to)
 {
 	LogDebug("SendTo: Packet.commandType = " + FormatTransportLayerCommandIncludeIndex(packet.tlMessage.tlHeader.commandType));
 
@@ -951,7 +1502,7 @@ bool OPUNetTransportLayer::SendTo(Packet& packet, const sockaddr_in& to)
 	packet.header.checksum = packet.Checksum();
 
 	// Send the packet
-	int errorCode = sendto(netSocket, (char*)&packet, packetSize, 0, (sockaddr*)&to, sizeof(to));
+	int errorCode = sendto(GetSendSocket(to), (char*)&packet, packetSize, 0, to.GetSocketAddress(), to.GetSocketAddressLength());
 
 	// Check for errors
 	if (errorCode != SOCKET_ERROR)
@@ -959,6 +1510,7 @@ bool OPUNetTransportLayer::SendTo(Packet& packet, const sockaddr_in& to)
 		// Update traffic counters
 		trafficCounters.numPacketsSent++;
 		trafficCounters.numBytesSent += packetSize;
+		NoteServerSent(to);
 	}
 	else
 	{
@@ -969,6 +1521,168 @@ bool OPUNetTransportLayer::SendTo(Packet& packet, const sockaddr_in& to)
 	return (errorCode != SOCKET_ERROR);
 }
 
+// Sends to the host named by the address string, or to the default address if none is given
+// If the host name is still being looked up, the packet is queued and sent once the lookup completes
+bool OPUNetTransportLayer::SendToHost(Packet& packet, const char* hostAddressString, const NetAddress& defaultAddress)
+{
+	NetAddress hostAddress = defaultAddress;
+	auto errorCode = GetHostAddress(hostAddressString, hostAddress);
+
+	switch (errorCode)
+	{
+	case HostAddressCode::Success:
+	case HostAddressCode::NoAddressSpecified:
+		return SendTo(packet, hostAddress);
+	case HostAddressCode::Pending:
+		LogDebug("Waiting on address lookup: " + std::string(hostAddressString));
+		deferredSends.push_back(DeferredSend{ packet, hostAddressString, defaultAddress, timeGetTime() });
+		return true;
+	default:
+		return false;
+	}
+}
+
+void OPUNetTransportLayer::SendDeferred(DWORD currentTime)
+{
+	for (auto it = deferredSends.begin(); it != deferredSends.end(); )
+	{
+		NetAddress hostAddress = it->defaultAddress;
+		auto errorCode = GetHostAddress(it->hostAddressString.c_str(), hostAddress);
+
+		if (errorCode == HostAddressCode::Pending)
+		{
+			// Keep waiting, unless the lookup is taking too long
+			if (currentTime - it->queueTime <= DeferredSendTimeOut)
+			{
+				++it;
+				continue;
+			}
+			Log("Address lookup timed out: " + it->hostAddressString);
+		}
+		else if (errorCode == HostAddressCode::InvalidAddress)
+		{
+			Log("Address lookup failed: " + it->hostAddressString);
+		}
+		else
+		{
+			SendTo(it->packet, hostAddress);
+		}
+
+		it = deferredSends.erase(it);
+	}
+}
+
+void OPUNetTransportLayer::SendDelayed(DWORD currentTime)
+{
+	DelayedSend delayedSend;
+	while (delayedSends.PopDue(currentTime, delayedSend)) {
+		SendTo(delayedSend.packet, delayedSend.address);
+	}
+}
+
+void OPUNetTransportLayer::BuildSearchQuery(Packet& packet)
+{
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = 0;
+	packet.header.sizeOfPayload = sizeof(HostedGameSearchQuery);
+	packet.header.type = 1;
+	packet.tlMessage.searchQuery.commandType = TransportLayerCommand::HostedGameSearchQuery;
+	packet.tlMessage.searchQuery.gameIdentifier = gameIdentifier;
+	packet.tlMessage.searchQuery.timeStamp = timeGetTime();
+	std::memset(packet.tlMessage.searchQuery.password, 0, sizeof(packet.tlMessage.searchQuery.password));
+}
+
+// Only to game servers (not hosts), and only when the server may have forgotten them
+bool OPUNetTransportLayer::SendSearchOptions(const char* gameServerAddressString, const NetAddress& defaultAddress)
+{
+	const std::vector<std::string>& gameServerAddrs = GetNetFixSettings().gameServerAddrs;
+	if (std::find(gameServerAddrs.begin(), gameServerAddrs.end(), gameServerAddressString) == gameServerAddrs.end()) {
+		return false;
+	}
+
+	const DWORD currentTime = timeGetTime();
+	const auto sendTime = searchOptionsSendTimes.find(gameServerAddressString);
+	if (sendTime != searchOptionsSendTimes.end() && currentTime - sendTime->second < SearchOptionsRefreshInterval) {
+		return true;
+	}
+
+	Packet packet;
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixSearchOptions);
+	packet.header.type = 1;
+
+	NetFixSearchOptions& options = GetNetFixMessage<NetFixSearchOptions>(packet);
+	options.commandType = ToTransportLayerCommand(NetFixCommand::SearchOptions);
+	options.flags = NetFixSearchFlag::BatchedReplies;
+
+	if (!SendToHost(packet, gameServerAddressString, defaultAddress)) {
+		return false;
+	}
+	searchOptionsSendTimes[gameServerAddressString] = currentTime;
+	return true;
+}
+
+// Sends an unsolicited search reply to the LAN multicast group
+void OPUNetTransportLayer::AnnounceHostedGame()
+{
+	// Password protected games only answer queries with the password
+	if (multicastSocket == INVALID_SOCKET || hostPassword[0] != 0) {
+		return;
+	}
+
+	Packet packet;
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = 0;
+	packet.header.sizeOfPayload = sizeof(HostedGameSearchReply);
+	packet.header.type = 1;
+	packet.tlMessage.searchReply.commandType = TransportLayerCommand::HostedGameSearchReply;
+	packet.tlMessage.searchReply.gameIdentifier = gameIdentifier;
+	packet.tlMessage.searchReply.timeStamp = timeGetTime();
+	packet.tlMessage.searchReply.sessionIdentifier = hostedGameInfo.sessionIdentifier;
+	packet.tlMessage.searchReply.createGameInfo = hostedGameInfo.createGameInfo;
+	std::memset(&packet.tlMessage.searchReply.hostAddress, 0, sizeof(packet.tlMessage.searchReply.hostAddress));
+
+	SendToLanGroup(packet);
+}
+
+// Sends to the LAN multicast group out of every interface
+bool OPUNetTransportLayer::SendToLanGroup(Packet& packet)
+{
+	NetAddress groupAddress;
+	ParseIPAddress(LanMulticastGroup, groupAddress);
+	groupAddress.SetPort(LanMulticastPort);
+
+	// No known interfaces, so just use the default one
+	if (lanInterfaces.empty()) {
+		return SendTo(packet, groupAddress);
+	}
+
+	const SOCKET sendSocket = GetSendSocket(groupAddress);
+	bool bSuccess = false;
+	for (const in_addr& interfaceAddress : lanInterfaces)
+	{
+		// Skip an interface that can't be selected, rather than sending out of the previous one again
+		if (setsockopt(sendSocket, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&interfaceAddress, sizeof(interfaceAddress)) != 0)
+		{
+			LogDebug("Unable to select multicast interface " + FormatIP4Address(interfaceAddress.s_addr) + ": " + std::to_string(WSAGetLastError()));
+			continue;
+		}
+		if (SendTo(packet, groupAddress)) {
+			bSuccess = true;
+		}
+	}
+
+	// The socket is shared, so later multicasts go back to leaving through the default interface
+	in_addr defaultInterface;
+	defaultInterface.s_addr = INADDR_ANY;
+	if (setsockopt(sendSocket, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&defaultInterface, sizeof(defaultInterface)) != 0) {
+		Log("Unable to restore the default multicast interface: " + std::to_string(WSAGetLastError()));
+	}
+
+	return bSuccess;
+}
+
 
 // -------------------------------------------
 
@@ -984,13 +1698,14 @@ bool OPUNetTransportLayer::SendStatusUpdate()
 	packet.tlMessage.statusUpdate.newStatus = peerInfos[PlayerNetID::GetPlayerIndex(playerNetID)].status;		// Copy local status
 
 	// Send the new status to the host
-	return SendTo(packet, peerInfos[HostPlayerIndex].address);
+	return SendTo(packet, peerInfos[HostPlayerIndex].GetSendAddress());
 }
 
 
 // -------------------------------------------
 
-bool OPUNetTransportLayer::SendUntilStatusUpdate(Packet& packet, PeerStatus untilStatus, int maxTries, int repeatDelay)
+// The precedingPacket (if any) is sent just before each copy of packet, to players that support NetFix extensions
+bool OPUNetTransportLayer::SendUntilStatusUpdate(Packet& packet, PeerStatus untilStatus, int maxTries, int repeatDelay, Packet* precedingPacket)
 {
 	// Checksum the packet
 	packet.header.checksum = packet.Checksum();
@@ -999,6 +1714,10 @@ bool OPUNetTransportLayer::SendUntilStatusUpdate(Packet& packet, PeerStatus unti
 	int playerNetIDList[MaxRemotePlayers];
 	int numPlayers = GetOpponentNetIDList(playerNetIDList, MaxRemotePlayers);
 
+	// Each packet is compressed once, for every player and try
+	CompressedCopy compressedCopy;
+	CompressedCopy compressedPrecedingPacket;
+
 	// Repeat sending packet
 	for (int numTries = 0; numTries < maxTries; ++numTries)
 	{
@@ -1014,7 +1733,10 @@ bool OPUNetTransportLayer::SendUntilStatusUpdate(Packet& packet, PeerStatus unti
 				// Must wait for a response from this player
 				bStillWaiting = true;
 				// Sent packet to this player
-				SendTo(packet, peerInfos[index].address);
+				if (precedingPacket != nullptr && peerInfos[index].capabilities != 0) {
+					SendToPeerCompressed(*precedingPacket, peerInfos[index], compressedPrecedingPacket);
+				}
+				SendToPeerCompressed(packet, peerInfos[index], compressedCopy);
 			}
 		}
 
@@ -1039,58 +1761,49 @@ bool OPUNetTransportLayer::SendUntilStatusUpdate(Packet& packet, PeerStatus unti
 // -------------------------------------------
 
 // Returns true if the packet was processed, and false otherwise
-bool OPUNetTransportLayer::OnImmediatePacketProcess(Packet& packet, const sockaddr_in& fromAddress)
+bool OPUNetTransportLayer::OnImmediatePacketProcess(Packet& packet, const NetAddress& fromAddress)
 {
 	// Create shorthand reference to known packet type
 	TransportLayerMessage& tlMessage = packet.tlMessage;
 
-	// Check if we need to repond to game host queries
-	if (bInvite)
+	// NetFix protocol extensions are always handled here (never passed on to the game)
+	if (IsNetFixCommand(tlMessage.tlHeader.commandType))
 	{
-		switch (tlMessage.tlHeader.commandType)
-		{
-		case TransportLayerCommand::JoinRequest:
-			OnJoinRequest(packet, fromAddress, tlMessage);
-			return true;
-		case TransportLayerCommand::HostedGameSearchQuery:
-			OnHostedGameSearchQuery(packet, fromAddress, tlMessage);
-			return true;
-		case TransportLayerCommand::JoinHelpRequest:
-			if (OnJoinHelpRequest(packet, fromAddress, tlMessage)) {
-				return true;
-			}
-			break;
-		default:  // Silence warnings about unused enumeration value in switch
-			break;
-		}
+		OnNetFixCommand(packet, fromAddress);
+		return true;
 	}
 
-	// Check if we need to respond to pre game setup messages
-	if (!bGameStarted)
+	// One table lookup finds the handler for the current state  (always None in game)
+	switch (GetImmediateHandler(state, tlMessage.tlHeader.commandType))
 	{
-		switch (tlMessage.tlHeader.commandType)
-		{
-		case TransportLayerCommand::StartGame:
-			break;
-		case TransportLayerCommand::SetPlayersList:
-			return OnSetPlayersList(packet, tlMessage);
-		case TransportLayerCommand::SetPlayersListFailed:
-			OnSetPlayersListFailed(packet);
-			return false; // Return packet for further processing
-		case TransportLayerCommand::UpdateStatus:
-			OnUpdateStatus(packet, tlMessage);
-			return true; // Packet handled
-		case TransportLayerCommand::HostedGameSearchReply:
-			return OnHostedGameSearchReply(packet, fromAddress);
-		default:  // Silence warnings about unused enumeration value in switch
-			break;
-		}
+	case ImmediateHandler::None:
+		break;
+	// Game host queries
+	case ImmediateHandler::JoinRequest:
+		OnJoinRequest(packet, fromAddress, tlMessage);
+		return true;
+	case ImmediateHandler::HostedGameSearchQuery:
+		OnHostedGameSearchQuery(packet, fromAddress, tlMessage);
+		return true;
+	case ImmediateHandler::JoinHelpRequest:
+		return OnJoinHelpRequest(packet, fromAddress, tlMessage);
+	// Pre game setup messages
+	case ImmediateHandler::SetPlayersList:
+		return OnSetPlayersList(packet, tlMessage);
+	case ImmediateHandler::SetPlayersListFailed:
+		OnSetPlayersListFailed(packet);
+		return false; // Return packet for further processing
+	case ImmediateHandler::UpdateStatus:
+		OnUpdateStatus(packet, tlMessage);
+		return true; // Packet handled
+	case ImmediateHandler::HostedGameSearchReply:
+		return OnHostedGameSearchReply(packet, fromAddress);
 	}
 
 	return false; // Unhandled (non-immediate) message
 }
 
-void OPUNetTransportLayer::OnJoinRequest(Packet& packet, const sockaddr_in& fromAddress, TransportLayerMessage& tlMessage)
+void OPUNetTransportLayer::OnJoinRequest(Packet& packet, const NetAddress& fromAddress, TransportLayerMessage& tlMessage)
 {
 	// Verify packet size
 	if (packet.header.sizeOfPayload != sizeof(JoinRequest)) {
@@ -1119,7 +1832,7 @@ void OPUNetTransportLayer::OnJoinRequest(Packet& packet, const sockaddr_in& from
 		{
 			LogDebug("Return Port forced to " + std::to_string(returnPortNum));
 			// Set the new return port number
-			peerInfos[PlayerNetID::GetPlayerIndex(tlMessage.joinReply.newPlayerNetID)].address.sin_port = returnPortNum;
+			peerInfos[PlayerNetID::GetPlayerIndex(tlMessage.joinReply.newPlayerNetID)].address.SetPort(static_cast<Port>(returnPortNum));
 		}
 	}
 	else
@@ -1134,7 +1847,7 @@ void OPUNetTransportLayer::OnJoinRequest(Packet& packet, const sockaddr_in& from
 	return; // Packet handled
 }
 
-void OPUNetTransportLayer::OnHostedGameSearchQuery(Packet& packet, const sockaddr_in& fromAddress, TransportLayerMessage& tlMessage)
+void OPUNetTransportLayer::OnHostedGameSearchQuery(Packet& packet, const NetAddress& fromAddress, TransportLayerMessage& tlMessage)
 {
 	// Verify packet size
 	if (packet.header.sizeOfPayload != sizeof(HostedGameSearchQuery)) {
@@ -1159,13 +1872,21 @@ void OPUNetTransportLayer::OnHostedGameSearchQuery(Packet& packet, const sockadd
 	tlMessage.searchReply.createGameInfo = hostedGameInfo.createGameInfo;
 	tlMessage.searchReply.hostAddress.sin_addr.s_addr = 0;		// Clear return address  (NAT will obscure it, let a game server or client fix it when the packet is received)
 
+	// Spread out replies to multicast queries, so every host on the LAN doesn't answer at once
+	if (lastSourceSocket == multicastSocket)
+	{
+		std::uniform_int_distribution<int> jitter(0, MaxLanReplyJitter);
+		delayedSends.Push(timeGetTime() + jitter(jitterRandom), DelayedSend{ packet, fromAddress });
+		return; // Packet handled
+	}
+
 	// Send the reply
 	SendTo(packet, fromAddress);
 
 	return; // Packet handled
 }
 
-bool OPUNetTransportLayer::OnJoinHelpRequest(const Packet& packet, const sockaddr_in& fromAddress, TransportLayerMessage& tlMessage)
+bool OPUNetTransportLayer::OnJoinHelpRequest(const Packet& packet, const NetAddress& fromAddress, TransportLayerMessage& tlMessage)
 {
 	// Verify packet size
 	if (packet.header.sizeOfPayload != sizeof(JoinHelpRequest)) {
@@ -1207,17 +1928,37 @@ bool OPUNetTransportLayer::OnSetPlayersList(Packet& packet, const TransportLayer
 		int i;
 		for (i = 1; i < MaxRemotePlayers; i++)
 		{
-			peerInfos[i].address.sin_family = AF_INET;
-			peerInfos[i].address.sin_port = tlMessage.playersList.netPeerInfo[i].port;
-			peerInfos[i].address.sin_addr.s_addr = tlMessage.playersList.netPeerInfo[i].ip;
-			std::memset(peerInfos[i].address.sin_zero, 0, sizeof(peerInfos[i].address.sin_zero));
+			peerInfos[i].address = NetAddress::FromIPv4(tlMessage.playersList.netPeerInfo[i].ip, tlMessage.playersList.netPeerInfo[i].port);
 			peerInfos[i].status = tlMessage.playersList.netPeerInfo[i].status;
 			peerInfos[i].playerNetID = tlMessage.playersList.netPeerInfo[i].playerNetID;
+
+			// Players who joined over IPv6 only have the IPv6 address from the (earlier) PeerAddressList
+			if (peerInfos[i].address.ipv4.sin_addr.s_addr == 0 && peerInfos[i].ipv6Address.IsSet()) {
+				peerInfos[i].address = peerInfos[i].ipv6Address;
+			}
+			// Prefer the address hole punching reached the player at  (the host may see a different NAT mapping)
+			if (punchPeers[i].bReachable && punchPeers[i].playerNetID == peerInfos[i].playerNetID && punchPeers[i].address.IsIPv4()) {
+				peerInfos[i].address = punchPeers[i].address;
+			}
+			// Players we haven't heard from yet have had no silence to measure
+			else {
+				peerActivity[i].Reset(timeGetTime());
+			}
 		}
 
 		LogDebug("Replicated Players List:");
 		LogDebug(FormatPlayerList(peerInfos));
 
+		// Try to reach other IPv6 players directly  (their reply switches the path over to IPv6)
+		const int localPlayerIndex = PlayerNetID::GetPlayerIndex(playerNetID);
+		for (i = 1; i < MaxRemotePlayers; i++)
+		{
+			PeerInfo& peerInfo = peerInfos[i];
+			if (i != localPlayerIndex && peerInfo.status != PeerStatus::EmptySlot && peerInfo.ipv6Address.IsSet() && localIPv6Address.IsSet()) {
+				SendHello(peerInfo.ipv6Address, false);
+			}
+		}
+
 		// Form a new packet to return to the game
 		packet.header.sourcePlayerNetID = 0;
 		packet.header.sizeOfPayload = 4;
@@ -1270,7 +2011,7 @@ void OPUNetTransportLayer::OnUpdateStatus(const Packet& packet, const TransportL
 	}
 }
 
-bool OPUNetTransportLayer::OnHostedGameSearchReply(Packet& packet, const sockaddr_in& fromAddress)
+bool OPUNetTransportLayer::OnHostedGameSearchReply(Packet& packet, const NetAddress& fromAddress)
 {
 	LogDebug("Hosted Game Search Reply: " + FormatAddress(fromAddress));
 
@@ -1284,31 +2025,40 @@ bool OPUNetTransportLayer::OnHostedGameSearchReply(Packet& packet, const sockadd
 		return true;		// Packet handled (discard)
 	}
 
+	// Check for a LAN game announcement
+	if (lastSourceSocket == multicastSocket)
+	{
+		// The announcement's time stamp is from the host's clock, so query the host directly to get a ping
+		if (state != TransportState::Hosting)
+		{
+			Packet queryPacket;
+			BuildSearchQuery(queryPacket);
+			SendTo(queryPacket, fromAddress);
+		}
+		return true;		// Packet handled
+	}
+
 	// Update the internal address if needed
 	if (packet.tlMessage.searchReply.hostAddress.sin_addr.s_addr == 0)
 	{
 		// Update the from address to that of the sender  (NAT will hide the real return address from the sender)
-		packet.tlMessage.searchReply.hostAddress = fromAddress;
+		// An IPv6 sender can't be stored in the reply. It is left clear, and GetLastSourceAddress is used instead.
+		if (fromAddress.IsIPv4()) {
+			packet.tlMessage.searchReply.hostAddress = fromAddress.ipv4;
+		}
 	}
 	else
 	{
 		// Just make sure the address family is correct
-		packet.tlMessage.searchReply.hostAddress.sin_family = fromAddress.sin_family;
+		packet.tlMessage.searchReply.hostAddress.sin_family = AF_INET;
 	}
 
 	return false;			// Return Packet for processing
 }
 
+// Returns true if at least one game server was sent the poke
 bool OPUNetTransportLayer::PokeGameServer(PokeStatusCode status)
 {
-	// Find the game server address
-	sockaddr_in gameServerAddress;
-	int errorCode = GetGameServerAddress(gameServerAddress);
-	// Check for errors
-	if (errorCode == 0) {
-		return false;
-	}
-
 	// Fill in the packet header
 	Packet packet;
 	packet.header.sourcePlayerNetID = 0;
@@ -1326,38 +2076,54 @@ bool OPUNetTransportLayer::PokeGameServer(PokeStatusCode status)
 	//  Might need to resend Game Hosted packet if it gets dropped
 	//  Or maybe even Game Started or Game Cancelled
 
-	// Send the packet
-	return SendTo(packet, gameServerAddress);
+	// Inform every game server  (each keeps its own game list)
+	bool bSuccess = false;
+	for (const std::string& gameServerAddr : GetNetFixSettings().gameServerAddrs)
+	{
+		// Find the game server address
+		NetAddress gameServerAddress;
+		auto errorCode = GetGameServerAddress(gameServerAddr.c_str(), gameServerAddress);
+		// Check for errors (a lookup still in progress is fine, the packet is sent once it completes)
+		if ((errorCode != HostAddressCode::Success) && (errorCode != HostAddressCode::Pending)) {
+			continue;
+		}
+
+		// Send the packet (once the game server address is known)
+		if (SendToHost(packet, gameServerAddr.c_str(), gameServerAddress)) {
+			bSuccess = true;
+		}
+	}
+
+	return bSuccess;
 }
 
 
-bool OPUNetTransportLayer::GetGameServerAddress(sockaddr_in &gameServerAddress)
+OPUNetTransportLayer::HostAddressCode OPUNetTransportLayer::GetGameServerAddress(NetAddress &gameServerAddress)
 {
-	// Get the address string
+	// Get the (primary) game server address string
 	char addressString[256];
 	GetGameServerAddressString(addressString, sizeof(addressString));
 
+	return GetGameServerAddress(addressString, gameServerAddress);
+}
+
+OPUNetTransportLayer::HostAddressCode OPUNetTransportLayer::GetGameServerAddress(const char* gameServerAddressString, NetAddress &gameServerAddress)
+{
 	// Set default address values
-	gameServerAddress.sin_family = AF_INET;
-	gameServerAddress.sin_port = htons(DefaultGameServerPort);
-	std::memset(gameServerAddress.sin_zero, 0, sizeof(gameServerAddress.sin_zero));
+	gameServerAddress = NetAddress::FromIPv4(INADDR_ANY, htons(DefaultGameServerPort));
 
-	// Convert the address string to a sockaddr_in struct
-	auto errorCode = GetHostAddress(addressString, gameServerAddress);
-	
-	return errorCode == HostAddressCode::Success;
+	// Convert the address string to a socket address
+	return GetHostAddress(gameServerAddressString, gameServerAddress);
 }
 
 void OPUNetTransportLayer::GetGameServerAddressString(char* gameServerAddressString, int maxLength)
 {
-	// Get the address string
-	config.GetString(sectionName, "GameServerAddr", gameServerAddressString, maxLength, "");
-
-	LogDebug("GameServerAddr = " + std::string(gameServerAddressString));
+	// Get the primary address string (from the loaded settings, so this is cheap enough to call frequently)
+	strncpy_s(gameServerAddressString, maxLength, GetNetFixSettings().gameServerAddr.c_str(), _TRUNCATE);
 }
 
 
-void OPUNetTransportLayer::CheckSourcePort(Packet &packet, sockaddr_in &from)
+void OPUNetTransportLayer::CheckSourcePort(Packet &packet, NetAddress &from, DWORD currentTime)
 {
 	int sourcePlayerNetId = packet.header.sourcePlayerNetID;
 
@@ -1365,12 +2131,20 @@ void OPUNetTransportLayer::CheckSourcePort(Packet &packet, sockaddr_in &from)
 		return;		// Don't try to update if they don't explicitly say who it's from
 	}
 
-	if (bGameStarted)
+	if (state == TransportState::InGame)
 	{
 		const int sourcePlayerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetId);
 		PeerInfo &sourcePlayerPeerInfo = peerInfos[sourcePlayerIndex];
-		unsigned short expectedPort = sourcePlayerPeerInfo.address.sin_port;
-		unsigned short sourcePort = from.sin_port;
+		// Players behind our router may send from their LAN address
+		const bool bFromLocalAddress = sourcePlayerPeerInfo.bUseLocalAddress && from.IsSameIP(sourcePlayerPeerInfo.localAddress);
+		NetAddress &expectedAddress = bFromLocalAddress ? sourcePlayerPeerInfo.localAddress :
+			(sourcePlayerPeerInfo.bUseIPv6 && from.IsIPv6()) ? sourcePlayerPeerInfo.ipv6Address : sourcePlayerPeerInfo.address;
+		// Only compare ports of the same address family
+		if (expectedAddress.GetFamily() != from.GetFamily()) {
+			return;
+		}
+		unsigned short expectedPort = expectedAddress.GetPort();
+		unsigned short sourcePort = from.GetPort();
 
 		// Verify source port
 		if ((expectedPort != sourcePort) && (expectedPort != 0))
@@ -1378,12 +2152,14 @@ void OPUNetTransportLayer::CheckSourcePort(Packet &packet, sockaddr_in &from)
 			// Port mismatch. Issue warning
 			Log("Packet from player " + std::to_string(sourcePlayerIndex) +
 				" (" + FormatAddress(from) + ") received on unexpected port (" +
-				std::to_string(ntohs(sourcePort)) + " instead of " +
-				std::to_string(ntohs(expectedPort)) +
+				std::to_string(sourcePort) + " instead of " +
+				std::to_string(expectedPort) +
 				") PlayerNetId: " + FormatPlayerNetID(sourcePlayerNetId));
+			// The player's NAT dropped the old mapping while the path was silent
+			OnMappingReplaced(currentTime - peerActivity[sourcePlayerIndex].lastReceiveTime);
 		}
 		// Update the source port
-		sourcePlayerPeerInfo.address.sin_port = sourcePort;
+		expectedAddress.SetPort(sourcePort);
 	}
 }
 
@@ -1394,4 +2170,1818 @@ void OPUNetTransportLayer::ClearPlayers()
 	{
 		peerInfo.Clear();
 	}
+	joinDeadlines.Clear();
+	ResetPunching();
+}
+
+// Reclaims the player records of joins that have timed out
+void OPUNetTransportLayer::ExpireJoins(DWORD currentTime)
+{
+	JoinDeadline joinDeadline;
+	while (joinDeadlines.PopDue(currentTime, joinDeadline))
+	{
+		// Skip joins that finished (or slots that were reused) before the deadline
+		PeerInfo& peerInfo = peerInfos[joinDeadline.playerIndex];
+		if (peerInfo.status != PeerStatus::Joining || peerInfo.playerNetID != joinDeadline.playerNetID) {
+			continue;
+		}
+
+		LogDebug("Join timed out: " + FormatPlayerNetID(peerInfo.playerNetID) + " " + FormatAddress(peerInfo.address));
+
+		// Cancel the join, and reclaim the player record
+		numPlayers--;
+		numJoining--;
+		peerInfo.bReturnJoinPacket = false;
+		peerInfo.Clear();
+	}
+}
+
+void OPUNetTransportLayer::ApplyReceiveNotify(SOCKET socket)
+{
+	if (socket == INVALID_SOCKET || receiveNotifyWindow == nullptr) {
+		return;
+	}
+
+	if (WSAAsyncSelect(socket, receiveNotifyWindow, receiveNotifyMessage, FD_READ) == SOCKET_ERROR) {
+		LogError("Could not set receive notification. Error: " + std::to_string(WSAGetLastError()));
+	}
+}
+
+// Moves to the state the event leads to. Events that aren't legal in the current state are ignored.
+void OPUNetTransportLayer::ChangeState(TransportEvent event)
+{
+	if (!IsTransitionAllowed(state, event))
+	{
+		LogDebug("Ignored transport event " + std::to_string(static_cast<int>(event)) + " in state " + FormatTransportState(state));
+		return;
+	}
+
+	state = GetNextTransportState(state, event);
+	LogDebug("Transport state: " + FormatTransportState(state));
+}
+
+// Reclaims the player records of players that haven't finished joining
+void OPUNetTransportLayer::CancelJoins()
+{
+	for (PeerInfo& peerInfo : peerInfos)
+	{
+		if (peerInfo.status == PeerStatus::Joining)
+		{
+			numPlayers--;
+			peerInfo.bReturnJoinPacket = false;
+			peerInfo.Clear();
+		}
+	}
+	numJoining = 0;
+	joinDeadlines.Clear();
+}
+
+
+// NetFix protocol extensions
+// --------------------------
+
+void OPUNetTransportLayer::OnNetFixCommand(Packet& packet, const NetAddress& fromAddress)
+{
+	switch (static_cast<NetFixCommand>(packet.tlMessage.tlHeader.commandType))
+	{
+	case NetFixCommand::Hello:
+		OnHello(packet, fromAddress);
+		break;
+	case NetFixCommand::PeerAddressList:
+		OnPeerAddressList(packet);
+		break;
+	case NetFixCommand::Parity:
+		OnParity(packet, fromAddress);
+		break;
+	case NetFixCommand::Compressed:
+		OnCompressed(packet, fromAddress);
+		break;
+	case NetFixCommand::Relay:
+		OnRelay(packet, fromAddress);
+		break;
+	case NetFixCommand::PathProbe:
+		OnPathProbe(packet);
+		break;
+	case NetFixCommand::PeerTable:
+		OnPeerTable(packet, fromAddress);
+		break;
+	case NetFixCommand::Punch:
+		OnPunch(packet, fromAddress);
+		break;
+	case NetFixCommand::PunchReport:
+		OnPunchReport(packet);
+		break;
+	case NetFixCommand::KeepAlive:	// Only there to refresh NAT mappings
+		break;
+	case NetFixCommand::PeerCandidates:
+		OnPeerCandidates(packet, fromAddress);
+		break;
+	case NetFixCommand::GameListEvent:
+		OnGameListEvent(packet, fromAddress);
+		break;
+	case NetFixCommand::SearchBatch:
+		OnSearchBatch(packet, fromAddress);
+		break;
+	default:  // Unknown (newer) extension. Ignore it.
+		break;
+	}
+}
+
+void OPUNetTransportLayer::OnHello(const Packet& packet, const NetAddress& fromAddress)
+{
+	// Verify packet size  (newer versions may append fields, and older ones lack localAddress)
+	if (packet.header.sizeOfPayload < offsetof(NetFixHello, localAddress)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only accept a Hello from a known player
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+		return;		// Packet handled (discard)
+	}
+	PeerInfo& peerInfo = peerInfos[playerIndex];
+	if (peerInfo.playerNetID != sourcePlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	const NetFixHello& hello = GetNetFixMessage<NetFixHello>(packet);
+	LogDebug("Hello from player " + std::to_string(playerIndex) + ": " + FormatAddress(fromAddress) +
+		"  Version: " + std::to_string(hello.protocolVersion) + "  Capabilities: " + std::to_string(hello.capabilities));
+
+	peerInfo.capabilities = hello.capabilities;
+
+	// Remember where the player can be reached over IPv6
+	const NetAddress ipv6Address = FromNetFixAddress(hello.ipv6Address);
+	const bool bNewIPv6Address = ipv6Address.IsIPv6() && ipv6Address.IsSet() && (ipv6Address != peerInfo.ipv6Address);
+	if (bNewIPv6Address) {
+		peerInfo.ipv6Address = ipv6Address;
+	}
+
+	// A Hello that arrived over IPv6 proves the path works  (only from the address the player announced, or the host passed on, as PlayerNetIDs are easily guessed)
+	if (fromAddress.IsIPv6() && fromAddress == peerInfo.ipv6Address) {
+		UseIPv6Path(peerInfo, fromAddress);
+	}
+
+	// Remember the player's LAN address  (the host passes it on to players behind the same router)
+	bool bNewLocalAddress = false;
+	if (packet.header.sizeOfPayload >= sizeof(NetFixHello))
+	{
+		const NetAddress localAddress = FromNetFixAddress(hello.localAddress);
+		bNewLocalAddress = localAddress.IsIPv4() && localAddress.IsSet() && localAddress != peerInfo.address && localAddress != peerInfo.localAddress;
+		if (bNewLocalAddress) {
+			peerInfo.localAddress = localAddress;
+		}
+	}
+	// A Hello from there proves the player is on our LAN
+	if (peerInfo.localAddress.IsSet() && fromAddress == peerInfo.localAddress) {
+		UseLocalPath(peerInfo);
+	}
+
+	// Answer an introduction
+	if (!hello.bReply) {
+		SendHello(peerInfo.GetSendAddress(), true);
+	}
+
+	// Probe a newly learned IPv6 path  (the player switches to IPv6 when the probe arrives, and its replies follow)
+	if (bNewIPv6Address && !peerInfo.bUseIPv6 && !peerInfo.address.IsIPv6() && localIPv6Address.IsSet()) {
+		SendHello(peerInfo.ipv6Address, true);
+	}
+
+	// Race the LAN path against hairpinning through our shared router (whichever arrives first, the LAN path is kept once it works)
+	if (bNewLocalAddress && !peerInfo.bUseLocalAddress && SharesPublicAddress(peerInfo.address)) {
+		SendHello(peerInfo.localAddress, true);
+	}
+}
+
+void OPUNetTransportLayer::OnPeerAddressList(const Packet& packet)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < sizeof(NetFixPeerAddressList)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only the host sends this
+	const int hostPlayerNetID = peerInfos[HostPlayerIndex].playerNetID;
+	if (hostPlayerNetID == 0 || packet.header.sourcePlayerNetID != hostPlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	// Copy the extra details  (applied to the player list when SetPlayersList arrives)
+	const NetFixPeerAddressList& peerAddressList = GetNetFixMessage<NetFixPeerAddressList>(packet);
+	const int localPlayerIndex = PlayerNetID::GetPlayerIndex(playerNetID);
+	for (int i = 1; i < MaxRemotePlayers; ++i)
+	{
+		if (i == localPlayerIndex) {
+			continue;
+		}
+		peerInfos[i].capabilities = peerAddressList.peers[i].capabilities;
+		peerInfos[i].ipv6Address = FromNetFixAddress(peerAddressList.peers[i].ipv6Address);
+	}
+}
+
+bool OPUNetTransportLayer::SendHello(const NetAddress& to, bool bReply)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixHello);
+	packet.header.type = 1;
+
+	NetFixHello& hello = GetNetFixMessage<NetFixHello>(packet);
+	hello.commandType = ToTransportLayerCommand(NetFixCommand::Hello);
+	hello.protocolVersion = NetFixProtocolVersion;
+	hello.capabilities = GetLocalNetFixCapabilities();
+	hello.bReply = bReply;
+	hello.ipv6Address = ToNetFixAddress(localIPv6Address);
+	// Our address on the LAN, for players behind the same router  (the interface on the default route)
+	NetAddress localAddress = natCacheInterface;
+	if (localAddress.IsIPv4()) {
+		localAddress.SetPort(static_cast<Port>(GetPort()));
+	}
+	hello.localAddress = ToNetFixAddress(localAddress);
+
+	return SendTo(packet, to);
+}
+
+void OPUNetTransportLayer::BuildPeerAddressList(Packet& packet)
+{
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixPeerAddressList);
+	packet.header.type = 1;
+
+	NetFixPeerAddressList& peerAddressList = GetNetFixMessage<NetFixPeerAddressList>(packet);
+	peerAddressList.commandType = ToTransportLayerCommand(NetFixCommand::PeerAddressList);
+	for (int i = 0; i < MaxRemotePlayers; ++i)
+	{
+		const PeerInfo& peerInfo = peerInfos[i];
+		// Players who joined over IPv6 have it as their main address
+		const NetAddress& ipv6Address = peerInfo.address.IsIPv6() ? peerInfo.address : peerInfo.ipv6Address;
+		peerAddressList.peers[i].capabilities = peerInfo.capabilities;
+		peerAddressList.peers[i].ipv6Address = ToNetFixAddress(ipv6Address);
+	}
+
+	// The host's own entry
+	peerAddressList.peers[HostPlayerIndex].capabilities = GetLocalNetFixCapabilities();
+	peerAddressList.peers[HostPlayerIndex].ipv6Address = ToNetFixAddress(localIPv6Address);
+}
+
+void OPUNetTransportLayer::UseIPv6Path(PeerInfo& peerInfo, const NetAddress& fromAddress)
+{
+	// Don't change paths once the game has started
+	if (state == TransportState::InGame || peerInfo.GetSendAddress() == fromAddress) {
+		return;
+	}
+
+	LogDebug("Using IPv6 path to player " + FormatPlayerNetID(peerInfo.playerNetID) + ": " + FormatAddress(fromAddress));
+	peerInfo.bUseIPv6 = true;
+}
+
+void OPUNetTransportLayer::UseLocalPath(PeerInfo& peerInfo)
+{
+	// Don't change paths once the game has started
+	if (state == TransportState::InGame || peerInfo.bUseLocalAddress) {
+		return;
+	}
+
+	Log("Using LAN path to player " + FormatPlayerNetID(peerInfo.playerNetID) + ": " + FormatAddress(peerInfo.localAddress) +
+		"  (instead of " + FormatAddress(peerInfo.GetSendAddress()) + ")");
+	peerInfo.bUseLocalAddress = true;
+
+	// The player switches over too, once this arrives from our LAN address
+	SendHello(peerInfo.localAddress, true);
+}
+
+// Players behind our router show up with our public IP
+bool OPUNetTransportLayer::SharesPublicAddress(const NetAddress& address) const
+{
+	const NetAddress& publicAddress = natClassifier.GetPublicAddress();
+	return publicAddress.IsSet() && address.IsIPv4() && address.IsSameIP(publicAddress);
+}
+
+
+// Forward error correction
+// ------------------------
+
+// Parity covers in game packets to players who asked for it, when it's turned on locally
+bool OPUNetTransportLayer::IsParityCovered(const PeerInfo& peerInfo, const Packet& packet, int packetSize) const
+{
+	return state == TransportState::InGame &&
+		packet.header.type == 0 &&
+		(peerInfo.capabilities & NetFixCapability::Parity) != 0 &&
+		GetNetFixSettings().parityGroupSize > 0 &&
+		static_cast<std::size_t>(packetSize) <= MaxParityDataSize;
+}
+
+void OPUNetTransportLayer::SendParity(int playerIndex)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	parityEncoders[playerIndex].BuildParity(packet);
+
+	if (SendPacketToPlayer(packet, peerInfos[playerIndex]))
+	{
+		parityStats.numParityPacketsSent++;
+		parityStats.numParityBytesSent += sizeof(packet.header) + packet.header.sizeOfPayload;
+	}
+}
+
+// Records packets tagged with a parity sequence number
+// Returns false if the packet is a duplicate of one already rebuilt from parity
+bool OPUNetTransportLayer::AcceptParityTrailer(const Packet& packet, int numBytes)
+{
+	const std::size_t packetSize = sizeof(PacketHeader) + packet.header.sizeOfPayload;
+	if (state != TransportState::InGame || packet.header.type != 0 ||
+		static_cast<std::size_t>(numBytes) != packetSize + sizeof(NetFixParityTrailer))
+	{
+		return true;		// Not tagged
+	}
+
+	NetFixParityTrailer trailer;
+	std::memcpy(&trailer, reinterpret_cast<const char*>(&packet) + packetSize, sizeof(trailer));
+	if (trailer.marker != ParityTrailerMarker) {
+		return true;		// Not tagged
+	}
+
+	// Only known players have a parity history
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (sourcePlayerNetID == 0 || playerIndex >= MaxRemotePlayers || peerInfos[playerIndex].playerNetID != sourcePlayerNetID) {
+		return true;
+	}
+
+	if (!parityDecoders[playerIndex].OnPacket(trailer.sequence, packet, packetSize))
+	{
+		LogDebug("Discarded packet already rebuilt from parity: " + FormatPlayerNetID(sourcePlayerNetID) + "  Sequence: " + std::to_string(trailer.sequence));
+		return false;
+	}
+	return true;
+}
+
+void OPUNetTransportLayer::OnParity(const Packet& packet, const NetAddress& fromAddress)
+{
+	if (state != TransportState::InGame) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only accept parity from a known player
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+		return;		// Packet handled (discard)
+	}
+	if (peerInfos[playerIndex].playerNetID != sourcePlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	Packet recoveredPacket;
+	if (!parityDecoders[playerIndex].OnParity(GetNetFixMessage<NetFixParity>(packet), packet.header.sizeOfPayload, recoveredPacket)) {
+		return;
+	}
+
+	// The rebuilt packet must be one the player sent to us
+	if (recoveredPacket.header.sourcePlayerNetID != sourcePlayerNetID ||
+		(recoveredPacket.header.destPlayerNetID != 0 && recoveredPacket.header.destPlayerNetID != playerNetID))
+	{
+		return;
+	}
+
+	LogDebug("Rebuilt lost packet from parity: " + FormatPlayerNetID(sourcePlayerNetID));
+	parityStats.numPacketsRecovered++;
+	rebuiltPackets.push_back(RebuiltPacket{ recoveredPacket, fromAddress, static_cast<int>(sizeof(PacketHeader) + recoveredPacket.header.sizeOfPayload) });
+}
+
+void OPUNetTransportLayer::ResetParity()
+{
+	for (ParityEncoder& parityEncoder : parityEncoders) {
+		parityEncoder.Reset();
+	}
+	for (ParityDecoder& parityDecoder : parityDecoders) {
+		parityDecoder.Reset();
+	}
+	parityStats = ParityStats{};
+}
+
+void OPUNetTransportLayer::LogParityStats() const
+{
+	if (parityStats.numPacketsCovered == 0 && parityStats.numPacketsRecovered == 0) {
+		return;
+	}
+
+	// Overhead is parity bytes as a share of the covered game traffic
+	const unsigned int overheadPercent = (parityStats.numBytesCovered == 0) ? 0 :
+		static_cast<unsigned int>(100ull * parityStats.numParityBytesSent / parityStats.numBytesCovered);
+	Log("Parity: " + std::to_string(parityStats.numPacketsCovered) + " packets covered (" + std::to_string(parityStats.numBytesCovered) + " bytes), " +
+		std::to_string(parityStats.numParityPacketsSent) + " parity packets sent (" + std::to_string(parityStats.numParityBytesSent) + " bytes, " +
+		std::to_string(overheadPercent) + "% overhead), " + std::to_string(parityStats.numPacketsRecovered) + " lost packets rebuilt");
+}
+
+
+// Compression
+// -----------
+
+// Returns the compressed copy to send to the player in place of the packet, or nullptr if the packet is sent as is
+// The packet is only compressed for the first player that accepts compression. Later players get the same copy.
+const Packet* OPUNetTransportLayer::CompressForPeer(const PeerInfo& peerInfo, const Packet& packet, CompressedCopy& compressedCopy)
+{
+	const int compressionThreshold = GetNetFixSettings().compressionThreshold;
+	if (compressionThreshold <= 0 || packet.header.sizeOfPayload < compressionThreshold ||
+		(peerInfo.capabilities & NetFixCapability::Compression) == 0)
+	{
+		return nullptr;
+	}
+
+	if (!compressedCopy.bAttempted)
+	{
+		compressedCopy.bAttempted = true;
+		compressedCopy.bCompressed = CompressPacket(packet, compressedCopy.packet);
+	}
+	if (!compressedCopy.bCompressed) {
+		return nullptr;
+	}
+
+	compressionStats.numBytesBefore += sizeof(packet.header) + packet.header.sizeOfPayload;
+	compressionStats.numBytesAfter += sizeof(compressedCopy.packet.header) + compressedCopy.packet.header.sizeOfPayload;
+	return &compressedCopy.packet;
+}
+
+// Fills compressedPacket with a NetFixCompressed message, if it saves space
+bool OPUNetTransportLayer::CompressPacket(const Packet& packet, Packet& compressedPacket)
+{
+	LARGE_INTEGER startTime;
+	LARGE_INTEGER endTime;
+	QueryPerformanceCounter(&startTime);
+
+	// Only worthwhile if the message (with its extra header fields) is smaller than the original payload
+	NetFixCompressed& compressed = GetNetFixMessage<NetFixCompressed>(compressedPacket);
+	const std::size_t maxDataSize = std::min<std::size_t>(MaxCompressedDataSize,
+		packet.header.sizeOfPayload - std::min<std::size_t>(packet.header.sizeOfPayload, offsetof(NetFixCompressed, data) + 1));
+	const std::size_t dataSize = CompressPayload(packet.data, packet.header.sizeOfPayload, compressed.data, maxDataSize);
+
+	QueryPerformanceCounter(&endTime);
+	compressionStats.numCompressAttempts++;
+	compressionStats.compressTime += endTime.QuadPart - startTime.QuadPart;
+
+	if (dataSize == 0) {
+		return false;		// Doesn't compress
+	}
+
+	compressed.commandType = ToTransportLayerCommand(NetFixCommand::Compressed);
+	compressed.sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	compressed.destPlayerNetID = packet.header.destPlayerNetID;
+	compressed.type = packet.header.type;
+	compressed.sizeOfPayload = packet.header.sizeOfPayload;
+
+	compressedPacket.header.sourcePlayerNetID = playerNetID;
+	compressedPacket.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	compressedPacket.header.sizeOfPayload = static_cast<unsigned char>(offsetof(NetFixCompressed, data) + dataSize);
+	compressedPacket.header.type = 1;
+	compressedPacket.header.checksum = compressedPacket.Checksum();
+
+	compressionStats.numPacketsCompressed++;
+	return true;
+}
+
+// Sends to the player, compressed if they accept compression and it saves space
+bool OPUNetTransportLayer::SendToPeerCompressed(Packet& packet, const PeerInfo& peerInfo, CompressedCopy& compressedCopy)
+{
+	if (CompressForPeer(peerInfo, packet, compressedCopy) != nullptr) {
+		return SendPacketToPlayer(compressedCopy.packet, peerInfo);
+	}
+	return SendPacketToPlayer(packet, peerInfo);
+}
+
+void OPUNetTransportLayer::OnCompressed(const Packet& packet, const NetAddress& fromAddress)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < offsetof(NetFixCompressed, data)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only accept compressed packets from a known player
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+		return;		// Packet handled (discard)
+	}
+	if (peerInfos[playerIndex].playerNetID != sourcePlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	// The original packet must be one the player sent to us  (so compression can't forge packets from the host or another player)
+	const NetFixCompressed& compressed = GetNetFixMessage<NetFixCompressed>(packet);
+	if (compressed.sourcePlayerNetID != sourcePlayerNetID ||
+		(compressed.destPlayerNetID != 0 && compressed.destPlayerNetID != playerNetID))
+	{
+		return;		// Packet handled (discard)
+	}
+
+	LARGE_INTEGER startTime;
+	LARGE_INTEGER endTime;
+	QueryPerformanceCounter(&startTime);
+
+	RebuiltPacket rebuiltPacket;
+	Packet& originalPacket = rebuiltPacket.packet;
+	const bool bSuccess = DecompressPayload(compressed.data, packet.header.sizeOfPayload - offsetof(NetFixCompressed, data),
+		originalPacket.data, compressed.sizeOfPayload);
+
+	QueryPerformanceCounter(&endTime);
+	compressionStats.decompressTime += endTime.QuadPart - startTime.QuadPart;
+
+	if (!bSuccess)
+	{
+		LogDebug("Discarded malformed compressed packet from " + FormatPlayerNetID(sourcePlayerNetID));
+		return;
+	}
+
+	originalPacket.header.sourcePlayerNetID = compressed.sourcePlayerNetID;
+	originalPacket.header.destPlayerNetID = compressed.destPlayerNetID;
+	originalPacket.header.sizeOfPayload = compressed.sizeOfPayload;
+	originalPacket.header.type = compressed.type;
+	originalPacket.header.checksum = originalPacket.Checksum();
+	rebuiltPacket.fromAddress = fromAddress;
+	rebuiltPacket.size = sizeof(PacketHeader) + originalPacket.header.sizeOfPayload;
+
+	compressionStats.numPacketsDecompressed++;
+	rebuiltPackets.push_back(rebuiltPacket);
+}
+
+void OPUNetTransportLayer::LogCompressionStats() const
+{
+	if (compressionStats.numCompressAttempts == 0 && compressionStats.numPacketsDecompressed == 0) {
+		return;
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	const auto ToMicroseconds = [&frequency](std::int64_t ticks) {
+		return std::to_string(frequency.QuadPart == 0 ? 0 : ticks * 1000000 / frequency.QuadPart);
+	};
+
+	Log("Compression: " + std::to_string(compressionStats.numPacketsCompressed) + " of " + std::to_string(compressionStats.numCompressAttempts) +
+		" packets compressed (" + std::to_string(compressionStats.numBytesBefore) + " bytes sent as " + std::to_string(compressionStats.numBytesAfter) +
+		"), " + ToMicroseconds(compressionStats.compressTime) + " us compressing. " +
+		std::to_string(compressionStats.numPacketsDecompressed) + " packets decompressed, " + ToMicroseconds(compressionStats.decompressTime) + " us decompressing");
+}
+
+
+// Relay
+// -----
+
+// The (primary) game server relays packets for players who can't reach each other directly
+bool OPUNetTransportLayer::GetRelayAddress(NetAddress& relayAddress)
+{
+	// Looked up once, rather than parsing the address on every probe and relayed packet
+	if (!cachedRelayAddress.IsSet())
+	{
+		NetAddress gameServerAddress;
+		if (GetGameServerAddress(gameServerAddress) != HostAddressCode::Success || !gameServerAddress.IsIPv4()) {
+			return false;
+		}
+		cachedRelayAddress = gameServerAddress;
+	}
+
+	relayAddress = cachedRelayAddress;
+	return true;
+}
+
+// Sends packet bytes (header, payload and any trailer) to a player, directly or through the relay
+bool OPUNetTransportLayer::SendToPlayer(const char* buffer, int size, const PeerInfo& peerInfo, bool bRelay)
+{
+	NetAddress relayAddress;
+	Packet relayPacket;
+	NetAddress to = peerInfo.GetSendAddress();
+
+	// Packets too large to wrap go direct
+	if (bRelay && static_cast<std::size_t>(size) <= MaxRelayDataSize && peerInfo.address.IsIPv4() && GetRelayAddress(relayAddress))
+	{
+		relayPacket.header.sourcePlayerNetID = playerNetID;
+		relayPacket.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+		relayPacket.header.sizeOfPayload = static_cast<unsigned char>(offsetof(NetFixRelay, data) + size);
+		relayPacket.header.type = 1;
+
+		NetFixRelay& relay = GetNetFixMessage<NetFixRelay>(relayPacket);
+		relay.commandType = ToTransportLayerCommand(NetFixCommand::Relay);
+		relay.address = ToNetFixAddress(peerInfo.address);
+		std::memcpy(relay.data, buffer, size);
+		relayPacket.header.checksum = relayPacket.Checksum();
+
+		buffer = reinterpret_cast<const char*>(&relayPacket);
+		size = sizeof(relayPacket.header) + relayPacket.header.sizeOfPayload;
+		to = relayAddress;
+	}
+
+	int errorCode = sendto(GetSendSocket(to), buffer, size, 0, to.GetSocketAddress(), to.GetSocketAddressLength());
+
+	if (errorCode == SOCKET_ERROR) {
+		return false;
+	}
+
+	trafficCounters.numPacketsSent++;
+	trafficCounters.numBytesSent += size;
+	// Relayed packets only keep the path to the relay open
+	if (to == peerInfo.GetSendAddress()) {
+		NotePlayerSent(PlayerNetID::GetPlayerIndex(peerInfo.playerNetID));
+	}
+	else {
+		NoteServerSent(to);
+	}
+	return true;
+}
+
+bool OPUNetTransportLayer::SendPacketToPlayer(Packet& packet, const PeerInfo& peerInfo)
+{
+	packet.header.checksum = packet.Checksum();
+	return SendToPlayer(reinterpret_cast<char*>(&packet), sizeof(packet.header) + packet.header.sizeOfPayload, peerInfo, peerInfo.bUseRelay);
+}
+
+// Probes the direct and relay paths to each player, and switches paths when the measurements call for it
+void OPUNetTransportLayer::ProbePaths(DWORD currentTime)
+{
+	NetAddress relayAddress;
+	const bool bRelayAvailable = GetRelayAddress(relayAddress);
+	bool bAllPathsUp = true;
+
+	for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		PeerInfo& peerInfo = peerInfos[playerIndex];
+		if (peerInfo.status == PeerStatus::EmptySlot || peerInfo.playerNetID == 0 || peerInfo.playerNetID == playerNetID ||
+			(peerInfo.capabilities & NetFixCapability::Relay) == 0)
+		{
+			continue;
+		}
+
+		// Start over for each new player in the slot
+		// Behind a symmetric NAT the direct path rarely opens, so switch as soon as the relay answers, without waiting on direct
+		// Always start direct: the server may not relay at all, which only a relay probe reply shows.
+		PathSelector& pathSelector = pathSelectors[playerIndex];
+		if (probedPlayerNetIDs[playerIndex] != peerInfo.playerNetID)
+		{
+			probedPlayerNetIDs[playerIndex] = peerInfo.playerNetID;
+			peerInfo.bUseRelay = false;
+			pathSelector.Reset(currentTime, peerInfo.address.IsIPv4() && natBehaviour.mapping == NatMapping::AddressPortDependent);
+		}
+
+		SendPathProbe(peerInfo, PathSelector::Path::Direct, currentTime, false);
+		if (bRelayAvailable && peerInfo.address.IsIPv4()) {
+			SendPathProbe(peerInfo, PathSelector::Path::Relay, currentTime, false);
+		}
+
+		if (pathSelector.Update(currentTime))
+		{
+			peerInfo.bUseRelay = (pathSelector.GetPath() == PathSelector::Path::Relay);
+			Log("Player " + FormatPlayerNetID(peerInfo.playerNetID) + " now using " + (peerInfo.bUseRelay ? "relay" : "direct") + " path" +
+				"  (direct: " + (pathSelector.IsAlive(PathSelector::Path::Direct, currentTime) ? std::to_string(pathSelector.GetRoundTripTime(PathSelector::Path::Direct)) + " ms" : "down") +
+				", relay: " + (pathSelector.IsAlive(PathSelector::Path::Relay, currentTime) ? std::to_string(pathSelector.GetRoundTripTime(PathSelector::Path::Relay)) + " ms" : "down") + ")");
+		}
+
+		if (!pathSelector.IsAlive(pathSelector.GetPath(), currentTime)) {
+			bAllPathsUp = false;
+		}
+	}
+
+	// Probe faster while a player can't be reached, so a working path is found quickly
+	nextPathProbeTime = currentTime + (bAllPathsUp ? PathProbeInterval : FastPathProbeInterval);
+}
+
+bool OPUNetTransportLayer::SendPathProbe(const PeerInfo& peerInfo, PathSelector::Path path, DWORD timeStamp, bool bReply)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixPathProbe);
+	packet.header.type = 1;
+
+	NetFixPathProbe& probe = GetNetFixMessage<NetFixPathProbe>(packet);
+	probe.commandType = ToTransportLayerCommand(NetFixCommand::PathProbe);
+	probe.timeStamp = timeStamp;
+	probe.path = static_cast<std::uint8_t>(path);
+	probe.bReply = bReply;
+	packet.header.checksum = packet.Checksum();
+
+	return SendToPlayer(reinterpret_cast<char*>(&packet), sizeof(packet.header) + packet.header.sizeOfPayload, peerInfo, path == PathSelector::Path::Relay);
+}
+
+void OPUNetTransportLayer::OnPathProbe(const Packet& packet)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < sizeof(NetFixPathProbe)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only accept probes from a known player
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+		return;		// Packet handled (discard)
+	}
+	if (peerInfos[playerIndex].playerNetID != sourcePlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	const NetFixPathProbe& probe = GetNetFixMessage<NetFixPathProbe>(packet);
+	if (probe.path > static_cast<std::uint8_t>(PathSelector::Path::Relay)) {
+		return;		// Packet handled (discard)
+	}
+	const PathSelector::Path path = static_cast<PathSelector::Path>(probe.path);
+
+	// Answer over the path the probe came by
+	if (!probe.bReply)
+	{
+		SendPathProbe(peerInfos[playerIndex], path, probe.timeStamp, true);
+		return;
+	}
+
+	// Ignore replies to probes sent before the selector was reset
+	if (probedPlayerNetIDs[playerIndex] != sourcePlayerNetID) {
+		return;
+	}
+	const DWORD currentTime = timeGetTime();
+	pathSelectors[playerIndex].OnProbeReply(path, currentTime - probe.timeStamp, currentTime);
+}
+
+// Unwraps a packet relayed from another player, to be processed as if it had arrived directly
+void OPUNetTransportLayer::OnRelay(const Packet& packet, const NetAddress& fromAddress)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < offsetof(NetFixRelay, data) + sizeof(PacketHeader)) {
+		return;		// Packet handled (discard)
+	}
+	// The wrapped source address is only trusted from our relay
+	NetAddress relayAddress;
+	if (!GetRelayAddress(relayAddress) || !(fromAddress == relayAddress)) {
+		return;		// Packet handled (discard)
+	}
+
+	const NetFixRelay& relay = GetNetFixMessage<NetFixRelay>(packet);
+	RebuiltPacket rebuiltPacket;
+	rebuiltPacket.size = packet.header.sizeOfPayload - offsetof(NetFixRelay, data);
+	std::memcpy(&rebuiltPacket.packet, relay.data, rebuiltPacket.size);
+	rebuiltPacket.fromAddress = FromNetFixAddress(relay.address);
+
+	// Only known players use the relay  (game setup messages from the host have no source, so match those by address)
+	const int sourcePlayerNetID = rebuiltPacket.packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	const bool bFromHost = (sourcePlayerNetID == 0) && peerInfos[HostPlayerIndex].playerNetID != 0 &&
+		(rebuiltPacket.fromAddress == peerInfos[HostPlayerIndex].address);
+	if (!bFromHost)
+	{
+		if (sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+			return;		// Packet handled (discard)
+		}
+		if (peerInfos[playerIndex].playerNetID != sourcePlayerNetID) {
+			return;		// Packet handled (discard)
+		}
+		// The relay must have seen it come from that player's IP  (a NAT may map a different port towards the relay)
+		NetAddress sourceIP = rebuiltPacket.fromAddress;
+		NetAddress playerIP = peerInfos[playerIndex].address;
+		sourceIP.SetPort(0);
+		playerIP.SetPort(0);
+		if (!(sourceIP == playerIP)) {
+			return;		// Packet handled (discard)
+		}
+		// Treat it as from the player's known address, so the relay's view of the port doesn't replace the direct path's
+		rebuiltPacket.fromAddress = peerInfos[playerIndex].address;
+	}
+
+	rebuiltPackets.push_back(rebuiltPacket);
+}
+
+
+// Hole punching
+// -------------
+// While a game is being set up, the host sends each joined player a table of the other players' addresses.
+// The players punch each other (opening their NATs for the game traffic), and report round trip times to the host.
+
+const ConnectivityMatrix& OPUNetTransportLayer::GetConnectivityMatrix() const
+{
+	return connectivityMatrix;
+}
+
+void OPUNetTransportLayer::UpdatePunching(DWORD currentTime)
+{
+	if (state == TransportState::Hosting)
+	{
+		if (static_cast<int>(currentTime - nextPeerTableTime) >= 0)
+		{
+			SendPeerTable();
+			nextPeerTableTime = currentTime + PeerTableInterval;
+		}
+
+		// The host's own row comes from path probing
+		for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex) {
+			connectivityMatrix[HostPlayerIndex][playerIndex] = GetDirectRoundTripTime(playerIndex, currentTime);
+		}
+		nextPunchTime = currentTime + PunchKeepInterval;
+		return;
+	}
+
+	if (state != TransportState::Joined)
+	{
+		nextPunchTime = currentTime + PunchKeepInterval;
+		return;
+	}
+
+	bool bAllReachable = true;
+	for (const PunchPeer& punchPeer : punchPeers)
+	{
+		if (punchPeer.playerNetID == 0) {
+			continue;
+		}
+		SendPunch(punchPeer.address, currentTime, false);
+		NotePlayerSent(PlayerNetID::GetPlayerIndex(punchPeer.playerNetID));
+		if (!punchPeer.bReachable)
+		{
+			// Race the player's LAN address against its public one
+			if (punchPeer.localAddress.IsSet() && punchPeer.localAddress != punchPeer.address) {
+				SendPunch(punchPeer.localAddress, currentTime, false);
+			}
+			bAllReachable = false;
+		}
+	}
+	SendPunchReport(currentTime);
+
+	// Punch faster until every player answers
+	nextPunchTime = currentTime + (bAllReachable ? PunchKeepInterval : PunchInterval);
+}
+
+void OPUNetTransportLayer::SendPeerTable()
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixPeerTable);
+	packet.header.type = 1;
+
+	NetFixPeerTable& peerTable = GetNetFixMessage<NetFixPeerTable>(packet);
+	std::memset(&peerTable, 0, sizeof(peerTable));
+	peerTable.commandType = ToTransportLayerCommand(NetFixCommand::PeerTable);
+	int numPunchPlayers = 0;
+	for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		const PeerInfo& peerInfo = peerInfos[playerIndex];
+		if (playerIndex == HostPlayerIndex || peerInfo.status == PeerStatus::EmptySlot || peerInfo.playerNetID == 0) {
+			continue;
+		}
+		peerTable.peers[playerIndex].playerNetID = peerInfo.playerNetID;
+		peerTable.peers[playerIndex].capabilities = peerInfo.capabilities;
+		peerTable.peers[playerIndex].address = ToNetFixAddress(peerInfo.address);
+		if (peerInfo.capabilities & NetFixCapability::Punch) {
+			numPunchPlayers++;
+		}
+	}
+
+	// Nobody to punch until two players can
+	if (numPunchPlayers < 2) {
+		return;
+	}
+
+	for (int playerIndex = 1; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		const PeerInfo& peerInfo = peerInfos[playerIndex];
+		if (peerTable.peers[playerIndex].playerNetID != 0 && (peerInfo.capabilities & NetFixCapability::Punch))
+		{
+			SendTo(packet, peerInfo.GetSendAddress());
+			SendPeerCandidates(playerIndex);
+		}
+	}
+}
+
+// Sends a player the LAN addresses of the other players who share its public IP
+void OPUNetTransportLayer::SendPeerCandidates(int playerIndex)
+{
+	const PeerInfo& receiverInfo = peerInfos[playerIndex];
+	if (!receiverInfo.address.IsIPv4()) {
+		return;
+	}
+
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixPeerCandidates);
+	packet.header.type = 1;
+
+	NetFixPeerCandidates& peerCandidates = GetNetFixMessage<NetFixPeerCandidates>(packet);
+	std::memset(&peerCandidates, 0, sizeof(peerCandidates));
+	peerCandidates.commandType = ToTransportLayerCommand(NetFixCommand::PeerCandidates);
+	int numCandidates = 0;
+	for (int otherIndex = 1; otherIndex < MaxRemotePlayers; ++otherIndex)
+	{
+		const PeerInfo& otherInfo = peerInfos[otherIndex];
+		if (otherIndex == playerIndex || otherInfo.playerNetID == 0 || !otherInfo.localAddress.IsSet() || !otherInfo.address.IsSameIP(receiverInfo.address)) {
+			continue;
+		}
+		peerCandidates.localAddresses[otherIndex] = ToNetFixAddress(otherInfo.localAddress);
+		numCandidates++;
+	}
+
+	if (numCandidates != 0) {
+		SendTo(packet, receiverInfo.GetSendAddress());
+	}
+}
+
+void OPUNetTransportLayer::OnPeerCandidates(const Packet& packet, const NetAddress& fromAddress)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < sizeof(NetFixPeerCandidates)) {
+		return;		// Packet handled (discard)
+	}
+	if (!IsFromJoinedHost(packet, fromAddress)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Candidates are for players already in the peer table  (the host sends the table first)
+	const NetFixPeerCandidates& peerCandidates = GetNetFixMessage<NetFixPeerCandidates>(packet);
+	for (int playerIndex = 1; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		PunchPeer& punchPeer = punchPeers[playerIndex];
+		const NetAddress localAddress = FromNetFixAddress(peerCandidates.localAddresses[playerIndex]);
+		if (punchPeer.playerNetID == 0 || !localAddress.IsIPv4() || !localAddress.IsSet() || localAddress == punchPeer.localAddress) {
+			continue;
+		}
+		punchPeer.localAddress = localAddress;
+		if (!punchPeer.bReachable) {
+			nextPunchTime = timeGetTime();
+		}
+	}
+}
+
+// Only the host of the game we joined sends the peer table and candidates
+bool OPUNetTransportLayer::IsFromJoinedHost(const Packet& packet, const NetAddress& fromAddress) const
+{
+	const PeerInfo& hostInfo = peerInfos[HostPlayerIndex];
+	if (state != TransportState::Joined || hostInfo.playerNetID == 0 || packet.header.sourcePlayerNetID != hostInfo.playerNetID) {
+		return false;
+	}
+	return fromAddress == hostInfo.address || fromAddress == hostInfo.ipv6Address || (hostInfo.localAddress.IsSet() && fromAddress == hostInfo.localAddress);
+}
+
+void OPUNetTransportLayer::OnPeerTable(const Packet& packet, const NetAddress& fromAddress)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < sizeof(NetFixPeerTable)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only accept the table from the host of the game we joined
+	if (!IsFromJoinedHost(packet, fromAddress)) {
+		return;		// Packet handled (discard)
+	}
+
+	const NetFixPeerTable& peerTable = GetNetFixMessage<NetFixPeerTable>(packet);
+	const int localPlayerIndex = PlayerNetID::GetPlayerIndex(playerNetID);
+	for (int playerIndex = 1; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		const NetFixPeerTableEntry& entry = peerTable.peers[playerIndex];
+		PunchPeer& punchPeer = punchPeers[playerIndex];
+		if (playerIndex == localPlayerIndex || entry.playerNetID == 0 || (entry.capabilities & NetFixCapability::Punch) == 0)
+		{
+			punchPeer.Clear();
+			continue;
+		}
+
+		// Start punching a new player right away  (an existing player keeps the address its punches came from)
+		if (punchPeer.playerNetID != entry.playerNetID)
+		{
+			punchPeer.Clear();
+			punchPeer.playerNetID = entry.playerNetID;
+			punchPeer.address = FromNetFixAddress(entry.address);
+			nextPunchTime = timeGetTime();
+		}
+	}
+}
+
+bool OPUNetTransportLayer::SendPunch(const NetAddress& to, DWORD timeStamp, bool bReply)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixPunch);
+	packet.header.type = 1;
+
+	NetFixPunch& punch = GetNetFixMessage<NetFixPunch>(packet);
+	punch.commandType = ToTransportLayerCommand(NetFixCommand::Punch);
+	punch.timeStamp = timeStamp;
+	punch.bReply = bReply;
+
+	return SendTo(packet, to);
+}
+
+void OPUNetTransportLayer::OnPunch(const Packet& packet, const NetAddress& fromAddress)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < sizeof(NetFixPunch)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only accept punches from players named in the peer table
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+		return;		// Packet handled (discard)
+	}
+	PunchPeer& punchPeer = punchPeers[playerIndex];
+	if (punchPeer.playerNetID != sourcePlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	// The NAT may map the player to a different port than the host saw. Use whatever works.
+	// Once the LAN address has answered, it is kept (hairpinned punches through the shared router still arrive).
+	if (!punchPeer.bReachable || !punchPeer.localAddress.IsSet() || punchPeer.address != punchPeer.localAddress) {
+		punchPeer.address = fromAddress;
+	}
+
+	const NetFixPunch& punch = GetNetFixMessage<NetFixPunch>(packet);
+	if (!punch.bReply)
+	{
+		SendPunch(fromAddress, punch.timeStamp, true);
+		NotePlayerSent(playerIndex);
+		return;
+	}
+
+	const DWORD roundTripTime = timeGetTime() - punch.timeStamp;
+	if (!punchPeer.bReachable)
+	{
+		punchPeer.bReachable = true;
+		punchPeer.roundTripTime = roundTripTime;
+		LogDebug("Punched through to player " + FormatPlayerNetID(sourcePlayerNetID) + " at " + FormatAddress(fromAddress) +
+			"  (" + std::to_string(roundTripTime) + " ms)");
+	}
+	else
+	{
+		punchPeer.roundTripTime = (punchPeer.roundTripTime * 7 + roundTripTime) / 8;
+	}
+}
+
+// Only sent when the row changes, and now and then in case a report was lost
+void OPUNetTransportLayer::SendPunchReport(DWORD currentTime)
+{
+	std::array<std::int32_t, MaxRemotePlayers> roundTripTimes;
+	for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		const PunchPeer& punchPeer = punchPeers[playerIndex];
+		if (playerIndex == HostPlayerIndex) {
+			roundTripTimes[playerIndex] = GetDirectRoundTripTime(playerIndex, currentTime);
+		}
+		else {
+			roundTripTimes[playerIndex] = (punchPeer.playerNetID != 0 && punchPeer.bReachable) ? static_cast<std::int32_t>(punchPeer.roundTripTime) : -1;
+		}
+	}
+
+	// Reachability changes are always reported, round trip times once they move noticeably
+	bool bChanged = false;
+	for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		const std::int32_t roundTripTime = roundTripTimes[playerIndex];
+		const std::int32_t lastRoundTripTime = lastPunchReport[playerIndex];
+		if ((roundTripTime < 0) != (lastRoundTripTime < 0) || std::abs(roundTripTime - lastRoundTripTime) >= PunchReportMinChange) {
+			bChanged = true;
+		}
+	}
+	if (!bChanged && static_cast<int>(currentTime - nextPunchReportTime) < 0) {
+		return;
+	}
+
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixPunchReport);
+	packet.header.type = 1;
+
+	NetFixPunchReport& report = GetNetFixMessage<NetFixPunchReport>(packet);
+	report.commandType = ToTransportLayerCommand(NetFixCommand::PunchReport);
+	std::copy(roundTripTimes.begin(), roundTripTimes.end(), report.roundTripTimes);
+
+	if (SendPacketToPlayer(packet, peerInfos[HostPlayerIndex]))
+	{
+		lastPunchReport = roundTripTimes;
+		nextPunchReportTime = currentTime + PunchReportRefreshInterval;
+	}
+}
+
+void OPUNetTransportLayer::OnPunchReport(const Packet& packet)
+{
+	// Verify packet size
+	if (packet.header.sizeOfPayload < sizeof(NetFixPunchReport)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only the host collects reports, and only from joined players
+	const int sourcePlayerNetID = packet.header.sourcePlayerNetID;
+	const int playerIndex = PlayerNetID::GetPlayerIndex(sourcePlayerNetID);
+	if (state != TransportState::Hosting || sourcePlayerNetID == 0 || sourcePlayerNetID == playerNetID || playerIndex >= MaxRemotePlayers) {
+		return;		// Packet handled (discard)
+	}
+	if (peerInfos[playerIndex].playerNetID != sourcePlayerNetID) {
+		return;		// Packet handled (discard)
+	}
+
+	const NetFixPunchReport& report = GetNetFixMessage<NetFixPunchReport>(packet);
+	for (int otherIndex = 0; otherIndex < MaxRemotePlayers; ++otherIndex)
+	{
+		const int roundTripTime = (otherIndex != playerIndex && peerInfos[otherIndex].playerNetID != 0) ? report.roundTripTimes[otherIndex] : -1;
+		if (connectivityMatrix[playerIndex][otherIndex] < 0 && roundTripTime >= 0) {
+			LogDebug("Players " + std::to_string(playerIndex) + " and " + std::to_string(otherIndex) + " connected  (" + std::to_string(roundTripTime) + " ms)");
+		}
+		connectivityMatrix[playerIndex][otherIndex] = (roundTripTime >= 0) ? roundTripTime : -1;
+	}
+}
+
+// Smoothed round trip time of the direct path to a player, from path probing (-1 if the path is down or unknown)
+int OPUNetTransportLayer::GetDirectRoundTripTime(int playerIndex, DWORD currentTime) const
+{
+	const PeerInfo& peerInfo = peerInfos[playerIndex];
+	if (peerInfo.playerNetID == 0 || peerInfo.playerNetID == playerNetID || probedPlayerNetIDs[playerIndex] != peerInfo.playerNetID) {
+		return -1;
+	}
+	const PathSelector& pathSelector = pathSelectors[playerIndex];
+	return pathSelector.IsAlive(PathSelector::Path::Direct, currentTime) ?
+		static_cast<int>(pathSelector.GetRoundTripTime(PathSelector::Path::Direct)) : -1;
+}
+
+void OPUNetTransportLayer::ResetPunching()
+{
+	for (PunchPeer& punchPeer : punchPeers) {
+		punchPeer.Clear();
+	}
+	for (auto& row : connectivityMatrix) {
+		row.fill(-1);
+	}
+	nextPunchTime = timeGetTime();
+	nextPeerTableTime = nextPunchTime;
+	lastPunchReport.fill(-1);
+	nextPunchReportTime = nextPunchTime;
+}
+
+
+// NAT classification
+// ------------------
+
+bool OPUNetTransportLayer::IsNatClassificationRunning() const
+{
+	return natClassifier.IsRunning();
+}
+
+const NatBehaviour& OPUNetTransportLayer::GetNatBehaviour() const
+{
+	return natBehaviour;
+}
+
+void OPUNetTransportLayer::LoadCachedNatBehaviour()
+{
+	NetAddress defaultRouteAddress;
+	if (!ParseIPAddress(DefaultRouteProbeAddress, defaultRouteAddress) || !GetLocalInterfaceAddress(defaultRouteAddress, natCacheInterface)) {
+		natCacheInterface.Clear();
+		return;
+	}
+
+	if (LoadNatBehaviour(natCacheInterface, natBehaviour)) {
+		LogDebug("Cached NAT behaviour for " + FormatIPAddress(natCacheInterface) + ": " + FormatNatBehaviour(natBehaviour));
+	}
+
+	DWORD lifetime;
+	if (LoadMappingLifetime(natCacheInterface, lifetime))
+	{
+		mappingLifetime.SetLifetime(lifetime);
+		LogDebug("Cached NAT mapping lifetime: " + std::to_string(lifetime / 1000) + " s  (keepalive every " + std::to_string(mappingLifetime.GetKeepAliveInterval() / 1000) + " s)");
+	}
+}
+
+void OPUNetTransportLayer::StartNatClassification(const NetAddress& gameServerAddr, int numMappingProbes)
+{
+	bNatClassificationStarted = true;
+
+	// The server sees the local address unless there is a NAT
+	NetAddress localAddress;
+	if (GetLocalInterfaceAddress(gameServerAddr, localAddress)) {
+		localAddress.SetPort(static_cast<Port>(GetPort()));
+	}
+	else {
+		localAddress.Clear();
+	}
+	natClassifier.Start(localAddress, numMappingProbes, timeGetTime());
+
+	// The filtering test needs a socket that hasn't sent to the server's second port
+	natProbeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (natProbeSocket == INVALID_SOCKET) {
+		return;
+	}
+	sockaddr_in probeAddress;
+	std::memset(&probeAddress, 0, sizeof(probeAddress));
+	probeAddress.sin_family = AF_INET;
+	probeAddress.sin_addr.s_addr = INADDR_ANY;
+	if (bind(natProbeSocket, reinterpret_cast<sockaddr*>(&probeAddress), sizeof(probeAddress)) == SOCKET_ERROR)
+	{
+		closesocket(natProbeSocket);
+		natProbeSocket = INVALID_SOCKET;
+		return;
+	}
+	ApplyReceiveNotify(natProbeSocket);
+
+	natProbeServer = gameServerAddr;
+	natProbeNonce = static_cast<std::uint32_t>(jitterRandom());
+	SendNatProbe(natProbeSocket, natProbeServer, true);
+}
+
+bool OPUNetTransportLayer::SendNatProbe(SOCKET sourceSocket, const NetAddress& to, bool bChangePort)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixNatProbe);
+	packet.header.type = 1;
+
+	NetFixNatProbe& probe = GetNetFixMessage<NetFixNatProbe>(packet);
+	probe.commandType = ToTransportLayerCommand(NetFixCommand::NatProbe);
+	probe.nonce = natProbeNonce;
+	probe.bChangePort = bChangePort;
+	packet.header.checksum = packet.Checksum();
+
+	const int packetSize = sizeof(packet.header) + packet.header.sizeOfPayload;
+	if (sendto(sourceSocket, reinterpret_cast<char*>(&packet), packetSize, 0, to.GetSocketAddress(), to.GetSocketAddressLength()) == SOCKET_ERROR) {
+		return false;
+	}
+	trafficCounters.numPacketsSent++;
+	trafficCounters.numBytesSent += packetSize;
+	return true;
+}
+
+void OPUNetTransportLayer::OnExternalAddressEcho(const EchoExternalAddress& echo)
+{
+	const NetAddress mappedAddress = NetAddress::FromIPv4(echo.addr);
+	natClassifier.OnMappedAddress(lastSourceAddress, mappedAddress);
+
+	if (!(lastSourceAddress == externalEchoServer)) {
+		return;
+	}
+	// Same public IP, new port: the NAT dropped our mapping  (a new IP is a network change instead)
+	if (externalEchoAddress.IsSet() && mappedAddress.IsSameIP(externalEchoAddress) && externalEchoAddress.GetPort() != mappedAddress.GetPort()) {
+		OnMappingReplaced(externalEchoSilentTime);
+	}
+	externalEchoAddress = mappedAddress;
+}
+
+// Echoes for the probe socket (filtering), and our own probe looped back by the NAT (hairpinning)
+void OPUNetTransportLayer::ReadNatProbeSocket()
+{
+	Packet packet;
+	NetAddress fromAddress;
+	int numBytes;
+	while ((numBytes = ReadSocket(natProbeSocket, packet, fromAddress)) != -1)
+	{
+		// Error check the packet
+		if (static_cast<std::size_t>(numBytes) < sizeof(PacketHeader) + sizeof(TransportLayerCommand) ||
+			static_cast<std::size_t>(numBytes) < sizeof(PacketHeader) + packet.header.sizeOfPayload ||
+			packet.header.checksum != packet.Checksum() || packet.header.type != 1)
+		{
+			continue;		// Discard packet
+		}
+
+		const TransportLayerCommand commandType = packet.tlMessage.tlHeader.commandType;
+		if (commandType == TransportLayerCommand::EchoExternalAddress && packet.header.sizeOfPayload == sizeof(EchoExternalAddress))
+		{
+			NetAddress fromServer = fromAddress;
+			NetAddress probeServer = natProbeServer;
+			fromServer.SetPort(0);
+			probeServer.SetPort(0);
+			if (fromServer != probeServer) {
+				continue;		// Discard packet
+			}
+
+			const bool bChangedPort = (fromAddress.GetPort() != natProbeServer.GetPort());
+			natClassifier.OnFilteringEcho(bChangedPort);
+
+			// Now that the probe socket's external address is known, try reaching it from the main socket
+			if (!bChangedPort && SendNatProbe(netSocket, NetAddress::FromIPv4(packet.tlMessage.echoExternalAddress.addr), false)) {
+				natClassifier.OnHairpinProbeSent();
+			}
+		}
+		else if (commandType == ToTransportLayerCommand(NetFixCommand::NatProbe) && packet.header.sizeOfPayload >= sizeof(NetFixNatProbe))
+		{
+			if (GetNetFixMessage<NetFixNatProbe>(packet).nonce == natProbeNonce) {
+				natClassifier.OnHairpin();
+			}
+		}
+	}
+}
+
+void OPUNetTransportLayer::FinishNatClassification()
+{
+	if (natProbeSocket != INVALID_SOCKET)
+	{
+		closesocket(natProbeSocket);
+		natProbeSocket = INVALID_SOCKET;
+	}
+
+	const NatBehaviour& measuredBehaviour = natClassifier.GetBehaviour();
+	Log("NAT behaviour: " + FormatNatBehaviour(measuredBehaviour));
+	if (!measuredBehaviour.IsKnown())
+	{
+		// Use a result cached for this public address, if the echoes showed it (the one loaded at startup may be for another network)
+		NatBehaviour cachedBehaviour;
+		if (natClassifier.GetPublicAddress().IsSet()) {
+			natBehaviour = LoadNatBehaviour(natCacheInterface, natClassifier.GetPublicAddress(), cachedBehaviour) ? cachedBehaviour : NatBehaviour{};
+		}
+		return;
+	}
+
+	natBehaviour = measuredBehaviour;
+	SaveNatBehaviour(natCacheInterface, natClassifier.GetPublicAddress(), natBehaviour);
+}
+
+
+// Port mapping
+// ------------
+
+void OPUNetTransportLayer::StartPortMapping()
+{
+	const NetFixSettings& settings = GetNetFixSettings();
+	if (settings.portMapping == 0) {
+		return;
+	}
+
+	NetAddress gateway = NetAddress::FromIPv4(INADDR_ANY, htons(PortMapServerPort));
+	if (!settings.portMapGateway.empty())
+	{
+		if (GetHostAddress(settings.portMapGateway.c_str(), gateway) != HostAddressCode::Success || !gateway.IsIPv4())
+		{
+			Log("PortMapGateway must be an IPv4 address: " + settings.portMapGateway);
+			return;
+		}
+	}
+	else
+	{
+		if (!GetDefaultGateway(gateway))
+		{
+			LogDebug("No default gateway found. Port mapping is off.");
+			return;
+		}
+		gateway.SetPort(PortMapServerPort);
+	}
+
+	// PCP requests name our address on the gateway's network
+	NetAddress localAddress;
+	if (!GetLocalInterfaceAddress(gateway, localAddress)) {
+		return;
+	}
+
+	portMapSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (portMapSocket == INVALID_SOCKET) {
+		return;
+	}
+	sockaddr_in bindAddress;
+	std::memset(&bindAddress, 0, sizeof(bindAddress));
+	bindAddress.sin_family = AF_INET;
+	bindAddress.sin_addr.s_addr = INADDR_ANY;
+	if (bind(portMapSocket, reinterpret_cast<sockaddr*>(&bindAddress), sizeof(bindAddress)) == SOCKET_ERROR)
+	{
+		closesocket(portMapSocket);
+		portMapSocket = INVALID_SOCKET;
+		return;
+	}
+	ApplyReceiveNotify(portMapSocket);
+
+	const DWORD currentTime = timeGetTime();
+	portMapper.Start(gateway, localAddress, currentTime);
+	portMapper.AddMapping(static_cast<Port>(GetPort()), currentTime);
+	LogDebug("Requesting port mappings from gateway " + FormatAddress(gateway));
+
+	UpdatePortMapping(currentTime);
+}
+
+void OPUNetTransportLayer::UpdatePortMapping(DWORD currentTime)
+{
+	// Responses  (only the gateway is listened to)
+	std::uint8_t buffer[MaxPortMapMessageSize];
+	unsigned long byteCount;
+	while (ioctlsocket(portMapSocket, FIONREAD, &byteCount) != SOCKET_ERROR && byteCount != 0)
+	{
+		sockaddr_storage fromStorage;
+		int fromLength = sizeof(fromStorage);
+		const int numBytes = recvfrom(portMapSocket, reinterpret_cast<char*>(buffer), sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&fromStorage), &fromLength);
+		if (numBytes == SOCKET_ERROR) {
+			break;
+		}
+		if (NetAddress::FromSocketAddress(reinterpret_cast<sockaddr*>(&fromStorage), fromLength) == portMapper.GetGateway()) {
+			portMapper.OnResponse(buffer, static_cast<std::size_t>(numBytes), currentTime);
+		}
+	}
+
+	// Requests, retries, and renewals that are due
+	const NetAddress& gateway = portMapper.GetGateway();
+	std::vector<std::uint8_t> request;
+	while (portMapper.GetDueRequest(currentTime, request))
+	{
+		sendto(portMapSocket, reinterpret_cast<const char*>(request.data()), static_cast<int>(request.size()), 0,
+			gateway.GetSocketAddress(), gateway.GetSocketAddressLength());
+	}
+}
+
+// Removes the mappings, so the gateway doesn't keep forwarding ports nothing listens on
+void OPUNetTransportLayer::StopPortMapping()
+{
+	if (portMapSocket == INVALID_SOCKET) {
+		return;
+	}
+
+	const NetAddress& gateway = portMapper.GetGateway();
+	for (const std::vector<std::uint8_t>& request : portMapper.GetDeleteRequests())
+	{
+		sendto(portMapSocket, reinterpret_cast<const char*>(request.data()), static_cast<int>(request.size()), 0,
+			gateway.GetSocketAddress(), gateway.GetSocketAddressLength());
+	}
+
+	closesocket(portMapSocket);
+	portMapSocket = INVALID_SOCKET;
+}
+
+
+// NAT keepalives
+// --------------
+
+// Sends a keepalive on each path that has been silent for the keepalive interval
+// Joined players, and the host, can sit in the setup screen for minutes. Without traffic, NATs drop their
+// mappings, the host stops receiving join help from the game server, and players come back on new ports.
+void OPUNetTransportLayer::SendKeepAlives(DWORD currentTime)
+{
+	nextKeepAliveTime = currentTime + KeepAliveCheckInterval;
+
+	// Searching is traffic enough, and in game packets never stop
+	if (state != TransportState::Hosting && state != TransportState::Joined) {
+		return;
+	}
+
+	for (int playerIndex = 0; playerIndex < MaxRemotePlayers; ++playerIndex)
+	{
+		const PeerInfo& peerInfo = peerInfos[playerIndex];
+		if (peerInfo.status == PeerStatus::EmptySlot || peerInfo.playerNetID == 0 || peerInfo.playerNetID == playerNetID) {
+			continue;
+		}
+		if (mappingLifetime.IsKeepAliveDue(peerActivity[playerIndex], currentTime) && SendKeepAlive(peerInfo.GetSendAddress())) {
+			NotePlayerSent(playerIndex);
+		}
+	}
+
+	// The game servers send join help to the host, and relay for joined players
+	if (mappingLifetime.IsKeepAliveDue(gameServerActivity, currentTime))
+	{
+		UpdateKeepAliveServers();
+		// Each keepalive sent resets the interval. If none could be sent (such as while the servers are still
+		// being looked up), they are tried again at the next check, rather than a full interval later.
+		for (const NetAddress& gameServerAddress : keepAliveServers) {
+			SendKeepAlive(gameServerAddress);
+		}
+	}
+}
+
+bool OPUNetTransportLayer::SendKeepAlive(const NetAddress& to)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = playerNetID;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixKeepAlive);
+	packet.header.type = 1;
+	GetNetFixMessage<NetFixKeepAlive>(packet).commandType = ToTransportLayerCommand(NetFixCommand::KeepAlive);
+
+	return SendTo(packet, to);
+}
+
+void OPUNetTransportLayer::UpdateKeepAliveServers()
+{
+	keepAliveServers.clear();
+	for (const std::string& gameServerAddr : GetNetFixSettings().gameServerAddrs)
+	{
+		NetAddress gameServerAddress;
+		if (GetGameServerAddress(gameServerAddr.c_str(), gameServerAddress) == HostAddressCode::Success) {
+			keepAliveServers.push_back(gameServerAddress);
+		}
+	}
+}
+
+// Any packet refreshes the NAT mapping for its path, so it stands in for a keepalive
+// Sends to players are noted by the player's index (by their callers), so only the few game servers are compared here
+void OPUNetTransportLayer::NoteServerSent(const NetAddress& to)
+{
+	if (state == TransportState::InGame) {
+		return;
+	}
+
+	for (const NetAddress& gameServerAddress : keepAliveServers)
+	{
+		if (to == gameServerAddress)
+		{
+			gameServerActivity.lastSendTime = timeGetTime();
+			return;
+		}
+	}
+}
+
+void OPUNetTransportLayer::NotePlayerSent(int playerIndex)
+{
+	if (state == TransportState::InGame || playerIndex >= MaxRemotePlayers) {
+		return;
+	}
+	peerActivity[playerIndex].lastSendTime = timeGetTime();
+}
+
+// A NAT mapping (ours, or a player's) was replaced after this much silence
+void OPUNetTransportLayer::OnMappingReplaced(DWORD silentTime)
+{
+	if (!mappingLifetime.OnMappingReplaced(silentTime)) {
+		return;
+	}
+
+	Log("NAT mapping expired within " + std::to_string(silentTime / 1000) + " s of silence. Sending keepalives every " +
+		std::to_string(mappingLifetime.GetKeepAliveInterval() / 1000) + " s.");
+	SaveMappingLifetime(natCacheInterface, mappingLifetime.GetLifetime());
+}
+
+
+// Game list subscriptions
+// -----------------------
+
+// While the lobby is open, game servers push changes to their game list, instead of being searched every few seconds
+void OPUNetTransportLayer::SubscribeToGameLists()
+{
+	if (GetNetFixSettings().gameListSubscription == 0) {
+		return;
+	}
+
+	bGameListSubscribed = true;
+	gameListSubscriptions.clear();
+	gameListPackets.clear();
+	UpdateGameListSubscriptions(timeGetTime());
+}
+
+void OPUNetTransportLayer::UnsubscribeFromGameLists()
+{
+	// Saves the servers pushing changes until the subscriptions time out
+	for (const GameListSubscription& subscription : gameListSubscriptions)
+	{
+		if (subscription.GetState() != GameListSubscription::State::Polling) {
+			SendGameListSubscribe(subscription.GetServer(), 0, true);
+		}
+	}
+
+	bGameListSubscribed = false;
+	gameListSubscriptions.clear();
+	gameListPackets.clear();
+}
+
+void OPUNetTransportLayer::RequestGameListSnapshots()
+{
+	const DWORD currentTime = timeGetTime();
+	for (GameListSubscription& subscription : gameListSubscriptions) {
+		subscription.RequestSnapshot(currentTime);
+	}
+}
+
+bool OPUNetTransportLayer::IsGameListSubscribed(const char* gameServerAddressString)
+{
+	NetAddress gameServerAddress;
+	if (GetGameServerAddress(gameServerAddressString, gameServerAddress) != HostAddressCode::Success) {
+		return false;
+	}
+
+	for (const GameListSubscription& subscription : gameListSubscriptions)
+	{
+		if (subscription.GetServer() == gameServerAddress) {
+			return subscription.GetState() == GameListSubscription::State::Subscribed;
+		}
+	}
+	return false;
+}
+
+void OPUNetTransportLayer::UpdateGameListSubscriptions(DWORD currentTime)
+{
+	// Servers still being looked up are subscribed to once their address is known
+	const std::vector<std::string>& gameServerAddrs = GetNetFixSettings().gameServerAddrs;
+	if (gameListSubscriptions.size() < gameServerAddrs.size())
+	{
+		for (const std::string& gameServerAddr : gameServerAddrs)
+		{
+			NetAddress gameServerAddress;
+			if (GetGameServerAddress(gameServerAddr.c_str(), gameServerAddress) != HostAddressCode::Success) {
+				continue;
+			}
+			const bool bSubscribed = std::any_of(gameListSubscriptions.begin(), gameListSubscriptions.end(), [&gameServerAddress](const GameListSubscription& subscription) {
+				return subscription.GetServer() == gameServerAddress;
+			});
+			if (!bSubscribed)
+			{
+				gameListSubscriptions.emplace_back();
+				gameListSubscriptions.back().Start(gameServerAddress, currentTime);
+			}
+		}
+	}
+
+	// Renewals also keep the NAT mapping open for the pushed changes
+	const DWORD renewInterval = mappingLifetime.GetKeepAliveInterval();
+	for (GameListSubscription& subscription : gameListSubscriptions)
+	{
+		std::uint32_t sequence;
+		if (subscription.GetDueRequest(currentTime, renewInterval, sequence)) {
+			SendGameListSubscribe(subscription.GetServer(), sequence, false);
+		}
+	}
+}
+
+bool OPUNetTransportLayer::SendGameListSubscribe(const NetAddress& to, std::uint32_t sequence, bool bUnsubscribe)
+{
+	Packet packet;
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = NetFixMessageDestPlayerNetID;
+	packet.header.sizeOfPayload = sizeof(NetFixGameListSubscribe);
+	packet.header.type = 1;
+
+	NetFixGameListSubscribe& subscribe = GetNetFixMessage<NetFixGameListSubscribe>(packet);
+	subscribe.commandType = ToTransportLayerCommand(NetFixCommand::GameListSubscribe);
+	subscribe.gameIdentifier = gameIdentifier;
+	subscribe.sequence = sequence;
+	subscribe.timeStamp = timeGetTime();
+	subscribe.bUnsubscribe = bUnsubscribe;
+
+	return SendTo(packet, to);
+}
+
+void OPUNetTransportLayer::OnGameListEvent(const Packet& packet, const NetAddress& fromAddress)
+{
+	if (packet.header.sizeOfPayload != sizeof(NetFixGameListEvent)) {
+		return;		// Packet handled (discard)
+	}
+
+	// Only from a server we subscribed to, and only games of our kind
+	const NetFixGameListEvent& event = GetNetFixMessage<NetFixGameListEvent>(packet);
+	auto subscription = std::find_if(gameListSubscriptions.begin(), gameListSubscriptions.end(), [&fromAddress](const GameListSubscription& subscription) {
+		return subscription.GetServer() == fromAddress;
+	});
+	if (subscription == gameListSubscriptions.end()) {
+		return;		// Packet handled (discard)
+	}
+	const bool bEmptyList = (event.eventType == NetFixGameListEventType::Snapshot && event.count == 0);
+	const bool bHasGame = (event.eventType != NetFixGameListEventType::Removed && event.eventType != NetFixGameListEventType::Sync && !bEmptyList);
+	if (bHasGame && event.game.gameIdentifier != gameIdentifier) {
+		return;		// Packet handled (discard)
+	}
+
+	std::vector<GameListSubscription::Change> changes;
+	subscription->OnEvent(event, timeGetTime(), changes);
+
+	for (const GameListSubscription::Change& change : changes)
+	{
+		RebuiltPacket changePacket;
+		changePacket.fromAddress = fromAddress;
+		changePacket.packet.header.sourcePlayerNetID = 0;
+		changePacket.packet.header.destPlayerNetID = 0;
+		changePacket.packet.header.type = 1;
+		if (change.bRemoved)
+		{
+			// The lobby has no message for a removed game, so it gets the event itself
+			changePacket.packet.header.sizeOfPayload = sizeof(NetFixGameListEvent);
+			NetFixGameListEvent& removal = GetNetFixMessage<NetFixGameListEvent>(changePacket.packet);
+			removal = NetFixGameListEvent{};
+			removal.commandType = ToTransportLayerCommand(NetFixCommand::GameListEvent);
+			removal.eventType = NetFixGameListEventType::Removed;
+			removal.game.sessionIdentifier = change.game.sessionIdentifier;
+		}
+		else
+		{
+			// Given the ping of the last request, as if it had answered a search
+			changePacket.packet.header.sizeOfPayload = sizeof(HostedGameSearchReply);
+			changePacket.packet.tlMessage.searchReply = change.game;
+			changePacket.packet.tlMessage.searchReply.commandType = TransportLayerCommand::HostedGameSearchReply;
+		}
+		changePacket.size = static_cast<int>(sizeof(PacketHeader) + changePacket.packet.header.sizeOfPayload);
+		gameListPackets.push_back(changePacket);
+	}
+}
+
+
+// Batched search replies
+// ----------------------
+
+// Unpacked in one pass into search replies, as if each game had been sent alone
+void OPUNetTransportLayer::OnSearchBatch(const Packet& packet, const NetAddress& fromAddress)
+{
+	const std::size_t headerSize = offsetof(NetFixSearchBatch, entries);
+	if (state == TransportState::InGame || packet.header.sizeOfPayload < headerSize) {
+		return;		// Packet handled (discard)
+	}
+
+	const NetFixSearchBatch& batch = GetNetFixMessage<NetFixSearchBatch>(packet);
+	if (batch.count > MaxSearchBatchEntries || packet.header.sizeOfPayload != headerSize + batch.count * sizeof(NetFixSearchBatchEntry)) {
+		return;		// Packet handled (discard)
+	}
+	if (batch.gameIdentifier != gameIdentifier) {
+		return;		// Packet handled (discard)
+	}
+
+	LogDebug("Hosted Game Search Batch: " + FormatAddress(fromAddress) + "  Games: " + std::to_string(batch.count));
+
+	for (std::size_t i = 0; i < batch.count; ++i)
+	{
+		const NetFixSearchBatchEntry& entry = batch.entries[i];
+
+		RebuiltPacket replyPacket;
+		replyPacket.fromAddress = fromAddress;
+		replyPacket.packet.header.sourcePlayerNetID = 0;
+		replyPacket.packet.header.destPlayerNetID = 0;
+		replyPacket.packet.header.sizeOfPayload = sizeof(HostedGameSearchReply);
+		replyPacket.packet.header.type = 1;
+
+		HostedGameSearchReply& reply = replyPacket.packet.tlMessage.searchReply;
+		reply.commandType = TransportLayerCommand::HostedGameSearchReply;
+		reply.gameIdentifier = batch.gameIdentifier;
+		reply.timeStamp = batch.timeStamp;
+		reply.sessionIdentifier = entry.sessionIdentifier;
+		reply.createGameInfo = entry.createGameInfo;
+		reply.hostAddress = entry.hostAddress;
+		reply.hostAddress.sin_family = AF_INET;
+
+		replyPacket.size = static_cast<int>(sizeof(PacketHeader) + sizeof(HostedGameSearchReply));
+		gameListPackets.push_back(replyPacket);
+	}
+}
+
+
+// Warm up
+// -------
+
+void OPUNetTransportLayer::WarmUp(HANDLE stopEvent)
+{
+	bWarmingUp = true;
+
+	// Searches wait on their game server lookups, and are sent by Receive
+	for (const std::string& gameServerAddr : GetNetFixSettings().gameServerAddrs) {
+		SearchForGames(gameServerAddr.c_str(), DefaultGameServerPort);
+	}
+	SearchForGamesOnLan(GetNetFixSettings().clientPort, true);
+
+	const DWORD startTime = timeGetTime();
+	bool bEchoRequested = false;
+	Packet packet;
+	do
+	{
+		// The echo request needs a resolved game server, so try until one is
+		if (!bEchoRequested) {
+			bEchoRequested = GetExternalAddress();
+		}
+
+		while (Receive(packet))
+		{
+			if (warmUpReplies.size() < MaxWarmUpReplies)
+			{
+				const int size = static_cast<int>(sizeof(PacketHeader) + packet.header.sizeOfPayload);
+				warmUpReplies.push_back(WarmUpReply{ RebuiltPacket{ packet, lastSourceAddress, size }, timeGetTime() });
+			}
+		}
+	} while ((timeGetTime() - startTime) < WarmUpDuration && WaitForSingleObject(stopEvent, WarmUpPollInterval) == WAIT_TIMEOUT);
+
+	bWarmingUp = false;
+	LogDebug("Warm up finished: " + std::to_string(warmUpReplies.size()) + " replies held for the join window");
+}
+
+
+// Microbenchmark access
+// ---------------------
+
+// Sets up a hosted game with the given players, all at playerAddress  (host side messages reach their handlers too)
+void OPUNetTransportLayer::BenchHostSession(const int playerNetIDs[], int numPlayers, int localPlayerNetID, const NetAddress& playerAddress, const GUID& sessionIdentifier, const char* password)
+{
+	ClearPlayers();
+	for (int i = 0; i < numPlayers; ++i)
+	{
+		PeerInfo& peerInfo = peerInfos[i];
+		peerInfo.playerNetID = playerNetIDs[i];
+		peerInfo.status = PeerStatus::Normal;
+		peerInfo.address = playerAddress;
+		peerInfo.bReturnJoinPacket = false;
+	}
+	this->numPlayers = numPlayers;
+	playerNetID = localPlayerNetID;
+
+	state = TransportState::Hosting;
+	numJoining = 0;
+	hostedGameInfo.sessionIdentifier = sessionIdentifier;
+	std::strncpy(hostPassword, password, sizeof(hostPassword));
+	lastSourceSocket = netSocket;
+	delayedSends.Clear();
+}
+
+void OPUNetTransportLayer::BenchEndSession()
+{
+	ClearPlayers();
+	state = TransportState::Idle;
+}
+
+bool OPUNetTransportLayer::BenchGetHostAddress(const char* hostAddressString, NetAddress& hostAddress)
+{
+	return GetHostAddress(hostAddressString, hostAddress) == HostAddressCode::Success;
+}
+
+bool OPUNetTransportLayer::BenchOnImmediatePacketProcess(Packet& packet, const NetAddress& fromAddress)
+{
+	return OnImmediatePacketProcess(packet, fromAddress);
 }
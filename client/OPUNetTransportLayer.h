@@ -1,35 +1,68 @@
 #pragma once
 
 #include "PlayerNetID.h"
+#include "NetAddress.h"
+#include "TransportState.h"
+#include "DeadlineQueue.h"
+#include "ParityStream.h"
+#include "PacketCompression.h"
+#include "PathSelector.h"
+#include "NatClassifier.h"
+#include "PortMapper.h"
+#include "KeepAlive.h"
+#include "GameListSubscription.h"
 #include <OP2Internal.h>
 #define WIN32_LEAN_AND_MEAN
 #include <winsock2.h>
 #include <array>
-
-// Type alias to handle different type names used by winsock and POSIX socket implementations
-#ifdef WIN32
-using Port = u_short;
-#else
-using Port = in_port_t;
-#endif
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <random>
+#include <cstdint>
 
 using namespace OP2Internal;
 
 const int HostPlayerIndex = 0;
 const int MaxRemotePlayers = 6;
 const int JoinTimeOut = 3000;		// 3 seconds
+const int DeferredSendTimeOut = 10000;	// 10 seconds
 
 // Default Ports
 const int DefaultGameServerPort = 47800;
 const int DefaultClientPort = 47800;
 
+// LAN discovery  (administratively scoped multicast group, not forwarded beyond the site)
+const char* const LanMulticastGroup = "239.255.47.80";
+const int LanMulticastPort = 47880;
+const int MaxLanReplyJitter = 200;		// Replies to multicast queries are spread over this many milliseconds
+
+// Search options are sent to each game server once, then refreshed before the server forgets them (after a minute)
+const DWORD SearchOptionsRefreshInterval = 30000;
+
+// Hole punching between joined players, before the game starts
+const DWORD PunchInterval = 250;		// Milliseconds between punches, until the other player answers
+const DWORD PunchKeepInterval = 1000;	// Milliseconds between punches (and reports to the host) once every player answers
+const DWORD PeerTableInterval = 2000;	// Milliseconds between the host's peer table updates
+const DWORD PunchReportRefreshInterval = 5000;	// Milliseconds between reports to the host while nothing changes
+const int PunchReportMinChange = 10;	// Milliseconds a round trip time must move by to be reported early
+
+// Warm up at module load  (the first search and external address check, before the join window opens)
+const DWORD WarmUpDuration = 5000;		// Milliseconds replies are collected for
+const DWORD WarmUpPollInterval = 50;	// Milliseconds between checks for replies
+const DWORD WarmUpReplyMaxAge = 60000;	// Older replies are discarded when the join window opens
+const std::size_t MaxWarmUpReplies = 4096;
+
 
 struct HostedGameInfo
 {
 	CreateGameInfo createGameInfo;
 	unsigned int ping;
 	GUID sessionIdentifier;
-	sockaddr_in address;
+	NetAddress address;
+	bool bStale;					// From the game list cache, and not seen again yet
+	long long lastSeenTime;			// Wall clock seconds  (stale games, and the game list cache)
 };
 
 
@@ -37,17 +70,62 @@ struct PeerInfo
 {
 	int playerNetID;
 	PeerStatus status;
-	sockaddr_in address;
+	NetAddress address;
 	bool bReturnJoinPacket;
+	// NetFix protocol extensions
+	unsigned int capabilities;		// Announced by the peer in a Hello message (0 for older clients)
+	NetAddress ipv6Address;			// Where the peer can be reached over IPv6 (if anywhere)
+	bool bUseIPv6;					// A packet has arrived from ipv6Address, so prefer it over address
+	bool bUseRelay;					// Packets go through the relay (game server), as the direct path is down or slower
+	NetAddress localAddress;		// The peer's address on its own LAN (announced in Hello)
+	bool bUseLocalAddress;			// A packet has arrived from localAddress (the peer is behind our router), so prefer it
 
 	void Clear()
 	{
 		playerNetID = 0;
 		status = PeerStatus::EmptySlot;
-		address.sin_addr.s_addr = INADDR_ANY;
+		address.Clear();
+		capabilities = 0;
+		ipv6Address.Clear();
+		bUseIPv6 = false;
+		bUseRelay = false;
+		localAddress.Clear();
+		bUseLocalAddress = false;
+	}
+
+	const NetAddress& GetSendAddress() const
+	{
+		if (bUseLocalAddress) {
+			return localAddress;
+		}
+		return bUseIPv6 ? ipv6Address : address;
+	}
+};
+
+
+// Another joined player, known from the host's peer table before the game starts
+struct PunchPeer
+{
+	int playerNetID;				// 0 = Empty slot
+	NetAddress address;				// From the host, then wherever the player's punches come from
+	NetAddress localAddress;		// The player's LAN address, if it is behind our public IP (punched as well, until one answers)
+	bool bReachable;				// A punch reply has arrived
+	DWORD roundTripTime;			// Smoothed
+
+	void Clear()
+	{
+		playerNetID = 0;
+		address.Clear();
+		localAddress.Clear();
+		bReachable = false;
+		roundTripTime = 0;
 	}
 };
 
+// Round trip times between each pair of players, in milliseconds (-1 = not reachable or unknown)
+// Row is the player who measured. Assembled by the host from the players' reports.
+using ConnectivityMatrix = std::array<std::array<int, MaxRemotePlayers>, MaxRemotePlayers>;
+
 
 class OPUNetTransportLayer : public NetTransportLayer
 {
@@ -57,8 +135,11 @@ public:
 	// Following functions: Return true on success, false on failure
 	bool CreateSocket();
 	bool HostGame(Port port, const char* hostPassword, const char* creatorName, int maxPlayers, int gameType);
-	bool SearchForGames(char* hostAddressString, Port defaultHostPort);
+	bool SearchForGames(const char* hostAddressString, Port defaultHostPort);
+	bool SearchForGamesOnLan(Port broadcastPort, bool bBroadcast);
+	bool ResolveHostAddress(const char* hostAddressString, Port defaultHostPort, NetAddress& hostAddress);	// False until a host name lookup completes
 	bool JoinGame(HostedGameInfo &game, const char* joinRequestPassword);
+	bool PrepareJoin(const HostedGameInfo& game);	// Opens the paths a join will use, and measures the host's ping
 	// Externally triggered events
 	void OnJoinAccepted(Packet &packet);
 	// Properties
@@ -66,7 +147,27 @@ public:
 	void GetGameServerAddressString(char* gameServerAddressString, int maxLength);
 	int GetPort();
 	bool GetAddress(sockaddr_in& addr);
-	bool GetExternalAddress();
+	bool GetExternalAddress();		// Also classifies the NAT, on the first call that reaches a game server
+	bool IsNatClassificationRunning() const;
+	const NatBehaviour& GetNatBehaviour() const;	// Cached or measured (Unknown if neither)
+	const NetAddress& GetLastSourceAddress() const;	// Source address of the last packet returned by Receive
+	// Receive notification  (lets a window call Receive when packets arrive, instead of polling)
+	void SetReceiveNotify(HWND notifyWindow, UINT notifyMessage);	// nullptr window stops notifications
+	bool HasPendingSends() const;	// Packets are waiting on a host name lookup, reply delay, or gateway retry (sent by Receive)
+	const ConnectivityMatrix& GetConnectivityMatrix() const;		// Host only
+	// Game list subscriptions  (lobby only). Receive returns pushed games as search replies, and removals as NetFixGameListEvent.
+	void SubscribeToGameLists();
+	void UnsubscribeFromGameLists();
+	void RequestGameListSnapshots();		// Full lists again  (after the lobby clears its list)
+	bool IsGameListSubscribed(const char* gameServerAddressString);	// False if the server should be searched instead
+	// Searches, and checks the external address, keeping the replies for the join window's first calls to Receive
+	// Runs on the warm up thread, until the stop event is set or WarmUpDuration passes
+	void WarmUp(HANDLE stopEvent);
+	// Microbenchmark access (bench/): the private handlers it times, and a session to time them in (nothing is sent to set it up)
+	void BenchHostSession(const int playerNetIDs[], int numPlayers, int localPlayerNetID, const NetAddress& playerAddress, const GUID& sessionIdentifier, const char* password);
+	void BenchEndSession();		// Back to Idle, without cancelling anything
+	bool BenchGetHostAddress(const char* hostAddressString, NetAddress& hostAddress);
+	bool BenchOnImmediatePacketProcess(Packet& packet, const NetAddress& fromAddress);
 
 	virtual ~OPUNetTransportLayer() override;
 	virtual int GetHostPlayerNetID() override;
@@ -88,46 +189,181 @@ private:
 	{
 		Success = -1,
 		InvalidAddress = 0,
-		NoAddressSpecified = 1
+		NoAddressSpecified = 1,
+		Pending = 2				// Host name lookup in progress
+	};
+
+	// Packet waiting on a host name lookup before it can be sent
+	struct DeferredSend
+	{
+		Packet packet;
+		std::string hostAddressString;
+		NetAddress defaultAddress;
+		DWORD queueTime;
+	};
+
+	// Packet held back until its deadline  (jittered replies)
+	struct DelayedSend
+	{
+		Packet packet;
+		NetAddress address;
+	};
+
+	// Packet rebuilt from parity, or decompressed, waiting to be processed by Receive
+	struct RebuiltPacket
+	{
+		Packet packet;
+		NetAddress fromAddress;
+		int size;				// Header, payload and any trailer
+	};
+
+	// Player who must finish joining by the deadline
+	struct JoinDeadline
+	{
+		int playerIndex;
+		int playerNetID;		// Detects a slot that has since been reused
 	};
 
 	OPUNetTransportLayer();			// Private Constructor  [Prevent object creation]
 	bool InitializeWinsock();
-	HostAddressCode GetHostAddress(char* addrString, sockaddr_in &hostAddress);
-	int AddPlayer(const sockaddr_in& from);
-	int ReadSocket(SOCKET sourceSocket, Packet& packet, sockaddr_in& from);
-	bool SendTo(Packet& packet, const sockaddr_in& to);
+	SOCKET CreateIPv6Socket(Port port);
+	SOCKET CreateMulticastSocket();
+	void BuildSearchQuery(Packet& packet);
+	bool SendSearchOptions(const char* gameServerAddressString, const NetAddress& defaultAddress);
+	void AnnounceHostedGame();
+	bool SendToLanGroup(Packet& packet);
+	HostAddressCode GetHostAddress(const char* addrString, NetAddress &hostAddress);
+	int AddPlayer(const NetAddress& from);
+	int ReadSocket(SOCKET sourceSocket, Packet& packet, NetAddress& from);
+	void UpdateLobby(DWORD currentTime);
+	bool GetLobbyPacket(Packet& packet, DWORD currentTime);
+	void SetGameSockets();
+	SOCKET GetSendSocket(const NetAddress& to) const;
+	bool SendTo(Packet& packet, const NetAddress& to);
+	bool SendToHost(Packet& packet, const char* hostAddressString, const NetAddress& defaultAddress);
+	void SendDeferred(DWORD currentTime);
+	void SendDelayed(DWORD currentTime);
+	void ExpireJoins(DWORD currentTime);
 	bool SendStatusUpdate();
-	bool SendUntilStatusUpdate(Packet& packet, PeerStatus untilStatus, int maxTries, int repeatDelay);
-	bool OnImmediatePacketProcess(Packet& packet, const sockaddr_in& fromAddress);
-	void OnJoinRequest(Packet& packet, const sockaddr_in& fromAddress, TransportLayerMessage& tlMessage);
-	void OnHostedGameSearchQuery(Packet& packet, const sockaddr_in& fromAddress, TransportLayerMessage& tlMessage);
-	bool OnJoinHelpRequest(const Packet& packet, const sockaddr_in& fromAddress, TransportLayerMessage& tlMessage);
+	bool SendUntilStatusUpdate(Packet& packet, PeerStatus untilStatus, int maxTries, int repeatDelay, Packet* precedingPacket = nullptr);
+	bool OnImmediatePacketProcess(Packet& packet, const NetAddress& fromAddress);
+	void OnJoinRequest(Packet& packet, const NetAddress& fromAddress, TransportLayerMessage& tlMessage);
+	void OnHostedGameSearchQuery(Packet& packet, const NetAddress& fromAddress, TransportLayerMessage& tlMessage);
+	bool OnJoinHelpRequest(const Packet& packet, const NetAddress& fromAddress, TransportLayerMessage& tlMessage);
 	bool OnSetPlayersList(Packet& packet, const TransportLayerMessage& tlMessage);
 	void OnSetPlayersListFailed(Packet& packet);
 	void OnUpdateStatus(const Packet& packet, const TransportLayerMessage& tlMessage);
-	bool OnHostedGameSearchReply(Packet& packet, const sockaddr_in& fromAddress);
+	bool OnHostedGameSearchReply(Packet& packet, const NetAddress& fromAddress);
 	bool PokeGameServer(PokeStatusCode status);
-	bool GetGameServerAddress(sockaddr_in &gameServerAddress);
-	void CheckSourcePort(Packet& packet, sockaddr_in& from);
+	HostAddressCode GetGameServerAddress(NetAddress &gameServerAddress);
+	HostAddressCode GetGameServerAddress(const char* gameServerAddressString, NetAddress &gameServerAddress);
+	void CheckSourcePort(Packet& packet, NetAddress& from, DWORD currentTime);
+	// NetFix protocol extensions
+	void OnNetFixCommand(Packet& packet, const NetAddress& fromAddress);
+	void OnHello(const Packet& packet, const NetAddress& fromAddress);
+	void OnPeerAddressList(const Packet& packet);
+	bool SendHello(const NetAddress& to, bool bReply);
+	void BuildPeerAddressList(Packet& packet);
+	void UseIPv6Path(PeerInfo& peerInfo, const NetAddress& fromAddress);
+	void UseLocalPath(PeerInfo& peerInfo);
+	bool SharesPublicAddress(const NetAddress& address) const;
+
+	// Forward error correction
+	bool IsParityCovered(const PeerInfo& peerInfo, const Packet& packet, int packetSize) const;
+	void SendParity(int playerIndex);
+	bool AcceptParityTrailer(const Packet& packet, int numBytes);
+	void OnParity(const Packet& packet, const NetAddress& fromAddress);
+	void ResetParity();
+	void LogParityStats() const;
+	// Compression
+	// A packet sent to several players is compressed once, on the first send to a player that accepts compression
+	struct CompressedCopy
+	{
+		bool bAttempted = false;
+		bool bCompressed = false;
+		Packet packet;
+	};
+	const Packet* CompressForPeer(const PeerInfo& peerInfo, const Packet& packet, CompressedCopy& compressedCopy);	// nullptr if sent as is
+	bool CompressPacket(const Packet& packet, Packet& compressedPacket);
+	bool SendToPeerCompressed(Packet& packet, const PeerInfo& peerInfo, CompressedCopy& compressedCopy);
+	void OnCompressed(const Packet& packet, const NetAddress& fromAddress);
+	void LogCompressionStats() const;
+	// Relay
+	bool GetRelayAddress(NetAddress& relayAddress);
+	bool SendToPlayer(const char* buffer, int size, const PeerInfo& peerInfo, bool bRelay);
+	bool SendPacketToPlayer(Packet& packet, const PeerInfo& peerInfo);
+	void ProbePaths(DWORD currentTime);
+	bool SendPathProbe(const PeerInfo& peerInfo, PathSelector::Path path, DWORD timeStamp, bool bReply);
+	void OnPathProbe(const Packet& packet);
+	void OnRelay(const Packet& packet, const NetAddress& fromAddress);
+	// Hole punching
+	void UpdatePunching(DWORD currentTime);
+	void SendPeerTable();
+	void OnPeerTable(const Packet& packet, const NetAddress& fromAddress);
+	void SendPeerCandidates(int playerIndex);
+	void OnPeerCandidates(const Packet& packet, const NetAddress& fromAddress);
+	bool IsFromJoinedHost(const Packet& packet, const NetAddress& fromAddress) const;
+	bool SendPunch(const NetAddress& to, DWORD timeStamp, bool bReply);
+	void OnPunch(const Packet& packet, const NetAddress& fromAddress);
+	void SendPunchReport(DWORD currentTime);
+	void OnPunchReport(const Packet& packet);
+	int GetDirectRoundTripTime(int playerIndex, DWORD currentTime) const;
+	void ResetPunching();
+	// NAT classification
+	void LoadCachedNatBehaviour();
+	void StartNatClassification(const NetAddress& gameServerAddr, int numMappingProbes);
+	bool SendNatProbe(SOCKET sourceSocket, const NetAddress& to, bool bChangePort);
+	void OnExternalAddressEcho(const EchoExternalAddress& echo);
+	void ReadNatProbeSocket();
+	void FinishNatClassification();
+	// Port mapping
+	void StartPortMapping();
+	void UpdatePortMapping(DWORD currentTime);
+	void StopPortMapping();
+	// NAT keepalives
+	void SendKeepAlives(DWORD currentTime);
+	bool SendKeepAlive(const NetAddress& to);
+	void UpdateKeepAliveServers();
+	void NoteServerSent(const NetAddress& to);
+	void NotePlayerSent(int playerIndex);
+	void OnMappingReplaced(DWORD silentTime);
+	// Game list subscriptions
+	void UpdateGameListSubscriptions(DWORD currentTime);
+	bool SendGameListSubscribe(const NetAddress& to, std::uint32_t sequence, bool bUnsubscribe);
+	void OnGameListEvent(const Packet& packet, const NetAddress& fromAddress);
+	void OnSearchBatch(const Packet& packet, const NetAddress& fromAddress);
 
 	void SendBroadcast(Packet& packet, int packetSize);
 	void SendSinglecast(Packet& packet, int packetSize);
+	void SendToPeer(int playerIndex, Packet& packet, int packetSize, CompressedCopy& compressedCopy);
 	void ClearPlayers();
+	void ApplyReceiveNotify(SOCKET socket);
+	void ChangeState(TransportEvent event);
+	void CancelJoins();
 
 	// Gameplay variables
 	unsigned int numPlayers;
 	bool bInitialized;
 	SOCKET netSocket;
 	SOCKET hostSocket;
+	SOCKET netSocket6;
+	SOCKET hostSocket6;
+	SOCKET multicastSocket;
+	SOCKET lastSourceSocket;			// Socket the packet being processed was read from
+	std::array<SOCKET, 4> gameSockets;	// Sockets read in game: the valid, distinct client and host sockets
+	std::size_t numGameSockets;
+	std::vector<in_addr> lanInterfaces;
 	int forcedPort;
+	NetAddress localIPv6Address;		// Global IPv6 address (and netSocket6 port), if there is one
+	NetAddress lastSourceAddress;
+	HWND receiveNotifyWindow;			// Posted receiveNotifyMessage when a socket has data to read
+	UINT receiveNotifyMessage;
 	// Peer Info
 	std::array<PeerInfo, MaxRemotePlayers> peerInfos;
 	// Traffic counters
 	TrafficCounters trafficCounters;
-	// State variables
-	bool bInvite;
-	bool bGameStarted;
+	// Session state
+	TransportState state;
 	// Hosted Game variables
 	HostedGameInfo hostedGameInfo;
 	char hostPassword[12];
@@ -136,6 +372,66 @@ private:
 	int numJoining;
 	// Game server random security  (prevents spoofing attacks)
 	int randValue;
+	// Packets waiting on host name lookups
+	std::vector<DeferredSend> deferredSends;
+	// Packets waiting on a reply delay
+	DeadlineQueue<DelayedSend> delayedSends;
+	// Join timeouts
+	DeadlineQueue<JoinDeadline> joinDeadlines;
+	// Forward error correction  (per player, in game)
+	std::array<ParityEncoder, MaxRemotePlayers> parityEncoders;
+	std::array<ParityDecoder, MaxRemotePlayers> parityDecoders;
+	ParityStats parityStats;
+	// Compression
+	CompressionStats compressionStats;
+	// Packets rebuilt from parity, decompressed, or unwrapped from a relay
+	std::deque<RebuiltPacket> rebuiltPackets;
+	// Relay  (path choice per player)
+	std::array<PathSelector, MaxRemotePlayers> pathSelectors;
+	std::array<int, MaxRemotePlayers> probedPlayerNetIDs;	// Player each path selector was reset for
+	DWORD nextPathProbeTime;
+	NetAddress cachedRelayAddress;		// Set once the relay address is known
+	// Hole punching
+	std::array<PunchPeer, MaxRemotePlayers> punchPeers;
+	ConnectivityMatrix connectivityMatrix;
+	DWORD nextPunchTime;
+	DWORD nextPeerTableTime;
+	std::array<std::int32_t, MaxRemotePlayers> lastPunchReport;	// Round trip times last reported to the host
+	DWORD nextPunchReportTime;
+	// NAT classification
+	NatClassifier natClassifier;
+	bool bNatClassificationStarted;
+	NatBehaviour natBehaviour;
+	NetAddress natCacheInterface;		// Interface on the default route (cache key)
+	SOCKET natProbeSocket;				// Only sends to the game server's first port, so its filtering is tested on the second
+	NetAddress natProbeServer;
+	std::uint32_t natProbeNonce;
+	// Port mapping  (the gateway forwards our ports, so players can reach us without traversal)
+	PortMapper portMapper;
+	SOCKET portMapSocket;
+	// NAT keepalives  (paths stay open while waiting for the game to start)
+	MappingLifetimeEstimate mappingLifetime;
+	std::array<PathActivity, MaxRemotePlayers> peerActivity;
+	PathActivity gameServerActivity;		// Any of the game servers
+	std::vector<NetAddress> keepAliveServers;
+	DWORD nextKeepAliveTime;
+	NetAddress externalEchoServer;			// Earlier echoes from the same server show if our mapping was replaced
+	NetAddress externalEchoAddress;
+	DWORD externalEchoSilentTime;			// Silence toward the game servers before the latest echo request
+	// Game list subscriptions  (game servers push changes to their list while the lobby is open)
+	bool bGameListSubscribed;
+	std::vector<GameListSubscription> gameListSubscriptions;
+	std::deque<RebuiltPacket> gameListPackets;		// Pushed changes and unpacked batches, waiting to be returned by Receive
+	std::map<std::string, DWORD> searchOptionsSendTimes;	// Keyed by GameServerAddr entry
+	// Warm up  (replies received before the join window opened)
+	struct WarmUpReply
+	{
+		RebuiltPacket rebuilt;
+		DWORD receiveTime;
+	};
+	bool bWarmingUp;
+	std::deque<WarmUpReply> warmUpReplies;
+	std::minstd_rand jitterRandom;
 };
 
 
@@ -0,0 +1,122 @@
+#include "PacketCompression.h"
+#include <array>
+#include <cstring>
+
+
+namespace {
+	const std::size_t HashTableSize = 256;
+
+	std::size_t Hash(const std::uint8_t* bytes)
+	{
+		return ((bytes[0] << 4) ^ (bytes[1] << 2) ^ bytes[2]) & (HashTableSize - 1);
+	}
+
+	// Returns false if the output is full
+	bool WriteLiterals(const std::uint8_t* literals, std::size_t count, std::uint8_t* output, std::size_t maxOutputSize, std::size_t& outputSize)
+	{
+		while (count > 0)
+		{
+			const std::size_t runLength = (count < MaxLzLiteralRun) ? count : MaxLzLiteralRun;
+			if (outputSize + 1 + runLength > maxOutputSize) {
+				return false;
+			}
+
+			output[outputSize++] = static_cast<std::uint8_t>(runLength - 1);
+			std::memcpy(output + outputSize, literals, runLength);
+			outputSize += runLength;
+
+			literals += runLength;
+			count -= runLength;
+		}
+		return true;
+	}
+}
+
+
+std::size_t CompressPayload(const std::uint8_t* input, std::size_t inputSize, std::uint8_t* output, std::size_t maxOutputSize)
+{
+	// Most recent position of each 3 byte hash  (-1 = none)
+	std::array<int, HashTableSize> lastPosition;
+	lastPosition.fill(-1);
+
+	std::size_t outputSize = 0;
+	std::size_t literalStart = 0;
+	std::size_t position = 0;
+	while (position + MinLzMatch <= inputSize)
+	{
+		const std::size_t hash = Hash(input + position);
+		const int candidate = lastPosition[hash];
+		lastPosition[hash] = static_cast<int>(position);
+
+		// Check the hash found a real match, within reach of an offset byte
+		if (candidate < 0 || position - candidate > MaxLzOffset ||
+			std::memcmp(input + candidate, input + position, MinLzMatch) != 0)
+		{
+			position++;
+			continue;
+		}
+
+		// Extend the match  (it may overlap the bytes being matched)
+		std::size_t matchLength = MinLzMatch;
+		while (position + matchLength < inputSize && matchLength < MaxLzMatch &&
+			input[candidate + matchLength] == input[position + matchLength])
+		{
+			matchLength++;
+		}
+
+		if (!WriteLiterals(input + literalStart, position - literalStart, output, maxOutputSize, outputSize)) {
+			return 0;
+		}
+		if (outputSize + 2 > maxOutputSize) {
+			return 0;
+		}
+		output[outputSize++] = static_cast<std::uint8_t>(0x80 + (matchLength - MinLzMatch));
+		output[outputSize++] = static_cast<std::uint8_t>(position - candidate);
+
+		position += matchLength;
+		literalStart = position;
+	}
+
+	if (!WriteLiterals(input + literalStart, inputSize - literalStart, output, maxOutputSize, outputSize)) {
+		return 0;
+	}
+	return outputSize;
+}
+
+bool DecompressPayload(const std::uint8_t* input, std::size_t inputSize, std::uint8_t* output, std::size_t outputSize)
+{
+	std::size_t inputPosition = 0;
+	std::size_t outputPosition = 0;
+	while (inputPosition < inputSize)
+	{
+		const std::uint8_t control = input[inputPosition++];
+		if (control < 0x80)
+		{
+			// Literal run
+			const std::size_t runLength = control + 1u;
+			if (inputPosition + runLength > inputSize || outputPosition + runLength > outputSize) {
+				return false;
+			}
+			std::memcpy(output + outputPosition, input + inputPosition, runLength);
+			inputPosition += runLength;
+			outputPosition += runLength;
+		}
+		else
+		{
+			// Match  (copied a byte at a time, since it may overlap itself)
+			if (inputPosition >= inputSize) {
+				return false;
+			}
+			const std::size_t matchLength = control - 0x80u + MinLzMatch;
+			const std::size_t offset = input[inputPosition++];
+			if (offset == 0 || offset > outputPosition || outputPosition + matchLength > outputSize) {
+				return false;
+			}
+			for (std::size_t i = 0; i < matchLength; ++i, ++outputPosition) {
+				output[outputPosition] = output[outputPosition - offset];
+			}
+		}
+	}
+
+	return outputPosition == outputSize;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// Payload compression
+// -------------------
+// A small byte oriented LZ77, suited to single packet payloads (at most 255 bytes, so match offsets fit
+// in a byte). Each run starts with a control byte:
+//   0x00 - 0x7F: Literal run. (control + 1) bytes follow.
+//   0x80 - 0xFF: Match. Copy (control - 0x80 + MinLzMatch) bytes from an offset byte back (1 - 255).
+// Each packet is compressed on its own, so a lost packet never affects the next one.
+
+#include <cstdint>
+#include <cstddef>
+
+
+const std::size_t MinLzMatch = 3;
+const std::size_t MaxLzMatch = 0x7F + MinLzMatch;
+const std::size_t MaxLzLiteralRun = 0x80;
+const std::size_t MaxLzOffset = 0xFF;
+
+
+// Returns the compressed size, or 0 if the input doesn't fit in maxOutputSize when compressed
+std::size_t CompressPayload(const std::uint8_t* input, std::size_t inputSize, std::uint8_t* output, std::size_t maxOutputSize);
+// Returns false unless the input is well formed, and decompresses to exactly outputSize bytes
+bool DecompressPayload(const std::uint8_t* input, std::size_t inputSize, std::uint8_t* output, std::size_t outputSize);
+
+
+// Bytes saved against time spent, logged when the transport layer is destroyed
+struct CompressionStats
+{
+	unsigned int numCompressAttempts;		// Payloads at or over the size threshold
+	unsigned int numPacketsCompressed;		// Attempts that saved space (and were sent compressed)
+	unsigned int numBytesBefore;			// Packet sizes (header and payload) of compressed packets, for each player sent to
+	unsigned int numBytesAfter;				// Sizes actually sent
+	unsigned int numPacketsDecompressed;
+	std::int64_t compressTime;				// Performance counter ticks, including attempts that didn't save space
+	std::int64_t decompressTime;
+};
@@ -0,0 +1,145 @@
+#include "ParityStream.h"
+#include "NetFixProtocol.h"
+#include <cstring>
+
+
+void ParityEncoder::Reset()
+{
+	nextSequence = 0;
+	firstSequence = 0;
+	count = 0;
+	sizeXor = 0;
+	dataSize = 0;
+	dataXor.fill(0);
+}
+
+std::uint16_t ParityEncoder::Add(const Packet& packet, std::size_t packetSize)
+{
+	const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(&packet);
+	for (std::size_t i = 0; i < packetSize; ++i) {
+		dataXor[i] ^= bytes[i];
+	}
+	sizeXor ^= static_cast<std::uint16_t>(packetSize);
+	if (packetSize > dataSize) {
+		dataSize = packetSize;
+	}
+
+	if (count == 0) {
+		firstSequence = nextSequence;
+	}
+	count++;
+	return nextSequence++;
+}
+
+bool ParityEncoder::IsGroupComplete(int groupSize) const
+{
+	return count != 0 && count >= groupSize;
+}
+
+void ParityEncoder::BuildParity(Packet& parityPacket)
+{
+	NetFixParity& parity = GetNetFixMessage<NetFixParity>(parityPacket);
+	parity.commandType = ToTransportLayerCommand(NetFixCommand::Parity);
+	parity.firstSequence = firstSequence;
+	parity.count = count;
+	parity.reserved = 0;
+	parity.sizeXor = sizeXor;
+	std::memcpy(parity.data, dataXor.data(), dataSize);
+	parityPacket.header.sizeOfPayload = static_cast<unsigned char>(offsetof(NetFixParity, data) + dataSize);
+	parityPacket.header.type = 1;
+
+	// Start the next group
+	count = 0;
+	sizeXor = 0;
+	dataSize = 0;
+	dataXor.fill(0);
+}
+
+
+void ParityDecoder::Reset()
+{
+	for (HistoryEntry& entry : history) {
+		entry.bValid = false;
+	}
+}
+
+bool ParityDecoder::OnPacket(std::uint16_t sequence, const Packet& packet, std::size_t packetSize)
+{
+	if (packetSize > MaxParityDataSize) {
+		return true;	// Not covered (the sender never tags these)
+	}
+
+	HistoryEntry& entry = history[sequence % ParityHistorySize];
+	if (entry.bValid && entry.sequence == sequence) {
+		return false;	// Duplicate
+	}
+
+	entry.bValid = true;
+	entry.sequence = sequence;
+	entry.size = packetSize;
+	std::memcpy(entry.data.data(), &packet, packetSize);
+	return true;
+}
+
+bool ParityDecoder::OnParity(const NetFixParity& parity, std::size_t payloadSize, Packet& recoveredPacket)
+{
+	if (payloadSize < offsetof(NetFixParity, data) || parity.count == 0 || parity.count > MaxParityGroupSize) {
+		return false;
+	}
+	const std::size_t dataSize = payloadSize - offsetof(NetFixParity, data);
+
+	// Find the one missing packet
+	int numMissing = 0;
+	std::uint16_t missingSequence = 0;
+	for (std::uint8_t i = 0; i < parity.count; ++i)
+	{
+		const std::uint16_t sequence = static_cast<std::uint16_t>(parity.firstSequence + i);
+		if (Find(sequence) == nullptr)
+		{
+			numMissing++;
+			missingSequence = sequence;
+		}
+	}
+	if (numMissing != 1) {
+		return false;	// Nothing lost, or too much lost to rebuild
+	}
+
+	// XOR out the packets that arrived
+	std::array<std::uint8_t, sizeof(Packet)> data = {};
+	std::memcpy(data.data(), parity.data, dataSize);
+	std::size_t size = parity.sizeXor;
+	for (std::uint8_t i = 0; i < parity.count; ++i)
+	{
+		const HistoryEntry* entry = Find(static_cast<std::uint16_t>(parity.firstSequence + i));
+		if (entry == nullptr) {
+			continue;
+		}
+		if (entry->size > dataSize) {
+			return false;	// Parity is inconsistent with the packets received
+		}
+		for (std::size_t j = 0; j < entry->size; ++j) {
+			data[j] ^= entry->data[j];
+		}
+		size ^= entry->size;
+	}
+
+	// Check the rebuilt packet is whole
+	if (size < sizeof(PacketHeader) || size > dataSize) {
+		return false;
+	}
+	std::memcpy(&recoveredPacket, data.data(), size);
+	if (sizeof(PacketHeader) + recoveredPacket.header.sizeOfPayload != size ||
+		recoveredPacket.header.checksum != recoveredPacket.Checksum())
+	{
+		return false;
+	}
+
+	OnPacket(missingSequence, recoveredPacket, size);
+	return true;
+}
+
+const ParityDecoder::HistoryEntry* ParityDecoder::Find(std::uint16_t sequence) const
+{
+	const HistoryEntry& entry = history[sequence % ParityHistorySize];
+	return (entry.bValid && entry.sequence == sequence) ? &entry : nullptr;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Forward error correction for in game packets
+// ---------------------------------------------
+// Every few covered packets sent to a peer are followed by a parity packet (XOR of the group).
+// A peer that lost one packet of the group rebuilds it locally, instead of waiting for the game's
+// guaranteed send layer to notice and retransmit it. Losing more than one packet of a group
+// (or the parity packet itself) falls back to retransmission, as before.
+
+#include <OP2Internal.h>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+using namespace OP2Internal;
+
+struct NetFixParity;
+
+
+const int MaxParityGroupSize = 8;
+// Received packets kept per peer, so a group is still complete when its parity arrives
+const std::size_t ParityHistorySize = 2 * MaxParityGroupSize;
+
+
+// Sender side, one per peer
+class ParityEncoder
+{
+public:
+	void Reset();
+
+	// Adds a packet to the current group, returning its sequence number
+	// Only packets no larger than MaxParityDataSize (NetFixProtocol.h) can be added.
+	std::uint16_t Add(const Packet& packet, std::size_t packetSize);
+	bool IsGroupComplete(int groupSize) const;
+	// Fills a NetFixParity message for the current group, and starts a new group
+	void BuildParity(Packet& parityPacket);
+
+private:
+	std::uint16_t nextSequence = 0;
+	std::uint16_t firstSequence = 0;
+	std::uint8_t count = 0;
+	std::uint16_t sizeXor = 0;
+	std::size_t dataSize = 0;
+	std::array<std::uint8_t, sizeof(Packet)> dataXor = {};
+};
+
+
+// Receiver side, one per peer
+class ParityDecoder
+{
+public:
+	void Reset();
+
+	// Records a received packet. Returns false if it was already received (or rebuilt).
+	bool OnPacket(std::uint16_t sequence, const Packet& packet, std::size_t packetSize);
+	// Rebuilds the one missing packet of the group, if exactly one is missing
+	// Returns true if recoveredPacket was filled in (and passed its checksum).
+	bool OnParity(const NetFixParity& parity, std::size_t payloadSize, Packet& recoveredPacket);
+
+private:
+	struct HistoryEntry
+	{
+		bool bValid;
+		std::uint16_t sequence;
+		std::size_t size;
+		std::array<std::uint8_t, sizeof(Packet)> data;
+	};
+
+	const HistoryEntry* Find(std::uint16_t sequence) const;
+
+	std::array<HistoryEntry, ParityHistorySize> history = {};
+};
+
+
+// Overhead and benefit, logged when the transport layer is destroyed
+struct ParityStats
+{
+	unsigned int numPacketsCovered;
+	unsigned int numBytesCovered;
+	unsigned int numParityPacketsSent;
+	unsigned int numParityBytesSent;
+	unsigned int numPacketsRecovered;
+};
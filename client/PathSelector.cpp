@@ -0,0 +1,89 @@
+#include "PathSelector.h"
+#include <algorithm>
+
+
+void PathSelector::Reset(DWORD currentTime, bool bDirectUnlikely)
+{
+	stats[0] = PathStats{};
+	stats[1] = PathStats{};
+	selectedPath = Path::Direct;
+	startTime = currentTime;
+	this->bDirectUnlikely = bDirectUnlikely;
+	lastSwitchTime = currentTime;
+}
+
+void PathSelector::OnProbeReply(Path path, DWORD roundTripTime, DWORD currentTime)
+{
+	PathStats& pathStats = stats[static_cast<int>(path)];
+
+	// Smooth the samples, so one delayed reply doesn't cause a switch
+	pathStats.roundTripTime = pathStats.bMeasured ? (7 * pathStats.roundTripTime + roundTripTime) / 8 : roundTripTime;
+	pathStats.lastReplyTime = currentTime;
+	pathStats.bMeasured = true;
+}
+
+bool PathSelector::Update(DWORD currentTime)
+{
+	const bool bDirectAlive = IsAlive(Path::Direct, currentTime);
+	const bool bRelayAlive = IsAlive(Path::Relay, currentTime);
+	const DWORD directTime = stats[static_cast<int>(Path::Direct)].roundTripTime;
+	const DWORD relayTime = stats[static_cast<int>(Path::Relay)].roundTripTime;
+	const bool bHoldExpired = (currentTime - lastSwitchTime) >= PathSwitchHoldTime;
+
+	if (selectedPath == Path::Direct)
+	{
+		// Give the direct path time to answer before giving up on it
+		if (!bDirectAlive && bRelayAlive && (bDirectUnlikely || (currentTime - startTime) >= PathTimeOut))
+		{
+			Select(Path::Relay, currentTime);
+			return true;
+		}
+		if (bDirectAlive && bRelayAlive && bHoldExpired && relayTime + Margin(relayTime) < directTime)
+		{
+			Select(Path::Relay, currentTime);
+			return true;
+		}
+	}
+	else
+	{
+		if (bDirectAlive && !bRelayAlive)
+		{
+			Select(Path::Direct, currentTime);
+			return true;
+		}
+		if (bDirectAlive && bHoldExpired && directTime < relayTime + Margin(relayTime) / 2)
+		{
+			Select(Path::Direct, currentTime);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+PathSelector::Path PathSelector::GetPath() const
+{
+	return selectedPath;
+}
+
+bool PathSelector::IsAlive(Path path, DWORD currentTime) const
+{
+	const PathStats& pathStats = stats[static_cast<int>(path)];
+	return pathStats.bMeasured && (currentTime - pathStats.lastReplyTime) < PathTimeOut;
+}
+
+DWORD PathSelector::GetRoundTripTime(Path path) const
+{
+	return stats[static_cast<int>(path)].roundTripTime;
+}
+
+DWORD PathSelector::Margin(DWORD roundTripTime)
+{
+	return std::max(MinPathMargin, roundTripTime / 4);
+}
+
+void PathSelector::Select(Path path, DWORD currentTime)
+{
+	selectedPath = path;
+	lastSwitchTime = currentTime;
+}
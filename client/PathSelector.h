@@ -0,0 +1,54 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+
+const DWORD PathProbeInterval = 1000;		// Milliseconds between probes, once every player has a working path
+const DWORD FastPathProbeInterval = 250;	// Milliseconds between probes, while any player has no working path
+const DWORD PathTimeOut = 3000;				// A path with no probe reply for this long is considered down
+const DWORD PathSwitchHoldTime = 5000;		// Minimum time between switching paths for latency alone
+const DWORD MinPathMargin = 20;				// Milliseconds a path must win by before it is switched to
+
+
+// Chooses between the direct path to a player and a relay through the game server
+// Both paths are probed, and each keeps a smoothed round trip time. The direct path is preferred.
+// The relay is used when the direct path stops answering, or is clearly slower, but only once a relay
+// probe has been answered (not every server relays). Switching back needs a smaller margin, so paths
+// with similar latency don't flap.
+class PathSelector
+{
+public:
+	enum class Path
+	{
+		Direct,
+		Relay,
+	};
+
+	// bDirectUnlikely skips the wait for the direct path to answer  (it still needs a working relay to switch)
+	void Reset(DWORD currentTime, bool bDirectUnlikely = false);
+	void OnProbeReply(Path path, DWORD roundTripTime, DWORD currentTime);
+	// Re-evaluates the choice. Returns true if the selected path changed.
+	bool Update(DWORD currentTime);
+
+	Path GetPath() const;
+	bool IsAlive(Path path, DWORD currentTime) const;
+	DWORD GetRoundTripTime(Path path) const;	// Smoothed. Only valid once the path has answered a probe.
+
+private:
+	struct PathStats
+	{
+		bool bMeasured;
+		DWORD roundTripTime;
+		DWORD lastReplyTime;
+	};
+
+	static DWORD Margin(DWORD roundTripTime);
+	void Select(Path path, DWORD currentTime);
+
+	PathStats stats[2] = {};
+	Path selectedPath = Path::Direct;
+	DWORD startTime = 0;
+	bool bDirectUnlikely = false;
+	DWORD lastSwitchTime = 0;
+};
@@ -0,0 +1,358 @@
+#include "PortMapper.h"
+#include "Log.h"
+#include <mmsystem.h>
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+	const std::uint8_t NatPmpVersion = 0;
+	const std::uint8_t PcpVersion = 2;
+	const std::uint8_t NatPmpMapUdpOpcode = 1;
+	const std::uint8_t PcpMapOpcode = 1;
+	const std::uint8_t ResponseBit = 0x80;
+	const std::uint8_t UdpProtocolNumber = 17;
+	const std::uint16_t UnsupportedVersionResult = 1;	// Same value in both protocols
+	const std::size_t NatPmpRequestSize = 12;
+	const std::size_t NatPmpResponseSize = 16;
+	const std::size_t PcpRequestSize = 60;				// Common header, and the MAP opcode
+	const std::size_t PcpResponseSize = 60;
+
+	void WriteUint16(std::uint8_t* data, std::uint16_t value)
+	{
+		data[0] = static_cast<std::uint8_t>(value >> 8);
+		data[1] = static_cast<std::uint8_t>(value);
+	}
+
+	void WriteUint32(std::uint8_t* data, std::uint32_t value)
+	{
+		WriteUint16(data, static_cast<std::uint16_t>(value >> 16));
+		WriteUint16(data + 2, static_cast<std::uint16_t>(value));
+	}
+
+	std::uint16_t ReadUint16(const std::uint8_t* data)
+	{
+		return static_cast<std::uint16_t>((data[0] << 8) | data[1]);
+	}
+
+	std::uint32_t ReadUint32(const std::uint8_t* data)
+	{
+		return (static_cast<std::uint32_t>(ReadUint16(data)) << 16) | ReadUint16(data + 2);
+	}
+
+	// PCP carries every address as IPv6. IPv4 addresses are IPv4-mapped (::ffff:a.b.c.d).
+	void WritePcpAddress(std::uint8_t* data, const NetAddress& address)
+	{
+		std::memset(data, 0, 16);
+		if (address.IsIPv6())
+		{
+			std::memcpy(data, &address.ipv6.sin6_addr, 16);
+			return;
+		}
+		data[10] = 0xFF;
+		data[11] = 0xFF;
+		if (address.IsIPv4()) {
+			std::memcpy(data + 12, &address.ipv4.sin_addr, 4);
+		}
+	}
+
+	DWORD GetRetryDelay(int attempt)
+	{
+		return PortMapInitialRetryDelay << std::min(attempt, MaxPortMapAttempt);
+	}
+}
+
+
+void PortMapper::Start(const NetAddress& gateway, const NetAddress& localAddress, DWORD currentTime)
+{
+	bStarted = true;
+	this->gateway = gateway;
+	this->localAddress = localAddress;
+	protocol = Protocol::PCP;
+	mappings.clear();
+	bKnowEpoch = false;
+	nonceRandom.seed(currentTime ^ GetCurrentProcessId());
+}
+
+void PortMapper::AddMapping(Port internalPort, DWORD currentTime)
+{
+	if (!bStarted || internalPort == 0 || FindMapping(internalPort) != nullptr) {
+		return;
+	}
+
+	Mapping mapping;
+	mapping.internalPort = internalPort;
+	mapping.externalPort = 0;
+	mapping.state = MappingState::Requesting;
+	mapping.attempt = 0;
+	mapping.dueTime = currentTime;
+	for (std::uint8_t& nonceByte : mapping.nonce) {
+		nonceByte = static_cast<std::uint8_t>(nonceRandom());
+	}
+	mappings.push_back(mapping);
+}
+
+bool PortMapper::GetDueRequest(DWORD currentTime, std::vector<std::uint8_t>& request)
+{
+	for (Mapping& mapping : mappings)
+	{
+		if (mapping.state == MappingState::Failed || static_cast<int>(currentTime - mapping.dueTime) < 0) {
+			continue;
+		}
+
+		// A renewal is a new request, with its own retries
+		if (mapping.state == MappingState::Mapped)
+		{
+			mapping.state = MappingState::Requesting;
+			mapping.attempt = 0;
+		}
+
+		// Out of retries. Older gateways may only know NAT-PMP, and silently drop PCP.
+		if (mapping.attempt >= MaxPortMapAttempt)
+		{
+			if (protocol == Protocol::PCP)
+			{
+				SwitchToNatPmp(currentTime);
+			}
+			else
+			{
+				mapping.state = MappingState::Failed;
+				Log("Port mapping for port " + std::to_string(mapping.internalPort) + " failed: no reply from gateway " + FormatAddress(gateway));
+				continue;
+			}
+		}
+
+		BuildRequest(mapping, PortMapLifetime, request);
+		mapping.dueTime = currentTime + GetRetryDelay(mapping.attempt);
+		mapping.attempt++;
+		return true;
+	}
+
+	return false;
+}
+
+std::vector<std::vector<std::uint8_t>> PortMapper::GetDeleteRequests() const
+{
+	std::vector<std::vector<std::uint8_t>> requests;
+	for (const Mapping& mapping : mappings)
+	{
+		if (mapping.externalPort != 0)
+		{
+			requests.emplace_back();
+			BuildRequest(mapping, 0, requests.back());
+		}
+	}
+	return requests;
+}
+
+bool PortMapper::OnResponse(const std::uint8_t* data, std::size_t size, DWORD currentTime)
+{
+	if (!bStarted || size < 4 || (data[1] & ResponseBit) == 0) {
+		return false;
+	}
+
+	// A NAT-PMP gateway answers PCP requests with a version 0 "unsupported version" error
+	if (data[0] == NatPmpVersion && protocol == Protocol::PCP)
+	{
+		if (ReadUint16(data + 2) == UnsupportedVersionResult) {
+			SwitchToNatPmp(currentTime);
+		}
+		return false;
+	}
+
+	if (data[0] == PcpVersion && protocol == Protocol::PCP) {
+		return OnPcpResponse(data, size, currentTime);
+	}
+	if (data[0] == NatPmpVersion && protocol == Protocol::NatPmp) {
+		return OnNatPmpResponse(data, size, currentTime);
+	}
+	return false;
+}
+
+bool PortMapper::IsStarted() const
+{
+	return bStarted;
+}
+
+bool PortMapper::HasPendingRequests() const
+{
+	return std::any_of(mappings.begin(), mappings.end(), [](const Mapping& mapping) {
+		return mapping.state == MappingState::Requesting;
+	});
+}
+
+bool PortMapper::IsDue(DWORD currentTime) const
+{
+	return std::any_of(mappings.begin(), mappings.end(), [currentTime](const Mapping& mapping) {
+		return mapping.state != MappingState::Failed && static_cast<int>(currentTime - mapping.dueTime) >= 0;
+	});
+}
+
+bool PortMapper::GetExternalPort(Port internalPort, Port& externalPort) const
+{
+	for (const Mapping& mapping : mappings)
+	{
+		if (mapping.internalPort == internalPort && mapping.externalPort != 0)
+		{
+			externalPort = mapping.externalPort;
+			return true;
+		}
+	}
+	return false;
+}
+
+const NetAddress& PortMapper::GetGateway() const
+{
+	return gateway;
+}
+
+PortMapper::Protocol PortMapper::GetProtocol() const
+{
+	return protocol;
+}
+
+void PortMapper::BuildRequest(const Mapping& mapping, std::uint32_t lifetime, std::vector<std::uint8_t>& request) const
+{
+	// The previously granted port is asked for again, so renewals keep it
+	const Port suggestedPort = (mapping.externalPort != 0) ? mapping.externalPort : mapping.internalPort;
+
+	if (protocol == Protocol::NatPmp)
+	{
+		request.assign(NatPmpRequestSize, 0);
+		request[0] = NatPmpVersion;
+		request[1] = NatPmpMapUdpOpcode;
+		WriteUint16(&request[4], mapping.internalPort);
+		WriteUint16(&request[6], lifetime != 0 ? suggestedPort : 0);
+		WriteUint32(&request[8], lifetime);
+		return;
+	}
+
+	request.assign(PcpRequestSize, 0);
+	request[0] = PcpVersion;
+	request[1] = PcpMapOpcode;
+	WriteUint32(&request[4], lifetime);
+	WritePcpAddress(&request[8], localAddress);
+	// MAP opcode
+	std::memcpy(&request[24], mapping.nonce, sizeof(mapping.nonce));
+	request[36] = UdpProtocolNumber;
+	WriteUint16(&request[40], mapping.internalPort);
+	WriteUint16(&request[42], suggestedPort);
+	WritePcpAddress(&request[44], NetAddress{});		// Any external address
+}
+
+bool PortMapper::OnPcpResponse(const std::uint8_t* data, std::size_t size, DWORD currentTime)
+{
+	if (size < PcpResponseSize || data[1] != (ResponseBit | PcpMapOpcode) || data[36] != UdpProtocolNumber) {
+		return false;
+	}
+
+	Mapping* mapping = FindMapping(ReadUint16(data + 40));
+	if (mapping == nullptr || mapping->state != MappingState::Requesting || std::memcmp(data + 24, mapping->nonce, sizeof(mapping->nonce)) != 0) {
+		return false;
+	}
+
+	OnEpoch(ReadUint32(data + 8), currentTime);
+
+	const std::uint8_t result = data[3];
+	if (result != 0)
+	{
+		mapping->state = MappingState::Failed;
+		Log("Port mapping for port " + std::to_string(mapping->internalPort) + " refused by gateway (PCP result " + std::to_string(result) + ")");
+		return true;
+	}
+
+	OnMapped(*mapping, ReadUint16(data + 42), ReadUint32(data + 4), currentTime);
+	return true;
+}
+
+bool PortMapper::OnNatPmpResponse(const std::uint8_t* data, std::size_t size, DWORD currentTime)
+{
+	if (size < NatPmpResponseSize || data[1] != (ResponseBit | NatPmpMapUdpOpcode)) {
+		return false;
+	}
+
+	Mapping* mapping = FindMapping(ReadUint16(data + 8));
+	if (mapping == nullptr || mapping->state != MappingState::Requesting) {
+		return false;
+	}
+
+	OnEpoch(ReadUint32(data + 4), currentTime);
+
+	const std::uint16_t result = ReadUint16(data + 2);
+	if (result != 0)
+	{
+		mapping->state = MappingState::Failed;
+		Log("Port mapping for port " + std::to_string(mapping->internalPort) + " refused by gateway (NAT-PMP result " + std::to_string(result) + ")");
+		return true;
+	}
+
+	OnMapped(*mapping, ReadUint16(data + 10), ReadUint32(data + 12), currentTime);
+	return true;
+}
+
+void PortMapper::OnMapped(Mapping& mapping, Port externalPort, std::uint32_t lifetime, DWORD currentTime)
+{
+	if (mapping.externalPort != externalPort)
+	{
+		Log("Port mapping: " + std::to_string(mapping.internalPort) + " -> " + std::to_string(externalPort) +
+			"  (" + (protocol == Protocol::PCP ? "PCP" : "NAT-PMP") + ", " + std::to_string(lifetime) + " s)");
+	}
+
+	mapping.state = MappingState::Mapped;
+	mapping.externalPort = externalPort;
+	// Renew halfway through the lifetime (at least a few seconds apart, in case a gateway grants very short ones)
+	mapping.dueTime = currentTime + std::max<DWORD>(lifetime / 2, 5) * 1000;
+}
+
+// The epoch counts seconds since the gateway started. If it falls behind, the gateway restarted and lost the mappings.
+void PortMapper::OnEpoch(std::uint32_t epoch, DWORD currentTime)
+{
+	const DWORD elapsedSeconds = (currentTime - lastEpochTime) / 1000;
+	const bool bRestarted = bKnowEpoch && (static_cast<std::uint64_t>(epoch) + 2 < lastEpoch + static_cast<std::uint64_t>(elapsedSeconds) * 7 / 8);
+	bKnowEpoch = true;
+	lastEpoch = epoch;
+	lastEpochTime = currentTime;
+
+	if (!bRestarted) {
+		return;
+	}
+
+	LogDebug("Gateway restarted. Requesting port mappings again.");
+	for (Mapping& mapping : mappings)
+	{
+		if (mapping.state == MappingState::Mapped) {
+			mapping.dueTime = currentTime;
+		}
+	}
+}
+
+void PortMapper::SwitchToNatPmp(DWORD currentTime)
+{
+	if (protocol == Protocol::NatPmp) {
+		return;
+	}
+
+	LogDebug("Gateway " + FormatAddress(gateway) + " does not support PCP. Trying NAT-PMP.");
+	protocol = Protocol::NatPmp;
+	bKnowEpoch = false;
+	for (Mapping& mapping : mappings)
+	{
+		if (mapping.state == MappingState::Requesting)
+		{
+			mapping.attempt = 0;
+			mapping.dueTime = currentTime;
+		}
+	}
+}
+
+PortMapper::Mapping* PortMapper::FindMapping(Port internalPort)
+{
+	for (Mapping& mapping : mappings)
+	{
+		if (mapping.internalPort == internalPort) {
+			return &mapping;
+		}
+	}
+	return nullptr;
+}
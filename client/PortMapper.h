@@ -0,0 +1,83 @@
+#pragma once
+
+#include "NetAddress.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+
+const Port PortMapServerPort = 5351;			// Gateway port for both PCP and NAT-PMP
+const std::uint32_t PortMapLifetime = 7200;		// Seconds requested for each mapping
+const DWORD PortMapInitialRetryDelay = 250;		// Milliseconds, doubled for each retry (as in RFC 6886)
+const int MaxPortMapAttempt = 6;				// Requests per protocol before giving up on it
+const std::size_t MaxPortMapMessageSize = 1100;
+
+
+// Asks the local gateway to forward UDP ports to this machine, with PCP (RFC 6887), or NAT-PMP (RFC 6886)
+// if the gateway doesn't speak PCP. Mappings are renewed halfway through their lifetime.
+// Only builds and parses messages. The caller sends the requests to the gateway, and passes back the responses.
+class PortMapper
+{
+public:
+	enum class Protocol : unsigned char
+	{
+		PCP,
+		NatPmp,
+	};
+
+	// localAddress: Our address on the gateway's network (PCP requests must name it)
+	void Start(const NetAddress& gateway, const NetAddress& localAddress, DWORD currentTime);
+	void AddMapping(Port internalPort, DWORD currentTime);
+
+	// Takes the next request that is due. Returns false if nothing is due.
+	bool GetDueRequest(DWORD currentTime, std::vector<std::uint8_t>& request);
+	// Requests removing each granted mapping
+	std::vector<std::vector<std::uint8_t>> GetDeleteRequests() const;
+	// Returns true if the response granted (or refused) a mapping
+	bool OnResponse(const std::uint8_t* data, std::size_t size, DWORD currentTime);
+
+	bool IsStarted() const;
+	bool HasPendingRequests() const;		// A request is waiting on a reply (or retry)
+	bool IsDue(DWORD currentTime) const;
+	bool GetExternalPort(Port internalPort, Port& externalPort) const;		// Only for granted mappings
+	const NetAddress& GetGateway() const;
+	Protocol GetProtocol() const;
+
+private:
+	enum class MappingState : unsigned char
+	{
+		Requesting,
+		Mapped,
+		Failed,
+	};
+
+	struct Mapping
+	{
+		Port internalPort;
+		Port externalPort;
+		MappingState state;
+		int attempt;				// Requests sent with the current protocol
+		DWORD dueTime;				// Next request (retry or renewal)
+		std::uint8_t nonce[12];		// PCP only
+	};
+
+	void BuildRequest(const Mapping& mapping, std::uint32_t lifetime, std::vector<std::uint8_t>& request) const;
+	bool OnPcpResponse(const std::uint8_t* data, std::size_t size, DWORD currentTime);
+	bool OnNatPmpResponse(const std::uint8_t* data, std::size_t size, DWORD currentTime);
+	void OnMapped(Mapping& mapping, Port externalPort, std::uint32_t lifetime, DWORD currentTime);
+	void OnEpoch(std::uint32_t epoch, DWORD currentTime);
+	void SwitchToNatPmp(DWORD currentTime);
+	Mapping* FindMapping(Port internalPort);
+
+	bool bStarted = false;
+	NetAddress gateway;
+	NetAddress localAddress;
+	Protocol protocol = Protocol::PCP;
+	std::vector<Mapping> mappings;
+	bool bKnowEpoch = false;
+	std::uint32_t lastEpoch = 0;		// Seconds since the gateway started. Going backwards means it lost its mappings.
+	DWORD lastEpochTime = 0;
+	std::mt19937 nonceRandom;
+};
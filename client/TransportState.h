@@ -0,0 +1,131 @@
+#pragma once
+
+// Transport session state machine
+// -------------------------------
+// The transport layer is always in exactly one state. Each state has a dispatch table, mapping
+// transport layer commands to the handler used for immediate processing. The tables, and the
+// legal transitions between states, are fixed at compile time.
+// In game, every command maps to None, so packets are passed straight on to the game.
+
+#include <OP2Internal.h>
+#include <array>
+#include <cstddef>
+
+using namespace OP2Internal;
+
+
+enum class TransportState : unsigned char
+{
+	Idle,			// Searching or joining a game
+	Hosting,		// Hosting a game, answering searches and join requests
+	Joined,			// Joined a game, waiting for it to start
+	InGame,			// Game started
+};
+
+enum class TransportEvent : unsigned char
+{
+	HostGame,		// HostGame succeeded
+	JoinAccepted,	// The host accepted our join request
+	StartGame,		// ShutDownInvite (game is starting)
+};
+
+const std::size_t NumTransportStates = static_cast<std::size_t>(TransportState::InGame) + 1;
+const std::size_t NumTransportEvents = static_cast<std::size_t>(TransportEvent::StartGame) + 1;
+
+
+// Transitions
+// -----------
+
+namespace TransportStateDetail
+{
+	// Illegal transitions keep the current state
+	constexpr TransportState transitionTable[NumTransportStates][NumTransportEvents] = {
+		//  HostGame                  JoinAccepted              StartGame
+		{ TransportState::Hosting, TransportState::Joined,   TransportState::InGame },	// Idle
+		{ TransportState::Hosting, TransportState::Hosting,  TransportState::InGame },	// Hosting
+		{ TransportState::Joined,  TransportState::Joined,   TransportState::InGame },	// Joined
+		{ TransportState::InGame,  TransportState::InGame,   TransportState::InGame },	// InGame
+	};
+}
+
+constexpr TransportState GetNextTransportState(TransportState state, TransportEvent event)
+{
+	return TransportStateDetail::transitionTable[static_cast<std::size_t>(state)][static_cast<std::size_t>(event)];
+}
+
+constexpr bool IsTransitionAllowed(TransportState state, TransportEvent event)
+{
+	return GetNextTransportState(state, event) != state;
+}
+
+static_assert(IsTransitionAllowed(TransportState::Idle, TransportEvent::HostGame), "Idle must allow hosting");
+static_assert(!IsTransitionAllowed(TransportState::InGame, TransportEvent::HostGame), "A started game can't be hosted again");
+
+
+// Immediate packet dispatch
+// -------------------------
+
+// Handler used by OnImmediatePacketProcess for a transport layer command
+enum class ImmediateHandler : unsigned char
+{
+	None,					// Not processed immediately (passed on to the game)
+	JoinRequest,
+	HostedGameSearchQuery,
+	JoinHelpRequest,
+	SetPlayersList,
+	SetPlayersListFailed,
+	UpdateStatus,
+	HostedGameSearchReply,
+};
+
+const std::size_t NumTransportLayerCommands = static_cast<std::size_t>(TransportLayerCommand::EchoExternalAddress) + 1;
+
+using ImmediateDispatchTable = std::array<ImmediateHandler, NumTransportLayerCommands>;
+
+namespace TransportStateDetail
+{
+	constexpr std::size_t CommandIndex(TransportLayerCommand command)
+	{
+		return static_cast<std::size_t>(command);
+	}
+
+	// bHostLobby: Answer searches and join requests
+	// bPreGame: Handle game setup messages
+	constexpr ImmediateDispatchTable MakeDispatchTable(bool bHostLobby, bool bPreGame)
+	{
+		ImmediateDispatchTable table{};
+		if (bHostLobby)
+		{
+			table[CommandIndex(TransportLayerCommand::JoinRequest)] = ImmediateHandler::JoinRequest;
+			table[CommandIndex(TransportLayerCommand::HostedGameSearchQuery)] = ImmediateHandler::HostedGameSearchQuery;
+			table[CommandIndex(TransportLayerCommand::JoinHelpRequest)] = ImmediateHandler::JoinHelpRequest;
+		}
+		if (bPreGame)
+		{
+			table[CommandIndex(TransportLayerCommand::SetPlayersList)] = ImmediateHandler::SetPlayersList;
+			table[CommandIndex(TransportLayerCommand::SetPlayersListFailed)] = ImmediateHandler::SetPlayersListFailed;
+			table[CommandIndex(TransportLayerCommand::UpdateStatus)] = ImmediateHandler::UpdateStatus;
+			table[CommandIndex(TransportLayerCommand::HostedGameSearchReply)] = ImmediateHandler::HostedGameSearchReply;
+		}
+		return table;
+	}
+
+	constexpr std::array<ImmediateDispatchTable, NumTransportStates> dispatchTables = {
+		MakeDispatchTable(false, true),		// Idle
+		MakeDispatchTable(true, true),		// Hosting
+		MakeDispatchTable(false, true),		// Joined
+		MakeDispatchTable(false, false),	// InGame
+	};
+}
+
+// Commands outside the table (such as NetFix extensions) return None
+constexpr ImmediateHandler GetImmediateHandler(TransportState state, TransportLayerCommand command)
+{
+	const std::size_t commandIndex = static_cast<std::size_t>(command);
+	return (commandIndex < NumTransportLayerCommands) ?
+		TransportStateDetail::dispatchTables[static_cast<std::size_t>(state)][commandIndex] : ImmediateHandler::None;
+}
+
+static_assert(GetImmediateHandler(TransportState::InGame, TransportLayerCommand::UpdateStatus) == ImmediateHandler::None, "In game packets must not reach lobby handlers");
+static_assert(GetImmediateHandler(TransportState::Joined, TransportLayerCommand::JoinRequest) == ImmediateHandler::None, "Only the host answers join requests");
+
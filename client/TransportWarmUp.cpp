@@ -0,0 +1,78 @@
+#include "TransportWarmUp.h"
+#include "OPUNetTransportLayer.h"
+#include "Log.h"
+
+
+TransportWarmUp transportWarmUp;
+
+
+bool TransportWarmUp::Start()
+{
+	if (thread != nullptr || transportLayer != nullptr) {
+		return false;
+	}
+
+	stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	if (stopEvent == nullptr) {
+		return false;
+	}
+
+	thread = CreateThread(nullptr, 0, ThreadProc, this, 0, nullptr);
+	if (thread == nullptr)
+	{
+		LogError("Unable to start transport layer warm up thread");
+		CloseHandle(stopEvent);
+		stopEvent = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void TransportWarmUp::Stop()
+{
+	if (thread == nullptr) {
+		return;
+	}
+
+	SetEvent(stopEvent);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	CloseHandle(stopEvent);
+	thread = nullptr;
+	stopEvent = nullptr;
+}
+
+OPUNetTransportLayer* TransportWarmUp::TakeTransportLayer()
+{
+	Stop();
+
+	OPUNetTransportLayer* takenTransportLayer = transportLayer;
+	transportLayer = nullptr;
+	return takenTransportLayer;
+}
+
+void TransportWarmUp::Discard()
+{
+	delete TakeTransportLayer();
+}
+
+
+DWORD WINAPI TransportWarmUp::ThreadProc(LPVOID parameter)
+{
+	static_cast<TransportWarmUp*>(parameter)->Run();
+	return 0;
+}
+
+void TransportWarmUp::Run()
+{
+	// Socket creation, Winsock start up, and the game server lookups, off the game's thread
+	OPUNetTransportLayer* newTransportLayer = OPUNetTransportLayer::Create();
+	if (newTransportLayer == nullptr)
+	{
+		Log("Transport layer warm up failed. It will be created when the join window opens.");
+		return;
+	}
+
+	newTransportLayer->WarmUp(stopEvent);
+	transportLayer = newTransportLayer;
+}
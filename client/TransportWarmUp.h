@@ -0,0 +1,32 @@
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+class OPUNetTransportLayer;
+
+
+// Creates the transport layer on a background thread when the module loads, and starts the first game search
+// and external address check, so the join window opens with the socket ready and the replies waiting.
+// The join window takes over the transport layer when it opens. Until then, only the warm up thread uses it.
+class TransportWarmUp
+{
+public:
+	bool Start();		// Returns false if the thread could not be started
+	// Waits for the warm up thread to stop (ending the warm up early)
+	void Stop();
+	// Returns the warmed up transport layer, or nullptr if there isn't one. Stops the thread first.
+	OPUNetTransportLayer* TakeTransportLayer();
+	// Deletes the transport layer  (such as when the settings it was created with have changed)
+	void Discard();
+
+private:
+	static DWORD WINAPI ThreadProc(LPVOID parameter);
+	void Run();
+
+	HANDLE thread = nullptr;
+	HANDLE stopEvent = nullptr;
+	OPUNetTransportLayer* transportLayer = nullptr;
+};
+
+extern TransportWarmUp transportWarmUp;
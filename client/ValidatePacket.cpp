@@ -1,3 +1,4 @@
+#include "NetAddress.h"
 #include <OP2Internal.h>
 #define WIN32_LEAN_AND_MEAN
 #include <winsock2.h>
@@ -5,7 +6,7 @@
 using namespace OP2Internal;
 
 
-bool ValidatePacket(Packet& packet, sockaddr_in& fromAddress)
+bool ValidatePacket(Packet& packet, NetAddress& fromAddress)
 {
 	// Validate source player net id against from address **TODO**
 
@@ -16,6 +16,7 @@
 #define IDC_StatusBar                   1018
 #define IDC_NetInfo                     1020
 #define IDC_ServerAddressLabel          1021
+#define IDC_JoinFastestButton           1022
 
 // Next default values for new objects
 // 
@@ -23,7 +24,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        105
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1022
+#define _APS_NEXT_CONTROL_VALUE         1023
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
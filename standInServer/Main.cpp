@@ -0,0 +1,104 @@
+// Stand-in for the NetFixServer, for testing the NetFixClient on localhost
+// Usage: netFixStandInServer [--port N] [--games N] [--rate N] [--delay MS] [--gateway N [--natpmp-only]] [--verbose]
+
+#include "StandInServer.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+
+namespace {
+	volatile bool bStop = false;
+
+	void OnSignal(int)
+	{
+		bStop = true;
+	}
+
+	void PrintUsage()
+	{
+		std::cout <<
+			"Usage: netFixStandInServer [options]\n"
+			"  --port N     First UDP port (the second echo port is N + 1). Default 47800\n"
+			"  --games N    Advertise N synthetic games in every search reply. Default 0\n"
+			"  --rate N     Send at most N packets per second (0 = unlimited). Default 0\n"
+			"  --delay MS   Hold each reply back MS milliseconds. Default 0\n"
+			"  --gateway N  Answer PCP and NAT-PMP port mapping requests on UDP port N. Default off\n"
+			"  --natpmp-only  The gateway answers PCP as an older NAT-PMP only router\n"
+			"  --verbose    Log every received packet\n";
+	}
+
+	bool ParseArguments(int argc, char* argv[], StandInOptions& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string argument = argv[i];
+			if (argument == "--verbose")
+			{
+				options.bVerbose = true;
+				continue;
+			}
+			if (argument == "--natpmp-only")
+			{
+				options.bNatPmpOnly = true;
+				continue;
+			}
+
+			// The remaining options all take a value
+			if (i + 1 >= argc) {
+				return false;
+			}
+			const int value = std::atoi(argv[++i]);
+			if (value < 0) {
+				return false;
+			}
+
+			if (argument == "--port") {
+				options.port = static_cast<std::uint16_t>(value);
+			}
+			else if (argument == "--games") {
+				options.syntheticGameCount = value;
+			}
+			else if (argument == "--rate") {
+				options.replyRate = value;
+			}
+			else if (argument == "--delay") {
+				options.replyDelay = value;
+			}
+			else if (argument == "--gateway") {
+				options.gatewayPort = static_cast<std::uint16_t>(value);
+			}
+			else {
+				return false;
+			}
+		}
+
+		return options.port != 0;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	StandInOptions options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		PrintUsage();
+		return EXIT_FAILURE;
+	}
+
+	StandInServer* server = StandInServer::Create(options);
+	if (server == nullptr) {
+		return EXIT_FAILURE;
+	}
+
+	std::signal(SIGINT, OnSignal);
+	std::signal(SIGTERM, OnSignal);
+
+	server->Run(bStop);
+
+	delete server;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#include "Protocol.h"
+#include <cstring>
+
+
+int Packet::Size() const
+{
+	return sizeof(header) + header.sizeOfPayload;
+}
+
+// Outpost 2's packet checksum: sum of the payload as 32 bit words, then any trailing bytes
+std::int32_t Packet::Checksum() const
+{
+	std::uint32_t checksum = 0;
+	const std::size_t payloadSize = header.sizeOfPayload;
+
+	std::size_t i = 0;
+	for (; i + 4 <= payloadSize; i += 4)
+	{
+		std::uint32_t word;
+		std::memcpy(&word, &data[i], sizeof(word));
+		checksum += word;
+	}
+	for (; i < payloadSize; ++i) {
+		checksum += data[i];
+	}
+
+	return static_cast<std::int32_t>(checksum);
+}
+
+
+bool operator==(const Guid& guid1, const Guid& guid2)
+{
+	return std::memcmp(&guid1, &guid2, sizeof(Guid)) == 0;
+}
+
+bool operator!=(const Guid& guid1, const Guid& guid2)
+{
+	return !(guid1 == guid2);
+}
+
+bool operator<(const Guid& guid1, const Guid& guid2)
+{
+	return std::memcmp(&guid1, &guid2, sizeof(Guid)) < 0;
+}
+
+
+WireAddress ToWireAddress(const sockaddr_in& address)
+{
+	WireAddress wireAddress;
+	std::memset(&wireAddress, 0, sizeof(wireAddress));
+	wireAddress.family = 2;		// AF_INET on Windows
+	wireAddress.port = address.sin_port;
+	wireAddress.ip = address.sin_addr.s_addr;
+	return wireAddress;
+}
+
+sockaddr_in FromWireAddress(const WireAddress& wireAddress)
+{
+	sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = wireAddress.port;
+	address.sin_addr.s_addr = wireAddress.ip;
+	return address;
+}
+
+NetFixAddress ToNetFixAddress(const sockaddr_in& address)
+{
+	NetFixAddress netFixAddress;
+	std::memset(&netFixAddress, 0, sizeof(netFixAddress));
+	netFixAddress.family = 4;
+	netFixAddress.port = address.sin_port;
+	std::memcpy(netFixAddress.ip, &address.sin_addr, sizeof(address.sin_addr));
+	return netFixAddress;
+}
+
+bool FromNetFixAddress(const NetFixAddress& netFixAddress, sockaddr_in& address)
+{
+	if (netFixAddress.family != 4) {
+		return false;
+	}
+
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = netFixAddress.port;
+	std::memcpy(&address.sin_addr, netFixAddress.ip, sizeof(address.sin_addr));
+	return true;
+}
+
+
+void FinishPacket(Packet& packet, std::size_t payloadSize)
+{
+	packet.header.sourcePlayerNetID = 0;
+	packet.header.destPlayerNetID = 0;
+	packet.header.sizeOfPayload = static_cast<std::uint8_t>(payloadSize);
+	packet.header.type = 1;
+	packet.header.checksum = packet.Checksum();
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+// Wire format of the messages the stand-in server handles
+// Layouts mirror the OP2Internal definitions used by the client (packed, little endian).
+// Only the messages a game server sends or receives are included.
+
+#include <netinet/in.h>
+#include <cstdint>
+#include <cstddef>
+
+
+enum class TransportLayerCommand : std::int32_t
+{
+	JoinRequest = 0,
+	JoinGranted = 1,
+	JoinRefused = 2,
+	StartGame = 3,
+	SetPlayersList = 4,
+	SetPlayersListFailed = 5,
+	UpdateStatus = 6,
+	HostedGameSearchQuery = 7,
+	HostedGameSearchReply = 8,
+	GameServerPoke = 9,
+	JoinHelpRequest = 10,
+	RequestExternalAddress = 11,
+	EchoExternalAddress = 12,
+	// NetFix protocol extensions
+	NetFixRelay = 68,
+	NetFixNatProbe = 73,
+	NetFixGameListSubscribe = 76,
+	NetFixGameListEvent = 77,
+	NetFixSearchBatch = 78,
+	NetFixJoinPrepare = 79,
+	NetFixSearchOptions = 80,
+};
+
+enum class NetFixGameListEventType : std::uint8_t
+{
+	Snapshot = 0,
+	Added = 1,
+	Updated = 2,
+	Removed = 3,
+	Sync = 4,
+};
+
+enum class PokeStatusCode : std::int32_t
+{
+	GameHosted = 0,
+	GameStarted = 1,
+	GameCancelled = 2,
+};
+
+
+#pragma pack(push, 1)
+
+struct Guid
+{
+	std::uint32_t data1;
+	std::uint16_t data2;
+	std::uint16_t data3;
+	std::uint8_t data4[8];
+};
+
+// Same layout as the Windows sockaddr_in
+struct WireAddress
+{
+	std::uint16_t family;
+	std::uint16_t port;		// Network byte order
+	std::uint32_t ip;		// Network byte order
+	std::uint8_t zero[8];
+};
+
+struct StartupFlags
+{
+	std::uint32_t bDisastersOn : 1;
+	std::uint32_t bDayNightOn : 1;
+	std::uint32_t bMoraleOn : 1;
+	std::uint32_t bCampaign : 1;
+	std::uint32_t bMultiplayer : 1;
+	std::uint32_t bCheatsOn : 1;
+	std::uint32_t maxPlayers : 3;
+	std::uint32_t b1 : 5;
+	std::int32_t missionType : 8;
+	std::uint32_t numInitialVehicles : 4;
+};
+
+struct CreateGameInfo
+{
+	StartupFlags startupFlags;
+	char gameCreatorName[15];
+};
+
+struct PacketHeader
+{
+	std::int32_t sourcePlayerNetID;
+	std::int32_t destPlayerNetID;
+	std::uint8_t sizeOfPayload;
+	std::uint8_t type;
+	std::int32_t checksum;
+};
+
+struct JoinRequest
+{
+	TransportLayerCommand commandType;
+	Guid sessionIdentifier;
+	std::int32_t returnPortNum;
+	char password[12];
+};
+
+struct HostedGameSearchQuery
+{
+	TransportLayerCommand commandType;
+	Guid gameIdentifier;
+	std::uint32_t timeStamp;
+	char password[12];
+};
+
+struct HostedGameSearchReply
+{
+	TransportLayerCommand commandType;
+	Guid gameIdentifier;
+	std::uint32_t timeStamp;
+	Guid sessionIdentifier;
+	CreateGameInfo createGameInfo;
+	WireAddress hostAddress;
+};
+
+struct GameServerPoke
+{
+	TransportLayerCommand commandType;
+	PokeStatusCode statusCode;
+	std::int32_t randValue;
+};
+
+struct JoinHelpRequest
+{
+	TransportLayerCommand commandType;
+	Guid sessionIdentifier;
+	std::int32_t returnPortNum;
+	WireAddress clientAddr;
+};
+
+struct RequestExternalAddress
+{
+	TransportLayerCommand commandType;
+	std::uint16_t internalPort;
+};
+
+struct EchoExternalAddress
+{
+	TransportLayerCommand commandType;
+	WireAddress addr;
+	std::uint16_t replyPort;
+};
+
+// Address of either family (NetFix extension wire format)
+struct NetFixAddress
+{
+	std::uint8_t family;		// 0 = None, 4 = IPv4, 6 = IPv6
+	std::uint8_t reserved;
+	std::uint16_t port;			// Network byte order
+	std::uint8_t ip[16];		// IPv4 addresses use the first 4 bytes
+};
+
+// A packet from one client to another. Arrives with the destination address, and is forwarded with the sender's.
+struct NetFixRelay
+{
+	TransportLayerCommand commandType;
+	NetFixAddress address;
+	std::uint8_t data[1];
+};
+
+// NAT filtering test. Echoed like RequestExternalAddress, and with bChangePort, also from the other port.
+struct NetFixNatProbe
+{
+	TransportLayerCommand commandType;
+	std::uint32_t nonce;
+	std::uint8_t bChangePort;
+};
+
+// Asks for the game list's changes to be pushed. Renewed while the lobby is open.
+struct NetFixGameListSubscribe
+{
+	TransportLayerCommand commandType;
+	Guid gameIdentifier;
+	std::uint32_t sequence;			// Last change the client applied (0 asks for the full list)
+	std::uint32_t timeStamp;		// Echoed in the reply
+	std::uint8_t bUnsubscribe;
+};
+
+// One change to the game list, or one game of the full list
+struct NetFixGameListEvent
+{
+	TransportLayerCommand commandType;
+	std::uint32_t sequence;			// Game list version, after this change
+	std::uint32_t timeStamp;		// Snapshot and Sync: echoed from the request (0 for pushed changes)
+	NetFixGameListEventType eventType;
+	std::uint16_t index;			// Snapshot: position of this game in the list
+	std::uint16_t count;			// Snapshot: games in the list
+	HostedGameSearchReply game;
+};
+
+// Sent before a search query, asking for the replies in another form
+struct NetFixSearchOptions
+{
+	TransportLayerCommand commandType;
+	std::uint32_t flags;			// SearchFlagBatchedReplies
+};
+
+struct NetFixSearchBatchEntry
+{
+	Guid sessionIdentifier;
+	CreateGameInfo createGameInfo;
+	WireAddress hostAddress;
+};
+
+// Several games per search reply, for clients that asked for it
+const std::size_t MaxSearchBatchEntries = 4;
+struct NetFixSearchBatch
+{
+	TransportLayerCommand commandType;
+	Guid gameIdentifier;
+	std::uint32_t timeStamp;
+	std::uint8_t count;
+	NetFixSearchBatchEntry entries[MaxSearchBatchEntries];
+};
+
+// Sent when a game is selected, before the join. Answered like a JoinRequest, with a JoinHelpRequest to the host.
+struct NetFixJoinPrepare
+{
+	TransportLayerCommand commandType;
+	Guid sessionIdentifier;
+	std::int32_t returnPortNum;
+};
+
+union TransportLayerMessage
+{
+	TransportLayerCommand commandType;
+	JoinRequest joinRequest;
+	HostedGameSearchQuery searchQuery;
+	HostedGameSearchReply searchReply;
+	GameServerPoke gameServerPoke;
+	JoinHelpRequest joinHelpRequest;
+	RequestExternalAddress requestExternalAddress;
+	EchoExternalAddress echoExternalAddress;
+	NetFixRelay relay;
+	NetFixNatProbe natProbe;
+	NetFixGameListSubscribe gameListSubscribe;
+	NetFixGameListEvent gameListEvent;
+	NetFixSearchBatch searchBatch;
+	NetFixJoinPrepare joinPrepare;
+	NetFixSearchOptions searchOptions;
+};
+
+struct Packet
+{
+	PacketHeader header;
+	union
+	{
+		TransportLayerMessage tlMessage;
+		std::uint8_t data[498];
+	};
+
+	int Size() const;
+	std::int32_t Checksum() const;
+};
+
+#pragma pack(pop)
+
+
+static_assert(sizeof(PacketHeader) == 14, "PacketHeader must match the client");
+static_assert(sizeof(WireAddress) == 16, "WireAddress must match sockaddr_in");
+static_assert(sizeof(StartupFlags) == 4, "StartupFlags must match the client");
+static_assert(sizeof(NetFixAddress) == 20, "NetFixAddress must match the client");
+static_assert(sizeof(NetFixGameListSubscribe) == 29, "NetFixGameListSubscribe must match the client");
+static_assert(sizeof(NetFixGameListEvent) == 17 + sizeof(HostedGameSearchReply), "NetFixGameListEvent must match the client");
+static_assert(sizeof(NetFixSearchBatch) == 229, "NetFixSearchBatch must match the client");
+static_assert(sizeof(NetFixJoinPrepare) == 24, "NetFixJoinPrepare must match the client");
+static_assert(sizeof(NetFixSearchOptions) == 8, "NetFixSearchOptions must match the client");
+
+const std::uint32_t SearchFlagBatchedReplies = 1 << 0;
+
+
+bool operator==(const Guid& guid1, const Guid& guid2);
+bool operator!=(const Guid& guid1, const Guid& guid2);
+bool operator<(const Guid& guid1, const Guid& guid2);
+
+WireAddress ToWireAddress(const sockaddr_in& address);
+sockaddr_in FromWireAddress(const WireAddress& address);
+NetFixAddress ToNetFixAddress(const sockaddr_in& address);
+bool FromNetFixAddress(const NetFixAddress& netFixAddress, sockaddr_in& address);	// Returns false unless IPv4
+
+// Fills in the header for a transport layer (type 1) message, including the checksum
+void FinishPacket(Packet& packet, std::size_t payloadSize);
@@ -0,0 +1,257 @@
+#include "StandInGateway.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+
+namespace {
+	const std::uint8_t NatPmpVersion = 0;
+	const std::uint8_t PcpVersion = 2;
+	const std::uint8_t MapUdpOpcode = 1;		// NAT-PMP "map UDP", and PCP "MAP"
+	const std::uint8_t ResponseBit = 0x80;
+	const std::uint8_t UdpProtocolNumber = 17;
+	const std::uint8_t UnsupportedVersionResult = 1;
+	const std::uint8_t UnsupportedOpcodeResult = 5;		// NAT-PMP
+	const std::uint8_t PcpUnsupportedOpcodeResult = 4;
+	const std::uint32_t MaxLifetime = 3600;				// Seconds granted at most (routers commonly shorten requests)
+
+	void WriteUint16(std::uint8_t* data, std::uint16_t value)
+	{
+		data[0] = static_cast<std::uint8_t>(value >> 8);
+		data[1] = static_cast<std::uint8_t>(value);
+	}
+
+	void WriteUint32(std::uint8_t* data, std::uint32_t value)
+	{
+		WriteUint16(data, static_cast<std::uint16_t>(value >> 16));
+		WriteUint16(data + 2, static_cast<std::uint16_t>(value));
+	}
+
+	std::uint16_t ReadUint16(const std::uint8_t* data)
+	{
+		return static_cast<std::uint16_t>((data[0] << 8) | data[1]);
+	}
+
+	std::uint32_t ReadUint32(const std::uint8_t* data)
+	{
+		return (static_cast<std::uint32_t>(ReadUint16(data)) << 16) | ReadUint16(data + 2);
+	}
+
+	std::uint64_t GetMappingKey(const sockaddr_in& client, std::uint16_t internalPort)
+	{
+		return (static_cast<std::uint64_t>(client.sin_addr.s_addr) << 16) | internalPort;
+	}
+
+	std::string FormatAddress(const sockaddr_in& address)
+	{
+		char buffer[INET_ADDRSTRLEN] = "";
+		inet_ntop(AF_INET, &address.sin_addr, buffer, sizeof(buffer));
+		return std::string(buffer) + ":" + std::to_string(ntohs(address.sin_port));
+	}
+}
+
+
+// Returns nullptr on failure
+StandInGateway* StandInGateway::Create(std::uint16_t port, bool bNatPmpOnly, bool bVerbose)
+{
+	StandInGateway* gateway = new StandInGateway(bNatPmpOnly, bVerbose);
+
+	gateway->socketHandle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (gateway->socketHandle == -1)
+	{
+		std::perror("socket");
+		delete gateway;
+		return nullptr;
+	}
+
+	sockaddr_in localAddress;
+	std::memset(&localAddress, 0, sizeof(localAddress));
+	localAddress.sin_family = AF_INET;
+	localAddress.sin_port = htons(port);
+	localAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(gateway->socketHandle, reinterpret_cast<sockaddr*>(&localAddress), sizeof(localAddress)) != 0)
+	{
+		std::perror(("bind port " + std::to_string(port)).c_str());
+		delete gateway;
+		return nullptr;
+	}
+	fcntl(gateway->socketHandle, F_SETFL, fcntl(gateway->socketHandle, F_GETFL) | O_NONBLOCK);
+
+	std::cout << "Gateway (" << (bNatPmpOnly ? "NAT-PMP" : "PCP and NAT-PMP") << ") listening on UDP port " << port << std::endl;
+	return gateway;
+}
+
+StandInGateway::StandInGateway(bool bNatPmpOnly, bool bVerbose) :
+	socketHandle(-1),
+	bNatPmpOnly(bNatPmpOnly),
+	bVerbose(bVerbose),
+	startTime(Clock::now())
+{
+}
+
+StandInGateway::~StandInGateway()
+{
+	if (socketHandle != -1) {
+		close(socketHandle);
+	}
+}
+
+int StandInGateway::GetSocket() const
+{
+	return socketHandle;
+}
+
+std::size_t StandInGateway::GetMappingCount() const
+{
+	return mappings.size();
+}
+
+void StandInGateway::ReceiveAll()
+{
+	PruneMappings();
+
+	for (;;)
+	{
+		std::uint8_t request[1100];
+		sockaddr_in from;
+		socklen_t fromLength = sizeof(from);
+		const ssize_t size = recvfrom(socketHandle, request, sizeof(request), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+		if (size < 0) {
+			return;		// Nothing more to read
+		}
+		if (size < 2 || (request[1] & ResponseBit) != 0) {
+			continue;
+		}
+
+		if (request[0] == NatPmpVersion) {
+			OnNatPmpRequest(request, static_cast<std::size_t>(size), from);
+		}
+		else if (request[0] == PcpVersion && !bNatPmpOnly) {
+			OnPcpRequest(request, static_cast<std::size_t>(size), from);
+		}
+		else
+		{
+			// Any other version gets the NAT-PMP error, which tells a PCP client to fall back
+			std::uint8_t response[8] = {};
+			response[0] = NatPmpVersion;
+			response[1] = static_cast<std::uint8_t>(ResponseBit | request[1]);
+			WriteUint16(&response[2], UnsupportedVersionResult);
+			WriteUint32(&response[4], GetEpoch());
+			Reply(response, sizeof(response), from);
+		}
+	}
+}
+
+void StandInGateway::OnPcpRequest(const std::uint8_t* request, std::size_t size, const sockaddr_in& from)
+{
+	// Common header (24 bytes), and the MAP opcode (36 bytes)
+	if (size < 60) {
+		return;
+	}
+
+	std::uint8_t response[60] = {};
+	response[0] = PcpVersion;
+	response[1] = static_cast<std::uint8_t>(ResponseBit | request[1]);
+	WriteUint32(&response[8], GetEpoch());
+	std::memcpy(&response[24], &request[24], 36);		// Nonce, protocol, and internal port are echoed
+
+	if (request[1] != MapUdpOpcode || request[36] != UdpProtocolNumber)
+	{
+		response[3] = PcpUnsupportedOpcodeResult;
+		Reply(response, sizeof(response), from);
+		return;
+	}
+
+	const std::uint32_t lifetime = std::min(ReadUint32(&request[4]), MaxLifetime);
+	const std::uint16_t externalPort = Map(from, ReadUint16(&request[40]), ReadUint16(&request[42]), lifetime);
+	WriteUint32(&response[4], lifetime);
+	WriteUint16(&response[42], externalPort);
+	// Assigned external address: the loopback, as IPv4-mapped IPv6
+	std::memset(&response[44], 0, 16);
+	response[54] = 0xFF;
+	response[55] = 0xFF;
+	const std::uint32_t loopback = htonl(INADDR_LOOPBACK);
+	std::memcpy(&response[56], &loopback, 4);
+	Reply(response, sizeof(response), from);
+}
+
+void StandInGateway::OnNatPmpRequest(const std::uint8_t* request, std::size_t size, const sockaddr_in& from)
+{
+	if (request[1] != MapUdpOpcode || size < 12)
+	{
+		std::uint8_t response[8] = {};
+		response[0] = NatPmpVersion;
+		response[1] = static_cast<std::uint8_t>(ResponseBit | request[1]);
+		WriteUint16(&response[2], UnsupportedOpcodeResult);
+		WriteUint32(&response[4], GetEpoch());
+		Reply(response, sizeof(response), from);
+		return;
+	}
+
+	const std::uint16_t internalPort = ReadUint16(&request[4]);
+	const std::uint32_t lifetime = std::min(ReadUint32(&request[8]), MaxLifetime);
+	const std::uint16_t externalPort = Map(from, internalPort, ReadUint16(&request[6]), lifetime);
+
+	std::uint8_t response[16] = {};
+	response[0] = NatPmpVersion;
+	response[1] = static_cast<std::uint8_t>(ResponseBit | request[1]);
+	WriteUint32(&response[4], GetEpoch());
+	WriteUint16(&response[8], internalPort);
+	WriteUint16(&response[10], externalPort);
+	WriteUint32(&response[12], lifetime);
+	Reply(response, sizeof(response), from);
+}
+
+std::uint16_t StandInGateway::Map(const sockaddr_in& client, std::uint16_t internalPort, std::uint16_t suggestedPort, std::uint32_t lifetime)
+{
+	const std::uint64_t key = GetMappingKey(client, internalPort);
+	if (lifetime == 0)
+	{
+		if (mappings.erase(key) != 0 && bVerbose) {
+			std::cout << "Gateway: removed mapping for " << FormatAddress(client) << " port " << internalPort << std::endl;
+		}
+		return 0;
+	}
+
+	// Keep an existing mapping's port. Otherwise grant the suggested port, unless another client has it.
+	auto mapping = mappings.find(key);
+	if (mapping == mappings.end())
+	{
+		std::uint16_t externalPort = (suggestedPort != 0) ? suggestedPort : internalPort;
+		const bool bTaken = std::any_of(mappings.begin(), mappings.end(), [externalPort](const std::pair<const std::uint64_t, Mapping>& other) {
+			return other.second.externalPort == externalPort;
+		});
+		if (bTaken) {
+			externalPort = internalPort;
+		}
+		mapping = mappings.emplace(key, Mapping{ externalPort, Clock::time_point() }).first;
+		std::cout << "Gateway: mapped " << externalPort << " -> " << FormatAddress(client) << " port " << internalPort << " for " << lifetime << " s" << std::endl;
+	}
+	mapping->second.expiryTime = Clock::now() + std::chrono::seconds(lifetime);
+	return mapping->second.externalPort;
+}
+
+void StandInGateway::PruneMappings()
+{
+	const Clock::time_point now = Clock::now();
+	for (auto mapping = mappings.begin(); mapping != mappings.end(); )
+	{
+		mapping = (mapping->second.expiryTime <= now) ? mappings.erase(mapping) : std::next(mapping);
+	}
+}
+
+std::uint32_t StandInGateway::GetEpoch() const
+{
+	return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - startTime).count());
+}
+
+void StandInGateway::Reply(const std::uint8_t* response, std::size_t size, const sockaddr_in& to)
+{
+	sendto(socketHandle, response, size, 0, reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+
+// Stand-in for a home router's PCP (RFC 6887) and NAT-PMP (RFC 6886) server, for testing the client's port mapping
+// Grants every UDP MAP request (the suggested port if free, else the internal port), and a lifetime of 0 removes the mapping.
+// Nothing is actually forwarded. With bNatPmpOnly, PCP requests get the NAT-PMP "unsupported version" reply, like an older router.
+class StandInGateway
+{
+public:
+	static StandInGateway* Create(std::uint16_t port, bool bNatPmpOnly, bool bVerbose);	// Returns nullptr on failure
+	~StandInGateway();
+
+	int GetSocket() const;
+	void ReceiveAll();
+	std::size_t GetMappingCount() const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Mapping
+	{
+		std::uint16_t externalPort;
+		Clock::time_point expiryTime;
+	};
+
+	StandInGateway(bool bNatPmpOnly, bool bVerbose);
+	void OnPcpRequest(const std::uint8_t* request, std::size_t size, const sockaddr_in& from);
+	void OnNatPmpRequest(const std::uint8_t* request, std::size_t size, const sockaddr_in& from);
+	// Returns the granted external port (0 if removed)
+	std::uint16_t Map(const sockaddr_in& client, std::uint16_t internalPort, std::uint16_t suggestedPort, std::uint32_t lifetime);
+	void PruneMappings();
+	std::uint32_t GetEpoch() const;
+	void Reply(const std::uint8_t* response, std::size_t size, const sockaddr_in& to);
+
+	int socketHandle;
+	bool bNatPmpOnly;
+	bool bVerbose;
+	Clock::time_point startTime;
+	std::map<std::uint64_t, Mapping> mappings;		// Keyed by client IP and internal port
+};
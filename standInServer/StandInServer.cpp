@@ -0,0 +1,749 @@
+#include "StandInServer.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+
+namespace {
+	const int StatusInterval = 5;		// Seconds between status lines
+	const int RelayClientTimeOut = 30;	// Seconds a client is relayed to after it was last heard from
+	const int SubscriberTimeOut = 60;	// Seconds a game list subscription lasts without being renewed
+	const int SearchOptionsTimeOut = 60;	// Seconds search options apply to a client's queries
+
+	std::string FormatAddress(const sockaddr_in& address)
+	{
+		char buffer[INET_ADDRSTRLEN] = "";
+		inet_ntop(AF_INET, &address.sin_addr, buffer, sizeof(buffer));
+		return std::string(buffer) + ":" + std::to_string(ntohs(address.sin_port));
+	}
+
+	bool IsSameAddress(const sockaddr_in& address1, const sockaddr_in& address2)
+	{
+		return (address1.sin_addr.s_addr == address2.sin_addr.s_addr) && (address1.sin_port == address2.sin_port);
+	}
+
+	std::uint64_t GetAddressKey(const sockaddr_in& address)
+	{
+		return (static_cast<std::uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+	}
+}
+
+
+// Returns nullptr on failure
+StandInServer* StandInServer::Create(const StandInOptions& options)
+{
+	StandInServer* server = new StandInServer(options);
+
+	if (!server->OpenSockets())
+	{
+		delete server;
+		return nullptr;
+	}
+
+	if (options.gatewayPort != 0)
+	{
+		server->gateway = StandInGateway::Create(options.gatewayPort, options.bNatPmpOnly, options.bVerbose);
+		if (server->gateway == nullptr)
+		{
+			delete server;
+			return nullptr;
+		}
+	}
+
+	server->CreateSyntheticGames();
+	return server;
+}
+
+StandInServer::StandInServer(const StandInOptions& options) :
+	options(options),
+	gateway(nullptr),
+	gameIdentifier(),
+	bKnowGameIdentifier(false),
+	gameListSequence(1),
+	sendTokens(0),
+	lastTokenTime(Clock::now()),
+	lastStatusTime(Clock::now())
+{
+	for (int i = 0; i < NumSockets; ++i)
+	{
+		sockets[i] = -1;
+		socketPorts[i] = static_cast<std::uint16_t>(options.port + i);
+	}
+}
+
+StandInServer::~StandInServer()
+{
+	delete gateway;
+	for (int socketHandle : sockets)
+	{
+		if (socketHandle != -1) {
+			close(socketHandle);
+		}
+	}
+}
+
+
+bool StandInServer::OpenSockets()
+{
+	for (int i = 0; i < NumSockets; ++i)
+	{
+		sockets[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (sockets[i] == -1)
+		{
+			std::perror("socket");
+			return false;
+		}
+
+		sockaddr_in localAddress;
+		std::memset(&localAddress, 0, sizeof(localAddress));
+		localAddress.sin_family = AF_INET;
+		localAddress.sin_port = htons(socketPorts[i]);
+		localAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+
+		if (bind(sockets[i], reinterpret_cast<sockaddr*>(&localAddress), sizeof(localAddress)) != 0)
+		{
+			std::perror(("bind port " + std::to_string(socketPorts[i])).c_str());
+			return false;
+		}
+
+		// Large receive buffer, so load tests measure the client rather than dropped queries
+		int bufferSize = 1 << 20;
+		setsockopt(sockets[i], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+		fcntl(sockets[i], F_SETFL, fcntl(sockets[i], F_GETFL) | O_NONBLOCK);
+	}
+
+	std::cout << "Listening on UDP ports " << socketPorts[0] << " and " << socketPorts[1] << std::endl;
+	return true;
+}
+
+void StandInServer::CreateSyntheticGames()
+{
+	// Fixed seed, so every run advertises the same games
+	std::mt19937 random(47800);
+
+	syntheticGames.resize(options.syntheticGameCount);
+	for (int i = 0; i < options.syntheticGameCount; ++i)
+	{
+		HostedGameSearchReply& reply = syntheticGames[i];
+		std::memset(&reply, 0, sizeof(reply));
+		reply.commandType = TransportLayerCommand::HostedGameSearchReply;
+
+		reply.sessionIdentifier.data1 = random();
+		reply.sessionIdentifier.data2 = static_cast<std::uint16_t>(random());
+		reply.sessionIdentifier.data3 = static_cast<std::uint16_t>(i);
+		reply.sessionIdentifier.data4[0] = 0x5E;	// Marks a synthetic game when debugging
+
+		StartupFlags& flags = reply.createGameInfo.startupFlags;
+		flags.bDisastersOn = 1;
+		flags.bDayNightOn = 1;
+		flags.bMoraleOn = 1;
+		flags.bMultiplayer = 1;
+		flags.maxPlayers = 2 + (random() % 5);
+		flags.missionType = -static_cast<int>(1 + random() % 8);
+		std::snprintf(reply.createGameInfo.gameCreatorName, sizeof(reply.createGameInfo.gameCreatorName), "Synthetic%04d", i % 10000);
+
+		// Benchmarking address range (RFC 2544), so nothing real is ever joined
+		sockaddr_in hostAddress;
+		std::memset(&hostAddress, 0, sizeof(hostAddress));
+		hostAddress.sin_family = AF_INET;
+		hostAddress.sin_port = htons(47800);
+		hostAddress.sin_addr.s_addr = htonl((198u << 24) | (18u << 16) | static_cast<std::uint32_t>(i & 0xFFFF));
+		reply.hostAddress = ToWireAddress(hostAddress);
+	}
+
+	if (options.syntheticGameCount > 0) {
+		std::cout << "Advertising " << options.syntheticGameCount << " synthetic games" << std::endl;
+	}
+}
+
+
+void StandInServer::Run(const volatile bool& bStop)
+{
+	// The last entry is the gateway socket (ignored by poll if there is no gateway)
+	pollfd pollFds[NumSockets + 1];
+	for (int i = 0; i < NumSockets; ++i)
+	{
+		pollFds[i].fd = sockets[i];
+		pollFds[i].events = POLLIN;
+	}
+	pollFds[NumSockets].fd = (gateway != nullptr) ? gateway->GetSocket() : -1;
+	pollFds[NumSockets].events = POLLIN;
+
+	while (!bStop)
+	{
+		const int result = poll(pollFds, NumSockets + 1, GetPollTimeOut());
+		if (result < 0) {
+			break;		// Interrupted (signal)
+		}
+
+		for (int i = 0; i < NumSockets; ++i)
+		{
+			if (pollFds[i].revents & POLLIN) {
+				ReceiveAll(i);
+			}
+		}
+		if (pollFds[NumSockets].revents & POLLIN) {
+			gateway->ReceiveAll();
+		}
+
+		FlushQueue();
+		PrintStatus();
+	}
+}
+
+void StandInServer::ReceiveAll(int socketIndex)
+{
+	for (;;)
+	{
+		Packet packet;
+		sockaddr_in from;
+		socklen_t fromLength = sizeof(from);
+		const ssize_t size = recvfrom(sockets[socketIndex], &packet, sizeof(packet), 0, reinterpret_cast<sockaddr*>(&from), &fromLength);
+		if (size < 0) {
+			return;		// Nothing more to read
+		}
+
+		counters.numPacketsReceived++;
+
+		// Error check the packet
+		if (static_cast<std::size_t>(size) < sizeof(PacketHeader) || size < packet.Size() || packet.header.checksum != packet.Checksum())
+		{
+			counters.numPacketsDropped++;
+			continue;
+		}
+
+		clientLastSeen[GetAddressKey(from)] = Clock::now();
+
+		if (packet.header.type == 1 && packet.header.sizeOfPayload >= sizeof(TransportLayerCommand)) {
+			OnPacket(socketIndex, packet, from);
+		}
+	}
+}
+
+void StandInServer::OnPacket(int socketIndex, Packet& packet, const sockaddr_in& from)
+{
+	if (options.bVerbose) {
+		std::cout << FormatAddress(from) << " -> command " << static_cast<int>(packet.tlMessage.commandType) << std::endl;
+	}
+
+	switch (packet.tlMessage.commandType)
+	{
+	case TransportLayerCommand::NetFixSearchOptions:
+		OnSearchOptions(packet, from);
+		break;
+	case TransportLayerCommand::HostedGameSearchQuery:
+		OnSearchQuery(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::HostedGameSearchReply:
+		OnSearchReply(packet, from);
+		break;
+	case TransportLayerCommand::GameServerPoke:
+		OnPoke(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::JoinRequest:
+		OnJoinRequest(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::NetFixJoinPrepare:
+		OnJoinPrepare(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::RequestExternalAddress:
+		OnRequestExternalAddress(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::NetFixRelay:
+		OnRelay(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::NetFixNatProbe:
+		OnNatProbe(socketIndex, packet, from);
+		break;
+	case TransportLayerCommand::NetFixGameListSubscribe:
+		OnGameListSubscribe(socketIndex, packet, from);
+		break;
+	default:
+		break;
+	}
+}
+
+// Clients send their options before each search query, so they're only kept a while
+void StandInServer::OnSearchOptions(const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(NetFixSearchOptions)) {
+		return;
+	}
+
+	const std::uint64_t addressKey = GetAddressKey(from);
+	if (packet.tlMessage.searchOptions.flags & SearchFlagBatchedReplies) {
+		batchedReplyClients[addressKey] = Clock::now() + std::chrono::seconds(SearchOptionsTimeOut);
+	}
+	else {
+		batchedReplyClients.erase(addressKey);
+	}
+}
+
+void StandInServer::OnSearchQuery(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(HostedGameSearchQuery)) {
+		return;
+	}
+
+	counters.numSearchQueries++;
+	const HostedGameSearchQuery& query = packet.tlMessage.searchQuery;
+
+	// Hosts only answer queries with the right game identifier, so remember it
+	if (!bKnowGameIdentifier)
+	{
+		gameIdentifier = query.gameIdentifier;
+		bKnowGameIdentifier = true;
+	}
+
+	const std::vector<HostedGameSearchReply> list = GetListedGames(query.gameIdentifier);
+
+	// Clients that asked for it get several games per reply
+	const auto batchedReplyClient = batchedReplyClients.find(GetAddressKey(from));
+	if (batchedReplyClient != batchedReplyClients.end() && Clock::now() <= batchedReplyClient->second)
+	{
+		SendSearchBatches(socketIndex, list, query, from);
+		return;
+	}
+
+	Packet replyPacket;
+	HostedGameSearchReply& reply = replyPacket.tlMessage.searchReply;
+	for (const HostedGameSearchReply& game : list)
+	{
+		reply = game;
+		reply.timeStamp = query.timeStamp;		// Echoed, so the client can measure ping
+		FinishPacket(replyPacket, sizeof(reply));
+		Queue(socketIndex, replyPacket, from);
+	}
+}
+
+void StandInServer::SendSearchBatches(int socketIndex, const std::vector<HostedGameSearchReply>& list, const HostedGameSearchQuery& query, const sockaddr_in& from)
+{
+	Packet batchPacket;
+	NetFixSearchBatch& batch = batchPacket.tlMessage.searchBatch;
+	std::memset(&batch, 0, sizeof(batch));
+	batch.commandType = TransportLayerCommand::NetFixSearchBatch;
+	batch.gameIdentifier = query.gameIdentifier;
+	batch.timeStamp = query.timeStamp;
+
+	for (std::size_t i = 0; i < list.size(); ++i)
+	{
+		NetFixSearchBatchEntry& entry = batch.entries[batch.count++];
+		entry.sessionIdentifier = list[i].sessionIdentifier;
+		entry.createGameInfo = list[i].createGameInfo;
+		entry.hostAddress = list[i].hostAddress;
+
+		if (batch.count == MaxSearchBatchEntries || i + 1 == list.size())
+		{
+			FinishPacket(batchPacket, offsetof(NetFixSearchBatch, entries) + batch.count * sizeof(NetFixSearchBatchEntry));
+			Queue(socketIndex, batchPacket, from);
+			batch.count = 0;
+		}
+	}
+}
+
+// Real games first, then any synthetic ones
+std::vector<HostedGameSearchReply> StandInServer::GetListedGames(const Guid& queryGameIdentifier) const
+{
+	std::vector<HostedGameSearchReply> list;
+	list.reserve(games.size() + syntheticGames.size());
+	for (const auto& entry : games) {
+		list.push_back(entry.second.reply);
+	}
+	for (const HostedGameSearchReply& syntheticGame : syntheticGames)
+	{
+		list.push_back(syntheticGame);
+		list.back().gameIdentifier = queryGameIdentifier;
+	}
+	return list;
+}
+
+// A host answering our query after it poked us
+void StandInServer::OnSearchReply(const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(HostedGameSearchReply)) {
+		return;
+	}
+
+	auto pendingHost = std::find_if(pendingHosts.begin(), pendingHosts.end(),
+		[&from](const PendingHost& host) { return IsSameAddress(host.hostAddress, from); });
+	if (pendingHost == pendingHosts.end()) {
+		return;		// Not asked for
+	}
+
+	HostedGame game;
+	game.reply = packet.tlMessage.searchReply;
+	game.reply.hostAddress = ToWireAddress(from);	// The host can't see its own external address
+	game.hostAddress = from;
+	game.randValue = pendingHost->randValue;
+	const bool bKnownGame = (games.count(game.reply.sessionIdentifier) != 0);
+	games[game.reply.sessionIdentifier] = game;
+	pendingHosts.erase(pendingHost);
+	PushGameListEvent(bKnownGame ? NetFixGameListEventType::Updated : NetFixGameListEventType::Added, game.reply);
+
+	std::cout << "Game hosted: " << std::string(game.reply.createGameInfo.gameCreatorName,
+		strnlen(game.reply.createGameInfo.gameCreatorName, sizeof(game.reply.createGameInfo.gameCreatorName)))
+		<< " at " << FormatAddress(from) << std::endl;
+}
+
+void StandInServer::OnPoke(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(GameServerPoke)) {
+		return;
+	}
+
+	const GameServerPoke& poke = packet.tlMessage.gameServerPoke;
+	switch (poke.statusCode)
+	{
+	case PokeStatusCode::GameHosted:
+	{
+		if (!bKnowGameIdentifier)
+		{
+			std::cout << "Game hosted at " << FormatAddress(from) << ", but no game identifier is known yet (search first)" << std::endl;
+			return;
+		}
+
+		// Ask the host for its game details
+		pendingHosts.push_back(PendingHost{ from, poke.randValue });
+
+		Packet queryPacket;
+		HostedGameSearchQuery& query = queryPacket.tlMessage.searchQuery;
+		std::memset(&query, 0, sizeof(query));
+		query.commandType = TransportLayerCommand::HostedGameSearchQuery;
+		query.gameIdentifier = gameIdentifier;
+		FinishPacket(queryPacket, sizeof(query));
+		Queue(socketIndex, queryPacket, from);
+		break;
+	}
+	case PokeStatusCode::GameStarted:
+	case PokeStatusCode::GameCancelled:
+		// Only the host that created the game (same random value) may remove it
+		for (auto it = games.begin(); it != games.end(); )
+		{
+			if (IsSameAddress(it->second.hostAddress, from) && it->second.randValue == poke.randValue)
+			{
+				std::cout << "Game removed: " << FormatAddress(from) << std::endl;
+				PushGameListEvent(NetFixGameListEventType::Removed, it->second.reply);
+				it = games.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		break;
+	}
+}
+
+// Joining clients send their join request through the server too. Ask the host to open a path back to them.
+void StandInServer::OnJoinRequest(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(JoinRequest)) {
+		return;
+	}
+
+	SendJoinHelpRequest(socketIndex, packet.tlMessage.joinRequest.sessionIdentifier, packet.tlMessage.joinRequest.returnPortNum, from);
+}
+
+// Clients send this when a game is selected, so the path is open before they ask to join
+void StandInServer::OnJoinPrepare(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(NetFixJoinPrepare)) {
+		return;
+	}
+
+	SendJoinHelpRequest(socketIndex, packet.tlMessage.joinPrepare.sessionIdentifier, packet.tlMessage.joinPrepare.returnPortNum, from);
+}
+
+void StandInServer::SendJoinHelpRequest(int socketIndex, const Guid& sessionIdentifier, std::int32_t returnPortNum, const sockaddr_in& client)
+{
+	auto game = games.find(sessionIdentifier);
+	if (game == games.end()) {
+		return;
+	}
+
+	Packet helpPacket;
+	JoinHelpRequest& helpRequest = helpPacket.tlMessage.joinHelpRequest;
+	helpRequest.commandType = TransportLayerCommand::JoinHelpRequest;
+	helpRequest.sessionIdentifier = sessionIdentifier;
+	helpRequest.returnPortNum = returnPortNum;
+	helpRequest.clientAddr = ToWireAddress(client);
+	FinishPacket(helpPacket, sizeof(helpRequest));
+	Queue(socketIndex, helpPacket, game->second.hostAddress);
+}
+
+// Each server port echoes the address it saw. Comparing the echoes shows how the client's NAT maps ports.
+void StandInServer::OnRequestExternalAddress(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(RequestExternalAddress)) {
+		return;
+	}
+
+	Packet echoPacket;
+	EchoExternalAddress& echo = echoPacket.tlMessage.echoExternalAddress;
+	echo.commandType = TransportLayerCommand::EchoExternalAddress;
+	echo.addr = ToWireAddress(from);
+	echo.replyPort = ntohs(from.sin_port);
+	FinishPacket(echoPacket, sizeof(echo));
+	Queue(socketIndex, echoPacket, from);
+
+	// Also try the internal port directly, to see if it can be reached (no NAT, or forwarded)
+	const std::uint16_t internalPort = packet.tlMessage.requestExternalAddress.internalPort;
+	if (internalPort != 0 && internalPort != ntohs(from.sin_port))
+	{
+		sockaddr_in internalAddress = from;
+		internalAddress.sin_port = htons(internalPort);
+		echo.replyPort = internalPort;
+		FinishPacket(echoPacket, sizeof(echo));
+		Queue(socketIndex, echoPacket, internalAddress);
+	}
+}
+
+// Forwards a packet between two clients that can't reach each other directly
+// Only clients heard from recently are relayed to, so the stand-in can't be used to send to arbitrary addresses.
+void StandInServer::OnRelay(int socketIndex, Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload < offsetof(NetFixRelay, data) + sizeof(PacketHeader)) {
+		return;
+	}
+
+	sockaddr_in to;
+	if (!FromNetFixAddress(packet.tlMessage.relay.address, to)) {
+		return;
+	}
+	const auto client = clientLastSeen.find(GetAddressKey(to));
+	if (client == clientLastSeen.end() || Clock::now() - client->second > std::chrono::seconds(RelayClientTimeOut)) {
+		return;
+	}
+
+	// The receiver learns who sent it
+	packet.tlMessage.relay.address = ToNetFixAddress(from);
+	packet.header.checksum = packet.Checksum();
+	counters.numPacketsRelayed++;
+	Queue(socketIndex, packet, to);
+}
+
+// Echoes from the port the probe was sent to, and (if asked) from the other port, which the client's NAT has not seen yet
+void StandInServer::OnNatProbe(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload < sizeof(NetFixNatProbe)) {
+		return;
+	}
+
+	Packet echoPacket;
+	EchoExternalAddress& echo = echoPacket.tlMessage.echoExternalAddress;
+	echo.commandType = TransportLayerCommand::EchoExternalAddress;
+	echo.addr = ToWireAddress(from);
+	echo.replyPort = ntohs(from.sin_port);
+	FinishPacket(echoPacket, sizeof(echo));
+	Queue(socketIndex, echoPacket, from);
+
+	if (packet.tlMessage.natProbe.bChangePort) {
+		Queue((socketIndex + 1) % NumSockets, echoPacket, from);
+	}
+}
+
+// Subscribers are sent the full list, or just the version if they're up to date, then each change as it happens
+void StandInServer::OnGameListSubscribe(int socketIndex, const Packet& packet, const sockaddr_in& from)
+{
+	if (packet.header.sizeOfPayload != sizeof(NetFixGameListSubscribe)) {
+		return;
+	}
+
+	const NetFixGameListSubscribe& subscribe = packet.tlMessage.gameListSubscribe;
+	const std::uint64_t addressKey = GetAddressKey(from);
+	if (subscribe.bUnsubscribe)
+	{
+		subscribers.erase(addressKey);
+		return;
+	}
+
+	if (!bKnowGameIdentifier)
+	{
+		gameIdentifier = subscribe.gameIdentifier;
+		bKnowGameIdentifier = true;
+	}
+
+	const Subscriber subscriber{ from, socketIndex, Clock::now() + std::chrono::seconds(SubscriberTimeOut) };
+	subscribers[addressKey] = subscriber;
+
+	if (subscribe.sequence != gameListSequence)
+	{
+		SendGameListSnapshot(subscriber, subscribe.timeStamp);
+		return;
+	}
+
+	Packet eventPacket;
+	NetFixGameListEvent& event = eventPacket.tlMessage.gameListEvent;
+	std::memset(&event, 0, sizeof(event));
+	event.commandType = TransportLayerCommand::NetFixGameListEvent;
+	event.sequence = gameListSequence;
+	event.timeStamp = subscribe.timeStamp;
+	event.eventType = NetFixGameListEventType::Sync;
+	FinishPacket(eventPacket, sizeof(event));
+	Queue(socketIndex, eventPacket, from);
+}
+
+// An empty list is sent as a single event with a count of 0
+void StandInServer::SendGameListSnapshot(const Subscriber& subscriber, std::uint32_t timeStamp)
+{
+	Packet eventPacket;
+	NetFixGameListEvent& event = eventPacket.tlMessage.gameListEvent;
+	std::memset(&event, 0, sizeof(event));
+	event.commandType = TransportLayerCommand::NetFixGameListEvent;
+	event.sequence = gameListSequence;
+	event.timeStamp = timeStamp;
+	event.eventType = NetFixGameListEventType::Snapshot;
+	event.count = static_cast<std::uint16_t>(std::min<std::size_t>(games.size() + syntheticGames.size(), 0xFFFF));
+
+	if (event.count == 0)
+	{
+		event.game.gameIdentifier = gameIdentifier;
+		FinishPacket(eventPacket, sizeof(event));
+		Queue(subscriber.socketIndex, eventPacket, subscriber.address);
+		return;
+	}
+
+	const std::vector<HostedGameSearchReply> list = GetListedGames(gameIdentifier);
+	for (std::size_t i = 0; i < event.count; ++i)
+	{
+		event.index = static_cast<std::uint16_t>(i);
+		event.game = list[i];
+		event.game.timeStamp = timeStamp;
+		FinishPacket(eventPacket, sizeof(event));
+		Queue(subscriber.socketIndex, eventPacket, subscriber.address);
+	}
+}
+
+void StandInServer::PushGameListEvent(NetFixGameListEventType eventType, const HostedGameSearchReply& game)
+{
+	gameListSequence++;
+
+	Packet eventPacket;
+	NetFixGameListEvent& event = eventPacket.tlMessage.gameListEvent;
+	std::memset(&event, 0, sizeof(event));
+	event.commandType = TransportLayerCommand::NetFixGameListEvent;
+	event.sequence = gameListSequence;
+	event.eventType = eventType;
+	event.game = game;
+	FinishPacket(eventPacket, sizeof(event));
+
+	const Clock::time_point now = Clock::now();
+	for (const auto& entry : subscribers)
+	{
+		if (entry.second.expiry > now) {
+			Queue(entry.second.socketIndex, eventPacket, entry.second.address);
+		}
+	}
+}
+
+void StandInServer::PruneClients()
+{
+	const Clock::time_point now = Clock::now();
+	for (auto it = clientLastSeen.begin(); it != clientLastSeen.end(); )
+	{
+		if (now - it->second > std::chrono::seconds(RelayClientTimeOut)) {
+			it = clientLastSeen.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	for (auto it = subscribers.begin(); it != subscribers.end(); )
+	{
+		if (now > it->second.expiry) {
+			it = subscribers.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	for (auto it = batchedReplyClients.begin(); it != batchedReplyClients.end(); )
+	{
+		if (now > it->second) {
+			it = batchedReplyClients.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+
+void StandInServer::Queue(int socketIndex, const Packet& packet, const sockaddr_in& to)
+{
+	sendQueue.push_back(PendingSend{ packet, socketIndex, to, Clock::now() + std::chrono::milliseconds(options.replyDelay) });
+}
+
+// Sends queued packets that are due, within the rate limit
+void StandInServer::FlushQueue()
+{
+	const Clock::time_point now = Clock::now();
+
+	if (options.replyRate > 0)
+	{
+		// Refill the token bucket  (bursts of up to 1/20 of a second's worth)
+		const double elapsed = std::chrono::duration<double>(now - lastTokenTime).count();
+		const double maxTokens = std::max(1.0, options.replyRate / 20.0);
+		sendTokens = std::min(maxTokens, sendTokens + elapsed * options.replyRate);
+	}
+	lastTokenTime = now;
+
+	while (!sendQueue.empty() && sendQueue.front().sendTime <= now)
+	{
+		if (options.replyRate > 0)
+		{
+			if (sendTokens < 1) {
+				break;
+			}
+			sendTokens -= 1;
+		}
+
+		const PendingSend& pendingSend = sendQueue.front();
+		sendto(sockets[pendingSend.socketIndex], &pendingSend.packet, pendingSend.packet.Size(), 0,
+			reinterpret_cast<const sockaddr*>(&pendingSend.to), sizeof(pendingSend.to));
+		counters.numPacketsSent++;
+		sendQueue.pop_front();
+	}
+}
+
+// Milliseconds until something in the send queue could next be sent
+int StandInServer::GetPollTimeOut() const
+{
+	if (sendQueue.empty()) {
+		return 1000;
+	}
+
+	const auto untilDue = std::chrono::duration_cast<std::chrono::milliseconds>(sendQueue.front().sendTime - Clock::now()).count();
+	int timeOut = static_cast<int>(std::max<long long>(0, untilDue));
+	if (options.replyRate > 0 && sendTokens < 1) {
+		timeOut = std::max(timeOut, std::max(1, 1000 / options.replyRate));
+	}
+	return timeOut;
+}
+
+void StandInServer::PrintStatus()
+{
+	const Clock::time_point now = Clock::now();
+	if (now - lastStatusTime < std::chrono::seconds(StatusInterval)) {
+		return;
+	}
+	lastStatusTime = now;
+	PruneClients();
+
+	std::cout << "Received " << counters.numPacketsReceived << " (" << counters.numSearchQueries << " searches, "
+		<< counters.numPacketsDropped << " bad)  Sent " << counters.numPacketsSent << "  Relayed " << counters.numPacketsRelayed
+		<< "  Queued " << sendQueue.size() << "  Games " << games.size() << "  Subscribers " << subscribers.size();
+	if (gateway != nullptr) {
+		std::cout << "  Mappings " << gateway->GetMappingCount();
+	}
+	std::cout << std::endl;
+}
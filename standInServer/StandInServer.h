@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Protocol.h"
+#include "StandInGateway.h"
+#include <netinet/in.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+
+struct StandInOptions
+{
+	std::uint16_t port = 47800;		// Second (echo) port is port + 1
+	int syntheticGameCount = 0;		// Fake games added to every search reply (load mode)
+	int replyRate = 0;				// Maximum packets sent per second (0 = unlimited)
+	int replyDelay = 0;				// Milliseconds each reply is held back (simulated latency)
+	std::uint16_t gatewayPort = 0;	// PCP and NAT-PMP stand-in port (0 = off)
+	bool bNatPmpOnly = false;		// Gateway answers PCP as an older NAT-PMP only router
+	bool bVerbose = false;
+};
+
+
+// Minimal NetFixServer stand-in, for testing the client on localhost
+// Handles game search (and game list subscriptions), host pokes, the two port external address echo (and NAT filtering probe), join help, and relaying between clients.
+// Optionally also stands in for the router's port mapping server.
+class StandInServer
+{
+public:
+	static StandInServer* Create(const StandInOptions& options);	// Returns nullptr on failure
+	~StandInServer();
+
+	void Run(const volatile bool& bStop);
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	static const int NumSockets = 2;
+
+	struct HostedGame
+	{
+		HostedGameSearchReply reply;	// As sent by the host, with hostAddress filled in
+		sockaddr_in hostAddress;
+		std::int32_t randValue;
+	};
+
+	struct PendingHost
+	{
+		sockaddr_in hostAddress;
+		std::int32_t randValue;
+	};
+
+	struct Subscriber
+	{
+		sockaddr_in address;
+		int socketIndex;
+		Clock::time_point expiry;
+	};
+
+	struct PendingSend
+	{
+		Packet packet;
+		int socketIndex;
+		sockaddr_in to;
+		Clock::time_point sendTime;
+	};
+
+	struct Counters
+	{
+		std::uint64_t numPacketsReceived = 0;
+		std::uint64_t numPacketsSent = 0;
+		std::uint64_t numSearchQueries = 0;
+		std::uint64_t numPacketsDropped = 0;
+		std::uint64_t numPacketsRelayed = 0;
+	};
+
+	StandInServer(const StandInOptions& options);
+	bool OpenSockets();
+	void CreateSyntheticGames();
+
+	void ReceiveAll(int socketIndex);
+	void OnPacket(int socketIndex, Packet& packet, const sockaddr_in& from);
+	void OnSearchOptions(const Packet& packet, const sockaddr_in& from);
+	void OnSearchQuery(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void SendSearchBatches(int socketIndex, const std::vector<HostedGameSearchReply>& list, const HostedGameSearchQuery& query, const sockaddr_in& from);
+	std::vector<HostedGameSearchReply> GetListedGames(const Guid& queryGameIdentifier) const;
+	void OnSearchReply(const Packet& packet, const sockaddr_in& from);
+	void OnPoke(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void OnJoinRequest(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void OnJoinPrepare(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void SendJoinHelpRequest(int socketIndex, const Guid& sessionIdentifier, std::int32_t returnPortNum, const sockaddr_in& client);
+	void OnRequestExternalAddress(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void OnRelay(int socketIndex, Packet& packet, const sockaddr_in& from);
+	void OnNatProbe(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void OnGameListSubscribe(int socketIndex, const Packet& packet, const sockaddr_in& from);
+	void SendGameListSnapshot(const Subscriber& subscriber, std::uint32_t timeStamp);
+	void PushGameListEvent(NetFixGameListEventType eventType, const HostedGameSearchReply& game);
+	void PruneClients();
+
+	void Queue(int socketIndex, const Packet& packet, const sockaddr_in& to);
+	void FlushQueue();
+	int GetPollTimeOut() const;
+	void PrintStatus();
+
+	StandInOptions options;
+	int sockets[NumSockets];
+	StandInGateway* gateway;
+	std::uint16_t socketPorts[NumSockets];
+
+	Guid gameIdentifier;				// Learned from the first search query
+	bool bKnowGameIdentifier;
+	std::map<Guid, HostedGame> games;	// Keyed by session identifier
+	std::vector<PendingHost> pendingHosts;
+	std::vector<HostedGameSearchReply> syntheticGames;
+	std::map<std::uint64_t, Clock::time_point> clientLastSeen;	// Keyed by address, so only active clients are relayed to
+	std::map<std::uint64_t, Subscriber> subscribers;			// Game list subscribers, keyed by address
+	std::map<std::uint64_t, Clock::time_point> batchedReplyClients;	// Expiry of each client's ask for batched search replies, keyed by address
+	std::uint32_t gameListSequence;								// Game list version, counted up by each change
+
+	std::deque<PendingSend> sendQueue;
+	double sendTokens;
+	Clock::time_point lastTokenTime;
+
+	Counters counters;
+	Clock::time_point lastStatusTime;
+};